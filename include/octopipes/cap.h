@@ -31,14 +31,18 @@ extern "C" {
 #include "types.h"
 
 //Prepare
-uint8_t* octopipes_cap_prepare_subscription(const char** groups, const size_t groups_size, size_t* data_size);
+uint8_t* octopipes_cap_prepare_subscription(const char** groups, const size_t groups_size, const char* reply_pipe, const OctopipesSubscriptionFlags flags, const uint64_t from, size_t* data_size);
 uint8_t* octopipes_cap_prepare_assign(OctopipesCapError error, const char* fifo_tx, const size_t fifo_tx_size, const char* fifo_rx, const size_t fifo_rx_size, size_t* data_size);
 uint8_t* octopipes_cap_prepare_unsubscription(size_t* data_size);
+uint8_t* octopipes_cap_prepare_groups_update(const OctopipesCapMessage message_type, const char** groups, const size_t groups_size, const char* reply_pipe, size_t* data_size);
+uint8_t* octopipes_cap_prepare_credits(const uint64_t messages_limit, const uint64_t bytes_limit, size_t* data_size);
 //Parse
 OctopipesCapMessage octopipes_cap_get_message(const uint8_t* data, const size_t data_size);
-OctopipesError octopipes_cap_parse_subscribe(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount);
+OctopipesError octopipes_cap_parse_subscribe(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount, char** reply_pipe, OctopipesSubscriptionFlags* flags, uint64_t* from);
 OctopipesError octopipes_cap_parse_assign(const uint8_t* data, const size_t data_size, OctopipesCapError* error, char** fifo_tx, char** fifo_rx);
 OctopipesError octopipes_cap_parse_unsubscribe(const uint8_t* data, const size_t data_size);
+OctopipesError octopipes_cap_parse_groups_update(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount, char** reply_pipe);
+OctopipesError octopipes_cap_parse_credits(const uint8_t* data, const size_t data_size, uint64_t* messages_limit, uint64_t* bytes_limit);
 
 #ifdef __cplusplus
 }
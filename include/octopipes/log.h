@@ -0,0 +1,51 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#ifndef OCTOPIPES_LOG_H
+#define OCTOPIPES_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "types.h"
+
+#define OCTOPIPES_LOG_NO_OFFSET UINT64_MAX
+
+//Log
+OctopipesError octopipes_log_open(OctopipesLog** log, const char* directory, const size_t segment_size, const size_t retention_bytes, const uint64_t retention_age_ms);
+OctopipesError octopipes_log_close(OctopipesLog* log);
+OctopipesError octopipes_log_get_group(OctopipesLog* log, const char* group, const int create, OctopipesLogGroup** log_group);
+OctopipesError octopipes_log_set_max_groups(OctopipesLog* log, const size_t max_groups);
+OctopipesError octopipes_log_get_groups(OctopipesLog* log, char*** groups, size_t* groups_len);
+//Groups
+OctopipesError octopipes_log_append(OctopipesLogGroup* log_group, const uint8_t* data, const size_t data_size, uint64_t* offset);
+uint64_t octopipes_log_first(OctopipesLogGroup* log_group);
+uint64_t octopipes_log_seek_time(OctopipesLogGroup* log_group, const uint64_t time_ms);
+const uint8_t* octopipes_log_read(OctopipesLogGroup* log_group, const uint64_t offset, size_t* data_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -47,16 +47,38 @@ OctopipesError octopipes_loop_start(OctopipesClient* client);
 OctopipesError octopipes_loop_stop(OctopipesClient* client);
 //Cap operartions
 OctopipesError octopipes_subscribe(OctopipesClient* client, const char** groups, size_t groups_amount, OctopipesCapError* assignment_error);
+OctopipesError octopipes_subscribe_ex(OctopipesClient* client, const char** groups, size_t groups_amount, const OctopipesSubscriptionFlags flags, OctopipesCapError* assignment_error);
+OctopipesError octopipes_subscribe_from(OctopipesClient* client, const char** groups, size_t groups_amount, const OctopipesSubscriptionFlags flags, const uint64_t from, OctopipesCapError* assignment_error);
 OctopipesError octopipes_unsubscribe(OctopipesClient* client);
+OctopipesError octopipes_add_groups(OctopipesClient* client, const char** groups, const size_t groups_amount, OctopipesCapError* update_error);
+OctopipesError octopipes_remove_groups(OctopipesClient* client, const char** groups, const size_t groups_amount, OctopipesCapError* update_error);
 //Tx operations
 OctopipesError octopipes_send(OctopipesClient* client, const char* remote, const void* data, uint64_t data_size);
 OctopipesError octopipes_send_ex(OctopipesClient* client, const char* remote, const void* data, uint64_t data_size, const uint8_t ttl, const OctopipesOptions options);
+OctopipesError octopipes_send_reserve(OctopipesClient* client, const char* remote, const uint64_t data_size, OctopipesSendHandle** handle, void** payload);
+OctopipesError octopipes_send_commit(OctopipesClient* client, OctopipesSendHandle* handle, const uint8_t ttl, const OctopipesOptions options);
+OctopipesError octopipes_send_discard(OctopipesSendHandle* handle);
+OctopipesError octopipes_send_batch(OctopipesClient* client, const OctopipesBatchEntry* entries, const size_t entries_len, OctopipesError* results);
+//Requests
+OctopipesError octopipes_request(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, OctopipesMessage** reply);
+OctopipesError octopipes_request_async(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, void (*on_reply)(const OctopipesClient* client, const OctopipesMessage* reply, const OctopipesError error, void* user_data), void* user_data);
+OctopipesError octopipes_reply(OctopipesClient* client, const OctopipesMessage* request, const void* data, const uint64_t data_size);
+//Acknowledgements
+OctopipesError octopipes_set_ack_window(OctopipesClient* client, const size_t window, const unsigned int timeout);
+//Receive
+OctopipesError octopipes_receive(OctopipesClient* client, OctopipesMessage** messages, const size_t max, const int timeout, size_t* received);
+//Executor
+OctopipesError octopipes_set_executor(OctopipesClient* client, const size_t workers, const size_t queue_size, const OctopipesExecutorPolicy policy);
+OctopipesError octopipes_get_executor_stats(const OctopipesClient* client, size_t* depth, size_t* dropped);
+//Credits
+OctopipesError octopipes_get_send_credits(OctopipesClient* client, size_t* messages, size_t* bytes);
 //Callbacks
 OctopipesError octopipes_set_received_cb(OctopipesClient* client, void (*on_received)(const OctopipesClient* client, const OctopipesMessage*));
 OctopipesError octopipes_set_sent_cb(OctopipesClient* client, void (*on_sent)(const OctopipesClient* client, const OctopipesMessage*));
 OctopipesError octopipes_set_receive_error_cb(OctopipesClient* client, void (*on_receive_error)(const OctopipesClient* client, const OctopipesError));
 OctopipesError octopipes_set_subscribed_cb(OctopipesClient* client, void (*on_subscribed)(const OctopipesClient* client));
 OctopipesError octopipes_set_unsubscribed_cb(OctopipesClient* client, void (*on_unsubscribed)(const OctopipesClient* client));
+OctopipesError octopipes_set_credits_cb(OctopipesClient* client, void (*on_credits)(const OctopipesClient* client, const size_t messages, const size_t bytes));
 
 //@! Server
 
@@ -71,9 +93,33 @@ OctopipesServerError octopipes_server_process_cap_all(OctopipesServer* server, s
 //Workers
 OctopipesServerError octopipes_server_start_worker(OctopipesServer* server, const char* client, char** subscriptions, const size_t subscription_len, const char* cli_tx_pipe, const char* cli_rx_pipe);
 OctopipesServerError octopipes_server_stop_worker(OctopipesServer* server, const char* client);
+OctopipesServerError octopipes_server_set_outbound_queue(OctopipesServer* server, const size_t queue_size, const OctopipesServerOverflowPolicy policy);
+OctopipesServerError octopipes_server_get_outbound_stats(OctopipesServer* server, const char* client, size_t* depth, size_t* dropped);
+OctopipesServerError octopipes_server_set_rate_limit(OctopipesServer* server, const char* client, const uint64_t messages_per_sec, const uint64_t bytes_per_sec, const OctopipesServerRateLimitPolicy policy);
+OctopipesServerError octopipes_server_get_rate_limit_stats(OctopipesServer* server, const char* client, size_t* dropped, size_t* throttled);
+OctopipesServerError octopipes_server_set_memory_budget(OctopipesServer* server, const size_t budget);
+OctopipesServerError octopipes_server_get_memory_stats(OctopipesServer* server, const char* client, size_t* bytes, size_t* paused);
+OctopipesServerError octopipes_server_set_credits(OctopipesServer* server, const char* client, const size_t messages, const size_t bytes);
+OctopipesServerError octopipes_server_get_expired_stats(OctopipesServer* server, const char* client, size_t* inbox_expired, size_t* outbound_expired);
+OctopipesServerError octopipes_server_set_retained_cache(OctopipesServer* server, const size_t budget);
+OctopipesServerError octopipes_server_get_retained_stats(OctopipesServer* server, size_t* groups, size_t* bytes, size_t* evicted);
+OctopipesServerError octopipes_server_set_conflation(OctopipesServer* server, const char* client, const int conflate);
+OctopipesServerError octopipes_server_set_log(OctopipesServer* server, const char* directory, const size_t segment_size, const size_t retention_bytes, const uint64_t retention_age_ms);
+OctopipesServerError octopipes_server_set_log_max_groups(OctopipesServer* server, const size_t max_groups);
+OctopipesServerError octopipes_server_get_log_offsets(OctopipesServer* server, const char* group, uint64_t* first, uint64_t* next);
+OctopipesServerError octopipes_server_register_handler(OctopipesServer* server, const char* group, void (*on_message)(OctopipesServer* server, const OctopipesMessage* message));
+OctopipesServerError octopipes_server_unregister_handler(OctopipesServer* server, const char* group);
+OctopipesServerError octopipes_server_dispatch_message(OctopipesServer* server, OctopipesMessage* message, const char** worker);
+OctopipesServerError octopipes_server_reply(OctopipesServer* server, const OctopipesMessage* request, const char* origin, const void* data, const uint64_t data_size);
+OctopipesServerError octopipes_server_set_fanout(OctopipesServer* server, const size_t threads, const size_t threshold);
+OctopipesServerError octopipes_server_start_dispatchers(OctopipesServer* server, const size_t dispatchers);
+OctopipesServerError octopipes_server_stop_dispatchers(OctopipesServer* server);
+OctopipesServerError octopipes_server_set_dispatch_error_cb(OctopipesServer* server, void (*on_error)(const OctopipesServer* server, const char* client, const OctopipesServerError error));
 OctopipesServerError octopipes_server_process_first(OctopipesServer* server, size_t* requests, const char** client);
 OctopipesServerError octopipes_server_process_once(OctopipesServer* server, size_t* requests, const char** client);
 OctopipesServerError octopipes_server_process_all(OctopipesServer* server, size_t* requests, const char** client);
+OctopipesServerError octopipes_server_process_budget(OctopipesServer* server, const size_t max_msgs, const uint64_t max_us, size_t* requests, const char** client);
+OctopipesServerError octopipes_server_set_weight(OctopipesServer* server, const char* client, const size_t weight);
 //Getters
 OctopipesServerError octopipes_server_is_subscribed(OctopipesServer* server, const char* client);
 OctopipesServerError octopipes_server_get_subscriptions(OctopipesServer* server, const char* client, char*** subscriptions, size_t* sub_len);
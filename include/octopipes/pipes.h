@@ -30,11 +30,24 @@ extern "C" {
 
 #include "types.h"
 
+#include <limits.h>
+
+//Writes up to PIPE_BUF bytes are atomic on a FIFO
+#ifndef PIPE_BUF
+#define PIPE_BUF 512
+#endif
+
 //I/O
 OctopipesError pipe_create(const char* fifo);
 OctopipesError pipe_delete(const char* fifo);
 OctopipesError pipe_receive(const char* fifo, uint8_t** data, size_t* data_size, const int timeout);
 OctopipesError pipe_send(const char* fifo, const uint8_t* data, const size_t data_size, const int timeout);
+//Persistent descriptors
+OctopipesError pipe_open(const char* fifo, int* fd);
+OctopipesError pipe_read(const int fd, uint8_t** data, size_t* data_size, const int timeout);
+OctopipesError pipe_write(const int fd, const uint8_t* data, const size_t data_size, size_t* written);
+OctopipesError pipe_wait(const int read_fd, const int write_fd, const int timeout, int* readable, int* writable);
+OctopipesError pipe_close(const int fd);
 
 #ifdef __cplusplus
 }
@@ -30,10 +30,30 @@ extern "C" {
 
 #include "types.h"
 
+//Frame delimiters
+#define OCTOPIPES_SOH 0x01
+#define OCTOPIPES_STX 0x02
+#define OCTOPIPES_ETX 0x03
+//Correlation id, epoch and sequence
+#define OCTOPIPES_FIELDS_MAX_SIZE 12
+//Frames larger than this are refused, so a corrupted data size can't hold a stream back
+#define OCTOPIPES_MAX_FRAME_SIZE 16777216
+
 //Encoding/decoding
 OctopipesError octopipes_decode(const uint8_t* data, const size_t data_size, OctopipesMessage** message);
+OctopipesError octopipes_decode_next(const uint8_t* stream, const size_t stream_size, size_t* offset, OctopipesMessage** message);
+OctopipesError octopipes_stream_append(uint8_t** stream, size_t* stream_len, uint8_t* data, const size_t data_len);
+void octopipes_stream_consume(uint8_t** stream, size_t* stream_len, const size_t bytes);
 OctopipesError octopipes_encode(OctopipesMessage* message, uint8_t** data, size_t* data_size);
+OctopipesError octopipes_encode_to(OctopipesMessage* message, uint8_t* data, const size_t buffer_size, size_t* data_size);
+OctopipesError octopipes_encode_header(const OctopipesMessage* message, uint8_t* data, const size_t buffer_size, size_t* header_size);
+size_t octopipes_get_encoded_size(const OctopipesMessage* message);
+size_t octopipes_get_checksum_offset(const OctopipesMessage* message);
+size_t octopipes_get_fields_size(const OctopipesOptions options);
+size_t octopipes_encode_fields(const OctopipesMessage* message, uint8_t* data);
+OctopipesError octopipes_get_frame_size(const uint8_t* data, const size_t data_size, size_t* frame_size);
 uint8_t calculate_checksum(const OctopipesMessage* message);
+uint8_t calculate_frame_checksum(const uint8_t* frame, const size_t frame_size, const size_t checksum_offset);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,48 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#ifndef OCTOPIPES_TIMER_H
+#define OCTOPIPES_TIMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "types.h"
+
+//Clock
+uint64_t octopipes_get_time_ms();
+uint64_t octopipes_get_time_us();
+uint64_t octopipes_get_epoch_ms();
+//Timer wheel
+OctopipesError octopipes_timer_wheel_init(OctopipesTimerWheel** wheel, const uint64_t tick_ms, const uint64_t now_ms);
+OctopipesError octopipes_timer_wheel_cleanup(OctopipesTimerWheel* wheel);
+void octopipes_timer_add(OctopipesTimerWheel* wheel, OctopipesTimer* timer, const uint64_t expires_ms);
+void octopipes_timer_remove(OctopipesTimerWheel* wheel, OctopipesTimer* timer);
+size_t octopipes_timer_wheel_advance(OctopipesTimerWheel* wheel, const uint64_t now_ms, OctopipesTimer** expired);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -47,6 +47,10 @@ typedef enum OctopipesError {
   OCTOPIPES_ERROR_NOT_UNSUBSCRIBED,
   OCTOPIPES_ERROR_THREAD,
   OCTOPIPES_ERROR_BAD_ALLOC,
+  OCTOPIPES_ERROR_REQUEST_TIMEOUT,
+  OCTOPIPES_ERROR_ACK_TIMEOUT,
+  OCTOPIPES_ERROR_WINDOW_FULL,
+  OCTOPIPES_ERROR_LOG_FULL,
   OCTOPIPES_ERROR_UNKNOWN_ERROR
 } OctopipesError;
 
@@ -69,9 +73,20 @@ typedef enum OctopipesOptions {
   OCTOPIPES_OPTIONS_NONE = 0,
   OCTOPIPES_OPTIONS_REQUIRE_ACK = 1,
   OCTOPIPES_OPTIONS_ACK = 2,
-  OCTOPIPES_OPTIONS_IGNORE_CHECKSUM = 4
+  OCTOPIPES_OPTIONS_IGNORE_CHECKSUM = 4,
+  OCTOPIPES_OPTIONS_REQUEST = 8,
+  OCTOPIPES_OPTIONS_REPLY = 16,
+  OCTOPIPES_OPTIONS_SEQUENCED = 32,
+  //Priority class (bits 6-7); the server delivers higher classes first
+  OCTOPIPES_OPTIONS_PRIORITY_ELEVATED = 64,
+  OCTOPIPES_OPTIONS_PRIORITY_HIGH = 128,
+  OCTOPIPES_OPTIONS_PRIORITY_CRITICAL = 192
 } OctopipesOptions;
 
+#define OCTOPIPES_PRIORITIES 4
+#define OCTOPIPES_PRIORITY_SHIFT 6
+#define OCTOPIPES_PRIORITY(options) (((options) >> OCTOPIPES_PRIORITY_SHIFT) & 0x03)
+
 typedef enum OctopipesVersion {
   OCTOPIPES_VERSION_1 = 1
 } OctopipesVersion;
@@ -80,15 +95,27 @@ typedef enum OctopipesCapMessage {
   OCTOPIPES_CAP_UNKNOWN = 0x00,
   OCTOPIPES_CAP_SUBSCRIPTION = 0x01,
   OCTOPIPES_CAP_ASSIGNMENT = 0xFF,
-  OCTOPIPES_CAP_UNSUBSCRIPTION = 0x02
+  OCTOPIPES_CAP_UNSUBSCRIPTION = 0x02,
+  OCTOPIPES_CAP_ADD_GROUPS = 0x03,
+  OCTOPIPES_CAP_REMOVE_GROUPS = 0x04,
+  OCTOPIPES_CAP_CREDITS = 0x05
 } OctopipesCapMessage;
 
 typedef enum OctopipesCapError {
   OCTOPIPES_CAP_ERROR_SUCCESS = 0,
   OCTOPIPES_CAP_ERROR_NAME_ALREADY_TAKEN = 1,
-  OCTOPIPES_CAP_ERROR_FS = 2
+  OCTOPIPES_CAP_ERROR_FS = 2,
+  OCTOPIPES_CAP_ERROR_INVALID_NAME = 3,
+  OCTOPIPES_CAP_ERROR_NOT_SUBSCRIBED = 4
 } OctopipesCapError;
 
+typedef enum OctopipesSubscriptionFlags {
+  OCTOPIPES_SUBSCRIPTION_NONE = 0,
+  OCTOPIPES_SUBSCRIPTION_CONFLATE = 1, //Only the latest queued message of each group is written to the client
+  OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET = 2, //Replay the logged messages of the groups starting from an offset
+  OCTOPIPES_SUBSCRIPTION_REPLAY_TIME = 4 //Replay the logged messages of the groups starting from a time (ms since epoch)
+} OctopipesSubscriptionFlags;
+
 typedef struct OctopipesMessage {
   OctopipesVersion version;
   uint8_t origin_size;
@@ -99,28 +126,234 @@ typedef struct OctopipesMessage {
   uint64_t data_size;
   OctopipesOptions options;
   uint8_t checksum;
+  uint32_t correlation_id;
+  uint32_t epoch;
+  uint32_t sequence;
   uint8_t* data;
 } OctopipesMessage;
 
+//Timers
+
+#define OCTOPIPES_TIMER_WHEEL_LEVELS 4
+#define OCTOPIPES_TIMER_WHEEL_SLOTS 64
+
+typedef struct OctopipesTimer {
+  uint64_t expires;
+  struct OctopipesTimer* prev;
+  struct OctopipesTimer* next;
+  struct OctopipesTimer** slot;
+} OctopipesTimer;
+
+typedef struct OctopipesTimerWheel {
+  uint64_t tick_ms;
+  uint64_t current_tick;
+  size_t timers;
+  OctopipesTimer* slots[OCTOPIPES_TIMER_WHEEL_LEVELS][OCTOPIPES_TIMER_WHEEL_SLOTS];
+} OctopipesTimerWheel;
+
+//Log
+
+typedef struct OctopipesLogSegment {
+  uint64_t base; //Offset of the first record
+  uint8_t* map; //Memory mapped file
+  size_t size; //Bytes mapped
+  size_t used; //Bytes written
+  size_t* index; //Position in map of each record
+  size_t index_len;
+  size_t index_size;
+  char* path;
+} OctopipesLogSegment;
+
+typedef struct OctopipesLogGroup {
+  char* group;
+  char* path; //Directory of the segments
+  uint32_t hash;
+  pthread_mutex_t lock;
+  OctopipesLogSegment* segments; //Oldest first; only the last one is appended to
+  size_t segments_len;
+  uint64_t next; //Offset of the next record
+  size_t bytes; //Bytes written in all the segments
+  struct OctopipesLog* log;
+} OctopipesLogGroup;
+
+typedef struct OctopipesLog {
+  char* directory;
+  size_t segment_size;
+  size_t retention_bytes; //0 if segments are not deleted by size
+  uint64_t retention_age; //0 if segments are not deleted by age (ms)
+  size_t max_groups; //Groups which can be loaded at once
+  pthread_rwlock_t lock; //Write locked while a group is loaded
+  OctopipesLogGroup** groups_map; //Open addressing table of groups
+  size_t groups_map_size; //Power of 2, at least twice groups_len
+  size_t groups_len;
+} OctopipesLog;
+
+typedef struct OctopipesBatchEntry {
+  const char* remote;
+  const void* data;
+  uint64_t data_size;
+  uint8_t ttl;
+  OctopipesOptions options;
+} OctopipesBatchEntry;
+
+typedef struct OctopipesSendHandle {
+  char* remote;
+  uint8_t* frame;
+  size_t frame_size;
+  size_t header_size;
+} OctopipesSendHandle;
+
+#define OCTOPIPES_HEADER_CACHE_SIZE 16
+
+typedef struct OctopipesHeaderTemplate {
+  uint64_t client; //Serial of the client the header was encoded for
+  char* remote;
+  uint8_t ttl;
+  OctopipesOptions options;
+  uint8_t* prefix;
+  size_t prefix_size;
+  uint8_t checksum;
+} OctopipesHeaderTemplate;
+
+struct OctopipesClient;
+
+typedef struct OctopipesRequest {
+  uint32_t correlation_id;
+  OctopipesTimer timer;
+  pthread_cond_t replied;
+  OctopipesMessage* reply;
+  int done;
+  void (*on_reply)(const struct OctopipesClient* client, const OctopipesMessage* reply, const OctopipesError error, void* user_data);
+  void* user_data;
+  size_t next_free;
+} OctopipesRequest;
+
+typedef struct OctopipesRequestTable {
+  OctopipesRequest** requests;
+  size_t requests_len;
+  size_t pending;
+  size_t free_head;
+  uint16_t generation;
+  OctopipesTimerWheel* timeouts;
+} OctopipesRequestTable;
+
+typedef struct OctopipesInflight {
+  uint32_t sequence;
+  uint8_t* frame;
+  size_t frame_size;
+  uint8_t ttl;
+} OctopipesInflight;
+
+typedef struct OctopipesAckStream {
+  char* remote;
+  uint32_t epoch;
+  uint32_t next_sequence;
+  OctopipesInflight* inflight;
+  size_t inflight_head;
+  size_t inflight_len;
+  size_t inflight_size;
+  size_t retries;
+  OctopipesTimer timer;
+  pthread_mutex_t send_lock; //Held while frames are written, so sequences reach the pipe in order without holding the acks lock
+} OctopipesAckStream;
+
+typedef struct OctopipesAckPeer {
+  char* origin;
+  char* remote;
+  uint32_t epoch;
+  uint32_t expected;
+  uint64_t delivered; //Epoch and sequence of the last message delivered
+  int ack_pending;
+} OctopipesAckPeer;
+
+typedef struct OctopipesAckTable {
+  size_t window;
+  unsigned int timeout;
+  OctopipesAckStream** streams;
+  size_t streams_len;
+  OctopipesAckPeer** peers;
+  size_t peers_len;
+  pthread_cond_t window_available;
+  OctopipesTimerWheel* timeouts;
+} OctopipesAckTable;
+
+typedef enum OctopipesExecutorPolicy {
+  OCTOPIPES_EXECUTOR_BLOCK,
+  OCTOPIPES_EXECUTOR_DROP
+} OctopipesExecutorPolicy;
+
+typedef struct OctopipesExecutorTask {
+  OctopipesMessage* message;
+  OctopipesAckPeer* peer; //Stream acknowledged once the message is delivered (NULL if not sequenced)
+} OctopipesExecutorTask;
+
+typedef struct OctopipesExecutorWorker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  OctopipesExecutorTask* queue;
+  size_t queue_head;
+  size_t queue_len;
+  size_t dropped;
+  int running;
+  struct OctopipesClient* client;
+} OctopipesExecutorWorker;
+
+typedef struct OctopipesExecutor {
+  size_t workers_len;
+  size_t queue_size;
+  OctopipesExecutorPolicy policy;
+  OctopipesExecutorWorker* workers;
+  OctopipesExecutorTask parked; //Message waiting for room in the queue of its worker (BLOCK policy)
+} OctopipesExecutor;
+
+typedef struct OctopipesCredits {
+  uint64_t messages_limit; //Messages the client can have sent since it subscribed (0 if not limited)
+  uint64_t bytes_limit; //Frame bytes the client can have sent since it subscribed (0 if not limited)
+  uint64_t messages_sent;
+  uint64_t bytes_sent;
+} OctopipesCredits;
+
 typedef struct OctopipesClient {
   //State
   OctopipesState state;
   //Thread
   pthread_t loop;
+  int loop_running; //Loop thread has been started and not joined yet
+  pthread_rwlock_t tx_lock;
+  pthread_mutex_t requests_lock;
+  pthread_mutex_t acks_lock;
+  pthread_mutex_t credits_lock;
   //Client parameters
   size_t client_id_size;
   char* client_id;
   OctopipesVersion protocol_version;
+  uint64_t serial; //Unique in the process, so the header templates cached by each thread are never mistaken for another client's
   //Pipes paths
   char* common_access_pipe;
   char* tx_pipe;
   char* rx_pipe;
+  //RX pipe descriptor, kept open while subscribed
+  int rx_fd;
+  //Received data which doesn't make a complete frame yet
+  uint8_t* rx_stream;
+  size_t rx_stream_size;
+  //Pending requests
+  OctopipesRequestTable requests;
+  //Acknowledged streams
+  OctopipesAckTable acks;
+  //Received messages executor
+  OctopipesExecutor executor;
+  //Send window granted by the server
+  OctopipesCredits credits;
   //Callbacks
   void (*on_received)(const struct OctopipesClient* client, const OctopipesMessage*);
   void (*on_sent)(const struct OctopipesClient* client, const OctopipesMessage*);
   void (*on_receive_error)(const struct OctopipesClient* client, const OctopipesError);
   void (*on_subscribed)(const struct OctopipesClient* client);
   void (*on_unsubscribed)(const struct OctopipesClient* client);
+  void (*on_credits)(const struct OctopipesClient* client, const size_t messages, const size_t bytes);
   //Extra - can be used to store anything NOTE: must be freed by the user
   void* user_data;
 } OctopipesClient;
@@ -146,19 +379,177 @@ typedef enum OctopipesServerError {
   OCTOPIPES_SERVER_ERROR_WORKER_NOT_RUNNING,
   OCTOPIPES_SERVER_ERROR_NO_RECIPIENT,
   OCTOPIPES_SERVER_ERROR_BAD_CLIENT_DIR,
+  OCTOPIPES_SERVER_ERROR_WORKER_OVERFLOW,
+  OCTOPIPES_SERVER_ERROR_LOG_FULL,
+  OCTOPIPES_SERVER_ERROR_BAD_CLIENT_ID,
+  OCTOPIPES_SERVER_ERROR_HANDLER_DEPTH,
   OCTOPIPES_SERVER_ERROR_UNKNOWN
 } OctopipesServerError;
 
 typedef struct OctopipesServerMessage {
   OctopipesMessage* message;
   OctopipesServerError error;
+  uint64_t expires; //Time the message expires at (ms, 0 if it never expires)
+  OctopipesTimer timer;
+  struct OctopipesServerMessage* prev;
+  struct OctopipesServerMessage* next;
 } OctopipesServerMessage;
 
 typedef struct OctopipesServerInbox {
-  OctopipesServerMessage** messages;
-  size_t inbox_len;
+  //One queue for each priority class
+  OctopipesServerMessage* head[OCTOPIPES_PRIORITIES];
+  OctopipesServerMessage* tail[OCTOPIPES_PRIORITIES];
+  size_t inbox_len[OCTOPIPES_PRIORITIES];
+  OctopipesTimerWheel* expirations; //Messages with a TTL
+  size_t expired;
+  size_t bytes; //Memory held by the queued messages
+  struct OctopipesServerMemory* memory; //Accounting of all the inboxes (NULL if not accounted)
+  struct OctopipesServerCredits* credits; //Credits given back by the messages taken out (NULL if not granted)
 } OctopipesServerInbox;
 
+//Fields are accessed with atomic operations, so the accounting never waits for a lock
+typedef struct OctopipesServerMemory {
+  size_t used; //Memory held by the inboxes, the undecoded streams, the outbound queues, the replays and the retained frames
+  size_t input; //Part of used read from the clients: the messages in the inboxes and the undecoded streams
+  size_t budget; //0 if unlimited
+  size_t inboxes; //Accounted inboxes
+} OctopipesServerMemory;
+
+typedef struct OctopipesServerDisconnects {
+  pthread_mutex_t lock;
+  size_t pending; //Workers whose outbound queue overflowed with the disconnect policy since they were last stopped
+} OctopipesServerDisconnects;
+
+typedef enum OctopipesServerOverflowPolicy {
+  OCTOPIPES_SERVER_OVERFLOW_DROP_OLDEST,
+  OCTOPIPES_SERVER_OVERFLOW_DROP_NEWEST,
+  OCTOPIPES_SERVER_OVERFLOW_DISCONNECT
+} OctopipesServerOverflowPolicy;
+
+typedef enum OctopipesServerRateLimitPolicy {
+  OCTOPIPES_SERVER_RATE_LIMIT_BACKPRESSURE, //The client is not read until its rate is within the limits
+  OCTOPIPES_SERVER_RATE_LIMIT_DROP //The messages exceeding the limits are dropped
+} OctopipesServerRateLimitPolicy;
+
+typedef struct OctopipesServerTokenBucket {
+  uint64_t rate; //Tokens per second, which is also the bucket capacity; 0 if unlimited
+  int64_t tokens; //Available tokens, in millionths; negative if the last message overdrew
+  uint64_t refilled; //Time of the last refill (us)
+} OctopipesServerTokenBucket;
+
+typedef struct OctopipesServerRateLimit {
+  OctopipesServerTokenBucket messages;
+  OctopipesServerTokenBucket bytes;
+  OctopipesServerRateLimitPolicy policy;
+  size_t dropped;
+  size_t throttled; //Times reading was paused
+} OctopipesServerRateLimit;
+
+typedef struct OctopipesServerCredits {
+  size_t messages; //Window of messages granted to the client (0 if not limited)
+  size_t bytes; //Window of frame bytes granted to the client (0 if not limited)
+  uint64_t messages_consumed; //Messages of the client taken out of the server (dispatched, expired or dropped)
+  uint64_t bytes_consumed;
+  uint64_t messages_granted; //Consumed messages when the last grant was sent
+  uint64_t bytes_granted;
+} OctopipesServerCredits;
+
+typedef struct OctopipesServerSharedFrame {
+  uint8_t* data; //Encoded message
+  size_t data_size;
+  size_t refs; //The dispatch, the retained cache and the outbound queues holding it; freed by the last one
+} OctopipesServerSharedFrame;
+
+typedef struct OctopipesServerFrame {
+  OctopipesServerSharedFrame* shared; //Shared with the other recipients of the message
+  uint64_t expires; //Time the frame expires at (ms, 0 if it never expires)
+  char* group; //Set only if the client conflates frames
+  uint32_t hash; //Hash of group
+} OctopipesServerFrame;
+
+typedef struct OctopipesServerLane {
+  OctopipesServerFrame* frames; //Allocated when the first frame is queued
+  size_t head;
+  size_t len;
+} OctopipesServerLane;
+
+typedef struct OctopipesServerReplay {
+  OctopipesLogGroup* log;
+  uint64_t next; //Offset of the next record to write
+  size_t written; //Bytes of the next record already written
+  int done; //Set once the replay caught up with the log
+  uint64_t until; //Offset the replay caught up at; live frames before it were replayed
+} OctopipesServerReplay;
+
+typedef struct OctopipesServerOutbound {
+  int fd;
+  pthread_mutex_t lock;
+  //A ring buffer for each priority class of the frames waiting for the client to read
+  OctopipesServerLane lanes[OCTOPIPES_PRIORITIES];
+  size_t len; //Frames queued in all the lanes
+  size_t size; //Capacity of each lane
+  size_t offset; //Bytes of the head frame of the writing lane already written
+  size_t writing; //Lane of the frame being written
+  OctopipesServerOverflowPolicy policy;
+  size_t dropped;
+  size_t expired;
+  int overflowed;
+  int conflate; //A newer frame of a group replaces the queued one
+  //Logged groups replayed to the client, written when the queue is empty
+  OctopipesServerReplay* replays;
+  size_t replays_len;
+  size_t replaying; //Replays not done yet
+  size_t bytes; //Memory held by the queued frames and the replays
+  OctopipesServerMemory* memory; //Accounting of the server memory
+} OctopipesServerOutbound;
+
+typedef struct OctopipesServerShard {
+  pthread_t thread;
+  size_t index;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct OctopipesServerWorker* ready_head; //Workers of the shard which received messages, oldest first
+  struct OctopipesServerWorker* ready_tail;
+  int running;
+  struct OctopipesServer* server;
+} OctopipesServerShard;
+
+typedef struct OctopipesServerDispatchers {
+  pthread_rwlock_t lock; //Write locked while shards are started or stopped
+  OctopipesServerShard* shards;
+  size_t shards_len;
+  void (*on_error)(const struct OctopipesServer* server, const char* client, const OctopipesServerError error);
+} OctopipesServerDispatchers;
+
+typedef struct OctopipesServerRetained {
+  char* group;
+  uint32_t hash;
+  OctopipesServerSharedFrame* frame; //The last frame dispatched to the group
+  size_t priority;
+  uint64_t expires;
+  //Recency list, most recently used first
+  struct OctopipesServerRetained* prev;
+  struct OctopipesServerRetained* next;
+} OctopipesServerRetained;
+
+typedef struct OctopipesServerHandler {
+  void (*on_message)(struct OctopipesServer* server, const OctopipesMessage* message);
+  size_t refs; //The registration and each dispatch which is going to call it; freed by the last one
+} OctopipesServerHandler;
+
+typedef struct OctopipesServerRetainedCache {
+  pthread_mutex_t lock;
+  OctopipesServerRetained** map; //Open addressing table of entries by group
+  size_t map_size; //Power of 2, at least twice entries
+  size_t entries;
+  OctopipesServerRetained* head; //Most recently used
+  OctopipesServerRetained* tail; //Least recently used
+  size_t bytes;
+  size_t budget; //0 if the cache is disabled
+  size_t evicted;
+  OctopipesServerMemory* memory; //Accounting of the server memory
+} OctopipesServerRetainedCache;
+
 typedef struct OctopipesServerWorker {
   char* client_id;
   char** subscriptions_list;
@@ -170,9 +561,80 @@ typedef struct OctopipesServerWorker {
   pthread_t worker_listener;
   pthread_mutex_t worker_lock;
   int active;
+  uint32_t hash; //Hash of client_id, selects the dispatcher shard and the slot in the workers map
+  size_t index; //Position in the server workers
+  //Scheduling
+  size_t weight;
+  long deficit; //Bytes the worker can still send in the current round; negative if it overdrew
+  OctopipesServerDispatchers* dispatchers;
+  int ready; //Set while the worker is in the ready queue of its shard; locked by the shard lock, as the links
+  struct OctopipesServerWorker* ready_prev;
+  struct OctopipesServerWorker* ready_next;
+  OctopipesServerDisconnects* disconnects;
+  int read_fd;
   OctopipesServerInbox* inbox;
+  OctopipesServerOutbound outbound;
+  OctopipesServerRateLimit rate_limit; //Locked by worker_lock
+  OctopipesServerCredits credits; //Locked by worker_lock
+  size_t paused; //Times reading stopped because the memory budget was exceeded
+  size_t stream_bytes; //Bytes read from the client and not decoded yet; written by the worker thread only
 } OctopipesServerWorker;
 
+typedef struct OctopipesServerTrieNode {
+  char* level;
+  struct OctopipesServerTrieNode** children; //Sorted by level
+  size_t children_len;
+  struct OctopipesServerTrieNode* single_wildcard; //'*': matches exactly one level
+  struct OctopipesServerTrieNode* multi_wildcard; //'#': matches all the remaining levels
+  OctopipesServerWorker** subscribers;
+  size_t subscribers_len;
+  OctopipesServerHandler* handler; //Registered for the group ending in this node
+} OctopipesServerTrieNode;
+
+typedef struct OctopipesServerRoute {
+  OctopipesServerWorker** workers;
+  size_t workers_len;
+  size_t workers_size;
+  OctopipesServerHandler** handlers; //Referenced, until they're called once routing_lock is released
+  size_t handlers_len;
+  size_t handlers_size;
+} OctopipesServerRoute;
+
+typedef struct OctopipesServerFanoutRange {
+  size_t begin;
+  size_t end;
+} OctopipesServerFanoutRange;
+
+typedef struct OctopipesServerFanoutThread {
+  pthread_t thread;
+  size_t index;
+  unsigned long job; //Last job served
+  struct OctopipesServerFanout* fanout;
+} OctopipesServerFanoutThread;
+
+typedef struct OctopipesServerFanout {
+  OctopipesServerFanoutThread* threads;
+  size_t threads_len;
+  size_t threshold;
+  int running;
+  pthread_mutex_t job_lock; //Held by the dispatcher which is using the pool
+  pthread_mutex_t lock;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  //Current job
+  unsigned long job;
+  OctopipesServerSharedFrame* frame;
+  size_t priority;
+  uint64_t expires;
+  const char* group;
+  uint64_t log_offset;
+  OctopipesServerWorker** workers;
+  OctopipesServerFanoutRange* ranges; //One for each thread, plus one for the dispatcher
+  size_t pending;
+  OctopipesServerError error;
+  OctopipesServerWorker* failed;
+} OctopipesServerFanout;
+
 typedef struct OctopipesServer {
   //Version
   OctopipesVersion version;
@@ -185,8 +647,33 @@ typedef struct OctopipesServer {
   pthread_t cap_listener;
   OctopipesServerInbox* cap_inbox;
   //Workers
+  pthread_rwlock_t routing_lock;
   OctopipesServerWorker** workers;
   size_t workers_len;
+  size_t workers_size;
+  OctopipesServerWorker** workers_map; //Open addressing table of workers by client id
+  size_t workers_map_size; //Power of 2, at least twice workers_len
+  size_t schedule_cursor; //Next worker to process
+  OctopipesServerTrieNode* routing_trie;
+  //Outbound queues of new workers
+  size_t outbound_queue_size;
+  OctopipesServerOverflowPolicy overflow_policy;
+  //Rate limit of new workers
+  OctopipesServerRateLimit rate_limit;
+  //Send window of new workers
+  OctopipesServerCredits credits;
+  //Memory held by the workers and the retained frames
+  OctopipesServerMemory memory;
+  //Workers to stop, once the routing can be write locked
+  OctopipesServerDisconnects disconnects;
+  //Parallel dispatch of large messages
+  OctopipesServerFanout fanout;
+  //Dispatcher threads
+  OctopipesServerDispatchers dispatchers;
+  //Last frame of each group, for late subscribers
+  OctopipesServerRetainedCache retained;
+  //Log of the groups, for replay (NULL if disabled)
+  OctopipesLog* log;
 } OctopipesServer;
 
 #ifdef __cplusplus
@@ -41,15 +41,21 @@ public:
   Error startLoop();
   Error stopLoop();
   Error subscribe(const std::list<std::string>& groups, CapError& assignment_error);
+  Error subscribe(const std::list<std::string>& groups, const SubscriptionFlags flags, CapError& assignment_error);
+  Error subscribe(const std::list<std::string>& groups, const SubscriptionFlags flags, const uint64_t from, CapError& assignment_error);
   Error unsubscribe();
+  Error addGroups(const std::list<std::string>& groups, CapError& update_error);
+  Error removeGroups(const std::list<std::string>& groups, CapError& update_error);
   Error send(const std::string& remote, const void* data, const uint64_t data_size);
   Error sendEx(const std::string& remote, const void* data, const uint64_t data_size, const uint8_t ttl, const Options options);
+  Error getSendCredits(size_t& messages, size_t& bytes) const;
   //Callbacks
   Error setReceivedCB(std::function<void(const Client*, const Message*)> on_received);
   Error setSentCB(std::function<void(const Client*, const Message*)> on_sent);
   Error setReceive_errorCB(std::function<void(const Client*, const Error)> on_receive_error);
   Error setSubscribedCB(std::function<void(const Client*)> on_subscribed);
   Error setUnsubscribedCB(std::function<void(const Client*)> on_unsubscribed);
+  Error setCreditsCB(std::function<void(const Client*, const size_t, const size_t)> on_credits);
   //Getters
   void* getUserData() const;
   std::string getClientId() const;
@@ -69,6 +75,7 @@ private:
   std::function<void(const Client*, const Error)> on_receive_error;
   std::function<void(const Client*)> on_subscribed;
   std::function<void(const Client*)> on_unsubscribed;
+  std::function<void(const Client*, const size_t, const size_t)> on_credits;
 
 };
 
@@ -49,6 +49,10 @@ enum class Error {
   NOT_UNSUBSCRIBED,
   THREAD,
   BAD_ALLOC,
+  REQUEST_TIMEOUT,
+  ACK_TIMEOUT,
+  WINDOW_FULL,
+  LOG_FULL,
   UNKNOWN_ERROR
 };
 
@@ -56,21 +60,39 @@ enum class CapMessage {
   UNKNOWN = 0x00,
   SUBSCRIPTION = 0x01,
   ASSIGNMENT = 0xFF,
-  UNSUBSCRIPTION = 0x02
+  UNSUBSCRIPTION = 0x02,
+  ADD_GROUPS = 0x03,
+  REMOVE_GROUPS = 0x04,
+  CREDITS = 0x05
 };
 
 enum class CapError {
   SUCCESS = 0,
   NAME_ALREADY_TAKEN = 1,
   FS = 2,
+  INVALID_NAME = 3,
+  NOT_SUBSCRIBED = 4,
   UNKNOWN = 255
 };
 
+enum class SubscriptionFlags {
+  NONE = 0,
+  CONFLATE = 1,
+  REPLAY_OFFSET = 2,
+  REPLAY_TIME = 4
+};
+
 enum class Options {
   NONE = 0,
   REQUIRE_ACK = 1,
   ACK = 2,
-  IGNORE_CHECKSUM = 4
+  IGNORE_CHECKSUM = 4,
+  REQUEST = 8,
+  REPLY = 16,
+  SEQUENCED = 32,
+  PRIORITY_ELEVATED = 64,
+  PRIORITY_HIGH = 128,
+  PRIORITY_CRITICAL = 192
 };
 
 enum class ProtocolVersion {
@@ -96,6 +118,10 @@ enum class ServerError {
   WORKER_NOT_RUNNING,
   NO_RECIPIENT,
   BAD_CLIENT_DIR,
+  WORKER_OVERFLOW,
+  LOG_FULL,
+  BAD_CLIENT_ID,
+  HANDLER_DEPTH,
   UNKNOWN
 };
 
@@ -54,6 +54,7 @@ Client::Client(const std::string& client_id, const std::string& cap_path, const
   this->on_sent = nullptr;
   this->on_subscribed = nullptr;
   this->on_unsubscribed = nullptr;
+  this->on_credits = nullptr;
   this->user_data = nullptr;
   //Set this in user_data
   client->user_data = reinterpret_cast<void*>(this);
@@ -110,17 +111,43 @@ Error Client::stopLoop() {
  */
 
 Error Client::subscribe(const std::list<std::string>& groups, CapError& assignment_error) {
+  return subscribe(groups, SubscriptionFlags::NONE, assignment_error);
+}
+
+/**
+ * @brief subscribe to Octopipes server with flags
+ * @param list<std::string> groups
+ * @param SubscriptionFlags flags
+ * @param CapError& assignment error
+ * @return octopipes::Error
+ */
+
+Error Client::subscribe(const std::list<std::string>& groups, const SubscriptionFlags flags, CapError& assignment_error) {
+  return subscribe(groups, flags, 0, assignment_error);
+}
+
+/**
+ * @brief subscribe to Octopipes server, replaying the messages logged for the groups from an offset (SubscriptionFlags::REPLAY_OFFSET)
+ * or from a time in milliseconds since epoch (SubscriptionFlags::REPLAY_TIME)
+ * @param list<std::string> groups
+ * @param SubscriptionFlags flags
+ * @param uint64_t from
+ * @param CapError& assignment error
+ * @return octopipes::Error
+ */
+
+Error Client::subscribe(const std::list<std::string>& groups, const SubscriptionFlags flags, const uint64_t from, CapError& assignment_error) {
   OctopipesClient* client = reinterpret_cast<OctopipesClient*>(octopipes_client);
   //Prepare groups
   const char** groups_c = new const char*[groups.size()];
   size_t i = 0;
   for (const auto& group : groups) {
-    groups_c[i] = group.c_str();
+    groups_c[i++] = group.c_str();
   }
   OctopipesError rc;
   OctopipesCapError cap_error;
   //Subscribe
-  if ((rc = octopipes_subscribe(client, groups_c, groups.size(), &cap_error)) != OCTOPIPES_ERROR_SUCCESS) {
+  if ((rc = octopipes_subscribe_from(client, groups_c, groups.size(), static_cast<OctopipesSubscriptionFlags>(flags), from, &cap_error)) != OCTOPIPES_ERROR_SUCCESS) {
     delete[] groups_c;
     //Translate CAP error
     assignment_error = translate_cap_error(cap_error);
@@ -143,6 +170,50 @@ Error Client::unsubscribe() {
   return translate_octopipes_error(octopipes_unsubscribe(client));
 }
 
+/**
+ * @brief subscribe to more groups, without subscribing again
+ * @param std::list<std::string> groups
+ * @param CapError& update error
+ * @return octopipes::Error
+ */
+
+Error Client::addGroups(const std::list<std::string>& groups, CapError& update_error) {
+  OctopipesClient* client = reinterpret_cast<OctopipesClient*>(octopipes_client);
+  //Prepare groups
+  const char** groups_c = new const char*[groups.size()];
+  size_t i = 0;
+  for (const auto& group : groups) {
+    groups_c[i++] = group.c_str();
+  }
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  const OctopipesError rc = octopipes_add_groups(client, groups_c, groups.size(), &cap_error);
+  delete[] groups_c;
+  update_error = translate_cap_error(cap_error);
+  return translate_octopipes_error(rc);
+}
+
+/**
+ * @brief unsubscribe from some groups, keeping the subscription to the others
+ * @param std::list<std::string> groups
+ * @param CapError& update error
+ * @return octopipes::Error
+ */
+
+Error Client::removeGroups(const std::list<std::string>& groups, CapError& update_error) {
+  OctopipesClient* client = reinterpret_cast<OctopipesClient*>(octopipes_client);
+  //Prepare groups
+  const char** groups_c = new const char*[groups.size()];
+  size_t i = 0;
+  for (const auto& group : groups) {
+    groups_c[i++] = group.c_str();
+  }
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  const OctopipesError rc = octopipes_remove_groups(client, groups_c, groups.size(), &cap_error);
+  delete[] groups_c;
+  update_error = translate_cap_error(cap_error);
+  return translate_octopipes_error(rc);
+}
+
 /**
  * @brief send a simple message to a certain node or group
  * @param string remote
@@ -171,6 +242,18 @@ Error Client::sendEx(const std::string& remote, const void* data, const uint64_t
   return translate_octopipes_error(octopipes_send_ex(client, remote.c_str(), data, data_size, ttl, static_cast<OctopipesOptions>(options)));
 }
 
+/**
+ * @brief get the messages and the bytes the client can still send before the server dispatches the ones already sent (SIZE_MAX if not limited)
+ * @param size_t& messages
+ * @param size_t& bytes
+ * @return octopipes::Error
+ */
+
+Error Client::getSendCredits(size_t& messages, size_t& bytes) const {
+  OctopipesClient* client = reinterpret_cast<OctopipesClient*>(octopipes_client);
+  return translate_octopipes_error(octopipes_get_send_credits(client, &messages, &bytes));
+}
+
 //Callbacks
 
 Error Client::setReceivedCB(std::function<void(const Client*, const Message*)> on_received) {
@@ -273,6 +356,26 @@ Error Client::setUnsubscribedCB(std::function<void(const Client*)> on_unsubscrib
   return Error::SUCCESS;
 }
 
+/**
+ * @brief set on_credits Callback
+ * @param function on_credits callback
+ * @return octopipes::Error
+ */
+
+Error Client::setCreditsCB(std::function<void(const Client*, const size_t, const size_t)> on_credits) {
+  OctopipesClient* client = reinterpret_cast<OctopipesClient*>(octopipes_client);
+  this->on_credits = on_credits;
+  //Use a lambda expression
+  client->on_credits = [](const OctopipesClient* client, const size_t messages, const size_t bytes) {
+    Client* client_ptr = reinterpret_cast<Client*>(client->user_data); //User data is always set here
+    if (client_ptr->on_credits == nullptr) {
+      return; //Just return
+    }
+    client_ptr->on_credits(client_ptr, messages, bytes);
+  };
+  return Error::SUCCESS;
+}
+
 /**
  * @brief returns user data (or nullptr)
  * @return void*
@@ -335,6 +438,14 @@ Error translate_octopipes_error(OctopipesError error) {
       return Error::OPEN_FAILED;
     case OCTOPIPES_ERROR_READ_FAILED:
       return Error::READ_FAILED;
+    case OCTOPIPES_ERROR_REQUEST_TIMEOUT:
+      return Error::REQUEST_TIMEOUT;
+    case OCTOPIPES_ERROR_ACK_TIMEOUT:
+      return Error::ACK_TIMEOUT;
+    case OCTOPIPES_ERROR_WINDOW_FULL:
+      return Error::WINDOW_FULL;
+    case OCTOPIPES_ERROR_LOG_FULL:
+      return Error::LOG_FULL;
     case OCTOPIPES_ERROR_SUCCESS:
       return Error::SUCCESS;
     case OCTOPIPES_ERROR_THREAD:
@@ -363,6 +474,10 @@ CapError translate_cap_error(OctopipesCapError error) {
       return CapError::NAME_ALREADY_TAKEN;
     case OCTOPIPES_CAP_ERROR_FS:
       return CapError::FS;
+    case OCTOPIPES_CAP_ERROR_INVALID_NAME:
+      return CapError::INVALID_NAME;
+    case OCTOPIPES_CAP_ERROR_NOT_SUBSCRIBED:
+      return CapError::NOT_SUBSCRIBED;
     default:
       return CapError::UNKNOWN;
   }
@@ -394,6 +509,14 @@ const std::string Client::getErrorDesc(const Error error) {
       return "Could not open the FIFO";
     case Error::READ_FAILED:
       return "An error occurred while trying to read from FIFO";
+    case Error::REQUEST_TIMEOUT:
+      return "The request hasn't been replied in time";
+    case Error::ACK_TIMEOUT:
+      return "The remote hasn't acknowledged the messages in time";
+    case Error::WINDOW_FULL:
+      return "The ACK window is full and the loop thread can't wait for ACKs";
+    case Error::LOG_FULL:
+      return "The log can't load more groups";
     case Error::SUCCESS:
       return "Not an error";
     case Error::THREAD:
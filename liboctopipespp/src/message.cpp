@@ -172,6 +172,9 @@ Error Message::encodeData(uint8_t*& data, size_t& data_size) {
   msg->remote[msg->remote_size] = 0x00;
   //Options
   msg->options = static_cast<OctopipesOptions>(options);
+  msg->correlation_id = 0;
+  msg->epoch = 0;
+  msg->sequence = 0;
   //TTL
   msg->ttl = ttl;
   //Assign data
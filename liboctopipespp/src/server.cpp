@@ -213,10 +213,13 @@ std::list<std::string> Server::getSubscriptions(const std::string& client) {
   std::list<std::string> subscriptions;
   char** sub_ptr = NULL;
   size_t sub_len = 0;
-  octopipes_server_get_subscriptions(server, client.c_str(), &sub_ptr, &sub_len);
+  if (octopipes_server_get_subscriptions(server, client.c_str(), &sub_ptr, &sub_len) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    return subscriptions;
+  }
   for (size_t i = 0; i < sub_len; i++) {
     subscriptions.push_back(sub_ptr[i]);
   }
+  free(sub_ptr);
   return subscriptions;
 }
 
@@ -284,6 +287,14 @@ const std::string Server::getServerErrorDesc(const ServerError error) {
       return "The requested worker is not running";
     case ServerError::WRITE_FAILED:
       return "Could not write to pipe";
+    case ServerError::WORKER_OVERFLOW:
+      return "The worker outbound queue overflowed; the worker has been disconnected";
+    case ServerError::LOG_FULL:
+      return "The log can't load more groups";
+    case ServerError::BAD_CLIENT_ID:
+      return "The client id can't contain wildcards or level separators";
+    case ServerError::HANDLER_DEPTH:
+      return "Too many dispatches nested in handlers";
     case ServerError::UNKNOWN:
     default:
       return "Unknown error";
@@ -328,6 +339,14 @@ ServerError translate_octopipes_server_error(OctopipesServerError error) {
       return ServerError::WORKER_NOT_RUNNING;
     case OCTOPIPES_SERVER_ERROR_WRITE_FAILED:
       return ServerError::WRITE_FAILED;
+    case OCTOPIPES_SERVER_ERROR_WORKER_OVERFLOW:
+      return ServerError::WORKER_OVERFLOW;
+    case OCTOPIPES_SERVER_ERROR_LOG_FULL:
+      return ServerError::LOG_FULL;
+    case OCTOPIPES_SERVER_ERROR_BAD_CLIENT_ID:
+      return ServerError::BAD_CLIENT_ID;
+    case OCTOPIPES_SERVER_ERROR_HANDLER_DEPTH:
+      return ServerError::HANDLER_DEPTH;
     case OCTOPIPES_SERVER_ERROR_UNKNOWN:
     default:
       return ServerError::UNKNOWN;
@@ -333,7 +333,8 @@ int main_server() {
           //Parse subscribe
           char** groups = NULL;
           size_t groups_amount;
-          if ((ret = octopipes_cap_parse_subscribe(data_in, data_in_size, &groups, &groups_amount)) != OCTOPIPES_ERROR_SUCCESS) {
+          char* reply_pipe = NULL;
+          if ((ret = octopipes_cap_parse_subscribe(message->data, message->data_size, &groups, &groups_amount, &reply_pipe, NULL, NULL)) != OCTOPIPES_ERROR_SUCCESS) {
             printf("%sCould not parse subscribe message: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
             octopipes_cleanup_message(message);
             free(data_in);
@@ -370,6 +371,9 @@ int main_server() {
           assignment_message->data_size = out_payload_size;
           assignment_message->data = out_payload;
           assignment_message->options = OCTOPIPES_OPTIONS_NONE;
+          assignment_message->correlation_id = 0;
+          assignment_message->epoch = 0;
+          assignment_message->sequence = 0;
           assignment_message->checksum = calculate_checksum(assignment_message);
           //Encode message
           uint8_t* out_data;
@@ -388,7 +392,7 @@ int main_server() {
             printf("%02x ", out_data[i]);
           }
           printf("%s\n", KNRM);
-          if ((ret = pipe_send(capPipe.c_str(), out_data, out_data_size, 5000)) != OCTOPIPES_ERROR_SUCCESS) {
+          if ((ret = pipe_send((reply_pipe != NULL) ? reply_pipe : capPipe.c_str(), out_data, out_data_size, 5000)) != OCTOPIPES_ERROR_SUCCESS) {
             printf("%sCould not send assignment to client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
             free(out_data);
             octopipes_cleanup_message(message);
@@ -402,6 +406,7 @@ int main_server() {
           printf("%sSent ASSIGNMENT to %s%s\n", KCYN, message->origin, KNRM);
           //Free out data
           free(out_data);
+          free(reply_pipe);
           break;
         }
         case OCTOPIPES_CAP_UNSUBSCRIPTION: {
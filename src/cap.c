@@ -29,16 +29,31 @@
  * @brief prepare a CAP subscribe payload
  * @param char** groups array
  * @param size_t groups size
+ * @param char* reply pipe the assignment must be written to (NULL to receive it on the CAP)
+ * @param OctopipesSubscriptionFlags flags
+ * @param uint64_t from: offset or time (ms since epoch) the replay starts from; written only if a replay flag is set
  * @param size_t out data size
  * @return uint8_t* data out
  */
 
-uint8_t* octopipes_cap_prepare_subscription(const char** groups, const size_t groups_size, size_t* data_size) {
+uint8_t* octopipes_cap_prepare_subscription(const char** groups, const size_t groups_size, const char* reply_pipe, const OctopipesSubscriptionFlags flags, const uint64_t from, size_t* data_size) {
   size_t current_size = 2; //Size is at least 2 (descriptor, groups amount)
   //Iterate over groups to get total size
   for (size_t i = 0; i < groups_size; i++) {
     current_size += strlen(groups[i]) + 1; //Group size + its size byte
   }
+  const size_t reply_pipe_size = (reply_pipe != NULL) ? strlen(reply_pipe) : 0;
+  //Flags follow the reply pipe, which is left empty if not set
+  if (reply_pipe != NULL || flags != OCTOPIPES_SUBSCRIPTION_NONE) {
+    current_size += reply_pipe_size + 1; //Reply pipe size + its size byte
+  }
+  if (flags != OCTOPIPES_SUBSCRIPTION_NONE) {
+    current_size++;
+  }
+  const int replay = (flags & (OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET | OCTOPIPES_SUBSCRIPTION_REPLAY_TIME)) != 0;
+  if (replay) {
+    current_size += 8;
+  }
   //Allocate buffer
   uint8_t* data = (uint8_t*) malloc(sizeof(uint8_t) * current_size);
   if (data == NULL) {
@@ -55,6 +70,21 @@ uint8_t* octopipes_cap_prepare_subscription(const char** groups, const size_t gr
     memcpy(data + data_ptr, groups[i], this_group_length);
     data_ptr += this_group_length;
   }
+  //Reply pipe follows groups
+  if (reply_pipe != NULL || flags != OCTOPIPES_SUBSCRIPTION_NONE) {
+    data[data_ptr++] = (uint8_t) reply_pipe_size;
+    memcpy(data + data_ptr, reply_pipe, reply_pipe_size);
+    data_ptr += reply_pipe_size;
+  }
+  if (flags != OCTOPIPES_SUBSCRIPTION_NONE) {
+    data[data_ptr++] = (uint8_t) flags;
+  }
+  //Replay start follows flags (big endian)
+  if (replay) {
+    for (size_t i = 0; i < 8; i++) {
+      data[data_ptr++] = (uint8_t) (from >> (56 - i * 8));
+    }
+  }
   *data_size = current_size;
   return data;
 }
@@ -80,10 +110,14 @@ uint8_t* octopipes_cap_prepare_assign(OctopipesCapError error, const char* fifo_
   data[1] = (uint8_t) error;
   data[2] = (uint8_t) fifo_tx_size;
   size_t curr_data_ptr = 3;
-  memcpy(data + curr_data_ptr, fifo_tx, fifo_tx_size);
+  if (fifo_tx_size > 0) {
+    memcpy(data + curr_data_ptr, fifo_tx, fifo_tx_size);
+  }
   curr_data_ptr += fifo_tx_size;
   data[curr_data_ptr++] = (uint8_t) fifo_rx_size;
-  memcpy(data + curr_data_ptr, fifo_rx, fifo_rx_size);
+  if (fifo_rx_size > 0) {
+    memcpy(data + curr_data_ptr, fifo_rx, fifo_rx_size);
+  }
   return data;
 }
 
@@ -103,6 +137,48 @@ uint8_t* octopipes_cap_prepare_unsubscription(size_t* data_size) {
   return data;
 }
 
+/**
+ * @brief prepare the payload of a CAP message which adds groups to (or removes groups from) a subscribed client. The payload has the same layout of a subscription without flags
+ * @param OctopipesCapMessage message type (OCTOPIPES_CAP_ADD_GROUPS or OCTOPIPES_CAP_REMOVE_GROUPS)
+ * @param char** groups array
+ * @param size_t groups size
+ * @param char* reply pipe the server writes the outcome of the update to (NULL if no reply is expected)
+ * @param size_t* data size
+ * @return uint8_t* data out
+ */
+
+uint8_t* octopipes_cap_prepare_groups_update(const OctopipesCapMessage message_type, const char** groups, const size_t groups_size, const char* reply_pipe, size_t* data_size) {
+  uint8_t* data = octopipes_cap_prepare_subscription(groups, groups_size, reply_pipe, OCTOPIPES_SUBSCRIPTION_NONE, 0, data_size);
+  if (data == NULL) {
+    return NULL;
+  }
+  data[0] = (uint8_t) message_type;
+  return data;
+}
+
+/**
+ * @brief prepare the payload of a credits grant, which the server writes to the RX pipe of a client. The limits are the totals
+ * the client can have sent since it subscribed (big endian), so a grant replaces the previous ones and a lost grant is made up by the next one
+ * @param uint64_t messages limit (0 if not limited)
+ * @param uint64_t frame bytes limit (0 if not limited)
+ * @param size_t* data size
+ * @return uint8_t* data out
+ */
+
+uint8_t* octopipes_cap_prepare_credits(const uint64_t messages_limit, const uint64_t bytes_limit, size_t* data_size) {
+  *data_size = 17;
+  uint8_t* data = (uint8_t*) malloc(sizeof(uint8_t) * *data_size);
+  if (data == NULL) {
+    return NULL;
+  }
+  data[0] = OCTOPIPES_CAP_CREDITS;
+  for (size_t i = 0; i < 8; i++) {
+    data[1 + i] = (uint8_t) (messages_limit >> (56 - i * 8));
+    data[9 + i] = (uint8_t) (bytes_limit >> (56 - i * 8));
+  }
+  return data;
+}
+
 /**
  * @brief get CAP message type from its object
  * @param uint8_t* data
@@ -122,6 +198,12 @@ OctopipesCapMessage octopipes_cap_get_message(const uint8_t* data, const size_t
       return OCTOPIPES_CAP_UNSUBSCRIPTION;
     case OCTOPIPES_CAP_ASSIGNMENT:
       return OCTOPIPES_CAP_ASSIGNMENT;
+    case OCTOPIPES_CAP_ADD_GROUPS:
+      return OCTOPIPES_CAP_ADD_GROUPS;
+    case OCTOPIPES_CAP_REMOVE_GROUPS:
+      return OCTOPIPES_CAP_REMOVE_GROUPS;
+    case OCTOPIPES_CAP_CREDITS:
+      return OCTOPIPES_CAP_CREDITS;
     default:
       return OCTOPIPES_CAP_UNKNOWN;
   }
@@ -133,10 +215,22 @@ OctopipesCapMessage octopipes_cap_get_message(const uint8_t* data, const size_t
  * @param size_t data in size
  * @param char*** groups will contain the groups to subscribe to
  * @param size_t* amount of groups
+ * @param char** reply pipe the assignment must be written to (NULL if not set); can be NULL if not needed
+ * @param OctopipesSubscriptionFlags* flags; can be NULL if not needed
+ * @param uint64_t* offset or time the replay starts from (0 if no replay flag is set); can be NULL if not needed
  * @return OctopipesError
  */
 
-OctopipesError octopipes_cap_parse_subscribe(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount) {
+OctopipesError octopipes_cap_parse_subscribe(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount, char** reply_pipe, OctopipesSubscriptionFlags* flags, uint64_t* from) {
+  if (reply_pipe != NULL) {
+    *reply_pipe = NULL;
+  }
+  if (flags != NULL) {
+    *flags = OCTOPIPES_SUBSCRIPTION_NONE;
+  }
+  if (from != NULL) {
+    *from = 0;
+  }
   if (data_size < 2) {
     return OCTOPIPES_ERROR_BAD_PACKET;
   }
@@ -177,6 +271,125 @@ OctopipesError octopipes_cap_parse_subscribe(const uint8_t* data, const size_t d
     //Increment current group
     curr_group++;
   }
+  //Parse reply pipe, if set; an empty reply pipe only precedes flags
+  if (curr_group == *groups_amount && data_ptr < data_size) {
+    const size_t reply_pipe_size = data[data_ptr++];
+    if (data_ptr + reply_pipe_size > data_size) {
+      for (size_t i = 0; i < curr_group; i++) {
+        free((*groups)[i]);
+      }
+      free(*groups);
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    if (reply_pipe != NULL && reply_pipe_size > 0) {
+      *reply_pipe = (char*) malloc(sizeof(char) * (reply_pipe_size + 1));
+      if (*reply_pipe == NULL) {
+        for (size_t i = 0; i < curr_group; i++) {
+          free((*groups)[i]);
+        }
+        free(*groups);
+        return OCTOPIPES_ERROR_BAD_ALLOC;
+      }
+      memcpy(*reply_pipe, data + data_ptr, reply_pipe_size);
+      (*reply_pipe)[reply_pipe_size] = 0x00;
+    }
+    data_ptr += reply_pipe_size;
+    //Parse flags, if set
+    if (data_ptr < data_size) {
+      const uint8_t flags_byte = data[data_ptr++];
+      if (flags != NULL) {
+        *flags = (OctopipesSubscriptionFlags) flags_byte;
+      }
+      //Parse replay start
+      if ((flags_byte & (OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET | OCTOPIPES_SUBSCRIPTION_REPLAY_TIME)) != 0) {
+        if (data_ptr + 8 > data_size) {
+          for (size_t i = 0; i < curr_group; i++) {
+            free((*groups)[i]);
+          }
+          free(*groups);
+          if (reply_pipe != NULL) {
+            free(*reply_pipe);
+            *reply_pipe = NULL;
+          }
+          return OCTOPIPES_ERROR_BAD_PACKET;
+        }
+        for (size_t i = 0; i < 8 && from != NULL; i++) {
+          *from = (*from << 8) | data[data_ptr + i];
+        }
+      }
+    }
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief parse the payload of an add groups or remove groups CAP message
+ * @param uint8_t* data in
+ * @param size_t data in size
+ * @param char*** groups to add or remove
+ * @param size_t* amount of groups
+ * @param char** reply pipe the outcome must be written to (NULL if not set); can be NULL if not needed
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_cap_parse_groups_update(const uint8_t* data, const size_t data_size, char*** groups, size_t* groups_amount, char** reply_pipe) {
+  if (reply_pipe != NULL) {
+    *reply_pipe = NULL;
+  }
+  if (data_size < 2) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  if (data[0] != OCTOPIPES_CAP_ADD_GROUPS && data[0] != OCTOPIPES_CAP_REMOVE_GROUPS) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  *groups_amount = (size_t) data[1];
+  *groups = (char**) malloc(sizeof(char*) * *groups_amount);
+  if (*groups == NULL && *groups_amount > 0) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  size_t data_ptr = 2;
+  for (size_t i = 0; i < *groups_amount; i++) {
+    OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+    size_t this_group_size = 0;
+    if (data_ptr >= data_size || data_ptr + 1 + (this_group_size = data[data_ptr]) > data_size) {
+      rc = OCTOPIPES_ERROR_BAD_PACKET;
+    } else if (((*groups)[i] = (char*) malloc(sizeof(char) * (this_group_size + 1))) == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      for (size_t j = 0; j < i; j++) {
+        free((*groups)[j]);
+      }
+      free(*groups);
+      *groups = NULL;
+      return rc;
+    }
+    memcpy((*groups)[i], data + data_ptr + 1, this_group_size);
+    (*groups)[i][this_group_size] = 0x00;
+    data_ptr += this_group_size + 1;
+  }
+  //Parse reply pipe, if set
+  if (data_ptr < data_size) {
+    const size_t reply_pipe_size = data[data_ptr++];
+    OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+    if (data_ptr + reply_pipe_size > data_size) {
+      rc = OCTOPIPES_ERROR_BAD_PACKET;
+    } else if (reply_pipe != NULL && reply_pipe_size > 0 && (*reply_pipe = (char*) malloc(sizeof(char) * (reply_pipe_size + 1))) == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      for (size_t i = 0; i < *groups_amount; i++) {
+        free((*groups)[i]);
+      }
+      free(*groups);
+      *groups = NULL;
+      return rc;
+    }
+    if (reply_pipe != NULL && reply_pipe_size > 0) {
+      memcpy(*reply_pipe, data + data_ptr, reply_pipe_size);
+      (*reply_pipe)[reply_pipe_size] = 0x00;
+    }
+  }
   return OCTOPIPES_ERROR_SUCCESS;
 }
 
@@ -248,3 +461,25 @@ OctopipesError octopipes_cap_parse_unsubscribe(const uint8_t* data, const size_t
     return OCTOPIPES_ERROR_BAD_PACKET;
   }
 }
+
+/**
+ * @brief parse a credits grant
+ * @param uint8_t* data in
+ * @param size_t data in size
+ * @param uint64_t* messages limit (0 if not limited)
+ * @param uint64_t* frame bytes limit (0 if not limited)
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_cap_parse_credits(const uint8_t* data, const size_t data_size, uint64_t* messages_limit, uint64_t* bytes_limit) {
+  if (data_size < 17 || data[0] != OCTOPIPES_CAP_CREDITS) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  *messages_limit = 0;
+  *bytes_limit = 0;
+  for (size_t i = 0; i < 8; i++) {
+    *messages_limit = (*messages_limit << 8) | data[1 + i];
+    *bytes_limit = (*bytes_limit << 8) | data[9 + i];
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
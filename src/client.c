@@ -25,15 +25,75 @@
 #include <octopipes/cap.h>
 #include <octopipes/pipes.h>
 #include <octopipes/serializer.h>
+#include <octopipes/timer.h>
 
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 #define DEFAULT_TTL 60
 
 //Private properties and functions
+#define OCTOPIPES_REQUEST_TICK 10 //Resolution of request timeouts (ms)
+#define OCTOPIPES_LOOP_POLL_TIME 100 //Receive timeout of the client loop (ms)
+#define OCTOPIPES_ACK_TIMEOUT 1000 //Default retransmission timeout (ms)
+#define OCTOPIPES_ACK_MAX_RETRIES 5 //Retransmissions before the in-flight messages of a stream are dropped
+#define OCTOPIPES_EXECUTOR_QUEUE_SIZE 1024 //Default queue size of executor workers
 //Threads
 void* octopipes_loop(void* args);
+OctopipesError octopipes_loop_join(OctopipesClient* client);
+//Tx
+OctopipesError octopipes_prepare_message(OctopipesClient* client, OctopipesMessage* message, const char* remote, const void* data, const uint64_t data_size, const uint8_t ttl, const OctopipesOptions options);
+OctopipesError octopipes_send_message(OctopipesClient* client, OctopipesMessage* message);
+OctopipesError octopipes_write_frame(OctopipesClient* client, const uint8_t* frame, const size_t frame_size, const size_t frames, const uint8_t ttl);
+OctopipesError octopipes_encode_cached(OctopipesClient* client, const OctopipesMessage* message, uint8_t* frame, size_t* frame_size);
+OctopipesHeaderTemplate* octopipes_header_cache_get();
+void octopipes_header_cache_key_init();
+void octopipes_header_cache_free(void* cache);
+//Requests
+OctopipesError octopipes_request_start(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, OctopipesRequest** request);
+OctopipesRequest* octopipes_request_alloc(OctopipesClient* client);
+void octopipes_request_release(OctopipesClient* client, OctopipesRequest* request);
+OctopipesRequest* octopipes_request_find(OctopipesClient* client, const uint32_t correlation_id);
+void octopipes_handle_reply(OctopipesClient* client, OctopipesMessage* message);
+void octopipes_expire_requests(OctopipesClient* client);
+//Acknowledged streams
+OctopipesError octopipes_send_sequenced(OctopipesClient* client, OctopipesMessage* message);
+OctopipesAckStream* octopipes_ack_stream_get(OctopipesClient* client, const char* remote);
+void octopipes_ack_stream_reset(OctopipesAckStream* stream);
+void octopipes_handle_ack(OctopipesClient* client, const OctopipesMessage* message);
+int octopipes_accept_sequenced(OctopipesClient* client, const OctopipesMessage* message, OctopipesAckPeer** peer);
+void octopipes_ack_delivered(OctopipesClient* client, const OctopipesMessage* message, OctopipesAckPeer* peer);
+void octopipes_flush_acks(OctopipesClient* client);
+void octopipes_retransmit(OctopipesClient* client);
+//Subscription
+OctopipesError octopipes_read_assignment(const int fd, const int timeout, OctopipesMessage** message);
+OctopipesError octopipes_cap_request(OctopipesClient* client, const uint8_t* data, const size_t data_size, const char* reply_pipe, OctopipesMessage** assignment);
+int octopipes_reply_pipe_name(OctopipesClient* client, const char* suffix, char* reply_pipe, const size_t reply_pipe_size);
+OctopipesError octopipes_send_groups_update(OctopipesClient* client, const OctopipesCapMessage message_type, const char** groups, const size_t groups_amount, OctopipesCapError* update_error);
+//Receive
+OctopipesError octopipes_read_stream(OctopipesClient* client, const int timeout);
+int octopipes_accept_message(OctopipesClient* client, OctopipesMessage* message, OctopipesAckPeer** peer);
+int octopipes_is_protocol_message(const OctopipesMessage* message);
+int octopipes_loop_awaited(OctopipesClient* client);
+//Credits
+void octopipes_handle_credits(OctopipesClient* client, const OctopipesMessage* message);
+void octopipes_credits_available(OctopipesClient* client, size_t* messages, size_t* bytes);
+//Executor
+OctopipesError octopipes_executor_start(OctopipesClient* client);
+void octopipes_executor_stop(OctopipesClient* client, const size_t workers_len);
+int octopipes_executor_submit(OctopipesClient* client, OctopipesMessage* message, OctopipesAckPeer* peer);
+void* octopipes_executor_loop(void* args);
+//Encode buffer for frames which can be written atomically (one per thread, so concurrent sends don't need any lock)
+static _Thread_local uint8_t tx_buffer[PIPE_BUF];
+//Header templates of the last remotes the thread sent messages to (one cache per thread, as tx_buffer); freed when the thread exits
+static _Thread_local OctopipesHeaderTemplate* header_cache = NULL;
+static pthread_key_t header_cache_key;
+static pthread_once_t header_cache_once = PTHREAD_ONCE_INIT;
+//Serial of the last client initialized
+static uint64_t client_serial = 0;
 
 /**
  * @brief initializes a OctopipesClient instance, the client mustn't be allocated before call, the client_id and cap_path are copied, so must be freed by the user later
@@ -63,15 +123,68 @@ OctopipesError octopipes_init(OctopipesClient** client, const char* client_id, c
     return OCTOPIPES_ERROR_BAD_ALLOC;
   }
   strcpy((*client)->common_access_pipe, cap_path);
+  if (pthread_rwlock_init(&(*client)->tx_lock, NULL) != 0) {
+    free((*client)->common_access_pipe);
+    free((*client)->client_id);
+    free(*client);
+    return OCTOPIPES_ERROR_THREAD;
+  }
+  (*client)->serial = __atomic_add_fetch(&client_serial, 1, __ATOMIC_RELAXED);
+  //Requests
+  (*client)->requests.requests = NULL;
+  (*client)->requests.requests_len = 0;
+  (*client)->requests.pending = 0;
+  (*client)->requests.free_head = SIZE_MAX;
+  (*client)->requests.generation = 0;
+  if (pthread_mutex_init(&(*client)->requests_lock, NULL) != 0 || octopipes_timer_wheel_init(&(*client)->requests.timeouts, OCTOPIPES_REQUEST_TICK, octopipes_get_time_ms()) != OCTOPIPES_ERROR_SUCCESS) {
+    pthread_rwlock_destroy(&(*client)->tx_lock);
+    free((*client)->common_access_pipe);
+    free((*client)->client_id);
+    free(*client);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  //Acknowledged streams
+  (*client)->acks.window = 0;
+  (*client)->acks.timeout = OCTOPIPES_ACK_TIMEOUT;
+  (*client)->acks.streams = NULL;
+  (*client)->acks.streams_len = 0;
+  (*client)->acks.peers = NULL;
+  (*client)->acks.peers_len = 0;
+  if (pthread_mutex_init(&(*client)->acks_lock, NULL) != 0 || pthread_cond_init(&(*client)->acks.window_available, NULL) != 0 || octopipes_timer_wheel_init(&(*client)->acks.timeouts, OCTOPIPES_REQUEST_TICK, octopipes_get_time_ms()) != OCTOPIPES_ERROR_SUCCESS || pthread_mutex_init(&(*client)->credits_lock, NULL) != 0) {
+    octopipes_timer_wheel_cleanup((*client)->requests.timeouts);
+    pthread_mutex_destroy(&(*client)->requests_lock);
+    pthread_rwlock_destroy(&(*client)->tx_lock);
+    free((*client)->common_access_pipe);
+    free((*client)->client_id);
+    free(*client);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  //Credits are not limited until the server grants them
+  (*client)->credits.messages_limit = 0;
+  (*client)->credits.bytes_limit = 0;
+  (*client)->credits.messages_sent = 0;
+  (*client)->credits.bytes_sent = 0;
+  //Executor is disabled by default
+  (*client)->executor.workers_len = 0;
+  (*client)->executor.queue_size = OCTOPIPES_EXECUTOR_QUEUE_SIZE;
+  (*client)->executor.policy = OCTOPIPES_EXECUTOR_BLOCK;
+  (*client)->executor.workers = NULL;
+  (*client)->executor.parked.message = NULL;
+  (*client)->executor.parked.peer = NULL;
+  (*client)->loop_running = 0;
   (*client)->protocol_version = version;
   (*client)->rx_pipe = NULL;
   (*client)->tx_pipe = NULL;
+  (*client)->rx_fd = -1;
+  (*client)->rx_stream = NULL;
+  (*client)->rx_stream_size = 0;
   (*client)->state = OCTOPIPES_STATE_INIT;
   (*client)->on_received = NULL;
   (*client)->on_sent = NULL;
   (*client)->on_receive_error = NULL;
   (*client)->on_subscribed = NULL;
   (*client)->on_unsubscribed = NULL;
+  (*client)->on_credits = NULL;
   (*client)->user_data = NULL;
   return OCTOPIPES_ERROR_SUCCESS;
 }
@@ -90,14 +203,55 @@ OctopipesError octopipes_cleanup(OctopipesClient* client) {
   if (client->state == OCTOPIPES_STATE_SUBSCRIBED || client->state == OCTOPIPES_STATE_RUNNING) {
     octopipes_unsubscribe(client);
   }
+  //The loop uses the RX pipe and stream, so it must have exited before they're freed (even if unsubscribe failed)
+  client->state = OCTOPIPES_STATE_STOPPED;
+  octopipes_loop_join(client);
   free(client->client_id);
   free(client->common_access_pipe);
   if (client->rx_pipe != NULL) {
     free(client->rx_pipe);
   }
+  if (client->rx_fd != -1) {
+    pipe_close(client->rx_fd);
+  }
+  free(client->rx_stream);
   if (client->tx_pipe != NULL) {
     free(client->tx_pipe);
   }
+  pthread_rwlock_destroy(&client->tx_lock);
+  //Pending requests are dropped
+  for (size_t i = 0; i < client->requests.requests_len; i++) {
+    OctopipesRequest* request = client->requests.requests[i];
+    octopipes_cleanup_message(request->reply);
+    pthread_cond_destroy(&request->replied);
+    free(request);
+  }
+  free(client->requests.requests);
+  octopipes_timer_wheel_cleanup(client->requests.timeouts);
+  pthread_mutex_destroy(&client->requests_lock);
+  //Unacknowledged messages are dropped
+  for (size_t i = 0; i < client->acks.streams_len; i++) {
+    OctopipesAckStream* stream = client->acks.streams[i];
+    for (size_t j = 0; j < stream->inflight_len; j++) {
+      free(stream->inflight[(stream->inflight_head + j) % stream->inflight_size].frame);
+    }
+    free(stream->inflight);
+    free(stream->remote);
+    pthread_mutex_destroy(&stream->send_lock);
+    free(stream);
+  }
+  free(client->acks.streams);
+  for (size_t i = 0; i < client->acks.peers_len; i++) {
+    free(client->acks.peers[i]->origin);
+    free(client->acks.peers[i]->remote);
+    free(client->acks.peers[i]);
+  }
+  free(client->acks.peers);
+  octopipes_timer_wheel_cleanup(client->acks.timeouts);
+  pthread_cond_destroy(&client->acks.window_available);
+  pthread_mutex_destroy(&client->acks_lock);
+  pthread_mutex_destroy(&client->credits_lock);
+  //Its templates cached by the threads are replaced as they're needed, since no other client has the same serial
   free(client);
   return OCTOPIPES_ERROR_SUCCESS;
 }
@@ -138,9 +292,19 @@ OctopipesError octopipes_loop_start(OctopipesClient* client) {
   if (client->state != OCTOPIPES_STATE_SUBSCRIBED) {
     return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
   }
+  //Workers must be ready before the first message is received
+  OctopipesError rc;
+  if ((rc = octopipes_executor_start(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Set state before the thread starts, so requests can be sent right after
+  client->state = OCTOPIPES_STATE_RUNNING;
   if(pthread_create(&client->loop, NULL, octopipes_loop, client) != 0) {
+    client->state = OCTOPIPES_STATE_SUBSCRIBED;
+    octopipes_executor_stop(client, client->executor.workers_len);
     return OCTOPIPES_ERROR_THREAD;
   }
+  client->loop_running = 1;
   return OCTOPIPES_ERROR_SUCCESS;
 }
 
@@ -157,13 +321,13 @@ OctopipesError octopipes_loop_stop(OctopipesClient* client) {
   if (client->state != OCTOPIPES_STATE_UNSUBSCRIBED) {
     return OCTOPIPES_ERROR_NOT_UNSUBSCRIBED;
   }
-  //Join thread
+  //Join thread (unsubscribe may have joined it already)
   client->state = OCTOPIPES_STATE_STOPPED;
-  if (pthread_join(client->loop, NULL) != 0) {
+  OctopipesError rc;
+  if ((rc = octopipes_loop_join(client)) != OCTOPIPES_ERROR_SUCCESS) {
     client->state = OCTOPIPES_STATE_UNSUBSCRIBED; //Set state back to UNSUBSCRIBED
-    return OCTOPIPES_ERROR_THREAD;
   }
-  return OCTOPIPES_ERROR_SUCCESS;
+  return rc;
 }
 
 /**
@@ -176,9 +340,44 @@ OctopipesError octopipes_loop_stop(OctopipesClient* client) {
  */
 
 OctopipesError octopipes_subscribe(OctopipesClient* client, const char** groups, size_t groups_amount, OctopipesCapError* assignment_error) {
+  return octopipes_subscribe_ex(client, groups, groups_amount, OCTOPIPES_SUBSCRIPTION_NONE, assignment_error);
+}
+
+/**
+ * @brief subscribe to Octopipe with flags
+ * @param OctopipesClient*
+ * @param char** groups
+ * @param size_t groups
+ * @param OctopipesSubscriptionFlags flags
+ * @param OctopipesCapError assignment error
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_subscribe_ex(OctopipesClient* client, const char** groups, size_t groups_amount, const OctopipesSubscriptionFlags flags, OctopipesCapError* assignment_error) {
+  return octopipes_subscribe_from(client, groups, groups_amount, flags, 0, assignment_error);
+}
+
+/**
+ * @brief subscribe to Octopipe, replaying the messages the server logged for the groups. With OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET
+ * the replay starts from an offset of the group logs; with OCTOPIPES_SUBSCRIPTION_REPLAY_TIME from the first message logged at or after a time
+ * @param OctopipesClient*
+ * @param char** groups
+ * @param size_t groups
+ * @param OctopipesSubscriptionFlags flags
+ * @param uint64_t from: offset or time (ms since epoch) the replay starts from
+ * @param OctopipesCapError assignment error
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_subscribe_from(OctopipesClient* client, const char** groups, size_t groups_amount, const OctopipesSubscriptionFlags flags, const uint64_t from, OctopipesCapError* assignment_error) {
   if (client == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
+  //The assignment is written to a private reply pipe, so concurrent subscriptions can't steal each other's assignment
+  char reply_pipe[UINT8_MAX + 1];
+  if (!octopipes_reply_pipe_name(client, "sub", reply_pipe, sizeof(reply_pipe))) {
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
   //Prepare packet
   OctopipesMessage* subscribe_message = (OctopipesMessage*) malloc(sizeof(OctopipesMessage));
   if (subscribe_message == NULL) {
@@ -203,8 +402,11 @@ OctopipesError octopipes_subscribe(OctopipesClient* client, const char** groups,
   //Options
   subscribe_message->ttl = DEFAULT_TTL;
   subscribe_message->options = OCTOPIPES_OPTIONS_NONE;
+  subscribe_message->correlation_id = 0;
+  subscribe_message->epoch = 0;
+  subscribe_message->sequence = 0;
   //Data
-  subscribe_message->data = octopipes_cap_prepare_subscription(groups, groups_amount, (size_t*) &subscribe_message->data_size);
+  subscribe_message->data = octopipes_cap_prepare_subscription(groups, groups_amount, reply_pipe, flags, from, (size_t*) &subscribe_message->data_size);
   if (subscribe_message->data == NULL) {
     octopipes_cleanup_message(subscribe_message);
     return OCTOPIPES_ERROR_BAD_ALLOC;
@@ -217,53 +419,51 @@ OctopipesError octopipes_subscribe(OctopipesClient* client, const char** groups,
   if (rc != OCTOPIPES_ERROR_SUCCESS) {
     return rc;
   }
-  //Send packet
-  rc = pipe_send(client->common_access_pipe, out_data, out_data_size, 5000);
+  //Send packet and wait for assignment
+  OctopipesMessage* cap_message = NULL;
+  rc = octopipes_cap_request(client, out_data, out_data_size, reply_pipe, &cap_message);
   free(out_data);
   if (rc != OCTOPIPES_ERROR_SUCCESS) {
     return rc;
   }
-  usleep(100000);
-  //If packet was sent successfully, then wait for assignment
-  uint8_t* in_data;
-  size_t in_data_size;
-  rc = pipe_receive(client->common_access_pipe, &in_data, &in_data_size, 5000);
-  if (rc != OCTOPIPES_ERROR_SUCCESS) {
-    return rc;
-  }
-  OctopipesMessage* cap_message = NULL;
-  rc = octopipes_decode(in_data, in_data_size, &cap_message);
-  if (rc != OCTOPIPES_ERROR_SUCCESS) {
-    free(in_data);
+  //Parse assignment
+  char* tx_pipe = NULL;
+  char* rx_pipe = NULL;
+  rc = octopipes_cap_parse_assign(cap_message->data, cap_message->data_size, assignment_error, &tx_pipe, &rx_pipe);
+  octopipes_cleanup_message(cap_message);
+  //A refused subscription leaves the client as it was
+  if (rc != OCTOPIPES_ERROR_SUCCESS || *assignment_error != OCTOPIPES_CAP_ERROR_SUCCESS) {
     return rc;
   }
-  free(in_data);
-  //Verify remote
-  if (cap_message->remote == NULL) {
-    octopipes_cleanup_message(cap_message);
-    return OCTOPIPES_ERROR_BAD_PACKET;
-  }
-  if (strcmp(cap_message->remote, client->client_id) != 0) {
-    octopipes_cleanup_message(cap_message);
-    return OCTOPIPES_ERROR_BAD_PACKET;
-  }
-  //Verify packet type
-  OctopipesCapMessage message_type = octopipes_cap_get_message(cap_message->data, cap_message->data_size);
-  if (message_type != OCTOPIPES_CAP_ASSIGNMENT) { //Return bad packet, the user must redo the operation
-    octopipes_cleanup_message(cap_message);
-    return OCTOPIPES_ERROR_BAD_PACKET;
-  }
-  //Stop running thread and free previous pipe
+  //Stop running thread before replacing the pipes it reads; it must be started again for the new subscription
   if (client->state == OCTOPIPES_STATE_RUNNING) {
-    octopipes_loop_stop(client);
+    client->state = OCTOPIPES_STATE_STOPPED;
+    octopipes_loop_join(client);
   }
-  if (client->state == OCTOPIPES_STATE_SUBSCRIBED || client->state == OCTOPIPES_STATE_RUNNING) {
-    free(client->tx_pipe);
-    free(client->rx_pipe);
+  if (client->rx_fd != -1) {
+    pipe_close(client->rx_fd);
+    client->rx_fd = -1;
   }
-  //Parse assignment
-  rc = octopipes_cap_parse_assign(cap_message->data, cap_message->data_size, assignment_error, &client->tx_pipe, &client->rx_pipe);
+  free(client->rx_stream);
+  client->rx_stream = NULL;
+  client->rx_stream_size = 0;
+  //Senders may be using the TX pipe
+  pthread_rwlock_wrlock(&client->tx_lock);
+  free(client->tx_pipe);
+  client->tx_pipe = tx_pipe;
+  pthread_rwlock_unlock(&client->tx_lock);
+  free(client->rx_pipe);
+  client->rx_pipe = rx_pipe;
+  //RX pipe is kept open, so no message is lost between reads
+  rc = pipe_open(client->rx_pipe, &client->rx_fd);
   if (rc == OCTOPIPES_ERROR_SUCCESS) {
+    //The server counts credits from the subscription
+    pthread_mutex_lock(&client->credits_lock);
+    client->credits.messages_limit = 0;
+    client->credits.bytes_limit = 0;
+    client->credits.messages_sent = 0;
+    client->credits.bytes_sent = 0;
+    pthread_mutex_unlock(&client->credits_lock);
     //Enter subscribed state
     client->state = OCTOPIPES_STATE_SUBSCRIBED;
     //Call on unsubscribed callback
@@ -271,8 +471,6 @@ OctopipesError octopipes_subscribe(OctopipesClient* client, const char** groups,
       client->on_subscribed(client);
     }
   }
-  //Free input data, and return rc
-  octopipes_cleanup_message(cap_message);
   return rc;
 }
 
@@ -318,6 +516,9 @@ OctopipesError octopipes_unsubscribe(OctopipesClient* client) {
   //Options
   subscribe_message->ttl = DEFAULT_TTL;
   subscribe_message->options = OCTOPIPES_OPTIONS_NONE;
+  subscribe_message->correlation_id = 0;
+  subscribe_message->epoch = 0;
+  subscribe_message->sequence = 0;
   //Data
   subscribe_message->data = octopipes_cap_prepare_unsubscription((size_t*) &subscribe_message->data_size);
   if (subscribe_message->data == NULL) {
@@ -338,19 +539,45 @@ OctopipesError octopipes_unsubscribe(OctopipesClient* client) {
   if (rc != OCTOPIPES_ERROR_SUCCESS) {
     return rc;
   }
-  //Stop loop
-  octopipes_loop_stop(client);
+  //Set state to unsubscribed, so the loop exits
+  client->state = OCTOPIPES_STATE_UNSUBSCRIBED;
+  //Wait for the loop, unless it's the loop which is unsubscribing; executor workers are stopped by octopipes_loop_stop
+  if (client->loop_running && !pthread_equal(client->loop, pthread_self()) && pthread_join(client->loop, NULL) == 0) {
+    client->loop_running = 0;
+  }
   //Call on unsubscribed callback
   if (client->on_unsubscribed != NULL) {
     client->on_unsubscribed(client);
   }
-  //Set state to unsubscribed
-  if (rc == OCTOPIPES_ERROR_SUCCESS) {
-    client->state = OCTOPIPES_STATE_UNSUBSCRIBED;
-  }
   return rc;
 }
 
+/**
+ * @brief subscribe to more groups, without subscribing again
+ * @param OctopipesClient* client
+ * @param char** groups
+ * @param size_t groups amount
+ * @param OctopipesCapError* update error
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_add_groups(OctopipesClient* client, const char** groups, const size_t groups_amount, OctopipesCapError* update_error) {
+  return octopipes_send_groups_update(client, OCTOPIPES_CAP_ADD_GROUPS, groups, groups_amount, update_error);
+}
+
+/**
+ * @brief unsubscribe from some groups, keeping the subscription to the others
+ * @param OctopipesClient* client
+ * @param char** groups
+ * @param size_t groups amount
+ * @param OctopipesCapError* update error
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_remove_groups(OctopipesClient* client, const char** groups, const size_t groups_amount, OctopipesCapError* update_error) {
+  return octopipes_send_groups_update(client, OCTOPIPES_CAP_REMOVE_GROUPS, groups, groups_amount, update_error);
+}
+
 /**
  * @brief send a packet to remote
  * @param OctopipesClient* client
@@ -383,144 +610,630 @@ OctopipesError octopipes_send_ex(OctopipesClient* client, const char* remote, co
   if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
     return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
   }
-  //Prepare packet
-  OctopipesMessage* message = (OctopipesMessage*) malloc(sizeof(OctopipesMessage));
-  if (message == NULL) {
-    return OCTOPIPES_ERROR_BAD_ALLOC;
+  OctopipesMessage message;
+  OctopipesError rc;
+  if ((rc = octopipes_prepare_message(client, &message, remote, data, data_size, ttl, options)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
   }
-  message->origin = NULL;
-  message->remote = NULL;
-  message->data = NULL;
-  //Fill message structure
-  message->version = client->protocol_version;
-  message->origin_size = client->client_id_size;
-  message->origin = (char*) malloc(sizeof(char) * (message->origin_size + 1));
-  if (message->origin == NULL) {
-    octopipes_cleanup_message(message);
-    return OCTOPIPES_ERROR_BAD_ALLOC;
+  //Messages which require an ACK are pipelined if the ACK window is enabled
+  if ((options & OCTOPIPES_OPTIONS_REQUIRE_ACK) != 0) {
+    return octopipes_send_sequenced(client, &message);
   }
-  memcpy(message->origin, client->client_id, message->origin_size);
-  message->origin[message->origin_size] = 0x00;
-  message->remote_size = strlen(remote);
-  message->remote = (char*) malloc(sizeof(char) * (message->remote_size + 1));
-  if (message->remote == NULL) {
-    octopipes_cleanup_message(message);
-    return OCTOPIPES_ERROR_BAD_ALLOC;
+  return octopipes_send_message(client, &message);
+}
+
+/**
+ * @brief reserve a frame to send to remote; the payload must be written by the caller into the returned payload pointer, then the frame is sent with octopipes_send_commit
+ * @param OctopipesClient* client
+ * @param char* remote node
+ * @param uint64_t data size
+ * @param OctopipesSendHandle** handle
+ * @param void** payload
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_send_reserve(OctopipesClient* client, const char* remote, const uint64_t data_size, OctopipesSendHandle** handle, void** payload) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  memcpy(message->remote, remote, message->remote_size);
-  message->origin[message->remote_size] = 0x00;
-  message->options = options;
-  message->ttl = ttl;
-  message->data_size = data_size;
-  message->data = (uint8_t*) malloc(sizeof(uint8_t) * message->data_size);
-  if (message->data == NULL) {
-    octopipes_cleanup_message(message);
+  //Check if state is running or subscribed
+  if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  const size_t remote_size = remote != NULL ? strlen(remote) : 0;
+  if (remote_size == 0 || remote_size > 255) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //Lay out the header; TTL, options and checksum are written at commit
+  OctopipesMessage message;
+  message.version = client->protocol_version;
+  message.origin_size = client->client_id_size;
+  message.origin = client->client_id;
+  message.remote_size = remote_size;
+  message.remote = (char*) remote;
+  message.ttl = 0;
+  message.data_size = data_size;
+  message.options = OCTOPIPES_OPTIONS_NONE;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = NULL;
+  const size_t frame_size = octopipes_get_encoded_size(&message);
+  if (data_size > OCTOPIPES_MAX_FRAME_SIZE || frame_size > OCTOPIPES_MAX_FRAME_SIZE) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //Handle, remote and frame share the same allocation
+  OctopipesSendHandle* ptr = (OctopipesSendHandle*) malloc(sizeof(OctopipesSendHandle) + remote_size + 1 + frame_size);
+  if (ptr == NULL) {
     return OCTOPIPES_ERROR_BAD_ALLOC;
   }
-  memcpy(message->data, (uint8_t*) data, message->data_size);
-  //Encode message
-  size_t out_data_size;
-  uint8_t* out_data;
-  OctopipesError rc = octopipes_encode(message, &out_data, &out_data_size);
-  if (rc != OCTOPIPES_ERROR_SUCCESS) {
-    octopipes_cleanup_message(message);
+  ptr->remote = (char*) (ptr + 1);
+  memcpy(ptr->remote, remote, remote_size + 1);
+  ptr->frame = (uint8_t*) ptr->remote + remote_size + 1;
+  ptr->frame_size = frame_size;
+  OctopipesError rc;
+  if ((rc = octopipes_encode_header(&message, ptr->frame, frame_size, &ptr->header_size)) != OCTOPIPES_ERROR_SUCCESS) {
+    free(ptr);
     return rc;
   }
-  //Write to FIFO
-  rc = pipe_send(client->tx_pipe, out_data, out_data_size, ttl * 1000);
+  ptr->frame[frame_size - 1] = OCTOPIPES_ETX;
+  *handle = ptr;
+  *payload = ptr->frame + ptr->header_size;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief send a frame reserved with octopipes_send_reserve; the handle is freed, even if the frame couldn't be sent
+ * @param OctopipesClient* client
+ * @param OctopipesSendHandle* handle
+ * @param uint8_t ttl
+ * @param OctopipesOptions options
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_send_commit(OctopipesClient* client, OctopipesSendHandle* handle, const uint8_t ttl, const OctopipesOptions options) {
+  if (client == NULL || handle == NULL) {
+    octopipes_send_discard(handle);
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    octopipes_send_discard(handle);
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  //Frame has been laid out without fields
+  if (octopipes_get_fields_size(options) > 0) {
+    octopipes_send_discard(handle);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //Fill TTL, options and checksum, which are just before STX
+  const size_t checksum_ptr = handle->header_size - 2;
+  handle->frame[checksum_ptr - 10] = ttl;
+  handle->frame[checksum_ptr - 1] = options;
+  handle->frame[checksum_ptr] = 0;
+  if ((options & OCTOPIPES_OPTIONS_IGNORE_CHECKSUM) == 0) {
+    handle->frame[checksum_ptr] = calculate_frame_checksum(handle->frame, handle->frame_size, checksum_ptr);
+  }
+  OctopipesError rc = octopipes_write_frame(client, handle->frame, handle->frame_size, 1, ttl);
   //Call on sent callback if necessary
   if (rc == OCTOPIPES_ERROR_SUCCESS && client->on_sent != NULL) {
-    client->on_sent(client, message);
+    OctopipesMessage message;
+    message.version = client->protocol_version;
+    message.origin_size = client->client_id_size;
+    message.origin = client->client_id;
+    message.remote_size = strlen(handle->remote);
+    message.remote = handle->remote;
+    message.ttl = ttl;
+    message.data_size = handle->frame_size - handle->header_size - 1;
+    message.options = options;
+    message.checksum = handle->frame[checksum_ptr];
+    message.correlation_id = 0;
+    message.epoch = 0;
+    message.sequence = 0;
+    message.data = handle->frame + handle->header_size;
+    client->on_sent(client, &message);
   }
-  //Call on sent
-  octopipes_cleanup_message(message);
-  free(out_data);
+  octopipes_send_discard(handle);
   return rc;
 }
 
 /**
- * @brief set the function to call when a message is received by the octopipes client
- * @param OctopipesClient*
- * @param function
+ * @brief free a frame reserved with octopipes_send_reserve without sending it
+ * @param OctopipesSendHandle* handle
  * @return OctopipesError
  */
 
-OctopipesError octopipes_set_received_cb(OctopipesClient* client, void (*on_received)(const OctopipesClient* client, const OctopipesMessage*)) {
+OctopipesError octopipes_send_discard(OctopipesSendHandle* handle) {
+  free(handle);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief send many packets at once; frames are encoded back to back into one buffer which is written with a single write
+ * @param OctopipesClient* client
+ * @param OctopipesBatchEntry* entries
+ * @param size_t entries amount
+ * @param OctopipesError* results; result for each entry (can be NULL)
+ * @return OctopipesError (first error occurred)
+ */
+
+OctopipesError octopipes_send_batch(OctopipesClient* client, const OctopipesBatchEntry* entries, const size_t entries_len, OctopipesError* results) {
   if (client == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  client->on_received = on_received;
-  return OCTOPIPES_ERROR_SUCCESS; 
+  //Check if state is running or subscribed
+  if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  if (entries_len == 0) {
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  //Messages only point to entries data, so nothing has to be copied before encoding
+  OctopipesMessage* messages = (OctopipesMessage*) malloc(sizeof(OctopipesMessage) * entries_len);
+  OctopipesError* rcs = (OctopipesError*) malloc(sizeof(OctopipesError) * entries_len);
+  if (messages == NULL || rcs == NULL) {
+    free(messages);
+    free(rcs);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  size_t out_data_size = 0;
+  uint8_t ttl = 0;
+  for (size_t i = 0; i < entries_len; i++) {
+    const OctopipesBatchEntry* entry = &entries[i];
+    OctopipesMessage* message = &messages[i];
+    const size_t remote_size = entry->remote != NULL ? strlen(entry->remote) : 0;
+    if (remote_size == 0 || remote_size > 255 || (entry->data == NULL && entry->data_size > 0) || entry->data_size > OCTOPIPES_MAX_FRAME_SIZE) {
+      rcs[i] = OCTOPIPES_ERROR_BAD_PACKET;
+      continue;
+    }
+    message->version = client->protocol_version;
+    message->origin_size = client->client_id_size;
+    message->origin = client->client_id;
+    message->remote_size = remote_size;
+    message->remote = (char*) entry->remote;
+    message->ttl = entry->ttl;
+    message->data_size = entry->data_size;
+    message->options = entry->options;
+    message->correlation_id = 0;
+    message->epoch = 0;
+    message->sequence = 0;
+    message->data = (uint8_t*) entry->data;
+    rcs[i] = OCTOPIPES_ERROR_SUCCESS;
+    out_data_size += octopipes_get_encoded_size(message);
+    //Wait as much as the entry with the highest TTL
+    if (entry->ttl > ttl) {
+      ttl = entry->ttl;
+    }
+  }
+  //Encode all the frames into the same buffer
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  uint8_t* out_data = NULL;
+  size_t out_data_ptr = 0;
+  size_t frames = 0;
+  if (out_data_size > 0) {
+    out_data = (out_data_size <= PIPE_BUF) ? tx_buffer : (uint8_t*) malloc(sizeof(uint8_t) * out_data_size);
+    if (out_data == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+  }
+  for (size_t i = 0; i < entries_len && out_data != NULL; i++) {
+    if (rcs[i] != OCTOPIPES_ERROR_SUCCESS) {
+      continue;
+    }
+    size_t frame_size;
+    rcs[i] = octopipes_encode_to(&messages[i], out_data + out_data_ptr, out_data_size - out_data_ptr, &frame_size);
+    if (rcs[i] == OCTOPIPES_ERROR_SUCCESS) {
+      out_data_ptr += frame_size;
+      frames++;
+    }
+  }
+  //Write all frames at once
+  if (out_data_ptr > 0) {
+    rc = octopipes_write_frame(client, out_data, out_data_ptr, frames, ttl);
+  }
+  if (out_data != tx_buffer) {
+    free(out_data);
+  }
+  //Report results
+  for (size_t i = 0; i < entries_len; i++) {
+    if (rcs[i] == OCTOPIPES_ERROR_SUCCESS) {
+      rcs[i] = rc;
+      //Call on sent callback if necessary
+      if (rc == OCTOPIPES_ERROR_SUCCESS && client->on_sent != NULL) {
+        client->on_sent(client, &messages[i]);
+      }
+    }
+    if (results != NULL) {
+      results[i] = rcs[i];
+    }
+  }
+  //Return first error
+  rc = OCTOPIPES_ERROR_SUCCESS;
+  for (size_t i = 0; i < entries_len && rc == OCTOPIPES_ERROR_SUCCESS; i++) {
+    rc = rcs[i];
+  }
+  free(messages);
+  free(rcs);
+  return rc;
 }
 
 /**
- * @brief set the function to call when a message is successfully sent to the octopipes client
- * @param OctopipesClient*
- * @param function
+ * @brief send a request to remote and wait for its reply; the client loop must be running.
+ * @param OctopipesClient* client
+ * @param char* remote node
+ * @param void* data
+ * @param uint64_t data size
+ * @param unsigned int timeout in milliseconds
+ * @param OctopipesMessage** reply (must be freed with octopipes_cleanup_message)
  * @return OctopipesError
  */
 
-OctopipesError octopipes_set_sent_cb(OctopipesClient* client, void (*on_sent)(const OctopipesClient* client, const OctopipesMessage*)) {
+OctopipesError octopipes_request(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, OctopipesMessage** reply) {
   if (client == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  client->on_sent = on_sent;
-  return OCTOPIPES_ERROR_SUCCESS; 
+  *reply = NULL;
+  OctopipesRequest* request;
+  OctopipesError rc;
+  if ((rc = octopipes_request_start(client, remote, data, data_size, timeout, &request)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Wait for reply
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_nsec += (timeout % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&client->requests_lock);
+  int ret = 0;
+  while (!request->done && ret != ETIMEDOUT) {
+    ret = pthread_cond_timedwait(&request->replied, &client->requests_lock, &deadline);
+  }
+  if (request->done) {
+    *reply = request->reply;
+    request->reply = NULL;
+    rc = OCTOPIPES_ERROR_SUCCESS;
+  } else {
+    rc = OCTOPIPES_ERROR_REQUEST_TIMEOUT;
+  }
+  octopipes_request_release(client, request);
+  pthread_mutex_unlock(&client->requests_lock);
+  return rc;
 }
 
 /**
- * @brief set the function to call when an error is returned during the receive of a message
- * @param OctopipesClient*
- * @param function
+ * @brief send a request to remote; on_reply is called by the client loop when the reply is received or when the request times out (with a NULL reply)
+ * @param OctopipesClient* client
+ * @param char* remote node
+ * @param void* data
+ * @param uint64_t data size
+ * @param unsigned int timeout in milliseconds
+ * @param function on_reply
+ * @param void* user data passed to on_reply
  * @return OctopipesError
  */
 
-OctopipesError octopipes_set_receive_error_cb(OctopipesClient* client, void (*on_receive_error)(const OctopipesClient* client, const OctopipesError)) {
-  if (client == NULL) {
+OctopipesError octopipes_request_async(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, void (*on_reply)(const OctopipesClient* client, const OctopipesMessage* reply, const OctopipesError error, void* user_data), void* user_data) {
+  if (on_reply == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  client->on_receive_error = on_receive_error;
-  return OCTOPIPES_ERROR_SUCCESS; 
+  OctopipesRequest* request;
+  OctopipesError rc;
+  if ((rc = octopipes_request_start(client, remote, data, data_size, timeout, &request)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Hand the request over to the client loop
+  pthread_mutex_lock(&client->requests_lock);
+  request->on_reply = on_reply;
+  request->user_data = user_data;
+  if (request->done) {
+    //Reply arrived before the callback was set
+    OctopipesMessage* reply = request->reply;
+    request->reply = NULL;
+    octopipes_request_release(client, request);
+    pthread_mutex_unlock(&client->requests_lock);
+    on_reply(client, reply, OCTOPIPES_ERROR_SUCCESS, user_data);
+    octopipes_cleanup_message(reply);
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  octopipes_timer_add(client->requests.timeouts, &request->timer, octopipes_get_time_ms() + timeout);
+  pthread_mutex_unlock(&client->requests_lock);
+  return OCTOPIPES_ERROR_SUCCESS;
 }
 
 /**
- * @brief set the function to call when the client subscribe to the server
- * @param OctopipesClient*
- * @param function
+ * @brief reply to a request received by the client
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* request
+ * @param void* data
+ * @param uint64_t data size
  * @return OctopipesError
  */
 
-OctopipesError octopipes_set_subscribed_cb(OctopipesClient* client, void (*on_subscribed)(const OctopipesClient* client)) {
-  if (client == NULL) {
+OctopipesError octopipes_reply(OctopipesClient* client, const OctopipesMessage* request, const void* data, const uint64_t data_size) {
+  if (client == NULL || request == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  client->on_subscribed = on_subscribed;
-  return OCTOPIPES_ERROR_SUCCESS;
+  if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  if ((request->options & OCTOPIPES_OPTIONS_REQUEST) == 0) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  OctopipesMessage message;
+  OctopipesError rc;
+  if ((rc = octopipes_prepare_message(client, &message, request->origin, data, data_size, request->ttl, OCTOPIPES_OPTIONS_REPLY)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  message.correlation_id = request->correlation_id;
+  return octopipes_send_message(client, &message);
 }
 
 /**
- * @brief set the function to call when the client unsubscribe from the server
- * @param OctopipesClient*
- * @param function
+ * @brief set the in-flight window of messages which require an ACK; up to window messages per remote are sent without waiting for their ACK.
+ * Unacknowledged messages are sent again after timeout milliseconds. A window of 0 disables the window, so every message is acknowledged on its own
+ * @param OctopipesClient* client
+ * @param size_t window
+ * @param unsigned int retransmission timeout in milliseconds (0 keeps the current one)
  * @return OctopipesError
  */
 
-OctopipesError octopipes_set_unsubscribed_cb(OctopipesClient* client, void (*on_unsubscribed)(const OctopipesClient* client)) {
+OctopipesError octopipes_set_ack_window(OctopipesClient* client, const size_t window, const unsigned int timeout) {
   if (client == NULL) {
     return OCTOPIPES_ERROR_UNINITIALIZED;
   }
-  client->on_unsubscribed = on_unsubscribed;
+  pthread_mutex_lock(&client->acks_lock);
+  client->acks.window = window;
+  if (timeout > 0) {
+    client->acks.timeout = timeout;
+  }
+  //Window may have grown
+  pthread_cond_broadcast(&client->acks.window_available);
+  pthread_mutex_unlock(&client->acks_lock);
   return OCTOPIPES_ERROR_SUCCESS;
 }
 
 /**
- * @brief get error description from the provided error code
- * @param OctopipesError
- * @return const char*
+ * @brief receive up to max messages without the client loop, waiting up to timeout milliseconds for the first ones.
+ * Received messages must be freed by the caller with octopipes_cleanup_message
+ * @param OctopipesClient* client
+ * @param OctopipesMessage** messages array of at least max messages
+ * @param size_t max
+ * @param int timeout in milliseconds
+ * @param size_t* received amount of messages stored into messages
+ * @return OctopipesError
  */
 
-const char* octopipes_get_error_desc(const OctopipesError error) {
+OctopipesError octopipes_receive(OctopipesClient* client, OctopipesMessage** messages, const size_t max, const int timeout, size_t* received) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  *received = 0;
+  if (client->state == OCTOPIPES_STATE_RUNNING) {
+    return OCTOPIPES_ERROR_THREAD;
+  } else if (client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  const unsigned long deadline = octopipes_get_time_ms() + (timeout > 0 ? timeout : 0);
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  while (*received < max) {
+    //Decode the frames left by the previous read first
+    size_t offset = 0;
+    OctopipesMessage* message;
+    OctopipesAckPeer* peer;
+    OctopipesError decode_rc;
+    while (*received < max && (decode_rc = octopipes_decode_next(client->rx_stream, client->rx_stream_size, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      if (decode_rc != OCTOPIPES_ERROR_SUCCESS) {
+        //@! Report error
+        if (client->on_receive_error != NULL) {
+          client->on_receive_error(client, decode_rc);
+        }
+      } else if (octopipes_accept_message(client, message, &peer)) {
+        //Messages are delivered as they are returned to the caller
+        octopipes_ack_delivered(client, message, peer);
+        messages[(*received)++] = message;
+      }
+    }
+    octopipes_stream_consume(&client->rx_stream, &client->rx_stream_size, offset);
+    //Acknowledge the sequenced messages received
+    octopipes_flush_acks(client);
+    if (*received > 0) {
+      break;
+    }
+    //Wait for more data
+    const unsigned long now = octopipes_get_time_ms();
+    const int remaining = now < deadline ? (int) (deadline - now) : 0;
+    rc = octopipes_read_stream(client, remaining);
+    if (rc == OCTOPIPES_ERROR_NO_DATA_AVAILABLE && remaining > 0) {
+      continue;
+    } else if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+  }
+  if (*received > 0) {
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  return rc;
+}
+
+/**
+ * @brief deliver received messages through a pool of worker threads instead of the loop thread. Messages are assigned to workers by origin, so the messages of an origin are delivered in order.
+ * When the queue of a worker is full, the loop waits (OCTOPIPES_EXECUTOR_BLOCK) or the message is dropped (OCTOPIPES_EXECUTOR_DROP). Can't be changed while the loop is running
+ * @param OctopipesClient* client
+ * @param size_t workers (0 delivers messages from the loop thread)
+ * @param size_t queue size of each worker (0 keeps the current one)
+ * @param OctopipesExecutorPolicy policy
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_executor(OctopipesClient* client, const size_t workers, const size_t queue_size, const OctopipesExecutorPolicy policy) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  if (client->state == OCTOPIPES_STATE_RUNNING) {
+    return OCTOPIPES_ERROR_THREAD;
+  }
+  client->executor.workers_len = workers;
+  if (queue_size > 0) {
+    client->executor.queue_size = queue_size;
+  }
+  client->executor.policy = policy;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the credits the client can still use: the messages and the frame bytes it can send before the server has dispatched
+ * the ones already sent. Credits are granted by the server (see octopipes_server_set_credits) and are advisory: sending over them doesn't fail,
+ * but the messages will wait in the pipe. SIZE_MAX is returned for what is not limited, as everything is until the server grants credits
+ * @param OctopipesClient* client
+ * @param size_t* messages
+ * @param size_t* bytes
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_get_send_credits(OctopipesClient* client, size_t* messages, size_t* bytes) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  pthread_mutex_lock(&client->credits_lock);
+  octopipes_credits_available(client, messages, bytes);
+  pthread_mutex_unlock(&client->credits_lock);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the amount of messages waiting in the executor queues and the amount of messages dropped because queues were full
+ * @param OctopipesClient* client
+ * @param size_t* depth
+ * @param size_t* dropped
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_get_executor_stats(const OctopipesClient* client, size_t* depth, size_t* dropped) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  *depth = 0;
+  *dropped = 0;
+  if (client->executor.workers == NULL) {
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  for (size_t i = 0; i < client->executor.workers_len; i++) {
+    OctopipesExecutorWorker* worker = &client->executor.workers[i];
+    pthread_mutex_lock(&worker->lock);
+    *depth += worker->queue_len;
+    *dropped += worker->dropped;
+    pthread_mutex_unlock(&worker->lock);
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief set the function to call when a message is received by the octopipes client
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_received_cb(OctopipesClient* client, void (*on_received)(const OctopipesClient* client, const OctopipesMessage*)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_received = on_received;
+  return OCTOPIPES_ERROR_SUCCESS; 
+}
+
+/**
+ * @brief set the function to call when a message is successfully sent to the octopipes client
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_sent_cb(OctopipesClient* client, void (*on_sent)(const OctopipesClient* client, const OctopipesMessage*)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_sent = on_sent;
+  return OCTOPIPES_ERROR_SUCCESS; 
+}
+
+/**
+ * @brief set the function to call when an error is returned during the receive of a message
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_receive_error_cb(OctopipesClient* client, void (*on_receive_error)(const OctopipesClient* client, const OctopipesError)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_receive_error = on_receive_error;
+  return OCTOPIPES_ERROR_SUCCESS; 
+}
+
+/**
+ * @brief set the function to call when the client subscribe to the server
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_subscribed_cb(OctopipesClient* client, void (*on_subscribed)(const OctopipesClient* client)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_subscribed = on_subscribed;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief set the function to call when the client unsubscribe from the server
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_unsubscribed_cb(OctopipesClient* client, void (*on_unsubscribed)(const OctopipesClient* client)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_unsubscribed = on_unsubscribed;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief set the function to call when the server grants credits to the client; it's called with the credits available after the grant
+ * @param OctopipesClient*
+ * @param function
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_set_credits_cb(OctopipesClient* client, void (*on_credits)(const OctopipesClient* client, const size_t messages, const size_t bytes)) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  client->on_credits = on_credits;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get error description from the provided error code
+ * @param OctopipesError
+ * @return const char*
+ */
+
+const char* octopipes_get_error_desc(const OctopipesError error) {
   switch (error) {
+    case OCTOPIPES_ERROR_ACK_TIMEOUT:
+      return "The remote hasn't acknowledged the messages in time";
+    case OCTOPIPES_ERROR_WINDOW_FULL:
+      return "The ACK window is full and the loop thread can't wait for ACKs";
+    case OCTOPIPES_ERROR_LOG_FULL:
+      return "The log can't load more groups";
     case OCTOPIPES_ERROR_BAD_ALLOC:
       return "Could not allocate more memory in the heap";
     case OCTOPIPES_ERROR_BAD_CHECKSUM:
@@ -539,6 +1252,8 @@ const char* octopipes_get_error_desc(const OctopipesError error) {
       return "Could not open the FIFO";
     case OCTOPIPES_ERROR_READ_FAILED:
       return "An error occurred while trying to read from FIFO";
+    case OCTOPIPES_ERROR_REQUEST_TIMEOUT:
+      return "The request hasn't been replied in time";
     case OCTOPIPES_ERROR_SUCCESS:
       return "Not an error";
     case OCTOPIPES_ERROR_THREAD:
@@ -558,49 +1273,1381 @@ const char* octopipes_get_error_desc(const OctopipesError error) {
 //Internal functions
 
 /**
- * @brief thread loop functions for octopipes client daemon thread
- * @param OctopipesClient*
+ * @brief fill a message to send to remote; fields which follow STX are set to 0
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @param char* remote node
+ * @param void* data
+ * @param uint64_t data size
+ * @param uint8_t ttl
+ * @param OctopipesOptions options
+ * @return OctopipesError
  */
 
-void* octopipes_loop(void* args) {
-  OctopipesClient* client = (OctopipesClient*) args;
-  client->state = OCTOPIPES_STATE_RUNNING;
-  while (client->state == OCTOPIPES_STATE_RUNNING) {
-    //Check if there are available messages to be read
-    uint8_t* data_in;
-    size_t data_in_size;
-    OctopipesError rc = pipe_receive(client->rx_pipe, &data_in, &data_in_size, 500); //500 ms
-    if (rc == OCTOPIPES_ERROR_SUCCESS) {
-      //Parse data
-      OctopipesMessage* message;
-      if ((rc = octopipes_decode(data_in, data_in_size, &message)) == OCTOPIPES_ERROR_SUCCESS) {
-        //Decoding was successful, report received message
-        if (client->on_received != NULL) {
-          client->on_received(client, message); //@! Success
-        }
-        //If RCK, send ACK
-        if ((message->options & OCTOPIPES_OPTIONS_REQUIRE_ACK) != 0) {
-          //Prepare and send ACK message
-          octopipes_send_ex(client, message->origin, NULL, 0, 255, OCTOPIPES_OPTIONS_ACK);
-        }
-        octopipes_cleanup_message(message);
-      } else {
-        //@! Report error
-        if (client->on_receive_error != NULL) {
-          client->on_receive_error(client, rc);
-        }
-      }
-      //Free data
-      free(data_in);
-    } else if (rc == OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
-      //It's ok, just keep waiting
-    } else {
-      //@! Report error
-      if (client->on_receive_error != NULL) {
-        client->on_receive_error(client, rc);
-      }
+OctopipesError octopipes_prepare_message(OctopipesClient* client, OctopipesMessage* message, const char* remote, const void* data, const uint64_t data_size, const uint8_t ttl, const OctopipesOptions options) {
+  const size_t remote_size = remote != NULL ? strlen(remote) : 0;
+  if (remote_size == 0 || remote_size > 255 || (data == NULL && data_size > 0) || data_size > OCTOPIPES_MAX_FRAME_SIZE) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  message->version = client->protocol_version;
+  message->origin_size = client->client_id_size;
+  message->origin = client->client_id;
+  message->remote_size = remote_size;
+  message->remote = (char*) remote;
+  message->ttl = ttl;
+  message->data_size = data_size;
+  message->options = options;
+  message->checksum = 0;
+  message->correlation_id = 0;
+  message->epoch = 0;
+  message->sequence = 0;
+  message->data = (uint8_t*) data;
+  //The receivers refuse the frames over the maximum frame size
+  if (octopipes_get_encoded_size(message) > OCTOPIPES_MAX_FRAME_SIZE) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief send a message prepared with octopipes_prepare_message
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_send_message(OctopipesClient* client, OctopipesMessage* message) {
+  //Encode message; frames which can be written atomically are encoded into the thread local buffer
+  size_t out_data_size = octopipes_get_encoded_size(message);
+  uint8_t* out_data = (out_data_size <= PIPE_BUF) ? tx_buffer : (uint8_t*) malloc(sizeof(uint8_t) * out_data_size);
+  if (out_data == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  OctopipesError rc;
+  if ((rc = octopipes_encode_cached(client, message, out_data, &out_data_size)) == OCTOPIPES_ERROR_SUCCESS) {
+    rc = octopipes_write_frame(client, out_data, out_data_size, 1, message->ttl);
+  }
+  //Call on sent callback if necessary
+  if (rc == OCTOPIPES_ERROR_SUCCESS && client->on_sent != NULL) {
+    message->checksum = out_data[octopipes_get_checksum_offset(message)];
+    client->on_sent(client, message);
+  }
+  if (out_data != tx_buffer) {
+    free(out_data);
+  }
+  return rc;
+}
+
+/**
+ * @brief register a new pending request and send it
+ * @param OctopipesClient* client
+ * @param char* remote node
+ * @param void* data
+ * @param uint64_t data size
+ * @param unsigned int timeout in milliseconds
+ * @param OctopipesRequest** request
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_request_start(OctopipesClient* client, const char* remote, const void* data, const uint64_t data_size, const unsigned int timeout, OctopipesRequest** request) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  if (client->state != OCTOPIPES_STATE_RUNNING && client->state != OCTOPIPES_STATE_SUBSCRIBED) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  //Replies are read by the client loop
+  if (client->state != OCTOPIPES_STATE_RUNNING) {
+    return OCTOPIPES_ERROR_THREAD;
+  }
+  //TTL is the timeout in seconds, rounded up
+  const unsigned int ttl = (timeout + 999) / 1000;
+  OctopipesMessage message;
+  OctopipesError rc;
+  if ((rc = octopipes_prepare_message(client, &message, remote, data, data_size, ttl > 255 ? 255 : ttl, OCTOPIPES_OPTIONS_REQUEST)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Register request before sending it, so the reply can't be missed
+  pthread_mutex_lock(&client->requests_lock);
+  *request = octopipes_request_alloc(client);
+  pthread_mutex_unlock(&client->requests_lock);
+  if (*request == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  message.correlation_id = (*request)->correlation_id;
+  if ((rc = octopipes_send_message(client, &message)) != OCTOPIPES_ERROR_SUCCESS) {
+    pthread_mutex_lock(&client->requests_lock);
+    octopipes_request_release(client, *request);
+    pthread_mutex_unlock(&client->requests_lock);
+  }
+  return rc;
+}
+
+/**
+ * @brief get a free slot in the requests table; requests lock must be held
+ * @param OctopipesClient* client
+ * @return OctopipesRequest* (NULL if table is full)
+ */
+
+OctopipesRequest* octopipes_request_alloc(OctopipesClient* client) {
+  OctopipesRequestTable* table = &client->requests;
+  OctopipesRequest* request;
+  if (table->free_head != SIZE_MAX) {
+    //Reuse a free slot
+    request = table->requests[table->free_head];
+    table->free_head = request->next_free;
+  } else {
+    //Slot index is stored in the lower 16 bits of the correlation id
+    if (table->requests_len > UINT16_MAX) {
+      return NULL;
     }
-    //Nothing else to do
+    OctopipesRequest** requests = (OctopipesRequest**) realloc(table->requests, sizeof(OctopipesRequest*) * (table->requests_len + 1));
+    if (requests == NULL) {
+      return NULL;
+    }
+    table->requests = requests;
+    request = (OctopipesRequest*) malloc(sizeof(OctopipesRequest));
+    if (request == NULL) {
+      return NULL;
+    }
+    if (pthread_cond_init(&request->replied, NULL) != 0) {
+      free(request);
+      return NULL;
+    }
+    request->correlation_id = (uint32_t) table->requests_len;
+    request->timer.slot = NULL;
+    request->reply = NULL;
+    table->requests[table->requests_len++] = request;
   }
-  return NULL;
+  //Upper 16 bits change each time the slot is used (0 is never used, so a valid id is never 0)
+  if (++table->generation == 0) {
+    table->generation = 1;
+  }
+  request->correlation_id = ((uint32_t) table->generation << 16) | (request->correlation_id & 0xFFFF);
+  request->done = 0;
+  request->reply = NULL;
+  request->on_reply = NULL;
+  request->user_data = NULL;
+  request->next_free = SIZE_MAX;
+  table->pending++;
+  return request;
+}
+
+/**
+ * @brief put a request slot back into the free list; requests lock must be held. The reply is not freed
+ * @param OctopipesClient* client
+ * @param OctopipesRequest* request
+ */
+
+void octopipes_request_release(OctopipesClient* client, OctopipesRequest* request) {
+  OctopipesRequestTable* table = &client->requests;
+  octopipes_timer_remove(table->timeouts, &request->timer);
+  const size_t index = request->correlation_id & 0xFFFF;
+  request->correlation_id = index; //Generation 0 is never valid
+  request->next_free = table->free_head;
+  table->free_head = index;
+  table->pending--;
+}
+
+/**
+ * @brief find a pending request by correlation id; requests lock must be held
+ * @param OctopipesClient* client
+ * @param uint32_t correlation id
+ * @return OctopipesRequest* (NULL if not pending)
+ */
+
+OctopipesRequest* octopipes_request_find(OctopipesClient* client, const uint32_t correlation_id) {
+  const size_t index = correlation_id & 0xFFFF;
+  if (index >= client->requests.requests_len || (correlation_id >> 16) == 0) {
+    return NULL;
+  }
+  OctopipesRequest* request = client->requests.requests[index];
+  if (request->correlation_id != correlation_id || request->done) {
+    return NULL;
+  }
+  return request;
+}
+
+/**
+ * @brief complete the request a reply belongs to; replies to requests which aren't pending anymore are dropped
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* reply (ownership is taken)
+ */
+
+void octopipes_handle_reply(OctopipesClient* client, OctopipesMessage* message) {
+  pthread_mutex_lock(&client->requests_lock);
+  OctopipesRequest* request = octopipes_request_find(client, message->correlation_id);
+  if (request == NULL) {
+    pthread_mutex_unlock(&client->requests_lock);
+    octopipes_cleanup_message(message);
+    return;
+  }
+  request->done = 1;
+  if (request->on_reply == NULL) {
+    //Requester is waiting (or still setting up the callback)
+    request->reply = message;
+    pthread_cond_signal(&request->replied);
+    pthread_mutex_unlock(&client->requests_lock);
+    return;
+  }
+  void (*on_reply)(const struct OctopipesClient*, const OctopipesMessage*, const OctopipesError, void*) = request->on_reply;
+  void* user_data = request->user_data;
+  octopipes_request_release(client, request);
+  pthread_mutex_unlock(&client->requests_lock);
+  on_reply(client, message, OCTOPIPES_ERROR_SUCCESS, user_data);
+  octopipes_cleanup_message(message);
+}
+
+/**
+ * @brief advance the requests timer wheel and report asynchronous requests which timed out
+ * @param OctopipesClient* client
+ */
+
+void octopipes_expire_requests(OctopipesClient* client) {
+  pthread_mutex_lock(&client->requests_lock);
+  OctopipesTimer* expired;
+  if (octopipes_timer_wheel_advance(client->requests.timeouts, octopipes_get_time_ms(), &expired) == 0) {
+    pthread_mutex_unlock(&client->requests_lock);
+    return;
+  }
+  while (expired != NULL) {
+    //Get the request the timer belongs to
+    OctopipesRequest* request = (OctopipesRequest*) ((uint8_t*) expired - offsetof(OctopipesRequest, timer));
+    expired = expired->next;
+    void (*on_reply)(const struct OctopipesClient*, const OctopipesMessage*, const OctopipesError, void*) = request->on_reply;
+    void* user_data = request->user_data;
+    octopipes_request_release(client, request);
+    //Callback may send new requests
+    pthread_mutex_unlock(&client->requests_lock);
+    on_reply(client, NULL, OCTOPIPES_ERROR_REQUEST_TIMEOUT, user_data);
+    pthread_mutex_lock(&client->requests_lock);
+  }
+  pthread_mutex_unlock(&client->requests_lock);
+}
+
+/**
+ * @brief send a message which requires an ACK through the stream of its remote; if the in-flight window is full, waits until an ACK frees a slot.
+ * The encoded frame is kept until it is acknowledged, so it can be sent again; it's written without holding the acks lock, so ACKs are
+ * processed meanwhile. If it can't be written it stays in flight and it's sent again on the retransmission timeout
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_send_sequenced(OctopipesClient* client, OctopipesMessage* message) {
+  pthread_mutex_lock(&client->acks_lock);
+  if (client->acks.window == 0) {
+    //Window is disabled, the receiver acknowledges each message on its own
+    pthread_mutex_unlock(&client->acks_lock);
+    return octopipes_send_message(client, message);
+  }
+  //ACKs are read by the client loop
+  if (client->state != OCTOPIPES_STATE_RUNNING) {
+    pthread_mutex_unlock(&client->acks_lock);
+    return OCTOPIPES_ERROR_THREAD;
+  }
+  OctopipesAckStream* stream = octopipes_ack_stream_get(client, message->remote);
+  if (stream == NULL) {
+    pthread_mutex_unlock(&client->acks_lock);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  //Streams are freed by cleanup only; the send lock is taken before the acks lock
+  while (1) {
+    //Wait for a free slot in the window, without the send lock, so retransmissions can go on meanwhile
+    while (client->acks.window > 0 && stream->inflight_len >= client->acks.window) {
+      if (client->state != OCTOPIPES_STATE_RUNNING) {
+        pthread_mutex_unlock(&client->acks_lock);
+        return OCTOPIPES_ERROR_THREAD;
+      }
+      if (client->loop_running && pthread_equal(client->loop, pthread_self())) {
+        //The loop thread is the one which reads the ACKs, it would wait forever
+        pthread_mutex_unlock(&client->acks_lock);
+        return OCTOPIPES_ERROR_WINDOW_FULL;
+      }
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += OCTOPIPES_LOOP_POLL_TIME * 1000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&client->acks.window_available, &client->acks_lock, &deadline);
+    }
+    pthread_mutex_unlock(&client->acks_lock);
+    pthread_mutex_lock(&stream->send_lock);
+    pthread_mutex_lock(&client->acks_lock);
+    if (client->acks.window == 0 || stream->inflight_len < client->acks.window) {
+      break;
+    }
+    //Another sender took the slot
+    pthread_mutex_unlock(&stream->send_lock);
+  }
+  //Grow the in-flight ring if it's full
+  if (stream->inflight_len == stream->inflight_size) {
+    const size_t inflight_size = stream->inflight_size > 0 ? stream->inflight_size * 2 : (client->acks.window > 0 ? client->acks.window : 1);
+    OctopipesInflight* inflight = (OctopipesInflight*) malloc(sizeof(OctopipesInflight) * inflight_size);
+    if (inflight == NULL) {
+      pthread_mutex_unlock(&client->acks_lock);
+      pthread_mutex_unlock(&stream->send_lock);
+      return OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    for (size_t i = 0; i < stream->inflight_len; i++) {
+      inflight[i] = stream->inflight[(stream->inflight_head + i) % stream->inflight_size];
+    }
+    free(stream->inflight);
+    stream->inflight = inflight;
+    stream->inflight_head = 0;
+    stream->inflight_size = inflight_size;
+  }
+  message->options |= OCTOPIPES_OPTIONS_SEQUENCED;
+  message->epoch = stream->epoch;
+  message->sequence = stream->next_sequence;
+  size_t frame_size = octopipes_get_encoded_size(message);
+  uint8_t* frame = (uint8_t*) malloc(sizeof(uint8_t) * frame_size);
+  uint8_t* frame_out = (uint8_t*) malloc(sizeof(uint8_t) * frame_size);
+  OctopipesError rc = OCTOPIPES_ERROR_BAD_ALLOC;
+  if (frame == NULL || frame_out == NULL || (rc = octopipes_encode_cached(client, message, frame, &frame_size)) != OCTOPIPES_ERROR_SUCCESS) {
+    pthread_mutex_unlock(&client->acks_lock);
+    pthread_mutex_unlock(&stream->send_lock);
+    free(frame);
+    free(frame_out);
+    return rc;
+  }
+  message->checksum = frame[octopipes_get_checksum_offset(message)];
+  //The frame in flight may be released by an ACK or by a stream reset as soon as the lock is released, so a copy is written
+  memcpy(frame_out, frame, frame_size);
+  OctopipesInflight* entry = &stream->inflight[(stream->inflight_head + stream->inflight_len) % stream->inflight_size];
+  entry->sequence = stream->next_sequence++;
+  entry->frame = frame;
+  entry->frame_size = frame_size;
+  entry->ttl = message->ttl;
+  if (stream->inflight_len++ == 0) {
+    //Timer always refers to the oldest message in flight
+    stream->retries = 0;
+    octopipes_timer_add(client->acks.timeouts, &stream->timer, octopipes_get_time_ms() + client->acks.timeout);
+  }
+  pthread_mutex_unlock(&client->acks_lock);
+  //Send lock is still held, so sequences reach the pipe in order
+  rc = octopipes_write_frame(client, frame_out, frame_size, 1, message->ttl);
+  pthread_mutex_unlock(&stream->send_lock);
+  free(frame_out);
+  //Call on sent callback if necessary
+  if (rc == OCTOPIPES_ERROR_SUCCESS && client->on_sent != NULL) {
+    client->on_sent(client, message);
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the stream of messages sent to remote, creating it if it doesn't exist yet; acks lock must be held
+ * @param OctopipesClient* client
+ * @param char* remote
+ * @return OctopipesAckStream* (NULL if it was not possible to allocate the stream)
+ */
+
+OctopipesAckStream* octopipes_ack_stream_get(OctopipesClient* client, const char* remote) {
+  for (size_t i = 0; i < client->acks.streams_len; i++) {
+    if (strcmp(client->acks.streams[i]->remote, remote) == 0) {
+      return client->acks.streams[i];
+    }
+  }
+  OctopipesAckStream** streams = (OctopipesAckStream**) realloc(client->acks.streams, sizeof(OctopipesAckStream*) * (client->acks.streams_len + 1));
+  if (streams == NULL) {
+    return NULL;
+  }
+  client->acks.streams = streams;
+  OctopipesAckStream* stream = (OctopipesAckStream*) malloc(sizeof(OctopipesAckStream));
+  if (stream == NULL) {
+    return NULL;
+  }
+  const size_t remote_size = strlen(remote);
+  stream->remote = (char*) malloc(sizeof(char) * (remote_size + 1));
+  if (stream->remote == NULL) {
+    free(stream);
+    return NULL;
+  }
+  if (pthread_mutex_init(&stream->send_lock, NULL) != 0) {
+    free(stream->remote);
+    free(stream);
+    return NULL;
+  }
+  memcpy(stream->remote, remote, remote_size + 1);
+  stream->epoch = 0;
+  stream->inflight = NULL;
+  stream->inflight_head = 0;
+  stream->inflight_len = 0;
+  stream->inflight_size = 0;
+  stream->timer.slot = NULL;
+  octopipes_ack_stream_reset(stream);
+  client->acks.streams[client->acks.streams_len++] = stream;
+  return stream;
+}
+
+/**
+ * @brief restart the sequence of a stream with a new epoch; the stream must have no messages in flight
+ * @param OctopipesAckStream* stream
+ */
+
+void octopipes_ack_stream_reset(OctopipesAckStream* stream) {
+  //Receivers wait for sequence 1 of an epoch they don't know, so a restarted sender is never taken for a duplicate
+  uint32_t epoch = (uint32_t) ((octopipes_get_time_ms() ^ (uintptr_t) stream) * 2654435761u);
+  while (epoch == 0 || epoch == stream->epoch) {
+    epoch++;
+  }
+  stream->epoch = epoch;
+  stream->next_sequence = 1;
+  stream->retries = 0;
+}
+
+/**
+ * @brief release the messages of a stream up to the sequence acknowledged by a cumulative ACK
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* ack (the payload is the stream remote)
+ */
+
+void octopipes_handle_ack(OctopipesClient* client, const OctopipesMessage* message) {
+  pthread_mutex_lock(&client->acks_lock);
+  OctopipesAckStream* stream = NULL;
+  for (size_t i = 0; i < client->acks.streams_len && stream == NULL; i++) {
+    OctopipesAckStream* candidate = client->acks.streams[i];
+    if (candidate->epoch == message->epoch && strlen(candidate->remote) == message->data_size && memcmp(candidate->remote, message->data, message->data_size) == 0) {
+      stream = candidate;
+    }
+  }
+  if (stream == NULL) {
+    //ACK of an old epoch
+    pthread_mutex_unlock(&client->acks_lock);
+    return;
+  }
+  //ACKs are cumulative: all the sequences up to the acknowledged one have been received
+  size_t acked = 0;
+  while (stream->inflight_len > 0) {
+    OctopipesInflight* entry = &stream->inflight[stream->inflight_head];
+    if ((int32_t) (message->sequence - entry->sequence) < 0) {
+      break;
+    }
+    free(entry->frame);
+    stream->inflight_head = (stream->inflight_head + 1) % stream->inflight_size;
+    stream->inflight_len--;
+    acked++;
+  }
+  if (acked > 0) {
+    stream->retries = 0;
+    if (stream->inflight_len > 0) {
+      octopipes_timer_add(client->acks.timeouts, &stream->timer, octopipes_get_time_ms() + client->acks.timeout);
+    } else {
+      octopipes_timer_remove(client->acks.timeouts, &stream->timer);
+    }
+    pthread_cond_broadcast(&client->acks.window_available);
+  }
+  pthread_mutex_unlock(&client->acks_lock);
+}
+
+/**
+ * @brief check whether a sequenced message is the next one of its stream; duplicated and out of order messages are dropped
+ * and an ACK is scheduled for the stream, while the accepted ones are acknowledged once delivered.
+ * Peers are only looked up and changed by the thread which reads the messages, so no lock is required
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @param OctopipesAckPeer** peer of the accepted message (NULL if it can't be acknowledged)
+ * @return int 1 if the message must be delivered
+ */
+
+int octopipes_accept_sequenced(OctopipesClient* client, const OctopipesMessage* message, OctopipesAckPeer** peer_out) {
+  *peer_out = NULL;
+  if (message->origin == NULL || message->remote == NULL) {
+    //Can't be acknowledged
+    return 1;
+  }
+  OctopipesAckPeer* peer = NULL;
+  for (size_t i = 0; i < client->acks.peers_len && peer == NULL; i++) {
+    if (strcmp(client->acks.peers[i]->origin, message->origin) == 0 && strcmp(client->acks.peers[i]->remote, message->remote) == 0) {
+      peer = client->acks.peers[i];
+    }
+  }
+  if (peer == NULL) {
+    //New peer; if it can't be allocated, the message is dropped and the sender will send it again
+    OctopipesAckPeer** peers = (OctopipesAckPeer**) realloc(client->acks.peers, sizeof(OctopipesAckPeer*) * (client->acks.peers_len + 1));
+    if (peers == NULL) {
+      return 0;
+    }
+    client->acks.peers = peers;
+    peer = (OctopipesAckPeer*) malloc(sizeof(OctopipesAckPeer));
+    if (peer == NULL) {
+      return 0;
+    }
+    peer->origin = (char*) malloc(sizeof(char) * (message->origin_size + 1));
+    peer->remote = (char*) malloc(sizeof(char) * (message->remote_size + 1));
+    if (peer->origin == NULL || peer->remote == NULL) {
+      free(peer->origin);
+      free(peer->remote);
+      free(peer);
+      return 0;
+    }
+    memcpy(peer->origin, message->origin, message->origin_size + 1);
+    memcpy(peer->remote, message->remote, message->remote_size + 1);
+    peer->epoch = 0;
+    peer->expected = 1;
+    peer->delivered = 0;
+    peer->ack_pending = 0;
+    client->acks.peers[client->acks.peers_len++] = peer;
+  }
+  if (peer->epoch != message->epoch) {
+    //New stream (or the sender restarted it): wait for its first message
+    if (message->sequence != 1) {
+      return 0;
+    }
+    peer->epoch = message->epoch;
+    peer->expected = 1;
+  }
+  if (message->sequence != peer->expected) {
+    //Duplicated or out of order; the ACK tells the sender where the stream is
+    __atomic_store_n(&peer->ack_pending, 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+  peer->expected++;
+  *peer_out = peer;
+  return 1;
+}
+
+/**
+ * @brief acknowledge a message once it has been delivered: a sequenced message moves the cumulative ACK of its stream, which is sent
+ * by the next flush, while a message which requires an ACK is acknowledged immediately. Called by the thread which delivered the message
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @param OctopipesAckPeer* peer of the message (NULL if not sequenced)
+ */
+
+void octopipes_ack_delivered(OctopipesClient* client, const OctopipesMessage* message, OctopipesAckPeer* peer) {
+  if (peer != NULL) {
+    //Epoch and sequence are stored together, so the flush never pairs a sequence with the epoch of another stream
+    __atomic_store_n(&peer->delivered, ((uint64_t) message->epoch << 32) | message->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&peer->ack_pending, 1, __ATOMIC_RELEASE);
+  } else if ((message->options & (OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED)) == OCTOPIPES_OPTIONS_REQUIRE_ACK) {
+    octopipes_send_ex(client, message->origin, NULL, 0, 255, OCTOPIPES_OPTIONS_ACK);
+  }
+}
+
+/**
+ * @brief send a cumulative ACK, up to the last message delivered, for each stream which received messages since the last flush
+ * @param OctopipesClient* client
+ */
+
+void octopipes_flush_acks(OctopipesClient* client) {
+  for (size_t i = 0; i < client->acks.peers_len; i++) {
+    OctopipesAckPeer* peer = client->acks.peers[i];
+    //Executor workers mark the streams of the messages they deliver
+    if (!__atomic_exchange_n(&peer->ack_pending, 0, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    const uint64_t delivered = __atomic_load_n(&peer->delivered, __ATOMIC_RELAXED);
+    //Payload is the stream remote, since the origin of the ACK may differ from it
+    OctopipesMessage ack;
+    if (octopipes_prepare_message(client, &ack, peer->origin, peer->remote, strlen(peer->remote), 255, OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED) != OCTOPIPES_ERROR_SUCCESS) {
+      continue;
+    }
+    ack.epoch = (uint32_t) (delivered >> 32);
+    ack.sequence = (uint32_t) delivered;
+    octopipes_send_message(client, &ack);
+  }
+}
+
+/**
+ * @brief advance the ACK timer wheel and send again the messages of the streams which haven't been acknowledged in time.
+ * After OCTOPIPES_ACK_MAX_RETRIES retransmissions, the messages in flight are dropped, the stream is restarted and OCTOPIPES_ERROR_ACK_TIMEOUT is reported.
+ * Frames are copied with the acks lock held and written after releasing it
+ * @param OctopipesClient* client
+ */
+
+void octopipes_retransmit(OctopipesClient* client) {
+  pthread_mutex_lock(&client->acks_lock);
+  OctopipesTimer* expired;
+  const uint64_t now = octopipes_get_time_ms();
+  if (octopipes_timer_wheel_advance(client->acks.timeouts, now, &expired) == 0) {
+    pthread_mutex_unlock(&client->acks_lock);
+    return;
+  }
+  size_t dropped = 0;
+  //Frames to send again, each with its stream
+  OctopipesInflight* resend = NULL;
+  OctopipesAckStream** resend_streams = NULL;
+  size_t resend_len = 0;
+  while (expired != NULL) {
+    //Get the stream the timer belongs to
+    OctopipesAckStream* stream = (OctopipesAckStream*) ((uint8_t*) expired - offsetof(OctopipesAckStream, timer));
+    expired = expired->next;
+    if (stream->retries >= OCTOPIPES_ACK_MAX_RETRIES) {
+      for (size_t i = 0; i < stream->inflight_len; i++) {
+        free(stream->inflight[(stream->inflight_head + i) % stream->inflight_size].frame);
+      }
+      stream->inflight_head = 0;
+      stream->inflight_len = 0;
+      octopipes_ack_stream_reset(stream);
+      dropped++;
+      continue;
+    }
+    stream->retries++;
+    octopipes_timer_add(client->acks.timeouts, &stream->timer, now + client->acks.timeout);
+    //Go back N: receivers drop everything after a missing sequence, so the whole window is sent again
+    OctopipesInflight* frames = (OctopipesInflight*) realloc(resend, sizeof(OctopipesInflight) * (resend_len + stream->inflight_len));
+    OctopipesAckStream** streams = (OctopipesAckStream**) realloc(resend_streams, sizeof(OctopipesAckStream*) * (resend_len + stream->inflight_len));
+    if (frames != NULL) {
+      resend = frames;
+    }
+    if (streams != NULL) {
+      resend_streams = streams;
+    }
+    if (frames == NULL || streams == NULL) {
+      continue; //Sent on the next timeout
+    }
+    for (size_t i = 0; i < stream->inflight_len; i++) {
+      const OctopipesInflight* entry = &stream->inflight[(stream->inflight_head + i) % stream->inflight_size];
+      uint8_t* frame = (uint8_t*) malloc(sizeof(uint8_t) * entry->frame_size);
+      if (frame == NULL) {
+        break; //The following ones would be dropped by the receiver
+      }
+      memcpy(frame, entry->frame, entry->frame_size);
+      resend[resend_len] = *entry;
+      resend[resend_len].frame = frame;
+      resend_streams[resend_len++] = stream;
+    }
+  }
+  if (dropped > 0) {
+    pthread_cond_broadcast(&client->acks.window_available);
+  }
+  pthread_mutex_unlock(&client->acks_lock);
+  //Frames of a stream are contiguous and written with its send lock, so they aren't interleaved with new sequences
+  for (size_t i = 0; i < resend_len; i++) {
+    if (i == 0 || resend_streams[i] != resend_streams[i - 1]) {
+      pthread_mutex_lock(&resend_streams[i]->send_lock);
+    }
+    octopipes_write_frame(client, resend[i].frame, resend[i].frame_size, 1, resend[i].ttl);
+    free(resend[i].frame);
+    if (i + 1 == resend_len || resend_streams[i + 1] != resend_streams[i]) {
+      pthread_mutex_unlock(&resend_streams[i]->send_lock);
+    }
+  }
+  free(resend);
+  free(resend_streams);
+  for (size_t i = 0; i < dropped && client->on_receive_error != NULL; i++) {
+    client->on_receive_error(client, OCTOPIPES_ERROR_ACK_TIMEOUT);
+  }
+}
+
+/**
+ * @brief wait up to timeout for the assignment written by the server to the reply pipe
+ * @param int fd reply pipe
+ * @param int timeout in milliseconds
+ * @param OctopipesMessage** message
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_read_assignment(const int fd, const int timeout, OctopipesMessage** message) {
+  uint8_t* stream = NULL;
+  size_t stream_size = 0;
+  const unsigned long deadline = octopipes_get_time_ms() + timeout;
+  OctopipesError rc = OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  unsigned long now;
+  while ((now = octopipes_get_time_ms()) < deadline) {
+    uint8_t* data_in;
+    size_t data_in_size;
+    if ((rc = pipe_read(fd, &data_in, &data_in_size, (int) (deadline - now))) == OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      continue;
+    } else if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+    if ((rc = octopipes_stream_append(&stream, &stream_size, data_in, data_in_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+    //Assignment may be read in more chunks
+    size_t offset = 0;
+    if ((rc = octopipes_decode_next(stream, stream_size, &offset, message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      break;
+    }
+  }
+  free(stream);
+  return rc;
+}
+
+/**
+ * @brief write a request to the CAP and wait for the assignment the server writes to the reply pipe; the assignment must be addressed to the client
+ * @param OctopipesClient* client
+ * @param uint8_t* encoded request
+ * @param size_t request size
+ * @param char* reply pipe set in the request
+ * @param OctopipesMessage** assignment
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_cap_request(OctopipesClient* client, const uint8_t* data, const size_t data_size, const char* reply_pipe, OctopipesMessage** assignment) {
+  //Reply pipe is open before sending the request, so the server can write the assignment as soon as it's ready
+  int reply_fd;
+  OctopipesError rc;
+  if ((rc = pipe_create(reply_pipe)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  if ((rc = pipe_open(reply_pipe, &reply_fd)) != OCTOPIPES_ERROR_SUCCESS) {
+    pipe_delete(reply_pipe);
+    return rc;
+  }
+  //Send packet
+  rc = pipe_send(client->common_access_pipe, data, data_size, 5000);
+  //If packet was sent successfully, then wait for assignment
+  OctopipesMessage* cap_message = NULL;
+  if (rc == OCTOPIPES_ERROR_SUCCESS) {
+    rc = octopipes_read_assignment(reply_fd, 5000, &cap_message);
+  }
+  pipe_close(reply_fd);
+  pipe_delete(reply_pipe);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Verify remote and packet type; return bad packet, the user must redo the operation
+  if (cap_message->remote == NULL || strcmp(cap_message->remote, client->client_id) != 0 || octopipes_cap_get_message(cap_message->data, cap_message->data_size) != OCTOPIPES_CAP_ASSIGNMENT) {
+    octopipes_cleanup_message(cap_message);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  *assignment = cap_message;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the path of a private reply pipe: "<CAP>.<client>.<pid>.<client address>.<suffix>", so each request kind of each client has its own
+ * @param OctopipesClient* client
+ * @param char* suffix
+ * @param char* reply pipe buffer
+ * @param size_t buffer size
+ * @return int 1 if the path fits the buffer and a CAP payload
+ */
+
+int octopipes_reply_pipe_name(OctopipesClient* client, const char* suffix, char* reply_pipe, const size_t reply_pipe_size) {
+  const int written = snprintf(reply_pipe, reply_pipe_size, "%s.%s.%d.%lx.%s", client->common_access_pipe, client->client_id, (int) getpid(), (unsigned long) (uintptr_t) client, suffix);
+  return written >= 0 && (size_t) written < reply_pipe_size && written <= UINT8_MAX;
+}
+
+/**
+ * @brief write an add groups or remove groups message to the CAP and wait for the server to apply it
+ * @param OctopipesClient* client
+ * @param OctopipesCapMessage message type
+ * @param char** groups
+ * @param size_t groups amount
+ * @param OctopipesCapError* update error
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_send_groups_update(OctopipesClient* client, const OctopipesCapMessage message_type, const char** groups, const size_t groups_amount, OctopipesCapError* update_error) {
+  if (client == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  if (client->state != OCTOPIPES_STATE_SUBSCRIBED && client->state != OCTOPIPES_STATE_RUNNING) {
+    return OCTOPIPES_ERROR_NOT_SUBSCRIBED;
+  }
+  //Groups amount is encoded in one byte
+  if (groups_amount > UINT8_MAX) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //The outcome is written to a private reply pipe, as the assignment of a subscription
+  char reply_pipe[UINT8_MAX + 1];
+  if (!octopipes_reply_pipe_name(client, "groups", reply_pipe, sizeof(reply_pipe))) {
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  OctopipesMessage message;
+  message.version = client->protocol_version;
+  message.origin_size = client->client_id_size;
+  message.origin = client->client_id;
+  //Server is 0
+  message.remote_size = 0;
+  message.remote = NULL;
+  message.ttl = DEFAULT_TTL;
+  message.options = OCTOPIPES_OPTIONS_NONE;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = octopipes_cap_prepare_groups_update(message_type, groups, groups_amount, reply_pipe, (size_t*) &message.data_size);
+  if (message.data == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  //Encode message
+  size_t out_data_size;
+  uint8_t* out_data;
+  OctopipesError rc = octopipes_encode(&message, &out_data, &out_data_size);
+  free(message.data);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Send packet and wait for the outcome
+  OctopipesMessage* cap_message = NULL;
+  rc = octopipes_cap_request(client, out_data, out_data_size, reply_pipe, &cap_message);
+  free(out_data);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  //The outcome is an assignment without pipes
+  char* tx_pipe = NULL;
+  char* rx_pipe = NULL;
+  rc = octopipes_cap_parse_assign(cap_message->data, cap_message->data_size, update_error, &tx_pipe, &rx_pipe);
+  octopipes_cleanup_message(cap_message);
+  free(tx_pipe);
+  free(rx_pipe);
+  return rc;
+}
+
+/**
+ * @brief read the data available on the RX pipe, waiting up to timeout, and append it to the RX stream
+ * @param OctopipesClient* client
+ * @param int timeout in milliseconds
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_read_stream(OctopipesClient* client, const int timeout) {
+  uint8_t* data_in;
+  size_t data_in_size;
+  OctopipesError rc = pipe_read(client->rx_fd, &data_in, &data_in_size, timeout);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  return octopipes_stream_append(&client->rx_stream, &client->rx_stream_size, data_in, data_in_size);
+}
+
+/**
+ * @brief handle the protocol part of a received message (replies, ACKs and sequencing).
+ * If the message must be delivered to the user 1 is returned, otherwise the message has been consumed and mustn't be used.
+ * A delivered message must be acknowledged with octopipes_ack_delivered
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @param OctopipesAckPeer** peer of the message, if sequenced
+ * @return int
+ */
+
+int octopipes_accept_message(OctopipesClient* client, OctopipesMessage* message, OctopipesAckPeer** peer) {
+  *peer = NULL;
+  const OctopipesCapMessage server_message = message->origin == NULL ? octopipes_cap_get_message(message->data, message->data_size) : OCTOPIPES_CAP_UNKNOWN;
+  if (server_message == OCTOPIPES_CAP_CREDITS) {
+    //Credits granted by the server
+    octopipes_handle_credits(client, message);
+    octopipes_cleanup_message(message);
+    return 0;
+  }
+  if (server_message == OCTOPIPES_CAP_UNSUBSCRIPTION) {
+    //The server disconnected the client (its outbound queue overflowed): the loop exits, as if the client unsubscribed
+    octopipes_cleanup_message(message);
+    if (client->state == OCTOPIPES_STATE_RUNNING || client->state == OCTOPIPES_STATE_SUBSCRIBED) {
+      client->state = OCTOPIPES_STATE_UNSUBSCRIBED;
+      if (client->on_unsubscribed != NULL) {
+        client->on_unsubscribed(client);
+      }
+    }
+    return 0;
+  }
+  if ((message->options & OCTOPIPES_OPTIONS_REPLY) != 0) {
+    //Replies are delivered to the pending request
+    octopipes_handle_reply(client, message);
+    return 0;
+  }
+  if ((message->options & (OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED)) == (OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED)) {
+    //Cumulative ACK for one of the client streams
+    octopipes_handle_ack(client, message);
+    octopipes_cleanup_message(message);
+    return 0;
+  }
+  //Sequenced messages are delivered once and in order
+  if ((message->options & (OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED)) == (OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED) && !octopipes_accept_sequenced(client, message, peer)) {
+    octopipes_cleanup_message(message);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief check whether a received message is consumed by octopipes_accept_message (credits, disconnection, replies and ACKs) instead of being delivered
+ * @param OctopipesMessage* message
+ * @return int
+ */
+
+int octopipes_is_protocol_message(const OctopipesMessage* message) {
+  if (message->origin == NULL) {
+    const OctopipesCapMessage server_message = octopipes_cap_get_message(message->data, message->data_size);
+    if (server_message == OCTOPIPES_CAP_CREDITS || server_message == OCTOPIPES_CAP_UNSUBSCRIPTION) {
+      return 1;
+    }
+  }
+  if ((message->options & OCTOPIPES_OPTIONS_REPLY) != 0) {
+    return 1;
+  }
+  return (message->options & (OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED)) == (OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED);
+}
+
+/**
+ * @brief apply a credits grant: it carries the totals the client can have sent since it subscribed, so it replaces the previous grant
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* grant
+ */
+
+void octopipes_handle_credits(OctopipesClient* client, const OctopipesMessage* message) {
+  uint64_t messages_limit;
+  uint64_t bytes_limit;
+  if (octopipes_cap_parse_credits(message->data, message->data_size, &messages_limit, &bytes_limit) != OCTOPIPES_ERROR_SUCCESS) {
+    if (client->on_receive_error != NULL) {
+      client->on_receive_error(client, OCTOPIPES_ERROR_BAD_PACKET);
+    }
+    return;
+  }
+  size_t messages;
+  size_t bytes;
+  pthread_mutex_lock(&client->credits_lock);
+  client->credits.messages_limit = messages_limit;
+  client->credits.bytes_limit = bytes_limit;
+  octopipes_credits_available(client, &messages, &bytes);
+  pthread_mutex_unlock(&client->credits_lock);
+  if (client->on_credits != NULL) {
+    client->on_credits(client, messages, bytes);
+  }
+}
+
+/**
+ * @brief get the credits left to the client (SIZE_MAX if not limited); credits_lock must be held by the caller
+ * @param OctopipesClient* client
+ * @param size_t* messages
+ * @param size_t* bytes
+ */
+
+void octopipes_credits_available(OctopipesClient* client, size_t* messages, size_t* bytes) {
+  const OctopipesCredits* credits = &client->credits;
+  *messages = SIZE_MAX;
+  *bytes = SIZE_MAX;
+  if (credits->messages_limit > 0) {
+    *messages = credits->messages_sent < credits->messages_limit ? (size_t) (credits->messages_limit - credits->messages_sent) : 0;
+  }
+  if (credits->bytes_limit > 0) {
+    *bytes = credits->bytes_sent < credits->bytes_limit ? (size_t) (credits->bytes_limit - credits->bytes_sent) : 0;
+  }
+}
+
+/**
+ * @brief start the executor workers, if the executor is enabled
+ * @param OctopipesClient* client
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_executor_start(OctopipesClient* client) {
+  OctopipesExecutor* executor = &client->executor;
+  if (executor->workers_len == 0) {
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  executor->workers = (OctopipesExecutorWorker*) malloc(sizeof(OctopipesExecutorWorker) * executor->workers_len);
+  if (executor->workers == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  for (size_t i = 0; i < executor->workers_len; i++) {
+    OctopipesExecutorWorker* worker = &executor->workers[i];
+    worker->queue = (OctopipesExecutorTask*) malloc(sizeof(OctopipesExecutorTask) * executor->queue_size);
+    worker->queue_head = 0;
+    worker->queue_len = 0;
+    worker->dropped = 0;
+    worker->running = 1;
+    worker->client = client;
+    if (worker->queue == NULL) {
+      octopipes_executor_stop(client, i);
+      return OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->not_empty, NULL);
+    pthread_cond_init(&worker->not_full, NULL);
+    if (pthread_create(&worker->thread, NULL, octopipes_executor_loop, worker) != 0) {
+      pthread_mutex_destroy(&worker->lock);
+      pthread_cond_destroy(&worker->not_empty);
+      pthread_cond_destroy(&worker->not_full);
+      free(worker->queue);
+      octopipes_executor_stop(client, i);
+      return OCTOPIPES_ERROR_THREAD;
+    }
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief stop the first workers_len executor workers, after they have delivered the messages in their queues, and free the workers
+ * @param OctopipesClient* client
+ * @param size_t workers_len
+ */
+
+void octopipes_executor_stop(OctopipesClient* client, const size_t workers_len) {
+  OctopipesExecutor* executor = &client->executor;
+  if (executor->workers == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < workers_len; i++) {
+    OctopipesExecutorWorker* worker = &executor->workers[i];
+    pthread_mutex_lock(&worker->lock);
+    worker->running = 0;
+    pthread_cond_signal(&worker->not_empty);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->not_empty);
+    pthread_cond_destroy(&worker->not_full);
+    free(worker->queue);
+  }
+  free(executor->workers);
+  executor->workers = NULL;
+}
+
+/**
+ * @brief hand a received message to the worker of its origin; the worker takes the ownership of the message and acknowledges it once delivered.
+ * With the BLOCK policy, the loop waits for room in the queue, so it stops reading and the RX pipe fills up; it gives up if replies or ACKs
+ * are awaited, since only the loop can read them, and the message is left to the caller. Once the client is stopping, the message is dropped
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ * @param OctopipesAckPeer* peer of the message, if sequenced
+ * @return int 0 if the message has been neither queued nor dropped
+ */
+
+int octopipes_executor_submit(OctopipesClient* client, OctopipesMessage* message, OctopipesAckPeer* peer) {
+  OctopipesExecutor* executor = &client->executor;
+  //Same origin, same worker: messages of an origin are delivered in order
+  uint32_t hash = 2166136261u; //FNV-1a
+  for (size_t i = 0; i < message->origin_size; i++) {
+    hash = (hash ^ (uint8_t) message->origin[i]) * 16777619u;
+  }
+  OctopipesExecutorWorker* worker = &executor->workers[hash % executor->workers_len];
+  pthread_mutex_lock(&worker->lock);
+  while (worker->queue_len == executor->queue_size) {
+    if (executor->policy == OCTOPIPES_EXECUTOR_DROP || client->state != OCTOPIPES_STATE_RUNNING) {
+      worker->dropped++;
+      pthread_mutex_unlock(&worker->lock);
+      octopipes_cleanup_message(message);
+      return 1;
+    }
+    if (octopipes_loop_awaited(client)) {
+      pthread_mutex_unlock(&worker->lock);
+      return 0;
+    }
+    //Backpressure: the loop stops reading, so the RX pipe fills up
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += OCTOPIPES_REQUEST_TICK * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&worker->not_full, &worker->lock, &deadline);
+  }
+  OctopipesExecutorTask* task = &worker->queue[(worker->queue_head + worker->queue_len) % executor->queue_size];
+  task->message = message;
+  task->peer = peer;
+  worker->queue_len++;
+  pthread_cond_signal(&worker->not_empty);
+  pthread_mutex_unlock(&worker->lock);
+  return 1;
+}
+
+/**
+ * @brief thread loop of an executor worker: delivers the messages in its queue to on_received
+ * @param OctopipesExecutorWorker*
+ */
+
+void* octopipes_executor_loop(void* args) {
+  OctopipesExecutorWorker* worker = (OctopipesExecutorWorker*) args;
+  OctopipesClient* client = worker->client;
+  const size_t queue_size = client->executor.queue_size;
+  pthread_mutex_lock(&worker->lock);
+  while (1) {
+    while (worker->queue_len == 0 && worker->running) {
+      pthread_cond_wait(&worker->not_empty, &worker->lock);
+    }
+    //Exit once stopped and drained
+    if (worker->queue_len == 0) {
+      break;
+    }
+    OctopipesExecutorTask task = worker->queue[worker->queue_head];
+    worker->queue_head = (worker->queue_head + 1) % queue_size;
+    worker->queue_len--;
+    pthread_cond_signal(&worker->not_full);
+    pthread_mutex_unlock(&worker->lock);
+    if (client->on_received != NULL) {
+      client->on_received(client, task.message); //@! Success
+    }
+    octopipes_ack_delivered(client, task.message, task.peer);
+    octopipes_cleanup_message(task.message);
+    pthread_mutex_lock(&worker->lock);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+/**
+ * @brief write an encoded frame (or more frames) to the client TX pipe, and charge them to the client credits
+ * @param OctopipesClient* client
+ * @param uint8_t* frame
+ * @param size_t frame size
+ * @param size_t amount of frames
+ * @param uint8_t ttl
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_write_frame(OctopipesClient* client, const uint8_t* frame, const size_t frame_size, const size_t frames, const uint8_t ttl) {
+  if (frame_size <= PIPE_BUF) {
+    //Atomic writes can run concurrently, they only have to wait for bigger frames being written
+    pthread_rwlock_rdlock(&client->tx_lock);
+  } else {
+    //Frame is written in more chunks, so nobody else can write to the pipe meanwhile
+    pthread_rwlock_wrlock(&client->tx_lock);
+  }
+  OctopipesError rc = pipe_send(client->tx_pipe, frame, frame_size, ttl * 1000);
+  pthread_rwlock_unlock(&client->tx_lock);
+  if (rc == OCTOPIPES_ERROR_SUCCESS) {
+    pthread_mutex_lock(&client->credits_lock);
+    client->credits.messages_sent += frames;
+    client->credits.bytes_sent += frame_size;
+    pthread_mutex_unlock(&client->credits_lock);
+  }
+  return rc;
+}
+
+/**
+ * @brief encode a message into frame, using the header template the calling thread cached for the client, remote, ttl and options.
+ * The template contains the header until TTL and the checksum of the constant bytes, so only the data size and the payload are encoded on each send
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message (origin is ignored, the client id is used)
+ * @param uint8_t* frame (must be big enough for the encoded message)
+ * @param size_t* frame size
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_encode_cached(OctopipesClient* client, const OctopipesMessage* message, uint8_t* frame, size_t* frame_size) {
+  const char* remote = message->remote;
+  const size_t remote_size = message->remote_size;
+  const uint8_t ttl = message->ttl;
+  const OctopipesOptions options = message->options;
+  //Get template slot
+  uint32_t hash = 2166136261u; //FNV-1a
+  for (size_t i = 0; i < remote_size; i++) {
+    hash = (hash ^ (uint8_t) remote[i]) * 16777619u;
+  }
+  hash = (hash ^ ttl) * 16777619u;
+  hash = (hash ^ (uint8_t) options) * 16777619u;
+  hash = (hash ^ (uint32_t) client->serial) * 16777619u;
+  OctopipesHeaderTemplate* cache = octopipes_header_cache_get();
+  if (cache == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  OctopipesHeaderTemplate* header = &cache[hash % OCTOPIPES_HEADER_CACHE_SIZE];
+  if (header->remote == NULL || header->client != client->serial || header->ttl != ttl || header->options != options || strcmp(header->remote, remote) != 0) {
+    //Encode a new template, replacing the previous one
+    OctopipesMessage header_message;
+    octopipes_prepare_message(client, &header_message, remote, NULL, 0, ttl, options);
+    size_t header_size = octopipes_get_checksum_offset(&header_message) + 2 + octopipes_get_fields_size(options);
+    uint8_t* prefix = (uint8_t*) malloc(sizeof(uint8_t) * header_size);
+    char* header_remote = (char*) malloc(sizeof(char) * (remote_size + 1));
+    OctopipesError rc = OCTOPIPES_ERROR_BAD_ALLOC;
+    if (prefix == NULL || header_remote == NULL || (rc = octopipes_encode_header(&header_message, prefix, header_size, &header_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      free(prefix);
+      free(header_remote);
+      return rc;
+    }
+    memcpy(header_remote, remote, remote_size + 1);
+    free(header->remote);
+    free(header->prefix);
+    header->client = client->serial;
+    header->remote = header_remote;
+    header->ttl = ttl;
+    header->options = options;
+    header->prefix = prefix;
+    //Prefix ends with TTL; data size, options, checksum, STX and fields follow
+    header->prefix_size = header_size - 11 - octopipes_get_fields_size(options);
+    //Checksum of the constant bytes: prefix, options, STX and ETX
+    header->checksum = calculate_frame_checksum(prefix, header->prefix_size, header_size) ^ (uint8_t) options ^ OCTOPIPES_STX ^ OCTOPIPES_ETX;
+  }
+  size_t frame_ptr = header->prefix_size;
+  memcpy(frame, header->prefix, frame_ptr);
+  uint8_t checksum = header->checksum;
+  //Data size (fields are part of data)
+  uint8_t fields[OCTOPIPES_FIELDS_MAX_SIZE];
+  const size_t fields_size = octopipes_encode_fields(message, fields);
+  const uint64_t wire_data_size = message->data_size + fields_size;
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    const uint8_t byte = (wire_data_size >> shift) & 0xFF;
+    frame[frame_ptr++] = byte;
+    checksum ^= byte;
+  }
+  //Options, checksum and STX
+  frame[frame_ptr++] = options;
+  const size_t checksum_ptr = frame_ptr++;
+  frame[frame_ptr++] = OCTOPIPES_STX;
+  //Fields
+  for (size_t i = 0; i < fields_size; i++) {
+    frame[frame_ptr++] = fields[i];
+    checksum ^= fields[i];
+  }
+  //Payload and ETX
+  for (uint64_t i = 0; i < message->data_size; i++) {
+    frame[frame_ptr++] = message->data[i];
+    checksum ^= message->data[i];
+  }
+  frame[frame_ptr++] = OCTOPIPES_ETX;
+  frame[checksum_ptr] = (options & OCTOPIPES_OPTIONS_IGNORE_CHECKSUM) ? 0 : checksum;
+  *frame_size = frame_ptr;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the header cache of the calling thread, allocating it on the first send of the thread
+ * @return OctopipesHeaderTemplate* (NULL if it couldn't be allocated)
+ */
+
+OctopipesHeaderTemplate* octopipes_header_cache_get() {
+  if (header_cache == NULL) {
+    pthread_once(&header_cache_once, octopipes_header_cache_key_init);
+    OctopipesHeaderTemplate* cache = (OctopipesHeaderTemplate*) calloc(OCTOPIPES_HEADER_CACHE_SIZE, sizeof(OctopipesHeaderTemplate));
+    if (cache == NULL) {
+      return NULL;
+    }
+    //The key frees the cache when the thread exits
+    if (pthread_setspecific(header_cache_key, cache) != 0) {
+      free(cache);
+      return NULL;
+    }
+    header_cache = cache;
+  }
+  return header_cache;
+}
+
+/**
+ * @brief create the key which frees the header cache of the exiting threads
+ */
+
+void octopipes_header_cache_key_init() {
+  pthread_key_create(&header_cache_key, octopipes_header_cache_free);
+}
+
+/**
+ * @brief free the header cache of a thread
+ * @param void* cache (OctopipesHeaderTemplate*)
+ */
+
+void octopipes_header_cache_free(void* cache) {
+  OctopipesHeaderTemplate* templates = (OctopipesHeaderTemplate*) cache;
+  for (size_t i = 0; i < OCTOPIPES_HEADER_CACHE_SIZE; i++) {
+    free(templates[i].remote);
+    free(templates[i].prefix);
+  }
+  free(templates);
+}
+
+/**
+ * @brief thread loop functions for octopipes client daemon thread
+ * @param OctopipesClient*
+ */
+
+void* octopipes_loop(void* args) {
+  OctopipesClient* client = (OctopipesClient*) args;
+  OctopipesExecutorTask* parked = &client->executor.parked;
+  //State is set to running by octopipes_loop_start, so a stop requested before the thread starts isn't lost
+  while (client->state == OCTOPIPES_STATE_RUNNING) {
+    //A message left by a full worker queue goes first; the messages after it wait in the stream meanwhile
+    if (parked->message != NULL && octopipes_executor_submit(client, parked->message, parked->peer)) {
+      parked->message = NULL;
+    }
+    //Check if there are available messages to be read; frames may be written back to back, so data is kept until frames are complete
+    OctopipesError rc = octopipes_read_stream(client, parked->message != NULL ? OCTOPIPES_REQUEST_TICK : OCTOPIPES_LOOP_POLL_TIME);
+    if (rc != OCTOPIPES_ERROR_SUCCESS && rc != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      //@! Report error
+      if (client->on_receive_error != NULL) {
+        client->on_receive_error(client, rc);
+      }
+    }
+    if (client->rx_stream_size > 0) {
+      //Parse all the complete frames; while a message is parked, only the replies and the ACKs are taken, the other frames are kept in the stream
+      size_t offset = 0;
+      size_t kept = 0;
+      size_t frame_offset = 0;
+      OctopipesMessage* message;
+      OctopipesAckPeer* peer;
+      while ((rc = octopipes_decode_next(client->rx_stream, client->rx_stream_size, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+        if (rc == OCTOPIPES_ERROR_SUCCESS) {
+          if (parked->message != NULL && !octopipes_is_protocol_message(message)) {
+            memmove(client->rx_stream + kept, client->rx_stream + frame_offset, offset - frame_offset);
+            kept += offset - frame_offset;
+            octopipes_cleanup_message(message);
+          } else if (!octopipes_accept_message(client, message, &peer)) {
+            //Consumed by the client
+          } else if (client->executor.workers != NULL) {
+            //Delivered by a worker, which frees the message
+            if (!octopipes_executor_submit(client, message, peer)) {
+              parked->message = message;
+              parked->peer = peer;
+            }
+          } else {
+            //Decoding was successful, report received message
+            if (client->on_received != NULL) {
+              client->on_received(client, message); //@! Success
+            }
+            octopipes_ack_delivered(client, message, peer);
+            octopipes_cleanup_message(message);
+          }
+        } else {
+          //@! Report error
+          if (client->on_receive_error != NULL) {
+            client->on_receive_error(client, rc);
+          }
+        }
+        frame_offset = offset;
+      }
+      //Keep the incomplete frame, after the frames kept, for the next read
+      if (kept > 0) {
+        memmove(client->rx_stream + kept, client->rx_stream + offset, client->rx_stream_size - offset);
+        client->rx_stream_size -= offset - kept;
+      } else {
+        octopipes_stream_consume(&client->rx_stream, &client->rx_stream_size, offset);
+      }
+    }
+    //Acknowledge the sequenced messages delivered
+    octopipes_flush_acks(client);
+    //Report requests which timed out
+    octopipes_expire_requests(client);
+    //Send again messages which haven't been acknowledged
+    octopipes_retransmit(client);
+  }
+  //The client is stopping: the parked message is queued if there's room, otherwise it's dropped
+  if (parked->message != NULL) {
+    octopipes_executor_submit(client, parked->message, parked->peer);
+    parked->message = NULL;
+  }
+  return NULL;
+}
+
+/**
+ * @brief check whether somebody waits for a message which only the loop can read: a reply to a pending request or an ACK for a message in flight
+ * @param OctopipesClient* client
+ * @return int
+ */
+
+int octopipes_loop_awaited(OctopipesClient* client) {
+  pthread_mutex_lock(&client->requests_lock);
+  int awaited = client->requests.pending > 0;
+  pthread_mutex_unlock(&client->requests_lock);
+  pthread_mutex_lock(&client->acks_lock);
+  for (size_t i = 0; i < client->acks.streams_len && !awaited; i++) {
+    awaited = client->acks.streams[i]->inflight_len > 0;
+  }
+  pthread_mutex_unlock(&client->acks_lock);
+  return awaited;
+}
+
+/**
+ * @brief wait for the loop thread to exit (its state must not be running anymore), then stop the executor workers
+ * @param OctopipesClient*
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_loop_join(OctopipesClient* client) {
+  if (client->loop_running) {
+    if (pthread_join(client->loop, NULL) != 0) {
+      return OCTOPIPES_ERROR_THREAD;
+    }
+    client->loop_running = 0;
+  }
+  //Workers deliver the messages left in their queues, then exit
+  octopipes_executor_stop(client, client->executor.workers_len);
+  return OCTOPIPES_ERROR_SUCCESS;
 }
@@ -0,0 +1,997 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#include <octopipes/log.h>
+
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__NetBSD__) || defined(__gnu_linux__) || defined(__linux__) || defined(__APPLE__)
+
+#include <octopipes/octopipes.h>
+#include <octopipes/serializer.h>
+#include <octopipes/timer.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define RECORD_HEADER_SIZE 16 //Frame size (4 bytes), reserved (4 bytes), time the frame was appended at (8 bytes)
+#define SEGMENT_NAME_LEN 24 //Base offset (20 digits) and extension
+#define SEGMENT_EXTENSION ".log"
+#define GROUPS_INITIAL_SIZE 16 //Groups allocated by the first load; doubled when full
+#define INDEX_INITIAL_SIZE 256 //Records indexed by a new segment; doubled when full
+#define SEGMENTS_INITIAL_SIZE 16 //Segments collected by the first recovery step; doubled when full
+#define LOG_MAX_GROUPS 1024 //Default groups which can be loaded at once; each one keeps its segments mapped
+
+//Private functions
+//Groups map
+uint32_t log_hash(const char* group);
+OctopipesLogGroup* log_find(OctopipesLog* log, const char* group, const uint32_t hash);
+OctopipesError log_insert(OctopipesLog* log, OctopipesLogGroup* log_group);
+//Groups
+OctopipesError log_group_load(OctopipesLog* log, const char* group, const uint32_t hash, const int create, OctopipesLogGroup** log_group);
+void log_group_cleanup(OctopipesLogGroup* log_group);
+OctopipesError log_roll(OctopipesLogGroup* log_group, const size_t record_size);
+void log_retain(OctopipesLogGroup* log_group);
+//Segments
+OctopipesError log_segment_create(OctopipesLogSegment* segment, char* path, const uint64_t base, const size_t size);
+OctopipesError log_segment_recover(OctopipesLogSegment* segment, char* path, const uint64_t base);
+void log_segment_close(OctopipesLogSegment* segment);
+OctopipesError log_segment_index(OctopipesLogSegment* segment, const size_t position);
+uint64_t log_segment_time(const OctopipesLogSegment* segment);
+char* log_segment_path(const char* directory, const uint64_t base);
+//Names
+char* log_encode_name(const char* group);
+char* log_decode_name(const char* name);
+int log_hex_value(const char c);
+//Records
+uint32_t log_get_u32(const uint8_t* data);
+uint64_t log_get_u64(const uint8_t* data);
+void log_put_u32(uint8_t* data, const uint32_t value);
+void log_put_u64(uint8_t* data, const uint64_t value);
+int log_compare_offsets(const void* a, const void* b);
+
+/**
+ * @brief open a segmented append-only log. Each group is stored in a subdirectory as memory mapped segments;
+ * groups already in the directory are recovered when they're first used
+ * @param OctopipesLog** log
+ * @param char* directory: created if it doesn't exist
+ * @param size_t segment size: bytes of each segment file (a larger record gets a segment of its own)
+ * @param size_t retention bytes: once a group log exceeds this size its oldest segments are deleted (0: no limit)
+ * @param uint64_t retention age: segments whose last record is older than this are deleted (ms, 0: no limit)
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_log_open(OctopipesLog** log, const char* directory, const size_t segment_size, const size_t retention_bytes, const uint64_t retention_age_ms) {
+  if (directory == NULL || segment_size <= RECORD_HEADER_SIZE) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  struct stat st;
+  if (stat(directory, &st) == -1) {
+    if (mkdir(directory, 0755) != 0) {
+      return OCTOPIPES_ERROR_OPEN_FAILED;
+    }
+  } else if (!S_ISDIR(st.st_mode)) {
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  OctopipesLog* ptr = (OctopipesLog*) malloc(sizeof(OctopipesLog));
+  if (ptr == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  const size_t directory_len = strlen(directory);
+  ptr->directory = (char*) malloc(sizeof(char) * (directory_len + 1));
+  if (ptr->directory == NULL) {
+    free(ptr);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  memcpy(ptr->directory, directory, directory_len + 1);
+  if (pthread_rwlock_init(&ptr->lock, NULL) != 0) {
+    free(ptr->directory);
+    free(ptr);
+    return OCTOPIPES_ERROR_THREAD;
+  }
+  ptr->segment_size = segment_size;
+  ptr->retention_bytes = retention_bytes;
+  ptr->retention_age = retention_age_ms;
+  ptr->max_groups = LOG_MAX_GROUPS;
+  ptr->groups_map = NULL;
+  ptr->groups_map_size = 0;
+  ptr->groups_len = 0;
+  *log = ptr;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief close a log, unmapping all its segments; the segments are kept on disk
+ * @param OctopipesLog* log
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_log_close(OctopipesLog* log) {
+  if (log == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  for (size_t i = 0; i < log->groups_map_size; i++) {
+    if (log->groups_map[i] != NULL) {
+      log_group_cleanup(log->groups_map[i]);
+    }
+  }
+  free(log->groups_map);
+  free(log->directory);
+  pthread_rwlock_destroy(&log->lock);
+  free(log);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the log of a group, loading it from disk the first time it's used. Groups are never unloaded, so the
+ * returned pointer is valid until the log is closed; once max groups are loaded, no other group can be
+ * @param OctopipesLog* log
+ * @param char* group
+ * @param int create: if set, the group log is created if it doesn't exist
+ * @param OctopipesLogGroup** log group
+ * @return OctopipesError: OCTOPIPES_ERROR_NO_DATA_AVAILABLE if the group has no log and create is not set, OCTOPIPES_ERROR_LOG_FULL if max groups are loaded
+ */
+
+OctopipesError octopipes_log_get_group(OctopipesLog* log, const char* group, const int create, OctopipesLogGroup** log_group) {
+  if (log == NULL || group == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  const uint32_t hash = log_hash(group);
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  pthread_rwlock_rdlock(&log->lock);
+  OctopipesLogGroup* found = log_find(log, group, hash);
+  pthread_rwlock_unlock(&log->lock);
+  if (found == NULL) {
+    pthread_rwlock_wrlock(&log->lock);
+    //Another thread may have loaded the group in the meantime
+    if ((found = log_find(log, group, hash)) == NULL) {
+      rc = log->groups_len < log->max_groups ? log_group_load(log, group, hash, create, &found) : OCTOPIPES_ERROR_LOG_FULL;
+    }
+    pthread_rwlock_unlock(&log->lock);
+  }
+  *log_group = found;
+  return rc;
+}
+
+/**
+ * @brief set how many groups can be loaded at once; groups already loaded are kept
+ * @param OctopipesLog* log
+ * @param size_t max groups
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_log_set_max_groups(OctopipesLog* log, const size_t max_groups) {
+  if (log == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  pthread_rwlock_wrlock(&log->lock);
+  log->max_groups = max_groups;
+  pthread_rwlock_unlock(&log->lock);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the groups which have a log on disk
+ * @param OctopipesLog* log
+ * @param char*** groups (must be freed, as the groups in it)
+ * @param size_t* groups length
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_log_get_groups(OctopipesLog* log, char*** groups, size_t* groups_len) {
+  *groups = NULL;
+  *groups_len = 0;
+  if (log == NULL) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  DIR* dir;
+  if ((dir = opendir(log->directory)) == NULL) {
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  size_t groups_size = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    //Names which are not encoded groups ('.' and '..' among them) are skipped
+    char* group = log_decode_name(entry->d_name);
+    if (group == NULL) {
+      continue;
+    }
+    if (*groups_len == groups_size) {
+      groups_size = groups_size > 0 ? groups_size * 2 : GROUPS_INITIAL_SIZE;
+      char** new_groups = (char**) realloc(*groups, sizeof(char*) * groups_size);
+      if (new_groups == NULL) {
+        free(group);
+        rc = OCTOPIPES_ERROR_BAD_ALLOC;
+        break;
+      }
+      *groups = new_groups;
+    }
+    (*groups)[(*groups_len)++] = group;
+  }
+  closedir(dir);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    for (size_t i = 0; i < *groups_len; i++) {
+      free((*groups)[i]);
+    }
+    free(*groups);
+    *groups = NULL;
+    *groups_len = 0;
+  }
+  return rc;
+}
+
+/**
+ * @brief append an encoded frame to a group log. The record is written into the mapped segment, its size last,
+ * so a record is valid only once it's complete; a new segment is started when the current one is full
+ * @param OctopipesLogGroup* log group
+ * @param uint8_t* data
+ * @param size_t data size
+ * @param uint64_t* offset assigned to the record
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_log_append(OctopipesLogGroup* log_group, const uint8_t* data, const size_t data_size, uint64_t* offset) {
+  if (data_size == 0 || data_size > UINT32_MAX) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  const size_t record_size = RECORD_HEADER_SIZE + data_size;
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  pthread_mutex_lock(&log_group->lock);
+  OctopipesLogSegment* segment = log_group->segments_len > 0 ? &log_group->segments[log_group->segments_len - 1] : NULL;
+  if (segment == NULL || segment->size - segment->used < record_size) {
+    if ((rc = log_roll(log_group, record_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      goto append_unlock;
+    }
+    segment = &log_group->segments[log_group->segments_len - 1];
+  }
+  //Index the record before writing it, so a failure leaves the segment unchanged
+  if ((rc = log_segment_index(segment, segment->used)) != OCTOPIPES_ERROR_SUCCESS) {
+    goto append_unlock;
+  }
+  uint8_t* record = segment->map + segment->used;
+  log_put_u32(record + 4, 0);
+  log_put_u64(record + 8, octopipes_get_epoch_ms());
+  memcpy(record + RECORD_HEADER_SIZE, data, data_size);
+  log_put_u32(record, (uint32_t) data_size);
+  segment->used += record_size;
+  log_group->bytes += record_size;
+  *offset = log_group->next++;
+
+append_unlock:
+  pthread_mutex_unlock(&log_group->lock);
+  return rc;
+}
+
+/**
+ * @brief get the offset of the oldest record still in a group log; log group lock must be held by the caller.
+ * Segments are deleted by age only when the log rolls, so the records older than the retention age are skipped until then
+ * @param OctopipesLogGroup* log group
+ * @return uint64_t: the next offset if the log is empty
+ */
+
+uint64_t octopipes_log_first(OctopipesLogGroup* log_group) {
+  uint64_t first = log_group->next;
+  for (size_t i = 0; i < log_group->segments_len; i++) {
+    if (log_group->segments[i].index_len > 0) {
+      first = log_group->segments[i].base;
+      break;
+    }
+  }
+  const OctopipesLog* log = log_group->log;
+  const uint64_t now = log->retention_age > 0 ? octopipes_get_epoch_ms() : 0;
+  if (now > log->retention_age) {
+    const uint64_t unexpired = octopipes_log_seek_time(log_group, now - log->retention_age);
+    first = unexpired > first ? unexpired : first;
+  }
+  return first;
+}
+
+/**
+ * @brief get the offset of the first record appended at or after a certain time; log group lock must be held by the caller
+ * @param OctopipesLogGroup* log group
+ * @param uint64_t time (ms since epoch)
+ * @return uint64_t: the next offset if all the records are older
+ */
+
+uint64_t octopipes_log_seek_time(OctopipesLogGroup* log_group, const uint64_t time_ms) {
+  for (size_t i = 0; i < log_group->segments_len; i++) {
+    const OctopipesLogSegment* segment = &log_group->segments[i];
+    if (segment->index_len == 0 || log_segment_time(segment) < time_ms) {
+      continue;
+    }
+    //Binary search of the first record of the segment which is not older
+    size_t low = 0;
+    size_t high = segment->index_len - 1;
+    while (low < high) {
+      const size_t middle = low + (high - low) / 2;
+      if (log_get_u64(segment->map + segment->index[middle] + 8) < time_ms) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    return segment->base + low;
+  }
+  return log_group->next;
+}
+
+/**
+ * @brief get a record of a group log. The frame is not copied: it points into the mapped segment and it's valid
+ * only while the log group lock, which must be held by the caller, is held
+ * @param OctopipesLogGroup* log group
+ * @param uint64_t offset
+ * @param size_t* data size
+ * @return const uint8_t*: NULL if there's no record at offset
+ */
+
+const uint8_t* octopipes_log_read(OctopipesLogGroup* log_group, const uint64_t offset, size_t* data_size) {
+  if (log_group->segments_len == 0 || offset >= log_group->next || offset < log_group->segments[0].base) {
+    return NULL;
+  }
+  //Binary search of the last segment starting at or before offset
+  size_t low = 0;
+  size_t high = log_group->segments_len - 1;
+  while (low < high) {
+    const size_t middle = high - (high - low) / 2;
+    if (log_group->segments[middle].base <= offset) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  const OctopipesLogSegment* segment = &log_group->segments[low];
+  if (offset - segment->base >= segment->index_len) {
+    return NULL;
+  }
+  const uint8_t* record = segment->map + segment->index[offset - segment->base];
+  *data_size = log_get_u32(record);
+  return record + RECORD_HEADER_SIZE;
+}
+
+/**
+ * @brief hash a group name (FNV-1a)
+ * @param char* group
+ * @return uint32_t
+ */
+
+uint32_t log_hash(const char* group) {
+  uint32_t hash = 2166136261u;
+  for (const char* c = group; *c != 0x00; c++) {
+    hash ^= (uint8_t) *c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief find a loaded group; log lock must be held by the caller
+ * @param OctopipesLog* log
+ * @param char* group
+ * @param uint32_t hash of group
+ * @return OctopipesLogGroup*: NULL if not loaded
+ */
+
+OctopipesLogGroup* log_find(OctopipesLog* log, const char* group, const uint32_t hash) {
+  if (log->groups_map_size == 0) {
+    return NULL;
+  }
+  const size_t mask = log->groups_map_size - 1;
+  for (size_t slot = hash & mask; log->groups_map[slot] != NULL; slot = (slot + 1) & mask) {
+    OctopipesLogGroup* log_group = log->groups_map[slot];
+    if (log_group->hash == hash && strcmp(log_group->group, group) == 0) {
+      return log_group;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief insert a group into the groups map, growing it if needed; log lock must be write locked by the caller
+ * @param OctopipesLog* log
+ * @param OctopipesLogGroup* log group
+ * @return OctopipesError
+ */
+
+OctopipesError log_insert(OctopipesLog* log, OctopipesLogGroup* log_group) {
+  if ((log->groups_len + 1) * 2 > log->groups_map_size) {
+    const size_t new_size = log->groups_map_size > 0 ? log->groups_map_size * 2 : GROUPS_INITIAL_SIZE;
+    OctopipesLogGroup** new_map = (OctopipesLogGroup**) calloc(new_size, sizeof(OctopipesLogGroup*));
+    if (new_map == NULL) {
+      return OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    for (size_t i = 0; i < log->groups_map_size; i++) {
+      OctopipesLogGroup* moved = log->groups_map[i];
+      if (moved != NULL) {
+        size_t slot = moved->hash & (new_size - 1);
+        while (new_map[slot] != NULL) {
+          slot = (slot + 1) & (new_size - 1);
+        }
+        new_map[slot] = moved;
+      }
+    }
+    free(log->groups_map);
+    log->groups_map = new_map;
+    log->groups_map_size = new_size;
+  }
+  size_t slot = log_group->hash & (log->groups_map_size - 1);
+  while (log->groups_map[slot] != NULL) {
+    slot = (slot + 1) & (log->groups_map_size - 1);
+  }
+  log->groups_map[slot] = log_group;
+  log->groups_len++;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief load a group log, recovering the segments found in its directory; log lock must be write locked by the caller
+ * @param OctopipesLog* log
+ * @param char* group
+ * @param uint32_t hash of group
+ * @param int create: if set, the group directory is created if it doesn't exist
+ * @param OctopipesLogGroup** log group
+ * @return OctopipesError
+ */
+
+OctopipesError log_group_load(OctopipesLog* log, const char* group, const uint32_t hash, const int create, OctopipesLogGroup** log_group) {
+  *log_group = NULL;
+  char* name = log_encode_name(group);
+  if (name == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  const size_t path_len = strlen(log->directory) + 1 + strlen(name);
+  char* path = (char*) malloc(sizeof(char) * (path_len + 1));
+  if (path == NULL) {
+    free(name);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  sprintf(path, "%s/%s", log->directory, name);
+  free(name);
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    if (!create) {
+      free(path);
+      return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+    }
+    if (mkdir(path, 0755) != 0) {
+      free(path);
+      return OCTOPIPES_ERROR_OPEN_FAILED;
+    }
+  }
+  OctopipesLogGroup* ptr = (OctopipesLogGroup*) malloc(sizeof(OctopipesLogGroup));
+  if (ptr == NULL) {
+    free(path);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  const size_t group_len = strlen(group);
+  ptr->group = (char*) malloc(sizeof(char) * (group_len + 1));
+  if (ptr->group == NULL) {
+    free(path);
+    free(ptr);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  memcpy(ptr->group, group, group_len + 1);
+  ptr->path = path;
+  ptr->hash = hash;
+  pthread_mutex_init(&ptr->lock, NULL);
+  ptr->segments = NULL;
+  ptr->segments_len = 0;
+  ptr->next = 0;
+  ptr->bytes = 0;
+  ptr->log = log;
+  //Collect the base offsets of the segments
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  uint64_t* bases = NULL;
+  size_t bases_len = 0;
+  size_t bases_size = 0;
+  DIR* dir;
+  if ((dir = opendir(path)) == NULL) {
+    rc = OCTOPIPES_ERROR_OPEN_FAILED;
+    goto load_error;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    char* extension;
+    const uint64_t base = strtoull(entry->d_name, &extension, 10);
+    if (strlen(entry->d_name) != SEGMENT_NAME_LEN || strcmp(extension, SEGMENT_EXTENSION) != 0) {
+      continue;
+    }
+    if (bases_len == bases_size) {
+      bases_size = bases_size > 0 ? bases_size * 2 : SEGMENTS_INITIAL_SIZE;
+      uint64_t* new_bases = (uint64_t*) realloc(bases, sizeof(uint64_t) * bases_size);
+      if (new_bases == NULL) {
+        closedir(dir);
+        rc = OCTOPIPES_ERROR_BAD_ALLOC;
+        goto load_error;
+      }
+      bases = new_bases;
+    }
+    bases[bases_len++] = base;
+  }
+  closedir(dir);
+  qsort(bases, bases_len, sizeof(uint64_t), log_compare_offsets);
+  //Map the segments, oldest first
+  if (bases_len > 0) {
+    ptr->segments = (OctopipesLogSegment*) malloc(sizeof(OctopipesLogSegment) * bases_len);
+    if (ptr->segments == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+      goto load_error;
+    }
+  }
+  for (size_t i = 0; i < bases_len; i++) {
+    char* segment_path = log_segment_path(path, bases[i]);
+    if (segment_path == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+      goto load_error;
+    }
+    OctopipesLogSegment* segment = &ptr->segments[ptr->segments_len];
+    if ((rc = log_segment_recover(segment, segment_path, bases[i])) == OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      //Empty file: the server stopped before it was sized
+      unlink(segment_path);
+      free(segment_path);
+      rc = OCTOPIPES_ERROR_SUCCESS;
+      continue;
+    } else if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      goto load_error;
+    }
+    ptr->segments_len++;
+    ptr->bytes += segment->used;
+    ptr->next = segment->base + segment->index_len;
+  }
+  if ((rc = log_insert(log, ptr)) != OCTOPIPES_ERROR_SUCCESS) {
+    goto load_error;
+  }
+  //Segments which expired while the server was stopped
+  log_retain(ptr);
+  free(bases);
+  *log_group = ptr;
+  return OCTOPIPES_ERROR_SUCCESS;
+
+load_error:
+  free(bases);
+  log_group_cleanup(ptr);
+  return rc;
+}
+
+/**
+ * @brief unmap the segments of a group log and free it
+ * @param OctopipesLogGroup* log group
+ */
+
+void log_group_cleanup(OctopipesLogGroup* log_group) {
+  for (size_t i = 0; i < log_group->segments_len; i++) {
+    log_segment_close(&log_group->segments[i]);
+  }
+  free(log_group->segments);
+  free(log_group->group);
+  free(log_group->path);
+  pthread_mutex_destroy(&log_group->lock);
+  free(log_group);
+}
+
+/**
+ * @brief start a new segment for a record which doesn't fit the current one, then apply the retention; log group lock must be held by the caller
+ * @param OctopipesLogGroup* log group
+ * @param size_t record size
+ * @return OctopipesError
+ */
+
+OctopipesError log_roll(OctopipesLogGroup* log_group, const size_t record_size) {
+  OctopipesLog* log = log_group->log;
+  const size_t size = record_size > log->segment_size ? record_size : log->segment_size;
+  if (log_group->segments_len > 0) {
+    OctopipesLogSegment* last = &log_group->segments[log_group->segments_len - 1];
+    if (last->index_len == 0) {
+      //An empty segment would have the same name of the new one
+      unlink(last->path);
+      log_segment_close(last);
+      log_group->segments_len--;
+    } else {
+      //Segment is complete, start writing it back
+      msync(last->map, last->size, MS_ASYNC);
+    }
+  }
+  OctopipesLogSegment* new_segments = (OctopipesLogSegment*) realloc(log_group->segments, sizeof(OctopipesLogSegment) * (log_group->segments_len + 1));
+  if (new_segments == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  log_group->segments = new_segments;
+  char* path = log_segment_path(log_group->path, log_group->next);
+  if (path == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  OctopipesError rc;
+  if ((rc = log_segment_create(&log_group->segments[log_group->segments_len], path, log_group->next, size)) != OCTOPIPES_ERROR_SUCCESS) {
+    return rc;
+  }
+  log_group->segments_len++;
+  log_retain(log_group);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief delete the oldest segments while the group log exceeds the retention size or they're older than the retention age.
+ * The segment being appended to is never deleted; log group lock must be held by the caller
+ * @param OctopipesLogGroup* log group
+ */
+
+void log_retain(OctopipesLogGroup* log_group) {
+  OctopipesLog* log = log_group->log;
+  const uint64_t now = octopipes_get_epoch_ms();
+  while (log_group->segments_len > 1) {
+    OctopipesLogSegment* oldest = &log_group->segments[0];
+    const int too_large = log->retention_bytes > 0 && log_group->bytes > log->retention_bytes;
+    const int too_old = log->retention_age > 0 && log_segment_time(oldest) + log->retention_age < now;
+    if (!too_large && !too_old) {
+      break;
+    }
+    log_group->bytes -= oldest->used;
+    unlink(oldest->path);
+    log_segment_close(oldest);
+    log_group->segments_len--;
+    memmove(log_group->segments, log_group->segments + 1, sizeof(OctopipesLogSegment) * log_group->segments_len);
+  }
+}
+
+/**
+ * @brief create a segment file and map it
+ * @param OctopipesLogSegment* segment
+ * @param char* path (the segment takes it)
+ * @param uint64_t base offset
+ * @param size_t size of the file
+ * @return OctopipesError
+ */
+
+OctopipesError log_segment_create(OctopipesLogSegment* segment, char* path, const uint64_t base, const size_t size) {
+  const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    free(path);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  //The file is sparse: blocks are allocated as records are written
+  if (ftruncate(fd, (off_t) size) != 0) {
+    close(fd);
+    unlink(path);
+    free(path);
+    return OCTOPIPES_ERROR_WRITE_FAILED;
+  }
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    unlink(path);
+    free(path);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  segment->base = base;
+  segment->map = (uint8_t*) map;
+  segment->size = size;
+  segment->used = 0;
+  segment->index = NULL;
+  segment->index_len = 0;
+  segment->index_size = 0;
+  segment->path = path;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief map an existing segment file and index its records. The scan stops at the first record which is not a
+ * complete frame (the server stopped while writing it): the segment is appended to from there
+ * @param OctopipesLogSegment* segment
+ * @param char* path (the segment takes it)
+ * @param uint64_t base offset
+ * @return OctopipesError: OCTOPIPES_ERROR_NO_DATA_AVAILABLE if the file is empty (path is not taken)
+ */
+
+OctopipesError log_segment_recover(OctopipesLogSegment* segment, char* path, const uint64_t base) {
+  const int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    free(path);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    free(path);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  } else if (st.st_size == 0) {
+    close(fd);
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  const size_t size = (size_t) st.st_size;
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    free(path);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  segment->base = base;
+  segment->map = (uint8_t*) map;
+  segment->size = size;
+  segment->used = 0;
+  segment->index = NULL;
+  segment->index_len = 0;
+  segment->index_size = 0;
+  segment->path = path;
+  while (segment->used + RECORD_HEADER_SIZE <= size) {
+    const size_t position = segment->used;
+    const size_t data_size = log_get_u32(segment->map + position);
+    if (data_size == 0) {
+      break;
+    }
+    OctopipesMessage* message;
+    if (data_size > size - position - RECORD_HEADER_SIZE || octopipes_decode(segment->map + position + RECORD_HEADER_SIZE, data_size, &message) != OCTOPIPES_ERROR_SUCCESS) {
+      //Clear the broken record, so it's not mistaken for a record once it's partially overwritten
+      const size_t broken = data_size < size - position - RECORD_HEADER_SIZE ? data_size + RECORD_HEADER_SIZE : size - position;
+      memset(segment->map + position, 0x00, broken);
+      break;
+    }
+    octopipes_cleanup_message(message);
+    OctopipesError rc;
+    if ((rc = log_segment_index(segment, position)) != OCTOPIPES_ERROR_SUCCESS) {
+      log_segment_close(segment);
+      return rc;
+    }
+    segment->used += RECORD_HEADER_SIZE + data_size;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief unmap a segment and free its index
+ * @param OctopipesLogSegment* segment
+ */
+
+void log_segment_close(OctopipesLogSegment* segment) {
+  munmap(segment->map, segment->size);
+  free(segment->index);
+  free(segment->path);
+}
+
+/**
+ * @brief add the position of a record to the index of a segment
+ * @param OctopipesLogSegment* segment
+ * @param size_t position of the record in the segment
+ * @return OctopipesError
+ */
+
+OctopipesError log_segment_index(OctopipesLogSegment* segment, const size_t position) {
+  if (segment->index_len == segment->index_size) {
+    const size_t new_size = segment->index_size > 0 ? segment->index_size * 2 : INDEX_INITIAL_SIZE;
+    size_t* new_index = (size_t*) realloc(segment->index, sizeof(size_t) * new_size);
+    if (new_index == NULL) {
+      return OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    segment->index = new_index;
+    segment->index_size = new_size;
+  }
+  segment->index[segment->index_len++] = position;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the time the last record of a segment was appended at
+ * @param OctopipesLogSegment* segment
+ * @return uint64_t: 0 if the segment is empty
+ */
+
+uint64_t log_segment_time(const OctopipesLogSegment* segment) {
+  if (segment->index_len == 0) {
+    return 0;
+  }
+  return log_get_u64(segment->map + segment->index[segment->index_len - 1] + 8);
+}
+
+/**
+ * @brief get the path of a segment: segments are named after their base offset, so they sort by name
+ * @param char* directory
+ * @param uint64_t base offset
+ * @return char* (must be freed)
+ */
+
+char* log_segment_path(const char* directory, const uint64_t base) {
+  char* path = (char*) malloc(sizeof(char) * (strlen(directory) + 1 + SEGMENT_NAME_LEN + 1));
+  if (path == NULL) {
+    return NULL;
+  }
+  sprintf(path, "%s/%020" PRIu64 SEGMENT_EXTENSION, directory, base);
+  return path;
+}
+
+/**
+ * @brief encode a group as a directory name: characters other than letters, digits, '-' and '_' are written as '%XX'
+ * @param char* group
+ * @return char* (must be freed)
+ */
+
+char* log_encode_name(const char* group) {
+  const size_t group_len = strlen(group);
+  char* name = (char*) malloc(sizeof(char) * (group_len * 3 + 1));
+  if (name == NULL) {
+    return NULL;
+  }
+  size_t name_len = 0;
+  for (size_t i = 0; i < group_len; i++) {
+    const uint8_t c = (uint8_t) group[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+      name[name_len++] = (char) c;
+    } else {
+      sprintf(name + name_len, "%%%02X", c);
+      name_len += 3;
+    }
+  }
+  name[name_len] = 0x00;
+  return name;
+}
+
+/**
+ * @brief decode a directory name made by log_encode_name
+ * @param char* name
+ * @return char*: NULL if name is not an encoded group (must be freed)
+ */
+
+char* log_decode_name(const char* name) {
+  const size_t name_len = strlen(name);
+  if (name_len == 0) {
+    return NULL;
+  }
+  char* group = (char*) malloc(sizeof(char) * (name_len + 1));
+  if (group == NULL) {
+    return NULL;
+  }
+  size_t group_len = 0;
+  for (size_t i = 0; i < name_len; i++) {
+    const char c = name[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+      group[group_len++] = c;
+      continue;
+    }
+    const int high = c == '%' && i + 2 < name_len ? log_hex_value(name[i + 1]) : -1;
+    const int low = high != -1 ? log_hex_value(name[i + 2]) : -1;
+    if (low == -1 || (high == 0 && low == 0)) {
+      free(group);
+      return NULL;
+    }
+    group[group_len++] = (char) (high * 16 + low);
+    i += 2;
+  }
+  group[group_len] = 0x00;
+  return group;
+}
+
+/**
+ * @brief get the value of an uppercase hex digit
+ * @param char c
+ * @return int: -1 if c is not a hex digit
+ */
+
+int log_hex_value(const char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief read a big endian 32 bit integer
+ * @param uint8_t* data
+ * @return uint32_t
+ */
+
+uint32_t log_get_u32(const uint8_t* data) {
+  return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+/**
+ * @brief read a big endian 64 bit integer
+ * @param uint8_t* data
+ * @return uint64_t
+ */
+
+uint64_t log_get_u64(const uint8_t* data) {
+  return ((uint64_t) log_get_u32(data) << 32) | log_get_u32(data + 4);
+}
+
+/**
+ * @brief write a big endian 32 bit integer
+ * @param uint8_t* data
+ * @param uint32_t value
+ */
+
+void log_put_u32(uint8_t* data, const uint32_t value) {
+  data[0] = (uint8_t) (value >> 24);
+  data[1] = (uint8_t) (value >> 16);
+  data[2] = (uint8_t) (value >> 8);
+  data[3] = (uint8_t) value;
+}
+
+/**
+ * @brief write a big endian 64 bit integer
+ * @param uint8_t* data
+ * @param uint64_t value
+ */
+
+void log_put_u64(uint8_t* data, const uint64_t value) {
+  log_put_u32(data, (uint32_t) (value >> 32));
+  log_put_u32(data + 4, (uint32_t) value);
+}
+
+/**
+ * @brief compare two offsets for qsort
+ * @param void* a
+ * @param void* b
+ * @return int
+ */
+
+int log_compare_offsets(const void* a, const void* b) {
+  const uint64_t first = *(const uint64_t*) a;
+  const uint64_t second = *(const uint64_t*) b;
+  return first < second ? -1 : first > second;
+}
+
+#else
+
+//Segments are memory mapped files; the log can't be opened on other systems
+
+OctopipesError octopipes_log_open(OctopipesLog** log, const char* directory, const size_t segment_size, const size_t retention_bytes, const uint64_t retention_age_ms) {
+  return OCTOPIPES_ERROR_OPEN_FAILED;
+}
+
+OctopipesError octopipes_log_close(OctopipesLog* log) {
+  return OCTOPIPES_ERROR_UNINITIALIZED;
+}
+
+OctopipesError octopipes_log_get_group(OctopipesLog* log, const char* group, const int create, OctopipesLogGroup** log_group) {
+  return OCTOPIPES_ERROR_UNINITIALIZED;
+}
+
+OctopipesError octopipes_log_set_max_groups(OctopipesLog* log, const size_t max_groups) {
+  return OCTOPIPES_ERROR_UNINITIALIZED;
+}
+
+OctopipesError octopipes_log_get_groups(OctopipesLog* log, char*** groups, size_t* groups_len) {
+  return OCTOPIPES_ERROR_UNINITIALIZED;
+}
+
+OctopipesError octopipes_log_append(OctopipesLogGroup* log_group, const uint8_t* data, const size_t data_size, uint64_t* offset) {
+  return OCTOPIPES_ERROR_UNINITIALIZED;
+}
+
+uint64_t octopipes_log_first(OctopipesLogGroup* log_group) {
+  return 0;
+}
+
+uint64_t octopipes_log_seek_time(OctopipesLogGroup* log_group, const uint64_t time_ms) {
+  return 0;
+}
+
+const uint8_t* octopipes_log_read(OctopipesLogGroup* log_group, const uint64_t offset, size_t* data_size) {
+  return NULL;
+}
+
+#endif
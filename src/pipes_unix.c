@@ -178,7 +178,7 @@ OctopipesError pipe_receive(const char* fifo, uint8_t** data, size_t* data_size,
 }
 
 /**
- * @brief send a message through a FIFO
+ * @brief send a message through a FIFO; symlinks and files which are not FIFOs are refused
  * @param char* fifo file path
  * @param uint8_t* data to send
  * @param size_t data size
@@ -192,12 +192,16 @@ OctopipesError pipe_send(const char* fifo, const uint8_t* data, const size_t dat
   OctopipesError rc = OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
   size_t total_bytes_written = 0; //Must be == data_size to succeed
   //Open FIFO
+  fds[0].fd = -1;
   time_t elapsed_time = 0;
   while (elapsed_time < timeout) {
-    fds[0].fd = open(fifo, O_WRONLY | O_NONBLOCK); //Keep trying opening the pipe
+    fds[0].fd = open(fifo, O_WRONLY | O_NONBLOCK | O_NOFOLLOW); //Keep trying opening the pipe
     if (fds[0].fd != -1) {
       break;
     }
+    if (errno == ELOOP) {
+      return OCTOPIPES_ERROR_OPEN_FAILED; //Path is a symlink
+    }
     elapsed_time += 50;
     usleep(50000); //50ms
   }
@@ -205,23 +209,34 @@ OctopipesError pipe_send(const char* fifo, const uint8_t* data, const size_t dat
     //Open failed
     return OCTOPIPES_ERROR_OPEN_FAILED;
   }
+  struct stat fifo_stat;
+  if (fstat(fds[0].fd, &fifo_stat) != 0 || !S_ISFIFO(fifo_stat.st_mode)) {
+    close(fds[0].fd);
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
   fds[0].events = POLLOUT;
   //Poll FIFO
   while (total_bytes_written < data_size) {
     ret = poll(fds, 1, timeout);
-    if (ret > 0) {
-      // Fifo is available to be written
-      if (fds[0].revents & POLLOUT) {
-        //Write data to FIFO
-        const size_t remaining_bytes = data_size - total_bytes_written;
-        //It's not obvious the data will be written in one shot, so just in case sum total_bytea_written to buffer index and write only remaining bytes
-        const size_t bytes_written = write(fds[0].fd, data + total_bytes_written, remaining_bytes);
-        //Then sum bytes written to total bytes written
-        total_bytes_written += bytes_written;
+    if (ret > 0 && (fds[0].revents & POLLOUT)) {
+      //Write data to FIFO
+      const size_t remaining_bytes = data_size - total_bytes_written;
+      //It's not obvious the data will be written in one shot, so just in case sum total_bytea_written to buffer index and write only remaining bytes
+      //NOTE: writes of at most PIPE_BUF bytes are atomic: they're either written entirely or fail with EAGAIN
+      const ssize_t bytes_written = write(fds[0].fd, data + total_bytes_written, remaining_bytes);
+      if (bytes_written == -1) {
+        if (errno == EAGAIN) {
+          continue; //Pipe is full, poll again
+        }
+        rc = OCTOPIPES_ERROR_WRITE_FAILED;
+        break;
       }
+      //Then sum bytes written to total bytes written
+      total_bytes_written += bytes_written;
     } else {
       //Could not write or nobody was listening
       rc = OCTOPIPES_ERROR_WRITE_FAILED;
+      break;
     }
   }
   close(fds[0].fd);
@@ -231,4 +246,142 @@ OctopipesError pipe_send(const char* fifo, const uint8_t* data, const size_t dat
   return rc;
 }
 
+/**
+ * @brief open a FIFO to be read with pipe_read; the FIFO is opened for writing too, so it has always a writer and doesn't hang up between writes
+ * @param char* fifo file path
+ * @param int* fd
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_open(const char* fifo, int* fd) {
+  *fd = open(fifo, O_RDWR | O_NONBLOCK);
+  if (*fd == -1) {
+    return OCTOPIPES_ERROR_OPEN_FAILED;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief wait up to timeout for data on a FIFO opened with pipe_open, then read everything available
+ * @param int fd
+ * @param uint8_t** buffer to store received data
+ * @param size_t data buffer size
+ * @param int timeout in milliseconds
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_read(const int fd, uint8_t** data, size_t* data_size, const int timeout) {
+  struct pollfd fds[1];
+  OctopipesError rc = OCTOPIPES_ERROR_SUCCESS;
+  *data = NULL;
+  *data_size = 0;
+  fds[0].fd = fd;
+  fds[0].events = POLLIN | POLLRDBAND;
+  const int ret = poll(fds, 1, timeout);
+  if (ret == 0 || (ret == -1 && errno == EINTR)) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  } else if (ret == -1 || (fds[0].revents & (POLLERR | POLLNVAL))) {
+    return OCTOPIPES_ERROR_READ_FAILED;
+  }
+  //Read until the FIFO is empty
+  while (1) {
+    uint8_t buffer[2048];
+    const ssize_t bytes_read = read(fd, buffer, 2048);
+    if (bytes_read == -1) {
+      if (errno != EAGAIN) {
+        rc = OCTOPIPES_ERROR_READ_FAILED;
+      }
+      break;
+    } else if (bytes_read == 0) {
+      break;
+    }
+    uint8_t* new_data = (uint8_t*) realloc(*data, sizeof(uint8_t) * (*data_size + bytes_read));
+    if (new_data == NULL) {
+      rc = OCTOPIPES_ERROR_BAD_ALLOC;
+      break;
+    }
+    memcpy(new_data + *data_size, buffer, bytes_read);
+    *data = new_data;
+    *data_size += bytes_read;
+  }
+  if (rc != OCTOPIPES_ERROR_SUCCESS || *data_size == 0) {
+    free(*data);
+    *data = NULL;
+    *data_size = 0;
+    return rc == OCTOPIPES_ERROR_SUCCESS ? OCTOPIPES_ERROR_NO_DATA_AVAILABLE : rc;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief write data to a FIFO opened with pipe_open without blocking. If the FIFO is full, written is set to the bytes which fit (even 0)
+ * @param int fd
+ * @param uint8_t* data to write
+ * @param size_t data size
+ * @param size_t* bytes written
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_write(const int fd, const uint8_t* data, const size_t data_size, size_t* written) {
+  *written = 0;
+  while (*written < data_size) {
+    const ssize_t bytes_written = write(fd, data + *written, data_size - *written);
+    if (bytes_written == -1) {
+      if (errno == EINTR) {
+        continue;
+      } else if (errno == EAGAIN) {
+        break;
+      }
+      return OCTOPIPES_ERROR_WRITE_FAILED;
+    }
+    *written += bytes_written;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief wait up to timeout until a FIFO opened with pipe_open has data to read or another one has room to write
+ * @param int fd to wait for data on (-1 to wait only for write_fd)
+ * @param int fd to wait for room on (-1 to wait only for read_fd)
+ * @param int timeout in milliseconds
+ * @param int* readable: set if read_fd has data
+ * @param int* writable: set if write_fd can be written (or if writing it would fail, so the error is reported by pipe_write)
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_wait(const int read_fd, const int write_fd, const int timeout, int* readable, int* writable) {
+  struct pollfd fds[2];
+  *readable = 0;
+  *writable = 0;
+  fds[0].fd = read_fd;
+  fds[0].events = POLLIN | POLLRDBAND;
+  fds[0].revents = 0;
+  fds[1].fd = write_fd;
+  fds[1].events = POLLOUT;
+  fds[1].revents = 0;
+  //Negative descriptors are ignored by poll
+  const int ret = poll(fds, 2, timeout);
+  if (ret == 0 || (ret == -1 && errno == EINTR)) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  } else if (ret == -1 || (fds[0].revents & (POLLERR | POLLNVAL))) {
+    return OCTOPIPES_ERROR_READ_FAILED;
+  }
+  *readable = (fds[0].revents & (POLLIN | POLLRDBAND)) != 0;
+  *writable = fds[1].revents != 0;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief close a FIFO opened with pipe_open
+ * @param int fd
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_close(const int fd) {
+  if (close(fd) != 0) {
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
 #endif
@@ -202,4 +202,71 @@ OctopipesError pipe_send(const char* fifo, const uint8_t* data, const size_t dat
   return OCTOPIPES_ERROR_READ_FAILED;
 }
 
+/**
+ * @brief open a FIFO to be read with pipe_read
+ * @param char* fifo path
+ * @param int* fd
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_open(const char* fifo, int* fd) {
+  *fd = -1;
+  return OCTOPIPES_ERROR_OPEN_FAILED;
+}
+
+/**
+ * @brief wait up to timeout for data on a FIFO opened with pipe_open, then read everything available
+ * @param int fd
+ * @param uint8_t** buffer to store received data
+ * @param size_t data buffer size
+ * @param int timeout in milliseconds
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_read(const int fd, uint8_t** data, size_t* data_size, const int timeout) {
+  *data = NULL;
+  *data_size = 0;
+  return OCTOPIPES_ERROR_READ_FAILED;
+}
+
+/**
+ * @brief write data to a FIFO opened with pipe_open without blocking. If the FIFO is full, written is set to the bytes which fit (even 0)
+ * @param int fd
+ * @param uint8_t* data to write
+ * @param size_t data size
+ * @param size_t* bytes written
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_write(const int fd, const uint8_t* data, const size_t data_size, size_t* written) {
+  *written = 0;
+  return OCTOPIPES_ERROR_WRITE_FAILED;
+}
+
+/**
+ * @brief wait up to timeout until a FIFO opened with pipe_open has data to read or another one has room to write
+ * @param int fd to wait for data on (-1 to wait only for write_fd)
+ * @param int fd to wait for room on (-1 to wait only for read_fd)
+ * @param int timeout in milliseconds
+ * @param int* readable
+ * @param int* writable
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_wait(const int read_fd, const int write_fd, const int timeout, int* readable, int* writable) {
+  *readable = 0;
+  *writable = 0;
+  return OCTOPIPES_ERROR_READ_FAILED;
+}
+
+/**
+ * @brief close a FIFO opened with pipe_open
+ * @param int fd
+ * @return OctopipesError
+ */
+
+OctopipesError pipe_close(const int fd) {
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
 #endif
@@ -25,9 +25,9 @@
 
 #include <string.h>
 
-#define SOH 0x01
-#define STX 0x02
-#define ETX 0x03
+#define SOH OCTOPIPES_SOH
+#define STX OCTOPIPES_STX
+#define ETX OCTOPIPES_ETX
 
 /**
  * @brief decode an octopipe message
@@ -122,9 +122,31 @@ OctopipesError octopipes_decode(const uint8_t* data, const size_t data_size, Oct
     }
     //Read data
     current_minimum_size += message_ptr->data_size;
-    if (data_size < message_ptr->data_size) {
+    if (data_size < current_minimum_size) {
+      goto decode_bad_packet;
+    }
+    //Read fields which precede data
+    message_ptr->correlation_id = 0;
+    message_ptr->epoch = 0;
+    message_ptr->sequence = 0;
+    const size_t fields_size = octopipes_get_fields_size(message_ptr->options);
+    if (message_ptr->data_size < fields_size) {
       goto decode_bad_packet;
     }
+    if ((message_ptr->options & (OCTOPIPES_OPTIONS_REQUEST | OCTOPIPES_OPTIONS_REPLY)) != 0) {
+      for (size_t i = 0; i < 4; i++) {
+        message_ptr->correlation_id = (message_ptr->correlation_id << 8) + data[data_ptr++];
+      }
+    }
+    if ((message_ptr->options & OCTOPIPES_OPTIONS_SEQUENCED) != 0) {
+      for (size_t i = 0; i < 4; i++) {
+        message_ptr->epoch = (message_ptr->epoch << 8) + data[data_ptr++];
+      }
+      for (size_t i = 0; i < 4; i++) {
+        message_ptr->sequence = (message_ptr->sequence << 8) + data[data_ptr++];
+      }
+    }
+    message_ptr->data_size -= fields_size;
     if (message_ptr->data_size > 0) {
       message_ptr->data = (uint8_t*) malloc(sizeof(uint8_t) * message_ptr->data_size);
       if (message_ptr->data == NULL) {
@@ -186,76 +208,346 @@ decode_bad_checksum:
   return OCTOPIPES_ERROR_BAD_CHECKSUM;
 }
 
+/**
+ * @brief get the size of the first frame in a stream of frames read from a FIFO
+ * @param uint8_t* data read from FIFO
+ * @param size_t data size
+ * @param size_t* frame size
+ * @return OctopipesError (OCTOPIPES_ERROR_NO_DATA_AVAILABLE if the frame is still incomplete)
+ */
+
+OctopipesError octopipes_get_frame_size(const uint8_t* data, const size_t data_size, size_t* frame_size) {
+  *frame_size = 0;
+  if (data == NULL || data_size == 0) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  if (data[0] != SOH) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  if (data_size < 3) { //SOH + VERSION + LNS
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  if (data[1] != OCTOPIPES_VERSION_1) {
+    return OCTOPIPES_ERROR_UNSUPPORTED_VERSION;
+  }
+  //Remote size follows origin
+  size_t data_ptr = 3 + data[2];
+  if (data_size <= data_ptr) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  data_ptr += 1 + data[data_ptr] + 1; //LND + remote + TTL
+  //Data size
+  if (data_size < data_ptr + 8) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  uint64_t payload_size = 0;
+  for (size_t i = 0; i < 8; i++) {
+    payload_size = (payload_size << 8) + data[data_ptr++];
+  }
+  //Options + checksum + STX + data + ETX; the frame boundaries are lost if it exceeds the maximum frame size
+  if (payload_size > OCTOPIPES_MAX_FRAME_SIZE - data_ptr - 4) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  const size_t size = data_ptr + 3 + payload_size + 1;
+  if (data_size < size) {
+    return OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+  }
+  if (data[size - 1] != ETX) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  *frame_size = size;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief decode the next frame of a stream of frames read from a FIFO; offset is moved after the decoded frame
+ * @param uint8_t* stream
+ * @param size_t stream size
+ * @param size_t* offset of the next frame in the stream
+ * @param OctopipesMessage**
+ * @return OctopipesError (OCTOPIPES_ERROR_NO_DATA_AVAILABLE if there are no more complete frames)
+ */
+
+OctopipesError octopipes_decode_next(const uint8_t* stream, const size_t stream_size, size_t* offset, OctopipesMessage** message) {
+  *message = NULL;
+  size_t frame_size;
+  OctopipesError rc = octopipes_get_frame_size(stream + *offset, stream_size - *offset, &frame_size);
+  if (rc == OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+    return rc;
+  } else if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    //Frame boundaries are lost, discard the rest of the stream
+    *offset = stream_size;
+    return rc;
+  }
+  rc = octopipes_decode(stream + *offset, frame_size, message);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    *message = NULL;
+  }
+  *offset += frame_size;
+  return rc;
+}
+
+/**
+ * @brief append data read from a pipe to a stream; data is moved into the stream, so mustn't be used after call
+ * @param uint8_t** stream
+ * @param size_t* stream length
+ * @param uint8_t* data
+ * @param size_t data length
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_stream_append(uint8_t** stream, size_t* stream_len, uint8_t* data, const size_t data_len) {
+  if (*stream == NULL) {
+    *stream = data;
+    *stream_len = data_len;
+    return OCTOPIPES_ERROR_SUCCESS;
+  }
+  uint8_t* new_stream = (uint8_t*) realloc(*stream, sizeof(uint8_t) * (*stream_len + data_len));
+  if (new_stream == NULL) {
+    free(data);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  memcpy(new_stream + *stream_len, data, data_len);
+  free(data);
+  *stream = new_stream;
+  *stream_len += data_len;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief remove the first bytes from a stream, keeping the incomplete frame for the next read
+ * @param uint8_t** stream
+ * @param size_t* stream length
+ * @param size_t bytes to remove
+ */
+
+void octopipes_stream_consume(uint8_t** stream, size_t* stream_len, const size_t bytes) {
+  *stream_len -= bytes;
+  if (*stream_len == 0) {
+    free(*stream);
+    *stream = NULL;
+  } else if (bytes > 0) {
+    memmove(*stream, *stream + bytes, *stream_len);
+  }
+}
+
 /**
  * @brief encode an OctopipeMessage structure into the buffer to write to the FIFO
  * @param OctopipesMessage* message structure
+ * @param uint8_t** out buffer
  * @param size_t* data size of out buffer
- * @return uint8_t*
+ * @return OctopipesError
  */
 
 OctopipesError octopipes_encode(OctopipesMessage* message, uint8_t** data, size_t* data_size) {
   //Prepare encoding
-  uint8_t* out_data;
+  if (message->version != OCTOPIPES_VERSION_1) {
+    return OCTOPIPES_ERROR_UNSUPPORTED_VERSION;
+  }
+  //Calculate required size
+  const size_t out_data_size = octopipes_get_encoded_size(message);
+  if (out_data_size > OCTOPIPES_MAX_FRAME_SIZE) {
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  uint8_t* out_data = (uint8_t*) malloc(sizeof(uint8_t) * out_data_size);
+  if (out_data == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  OctopipesError rc;
+  if ((rc = octopipes_encode_to(message, out_data, out_data_size, data_size)) != OCTOPIPES_ERROR_SUCCESS) {
+    free(out_data);
+    return rc;
+  }
+  //Assign out data to data
+  *data = out_data;
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief encode an OctopipeMessage structure into a buffer provided by the caller
+ * @param OctopipesMessage* message structure
+ * @param uint8_t* out buffer
+ * @param size_t out buffer size
+ * @param size_t* encoded data size
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_encode_to(OctopipesMessage* message, uint8_t* data, const size_t buffer_size, size_t* data_size) {
   if (message->version == OCTOPIPES_VERSION_1) {
-    //Calculate required size
-    *data_size = 17; //Minimum size
-    *data_size += message->remote_size;
-    *data_size += message->origin_size;
-    *data_size += message->data_size;
-    out_data = (uint8_t*) malloc(sizeof(uint8_t) * *data_size);
-    if (out_data == NULL) {
+    //Check if buffer is big enough
+    *data_size = octopipes_get_encoded_size(message);
+    if (*data_size > OCTOPIPES_MAX_FRAME_SIZE) {
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    if (*data_size > buffer_size) {
       return OCTOPIPES_ERROR_BAD_ALLOC;
     }
-    size_t data_ptr = 0;
-    //SOH
-    out_data[data_ptr++] = SOH;
-    //Version
-    out_data[data_ptr++] = message->version;
-    //Origin / origin_size
-    out_data[data_ptr++] = message->origin_size;
-    memcpy(out_data + data_ptr, message->origin, message->origin_size);
-    data_ptr += message->origin_size;
-    //Remote / remote size
-    out_data[data_ptr++] = message->remote_size;
-    memcpy(out_data + data_ptr, message->remote, message->remote_size);
-    data_ptr += message->remote_size;
-    //TTL
-    out_data[data_ptr++] = message->ttl;
-    //Data size
-    out_data[data_ptr++] = (message->data_size >> 56) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 48) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 40) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 32) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 24) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 16) & 0xFF;
-    out_data[data_ptr++] = (message->data_size >> 8) & 0xFF;
-    out_data[data_ptr++] = message->data_size & 0xFF;
-    //Options
-    out_data[data_ptr++] = message->options;
-    //Keep position of checksum, and go ahead
-    size_t checksum_ptr = data_ptr;
-    data_ptr++;
-    //STX
-    out_data[data_ptr++] = STX;
+    //Write header
+    size_t data_ptr;
+    OctopipesError rc;
+    if ((rc = octopipes_encode_header(message, data, buffer_size, &data_ptr)) != OCTOPIPES_ERROR_SUCCESS) {
+      return rc;
+    }
     //Write data
-    memcpy(out_data + data_ptr, message->data, message->data_size);
+    memcpy(data + data_ptr, message->data, message->data_size);
     data_ptr += message->data_size;
     //Write ETX
-    out_data[data_ptr++] = ETX;
+    data[data_ptr++] = ETX;
     //Checksum as last thing
     message->checksum = 0;
     if ((message->options & OCTOPIPES_OPTIONS_IGNORE_CHECKSUM) == 0) {
       message->checksum = calculate_checksum(message);
     }
-    out_data[checksum_ptr] = message->checksum;
+    data[octopipes_get_checksum_offset(message)] = message->checksum;
   } else {
     return OCTOPIPES_ERROR_UNSUPPORTED_VERSION;
   }
-  //Assign out data to data
-  *data = out_data;
   return OCTOPIPES_ERROR_SUCCESS;
 }
 
+/**
+ * @brief encode the header of an OctopipesMessage (everything until STX); the checksum is left to 0
+ * @param OctopipesMessage* message structure
+ * @param uint8_t* out buffer
+ * @param size_t out buffer size
+ * @param size_t* header size
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_encode_header(const OctopipesMessage* message, uint8_t* data, const size_t buffer_size, size_t* header_size) {
+  if (message->version != OCTOPIPES_VERSION_1) {
+    return OCTOPIPES_ERROR_UNSUPPORTED_VERSION;
+  }
+  const size_t fields_size = octopipes_get_fields_size(message->options);
+  const uint64_t wire_data_size = message->data_size + fields_size;
+  *header_size = octopipes_get_checksum_offset(message) + 2 + fields_size;
+  if (*header_size > buffer_size) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  size_t data_ptr = 0;
+  //SOH
+  data[data_ptr++] = SOH;
+  //Version
+  data[data_ptr++] = message->version;
+  //Origin / origin_size
+  data[data_ptr++] = message->origin_size;
+  memcpy(data + data_ptr, message->origin, message->origin_size);
+  data_ptr += message->origin_size;
+  //Remote / remote size
+  data[data_ptr++] = message->remote_size;
+  memcpy(data + data_ptr, message->remote, message->remote_size);
+  data_ptr += message->remote_size;
+  //TTL
+  data[data_ptr++] = message->ttl;
+  //Data size (fields are part of data)
+  data[data_ptr++] = (wire_data_size >> 56) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 48) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 40) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 32) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 24) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 16) & 0xFF;
+  data[data_ptr++] = (wire_data_size >> 8) & 0xFF;
+  data[data_ptr++] = wire_data_size & 0xFF;
+  //Options
+  data[data_ptr++] = message->options;
+  //Checksum
+  data[data_ptr++] = 0;
+  //STX
+  data[data_ptr++] = STX;
+  //Fields
+  data_ptr += octopipes_encode_fields(message, data + data_ptr);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get the position of the checksum in the encoded message
+ * @param OctopipesMessage*
+ * @return size_t
+ */
+
+size_t octopipes_get_checksum_offset(const OctopipesMessage* message) {
+  //SOH + VER + LNS + origin + LND + remote + TTL + data size + options
+  return 3 + message->origin_size + 1 + message->remote_size + 1 + 8 + 1;
+}
+
+/**
+ * @brief calculate the checksum of an encoded frame (all the bytes but the checksum itself)
+ * @param uint8_t* frame
+ * @param size_t frame size
+ * @param size_t checksum offset
+ * @return uint8_t checksum
+ */
+
+uint8_t calculate_frame_checksum(const uint8_t* frame, const size_t frame_size, const size_t checksum_offset) {
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < frame_size; i++) {
+    if (i != checksum_offset) {
+      checksum = checksum ^ frame[i];
+    }
+  }
+  return checksum;
+}
+
+/**
+ * @brief get the size the message will have once encoded
+ * @param OctopipesMessage*
+ * @return size_t
+ */
+
+size_t octopipes_get_encoded_size(const OctopipesMessage* message) {
+  size_t data_size = 17; //Minimum size
+  data_size += message->remote_size;
+  data_size += message->origin_size;
+  data_size += octopipes_get_fields_size(message->options);
+  data_size += message->data_size;
+  return data_size;
+}
+
+/**
+ * @brief get the size of the fields which precede data for the provided options
+ * @param OctopipesOptions
+ * @return size_t
+ */
+
+size_t octopipes_get_fields_size(const OctopipesOptions options) {
+  size_t fields_size = 0;
+  if ((options & (OCTOPIPES_OPTIONS_REQUEST | OCTOPIPES_OPTIONS_REPLY)) != 0) {
+    fields_size += 4; //Correlation id
+  }
+  if ((options & OCTOPIPES_OPTIONS_SEQUENCED) != 0) {
+    fields_size += 8; //Epoch and sequence
+  }
+  return fields_size;
+}
+
+/**
+ * @brief encode the fields which precede data
+ * @param OctopipesMessage*
+ * @param uint8_t* out buffer
+ * @return size_t fields size
+ */
+
+size_t octopipes_encode_fields(const OctopipesMessage* message, uint8_t* data) {
+  size_t data_ptr = 0;
+  if ((message->options & (OCTOPIPES_OPTIONS_REQUEST | OCTOPIPES_OPTIONS_REPLY)) != 0) {
+    data[data_ptr++] = (message->correlation_id >> 24) & 0xFF;
+    data[data_ptr++] = (message->correlation_id >> 16) & 0xFF;
+    data[data_ptr++] = (message->correlation_id >> 8) & 0xFF;
+    data[data_ptr++] = message->correlation_id & 0xFF;
+  }
+  if ((message->options & OCTOPIPES_OPTIONS_SEQUENCED) != 0) {
+    data[data_ptr++] = (message->epoch >> 24) & 0xFF;
+    data[data_ptr++] = (message->epoch >> 16) & 0xFF;
+    data[data_ptr++] = (message->epoch >> 8) & 0xFF;
+    data[data_ptr++] = message->epoch & 0xFF;
+    data[data_ptr++] = (message->sequence >> 24) & 0xFF;
+    data[data_ptr++] = (message->sequence >> 16) & 0xFF;
+    data[data_ptr++] = (message->sequence >> 8) & 0xFF;
+    data[data_ptr++] = message->sequence & 0xFF;
+  }
+  return data_ptr;
+}
+
 /**
  * @brief calculate checksum for message
  * @param OctopipesMessage*
@@ -275,17 +567,23 @@ uint8_t calculate_checksum(const OctopipesMessage* message) {
       checksum = checksum ^ message->remote[i];
     }
     checksum = checksum ^ message->ttl;
-    //Data size
-    checksum = checksum ^ ((message->data_size >> 56) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 48) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 40) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 32) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 24) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 16) & 0xFF);
-    checksum = checksum ^ ((message->data_size >> 8) & 0xFF);
-    checksum = checksum ^ (message->data_size & 0xFF);
+    //Data size (fields are part of data)
+    uint8_t fields[OCTOPIPES_FIELDS_MAX_SIZE];
+    const size_t fields_size = octopipes_encode_fields(message, fields);
+    const uint64_t wire_data_size = message->data_size + fields_size;
+    checksum = checksum ^ ((wire_data_size >> 56) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 48) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 40) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 32) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 24) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 16) & 0xFF);
+    checksum = checksum ^ ((wire_data_size >> 8) & 0xFF);
+    checksum = checksum ^ (wire_data_size & 0xFF);
     checksum = checksum ^ message->options;
     checksum = checksum ^ STX;
+    for (size_t i = 0; i < fields_size; i++) {
+      checksum = checksum ^ fields[i];
+    }
     for (size_t i = 0; i < message->data_size; i++) {
       checksum = checksum ^ message->data[i];
     }
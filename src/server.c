@@ -21,12 +21,22 @@
  * SOFTWARE.
 **/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE //pthread_setaffinity_np
+#endif
+
 #include <octopipes/octopipes.h>
 #include <octopipes/cap.h>
+#include <octopipes/log.h>
 #include <octopipes/pipes.h>
 #include <octopipes/serializer.h>
+#include <octopipes/timer.h>
 
 #include <dirent.h>
+#include <stddef.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -37,30 +47,117 @@
 //CAP
 OctopipesServerError octopipes_server_lock_cap(OctopipesServer* server);
 OctopipesServerError octopipes_server_unlock_cap(OctopipesServer* server);
-OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const char* client, const uint8_t* data, const size_t data_size);
+OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const char* client, const char* reply_pipe, const uint8_t* data, const size_t data_size);
+int cap_reply_pipe_valid(OctopipesServer* server, const char* client, const char* reply_pipe);
+int client_id_valid(const char* client);
 OctopipesServerError octopipes_server_handle_cap_message(OctopipesServer* server, OctopipesMessage* message);
 OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char* client, const uint8_t* payload, const size_t payload_len);
 OctopipesServerError cap_manage_unsubscription(OctopipesServer* server, const char* client, const uint8_t* payload, const size_t payload_len);
+OctopipesServerError cap_manage_groups_update(OctopipesServer* server, const char* client, const uint8_t* payload, const size_t payload_len);
 //Workers
-OctopipesServerError octopipes_server_dispatch_message(OctopipesServer* server, OctopipesMessage* message, const char** worker);
-OctopipesServerError worker_init(OctopipesServerWorker** worker, const char** subcsriptions, const size_t sub_len, const char* client_id, const char* pipe_read, const char* pipe_write);
+OctopipesServerError dispatch_message_locked(OctopipesServer* server, OctopipesMessage* message, const uint64_t expires, const char** worker, OctopipesServerRoute* route);
+OctopipesServerError worker_start(OctopipesServer* server, const char* client, char** subscriptions, const size_t subscription_len, const char* cli_tx_pipe, const char* cli_rx_pipe, const OctopipesSubscriptionFlags flags, const uint64_t from);
+OctopipesServerError worker_init(OctopipesServerWorker** worker, const char** subcsriptions, const size_t sub_len, const char* client_id, const char* pipe_read, const char* pipe_write, const size_t queue_size, const OctopipesServerOverflowPolicy policy, const OctopipesServerRateLimit* rate_limit, const OctopipesServerCredits* credits, OctopipesServerMemory* memory, OctopipesServerDispatchers* dispatchers, OctopipesServerDisconnects* disconnects);
+void worker_notify(OctopipesServerWorker* worker);
+void worker_drop_frames(OctopipesServerOutbound* outbound);
 OctopipesServerError worker_cleanup(OctopipesServerWorker* worker);
-OctopipesServerError worker_send(OctopipesServerWorker* worker, OctopipesMessage* message);
+OctopipesServerError worker_send(OctopipesServerWorker* worker, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires, const char* group, const uint64_t log_offset);
+OctopipesServerError worker_flush(OctopipesServerWorker* worker, int* pending);
 OctopipesServerError worker_get_next_message(OctopipesServerWorker* worker, OctopipesServerMessage** message);
+int worker_has_messages(OctopipesServerWorker* worker);
 OctopipesServerError worker_get_subscriptions(OctopipesServerWorker* worker, char*** groups, size_t* groups_len);
-int worker_match_subscription(OctopipesServerWorker* worker, const char* remote);
+int worker_has_subscription(OctopipesServerWorker* worker, const char* group);
+OctopipesServerError worker_add_subscriptions(OctopipesServerWorker* worker, const char** groups, const size_t groups_len);
+OctopipesServerError worker_remove_subscriptions(OctopipesServerWorker* worker, const char** groups, const size_t groups_len);
+//Workers map
+OctopipesServerWorker* workers_find(OctopipesServer* server, const char* client);
+int workers_contains(OctopipesServer* server, const OctopipesServerWorker* worker, const uint32_t hash);
+OctopipesServerError workers_insert(OctopipesServer* server, OctopipesServerWorker* worker);
+void workers_remove(OctopipesServer* server, OctopipesServerWorker* worker);
+void workers_disconnect(OctopipesServer* server);
+void worker_notify_disconnect(OctopipesServerWorker* worker);
+//Routing trie
+OctopipesServerError trie_node_init(OctopipesServerTrieNode** node, const char* level, const size_t level_len);
+void trie_node_cleanup(OctopipesServerTrieNode* node);
+size_t trie_level_len(const char* level);
+int trie_find_child(OctopipesServerTrieNode* node, const char* level, const size_t level_len, size_t* index);
+OctopipesServerTrieNode** trie_wildcard_slot(OctopipesServerTrieNode* node, const char* level, const size_t level_len, const int last);
+OctopipesServerError trie_walk(OctopipesServerTrieNode* root, const char* group, const int create, OctopipesServerTrieNode** node);
+OctopipesServerError trie_insert(OctopipesServerTrieNode* root, const char* group, OctopipesServerWorker* worker);
+void trie_remove(OctopipesServerTrieNode* root, const char* group, OctopipesServerWorker* worker);
+int trie_remove_level(OctopipesServerTrieNode* node, const char* level, OctopipesServerWorker* worker);
+OctopipesServerError trie_match(OctopipesServerTrieNode* node, const char* level, OctopipesServerRoute* route);
+OctopipesServerError route_add_subscribers(OctopipesServerRoute* route, OctopipesServerTrieNode* node);
+void route_init(OctopipesServerRoute* route, OctopipesServerWorker** workers, OctopipesServerHandler** handlers);
+void route_drop_handlers(OctopipesServerRoute* route);
+void route_cleanup(OctopipesServerRoute* route);
+
+//Dispatchers
+void shard_process(OctopipesServerShard* shard);
+void shard_push(OctopipesServerShard* shard, OctopipesServerWorker* worker);
+OctopipesServerWorker* shard_pop(OctopipesServerShard* shard);
+void shard_remove(OctopipesServerShard* shard, OctopipesServerWorker* worker);
+uint32_t client_hash(const char* client_id);
+//Fanout
+void fanout_stop(OctopipesServerFanout* fanout);
+OctopipesServerError fanout_dispatch(OctopipesServerFanout* fanout, OctopipesServerWorker** workers, const size_t workers_len, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires, const char* group, const uint64_t log_offset, OctopipesServerWorker** failed);
+void fanout_work(OctopipesServerFanout* fanout, const size_t index);
+int fanout_next(OctopipesServerFanout* fanout, const size_t index, size_t* worker_index);
+//Retained
+void retained_store(OctopipesServerRetainedCache* cache, const char* group, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires);
+OctopipesServerError retained_deliver(OctopipesServer* server, const char* client, const char** groups, const size_t groups_len);
+OctopipesServerRetained* retained_find(OctopipesServerRetainedCache* cache, const char* group, const uint32_t hash);
+OctopipesServerError retained_insert(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry);
+void retained_remove(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry);
+void retained_touch(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry);
+void retained_evict(OctopipesServerRetainedCache* cache);
+size_t retained_cost(const OctopipesServerRetained* entry);
+int group_matches(const char* pattern, const char* group);
+//Replay
+OctopipesServerError replay_add(OctopipesServer* server, OctopipesServerWorker* worker, const OctopipesSubscriptionFlags flags, const uint64_t from);
+OctopipesServerError replay_add_group(OctopipesServerOutbound* outbound, OctopipesLogGroup* log_group, const OctopipesSubscriptionFlags flags, const uint64_t from);
+OctopipesServerError replay_flush(OctopipesServerOutbound* outbound);
+int replay_partial(const OctopipesServerOutbound* outbound);
+int replay_drops(const OctopipesServerOutbound* outbound, const char* group, const uint64_t log_offset);
+//Handlers
+void handlers_call(OctopipesServer* server, const OctopipesMessage* message, OctopipesServerRoute* route);
+void handler_release(OctopipesServerHandler* handler);
+//Rate limit
+void rate_limit_set(OctopipesServerRateLimit* rate_limit, const uint64_t messages_per_sec, const uint64_t bytes_per_sec, const OctopipesServerRateLimitPolicy policy);
+uint64_t rate_limit_delay(OctopipesServerRateLimit* rate_limit);
+int rate_limit_admit(OctopipesServerRateLimit* rate_limit, const size_t bytes);
+void token_bucket_refill(OctopipesServerTokenBucket* bucket, const uint64_t now);
+//Credits
+void credits_return(OctopipesServerCredits* credits, const size_t bytes);
+int credits_due(const OctopipesServerCredits* credits);
+OctopipesServerError worker_grant_credits(OctopipesServerWorker* worker);
 //Inbox
-OctopipesServerError message_inbox_init(OctopipesServerInbox** inbox);
+OctopipesServerError message_inbox_init(OctopipesServerInbox** inbox, OctopipesServerMemory* memory);
 OctopipesServerError message_inbox_cleanup(OctopipesServerInbox* inbox);
 OctopipesServerMessage* message_inbox_dequeue(OctopipesServerInbox* inbox);
+void message_inbox_unlink(OctopipesServerInbox* inbox, OctopipesServerMessage* message);
+size_t message_inbox_expire(OctopipesServerInbox* inbox, const uint64_t now);
 OctopipesServerError message_inbox_expunge(OctopipesServerInbox* inbox);
 OctopipesServerError message_inbox_push(OctopipesServerInbox* inbox, OctopipesMessage* message, OctopipesServerError error);
 OctopipesServerError message_inbox_remove(OctopipesServerInbox* inbox, const size_t index);
+size_t message_inbox_cost(const OctopipesServerMessage* message);
+void message_inbox_account(OctopipesServerInbox* inbox, const size_t added, const size_t removed);
+//Memory
+void memory_account(OctopipesServerMemory* memory, const size_t added, const size_t removed, const int input);
+int memory_over_budget(OctopipesServerMemory* memory, const size_t bytes);
+void outbound_account(OctopipesServerOutbound* outbound, const size_t added, const size_t removed);
+void worker_account_stream(OctopipesServerWorker* worker, const size_t stream_len);
 //Messages
 OctopipesServerError server_message_cleanup(OctopipesServerMessage* message);
+//Shared frames
+OctopipesServerError shared_frame_init(OctopipesServerSharedFrame** frame, uint8_t* data, const size_t data_size);
+void shared_frame_retain(OctopipesServerSharedFrame* frame);
+void shared_frame_release(OctopipesServerSharedFrame* frame);
 //Thread
 void* cap_loop(void* args);
 void* worker_loop(void* args);
+void* fanout_loop(void* args);
+void* shard_loop(void* args);
 //FS
 int create_clients_dir(const char* directory);
 //Others
@@ -76,6 +173,30 @@ OctopipesServerError to_server_error(const OctopipesError error);
 #define TIME_700MS 700000
 #define TIME_800MS 800000
 #define TIME_900MS 900000
+#define CAP_REPLY_TIMEOUT 50 //Clients open their reply pipe before subscribing, so a reply which can't be written at once is dropped (ms)
+#define GROUP_LEVEL_SEPARATOR '/'
+#define GROUP_SINGLE_WILDCARD "*"
+#define GROUP_MULTI_WILDCARD "#"
+#define ROUTE_STACK_SIZE 32 //Subscribers which can be routed without allocating
+#define OUTBOUND_QUEUE_SIZE 1024 //Default amount of frames queued for each client
+#define WORKER_POLL_TIMEOUT 100 //How long a worker waits for data from its client (ms)
+#define DISCONNECT_NOTIFY_TIMEOUT 50 //How long the server waits for room in the pipe of a disconnected client to notify it (ms)
+#define WORKERS_INITIAL_SIZE 16 //Workers allocated by the first subscription; doubled when full
+#define SCHEDULE_QUANTUM 4096 //Bytes granted to a worker with weight 1 for each scheduling round
+#define SCHEDULE_MESSAGE_COST 64 //Bytes charged for each message besides its payload
+#define INBOX_TTL_TICK 10 //Resolution of the expiration of queued messages (ms)
+#define RETAINED_INITIAL_SIZE 16 //Retained groups allocated by the first store; doubled when full
+#define POINT_TO_POINT_OPTIONS (OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_REQUEST | OCTOPIPES_OPTIONS_REPLY) //Messages addressed to a single client are neither retained nor logged
+#define SHARD_BATCH 64 //Messages a dispatcher takes from a worker before queueing it again behind the others
+#define FANOUT_THRESHOLD 1048576 //Default bytes (payload size * recipients) above which a message is dispatched in parallel
+#define TOKEN_SCALE 1000000 //Token bucket units per token, so buckets are refilled every microsecond
+#define MEMORY_RETRY_INTERVAL 10 //How often a worker paused by the memory budget checks whether it can read again (ms)
+#define CREDITS_TTL 5 //TTL of the grants (seconds)
+#define ROUTE_HANDLERS_SIZE 8 //Handlers which can be routed without allocating
+#define HANDLER_MAX_DEPTH 8 //Nested dispatches from handlers; deeper ones fail
+#define HANDLER_WAIT_INTERVAL 1 //How often unregistering a handler checks whether its running calls are over (ms)
+//Handlers called by this thread and still running (one per nested dispatch)
+static _Thread_local size_t handler_depth;
 
 /**
  * @brief initialize an OctopipesServer
@@ -95,6 +216,7 @@ OctopipesServerError octopipes_server_init(OctopipesServer** server, const char*
   ptr->cap_inbox = NULL;
   ptr->cap_pipe = NULL;
   ptr->client_folder = NULL;
+  ptr->routing_trie = NULL;
   //Allocate CAP
   const size_t cap_len = strlen(cap_path);
   ptr->cap_pipe = (char*) malloc(sizeof(char) * (cap_len + 1));
@@ -112,13 +234,77 @@ OctopipesServerError octopipes_server_init(OctopipesServer** server, const char*
   memcpy(ptr->client_folder, client_folder, cli_dir_len);
   ptr->client_folder[cli_dir_len] = 0x00;
   //Allocate inbox
-  if (message_inbox_init(&ptr->cap_inbox) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+  if (message_inbox_init(&ptr->cap_inbox, NULL) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto bad_alloc;
+  }
+  //Allocate routing trie root
+  if (trie_node_init(&ptr->routing_trie, NULL, 0) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto bad_alloc;
+  }
+  pthread_rwlockattr_t routing_attr;
+  pthread_rwlockattr_init(&routing_attr);
+#ifdef __linux__
+  //Dispatchers keep routing read locked most of the time; don't let them starve subscriptions
+  pthread_rwlockattr_setkind_np(&routing_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  const int routing_ret = pthread_rwlock_init(&ptr->routing_lock, &routing_attr);
+  pthread_rwlockattr_destroy(&routing_attr);
+  if (routing_ret != 0) {
     goto bad_alloc;
   }
   ptr->state = OCTOPIPES_SERVER_STATE_INIT;
   ptr->version = version;
   ptr->workers = NULL;
   ptr->workers_len = 0;
+  ptr->workers_size = 0;
+  ptr->workers_map = NULL;
+  ptr->workers_map_size = 0;
+  ptr->schedule_cursor = 0;
+  ptr->outbound_queue_size = OUTBOUND_QUEUE_SIZE;
+  ptr->overflow_policy = OCTOPIPES_SERVER_OVERFLOW_DROP_OLDEST;
+  rate_limit_set(&ptr->rate_limit, 0, 0, OCTOPIPES_SERVER_RATE_LIMIT_BACKPRESSURE);
+  ptr->rate_limit.dropped = 0;
+  ptr->rate_limit.throttled = 0;
+  //Credits are disabled by default
+  ptr->credits.messages = 0;
+  ptr->credits.bytes = 0;
+  //Memory budget is set by octopipes_server_set_memory_budget
+  ptr->memory.used = 0;
+  ptr->memory.input = 0;
+  ptr->memory.budget = 0;
+  ptr->memory.inboxes = 0;
+  //Workers overflowed with the disconnect policy are stopped by the processing functions
+  pthread_mutex_init(&ptr->disconnects.lock, NULL);
+  ptr->disconnects.pending = 0;
+  //Fanout pool is started by octopipes_server_set_fanout
+  ptr->fanout.threads = NULL;
+  ptr->fanout.threads_len = 0;
+  ptr->fanout.threshold = FANOUT_THRESHOLD;
+  ptr->fanout.running = 0;
+  ptr->fanout.job = 0;
+  ptr->fanout.ranges = NULL;
+  pthread_mutex_init(&ptr->fanout.job_lock, NULL);
+  pthread_mutex_init(&ptr->fanout.lock, NULL);
+  pthread_cond_init(&ptr->fanout.job_ready, NULL);
+  pthread_cond_init(&ptr->fanout.job_done, NULL);
+  //Dispatchers are started by octopipes_server_start_dispatchers
+  pthread_rwlock_init(&ptr->dispatchers.lock, NULL);
+  ptr->dispatchers.shards = NULL;
+  ptr->dispatchers.shards_len = 0;
+  ptr->dispatchers.on_error = NULL;
+  //Retained cache is enabled by octopipes_server_set_retained_cache
+  pthread_mutex_init(&ptr->retained.lock, NULL);
+  ptr->retained.map = NULL;
+  ptr->retained.map_size = 0;
+  ptr->retained.entries = 0;
+  ptr->retained.head = NULL;
+  ptr->retained.tail = NULL;
+  ptr->retained.bytes = 0;
+  ptr->retained.budget = 0;
+  ptr->retained.evicted = 0;
+  ptr->retained.memory = &ptr->memory;
+  //Log is enabled by octopipes_server_set_log
+  ptr->log = NULL;
   *server = ptr;
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 
@@ -130,6 +316,7 @@ bad_alloc:
     free(ptr->client_folder);
   }
   message_inbox_cleanup(ptr->cap_inbox);
+  trie_node_cleanup(ptr->routing_trie);
   if (ptr != NULL) {
     free(ptr);
   }
@@ -147,6 +334,10 @@ OctopipesServerError octopipes_server_cleanup(OctopipesServer* server) {
     return OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
   OctopipesServerError ret;
+  //Dispatchers use workers, so they're stopped first
+  if (server->dispatchers.shards_len > 0) {
+    octopipes_server_stop_dispatchers(server);
+  }
   if (server->state == OCTOPIPES_SERVER_STATE_RUNNING) {
     if ((ret = octopipes_server_stop_cap_listener(server)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
       return ret;
@@ -159,6 +350,7 @@ OctopipesServerError octopipes_server_cleanup(OctopipesServer* server) {
       }
     }
     free(server->workers);
+    free(server->workers_map);
   }
   //Try Free client directory
   rmdir(server->client_folder);
@@ -166,6 +358,28 @@ OctopipesServerError octopipes_server_cleanup(OctopipesServer* server) {
   free(server->client_folder);
   free(server->cap_pipe);
   message_inbox_cleanup(server->cap_inbox);
+  trie_node_cleanup(server->routing_trie);
+  pthread_rwlock_destroy(&server->routing_lock);
+  //Stop fanout pool, as octopipes_server_set_fanout does
+  pthread_mutex_lock(&server->fanout.job_lock);
+  fanout_stop(&server->fanout);
+  pthread_mutex_unlock(&server->fanout.job_lock);
+  pthread_mutex_destroy(&server->fanout.job_lock);
+  pthread_mutex_destroy(&server->fanout.lock);
+  pthread_cond_destroy(&server->fanout.job_ready);
+  pthread_cond_destroy(&server->fanout.job_done);
+  pthread_rwlock_destroy(&server->dispatchers.lock);
+  //Free retained frames
+  while (server->retained.head != NULL) {
+    retained_remove(&server->retained, server->retained.head);
+  }
+  free(server->retained.map);
+  pthread_mutex_destroy(&server->retained.lock);
+  pthread_mutex_destroy(&server->disconnects.lock);
+  //Unmap the log; segments are kept on disk
+  if (server->log != NULL) {
+    octopipes_log_close(server->log);
+  }
   //Free server itself
   free(server);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
@@ -252,15 +466,16 @@ OctopipesServerError octopipes_server_unlock_cap(OctopipesServer* server) {
 }
 
 /**
- * @brief write a message to the CAP
+ * @brief write a CAP message to the reply pipe of a client, or to the CAP if the client didn't provide a reply pipe
  * @param OctopipesServer* server
  * @param char* client name
+ * @param char* reply pipe (NULL to write to the CAP)
  * @param uint8_t* data
  * @param size_t data size
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const char* client, const uint8_t* data, const size_t data_size) {
+OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const char* client, const char* reply_pipe, const uint8_t* data, const size_t data_size) {
   if (server->state != OCTOPIPES_SERVER_STATE_RUNNING) {
     return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
@@ -277,6 +492,9 @@ OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const c
   message->remote = NULL;
   message->ttl = 5;
   message->options = OCTOPIPES_OPTIONS_NONE;
+  message->correlation_id = 0;
+  message->epoch = 0;
+  message->sequence = 0;
   message->data = (uint8_t*) malloc(sizeof(uint8_t) * data_size);
   if (message->data == NULL) {
     octopipes_cleanup_message(message);
@@ -302,6 +520,16 @@ OctopipesServerError octopipes_server_write_cap(OctopipesServer* server, const c
     return to_server_error(err);
   }
   octopipes_cleanup_message(message); //Clean message
+  //Reply pipe is private, so there's no need to block the CAP listener
+  if (reply_pipe != NULL) {
+    if (!cap_reply_pipe_valid(server, client, reply_pipe)) {
+      free(data_out);
+      return OCTOPIPES_SERVER_ERROR_BAD_PACKET;
+    }
+    err = pipe_send(reply_pipe, data_out, data_out_size, CAP_REPLY_TIMEOUT);
+    free(data_out);
+    return to_server_error(err);
+  }
   //Block CAP listener
   if ((rc = octopipes_server_lock_cap(server)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
     return rc;
@@ -330,6 +558,8 @@ OctopipesServerError octopipes_server_process_cap_once(OctopipesServer* server,
   if (server->cap_inbox == NULL) {
     return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
   //Lock cap listener
   pthread_mutex_lock(&server->cap_lock);
   //Process
@@ -337,17 +567,18 @@ OctopipesServerError octopipes_server_process_cap_once(OctopipesServer* server,
   OctopipesServerError rc;
   OctopipesServerMessage* message = message_inbox_dequeue(server->cap_inbox);
   if (message != NULL) {
+    *requests = *requests + 1;
     if (message->message == NULL) {
-      rc = server->cap_inbox->messages[0]->error;
+      rc = message->error;
     } else {
       //Process message
-      if ((rc = octopipes_server_handle_cap_message(server, message->message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-        server_message_cleanup(message);
-        return rc;
-      }
+      rc = octopipes_server_handle_cap_message(server, message->message);
     }
     server_message_cleanup(message);
-    *requests = *requests + 1;
+    if (rc != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      pthread_mutex_unlock(&server->cap_lock);
+      return rc;
+    }
   }
   //Unlock mutex
   pthread_mutex_unlock(&server->cap_lock);
@@ -364,7 +595,7 @@ OctopipesServerError octopipes_server_process_cap_all(OctopipesServer* server, s
   if (server->state != OCTOPIPES_SERVER_STATE_RUNNING) {
     return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  if (server->cap_inbox != NULL) {
+  if (server->cap_inbox == NULL) {
     return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
   *requests = 0;
@@ -380,6 +611,47 @@ OctopipesServerError octopipes_server_process_cap_all(OctopipesServer* server, s
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
+/**
+ * @brief check that a reply pipe is the one a client would create: it must be next to the CAP and named "<CAP>.<client>.<suffix>" (no other directory can be reached)
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param char* reply_pipe
+ * @return int 1 if valid
+ */
+
+int cap_reply_pipe_valid(OctopipesServer* server, const char* client, const char* reply_pipe) {
+  const size_t cap_len = strlen(server->cap_pipe);
+  const size_t client_len = strlen(client);
+  if (strncmp(reply_pipe, server->cap_pipe, cap_len) != 0 || reply_pipe[cap_len] != '.') {
+    return 0;
+  }
+  const char* name = reply_pipe + cap_len + 1;
+  if (strncmp(name, client, client_len) != 0 || name[client_len] != '.' || name[client_len + 1] == 0x00) {
+    return 0;
+  }
+  //Neither the client id nor the suffix can leave the CAP directory
+  return strchr(name, '/') == NULL;
+}
+
+/**
+ * @brief check that a client id can be used: it's routed as a group, so it can't contain wildcards or level separators,
+ * which would make the worker receive the messages of other groups
+ * @param char* client
+ * @return int 1 if valid
+ */
+
+int client_id_valid(const char* client) {
+  if (client[0] == 0x00) {
+    return 0;
+  }
+  for (const char* ptr = client; *ptr != 0x00; ptr++) {
+    if (*ptr == GROUP_LEVEL_SEPARATOR || *ptr == GROUP_SINGLE_WILDCARD[0] || *ptr == GROUP_MULTI_WILDCARD[0]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 /**
  * @brief handle a CAP message
  * @param OctopipesServer* server
@@ -403,6 +675,10 @@ OctopipesServerError octopipes_server_handle_cap_message(OctopipesServer* server
     case OCTOPIPES_CAP_UNSUBSCRIPTION: {
       return cap_manage_unsubscription(server, message->origin, message->data, message->data_size);
     }
+    case OCTOPIPES_CAP_ADD_GROUPS:
+    case OCTOPIPES_CAP_REMOVE_GROUPS: {
+      return cap_manage_groups_update(server, message->origin, message->data, message->data_size);
+    }
     default:
       return OCTOPIPES_SERVER_ERROR_BAD_PACKET;
   }
@@ -422,13 +698,26 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
   OctopipesError ret;
   char** groups = NULL;
   size_t groups_len = 0;
-  if ((ret = octopipes_cap_parse_subscribe(payload, payload_len, &groups, &groups_len)) != OCTOPIPES_ERROR_SUCCESS) {
+  char* reply_pipe = NULL;
+  OctopipesSubscriptionFlags flags;
+  uint64_t from;
+  if ((ret = octopipes_cap_parse_subscribe(payload, payload_len, &groups, &groups_len, &reply_pipe, &flags, &from)) != OCTOPIPES_ERROR_SUCCESS) {
     return to_server_error(ret);
   }
+  //Don't start a worker which couldn't get its assignment
+  if (reply_pipe != NULL && !cap_reply_pipe_valid(server, client, reply_pipe)) {
+    for (size_t i = 0; i < groups_len; i++) {
+      free(groups[i]);
+    }
+    free(groups);
+    free(reply_pipe);
+    return OCTOPIPES_SERVER_ERROR_BAD_PACKET;
+  }
   //Prepare pipes
   size_t pipe_tx_len = strlen(server->client_folder) + 1 + strlen(client) + 9;
   char* pipe_tx = (char*) malloc(sizeof(char) * pipe_tx_len);
   if (pipe_tx == NULL) {
+    free(reply_pipe);
     return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
   }
   sprintf(pipe_tx, "%s/%s_tx.fifo", server->client_folder, client);
@@ -436,12 +725,15 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
   char* pipe_rx = (char*) malloc(sizeof(char) * pipe_rx_len);
   if (pipe_rx == NULL) {
     free(pipe_tx);
+    free(reply_pipe);
     return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
   }
   sprintf(pipe_rx, "%s/%s_rx.fifo", server->client_folder, client);
-  //Check if worker already exists
+  //Check if the name can be used and if worker already exists
   OctopipesCapError cap_err = OCTOPIPES_CAP_ERROR_SUCCESS;
-  if (octopipes_server_is_subscribed(server, client) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+  if (!client_id_valid(client)) {
+    cap_err = OCTOPIPES_CAP_ERROR_INVALID_NAME;
+  } else if (octopipes_server_is_subscribed(server, client) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
     cap_err = OCTOPIPES_CAP_ERROR_NAME_ALREADY_TAKEN;
   }
   if (cap_err != OCTOPIPES_CAP_ERROR_SUCCESS) {
@@ -457,8 +749,8 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
     pipe_tx_len = 0;
   }
   //Create worker
-  OctopipesServerError rc;
-  if ((rc = octopipes_server_start_worker(server, client, groups, groups_len, pipe_tx, pipe_rx)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  if (cap_err == OCTOPIPES_CAP_ERROR_SUCCESS && (rc = worker_start(server, client, groups, groups_len, pipe_tx, pipe_rx, flags, from)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
     if (pipe_rx != NULL) {
       free(pipe_rx);
     }
@@ -474,6 +766,19 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
     cap_err = OCTOPIPES_CAP_ERROR_FS;
     groups = NULL;
     groups_len = 0;
+    pipe_rx = NULL;
+    pipe_tx = NULL;
+    pipe_rx_len = 0;
+    pipe_tx_len = 0;
+  } else if (cap_err == OCTOPIPES_CAP_ERROR_SUCCESS) {
+    if (flags & OCTOPIPES_SUBSCRIPTION_CONFLATE) {
+      octopipes_server_set_conflation(server, client, 1);
+    }
+    //Send the current state of the groups to the new subscriber; it's queued until the client opens its pipe.
+    //A replay includes it already
+    if (server->log == NULL || (flags & (OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET | OCTOPIPES_SUBSCRIPTION_REPLAY_TIME)) == 0) {
+      retained_deliver(server, client, (const char**) groups, groups_len);
+    }
   }
   //Free groups
   for (size_t i = 0; i < groups_len; i++) {
@@ -482,10 +787,10 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
   if (groups != NULL) {
     free(groups);
   }
-  //Encode assignment
+  //Encode assignment; a refused assignment has no pipes
   uint8_t* assignment_payload = NULL;
   size_t assignment_len = 0;
-  if ((assignment_payload = octopipes_cap_prepare_assign(cap_err, pipe_tx, pipe_tx_len - 1, pipe_rx, pipe_rx_len - 1, &assignment_len)) == NULL) {
+  if ((assignment_payload = octopipes_cap_prepare_assign(cap_err, pipe_tx, pipe_tx_len > 0 ? pipe_tx_len - 1 : 0, pipe_rx, pipe_rx_len > 0 ? pipe_rx_len - 1 : 0, &assignment_len)) == NULL) {
     if (pipe_rx != NULL) {
       free(pipe_rx);
     }
@@ -493,6 +798,7 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
       free(pipe_tx);
     }
     octopipes_server_stop_worker(server, client);
+    free(reply_pipe);
     return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
   }
   if (pipe_rx != NULL) {
@@ -502,13 +808,12 @@ OctopipesServerError cap_manage_subscription(OctopipesServer* server, const char
     free(pipe_tx);
   }
   //Send message
-  if ((rc = octopipes_server_write_cap(server, client, assignment_payload, assignment_len)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+  rc = octopipes_server_write_cap(server, client, reply_pipe, assignment_payload, assignment_len);
+  free(reply_pipe);
+  free(assignment_payload);
+  if (rc != OCTOPIPES_SERVER_ERROR_SUCCESS && cap_err == OCTOPIPES_CAP_ERROR_SUCCESS) {
     octopipes_server_stop_worker(server, client);
-    free(assignment_payload);
-    return rc;
   }
-  //Free buffers
-  free(assignment_payload);
   return rc;
 }
 
@@ -527,16 +832,106 @@ OctopipesServerError cap_manage_unsubscription(OctopipesServer* server, const ch
   if ((ret = octopipes_cap_parse_unsubscribe(payload, payload_len)) != OCTOPIPES_ERROR_SUCCESS) {
     return to_server_error(ret);
   }
-  //Unsubscribe client and stop associated worker
-  for (size_t i = 0; server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    if (strcmp(this_worker->client_id, client) == 0) {
-      //Stop worker
-      OctopipesServerError rc = octopipes_server_stop_worker(server, client);
-      return rc;
+  //Unsubscribe client and stop associated worker (WORKER_NOT_FOUND if it doesn't exist)
+  return octopipes_server_stop_worker(server, client);
+}
+
+/**
+ * @brief add groups to (or remove groups from) the subscriptions of a client, without restarting its worker; if the client set a
+ * reply pipe, the outcome is written to it as an assignment without pipes
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param uint8_t* message payload
+ * @param size_t payload lenght
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError cap_manage_groups_update(OctopipesServer* server, const char* client, const uint8_t* payload, const size_t payload_len) {
+  //Parse groups
+  OctopipesError ret;
+  char** groups = NULL;
+  size_t groups_len = 0;
+  char* reply_pipe = NULL;
+  if ((ret = octopipes_cap_parse_groups_update(payload, payload_len, &groups, &groups_len, &reply_pipe)) != OCTOPIPES_ERROR_SUCCESS) {
+    return to_server_error(ret);
+  }
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  //Groups the worker wasn't subscribed to, which get their retained frames
+  const char** added = NULL;
+  size_t added_len = 0;
+  //Don't apply an update whose outcome can't be written
+  if (reply_pipe != NULL && !cap_reply_pipe_valid(server, client, reply_pipe)) {
+    rc = OCTOPIPES_SERVER_ERROR_BAD_PACKET;
+    goto groups_cleanup;
+  }
+  if (payload[0] == OCTOPIPES_CAP_ADD_GROUPS && groups_len > 0 && (added = (const char**) malloc(sizeof(char*) * groups_len)) == NULL) {
+    rc = OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    goto groups_reply;
+  }
+  //Dispatch sees either the old or the new subscriptions of the worker
+  pthread_rwlock_wrlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    if (payload[0] == OCTOPIPES_CAP_ADD_GROUPS) {
+      //Route the groups first, so a failure doesn't leave subscriptions which can't be routed
+      size_t routed = 0;
+      rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+      for (; routed < groups_len && rc == OCTOPIPES_SERVER_ERROR_SUCCESS; routed++) {
+        if (worker_has_subscription(this_worker, groups[routed])) {
+          continue;
+        }
+        if ((rc = trie_insert(server->routing_trie, groups[routed], this_worker)) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+          added[added_len++] = groups[routed];
+        }
+      }
+      if (rc == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+        rc = worker_add_subscriptions(this_worker, (const char**) groups, groups_len);
+      }
+      if (rc != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+        for (size_t j = 0; j < routed; j++) {
+          if (!worker_has_subscription(this_worker, groups[j])) {
+            trie_remove(server->routing_trie, groups[j], this_worker);
+          }
+        }
+        added_len = 0;
+      }
+    } else {
+      if ((rc = worker_remove_subscriptions(this_worker, (const char**) groups, groups_len)) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+        for (size_t j = 0; j < groups_len; j++) {
+          if (!worker_has_subscription(this_worker, groups[j])) {
+            trie_remove(server->routing_trie, groups[j], this_worker);
+          }
+        }
+      }
     }
   }
-  return OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_unlock(&server->routing_lock);
+  //Send the current state of the new groups, as for a new subscriber
+  if (added_len > 0) {
+    retained_deliver(server, client, added, added_len);
+  }
+
+groups_reply:
+  //Tell the client whether its subscriptions changed; the update error is still returned to the server
+  if (reply_pipe != NULL) {
+    const OctopipesCapError cap_err = rc == OCTOPIPES_SERVER_ERROR_SUCCESS ? OCTOPIPES_CAP_ERROR_SUCCESS : (rc == OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND ? OCTOPIPES_CAP_ERROR_NOT_SUBSCRIBED : OCTOPIPES_CAP_ERROR_FS);
+    size_t reply_len = 0;
+    uint8_t* reply_payload = octopipes_cap_prepare_assign(cap_err, NULL, 0, NULL, 0, &reply_len);
+    OctopipesServerError write_rc = reply_payload != NULL ? octopipes_server_write_cap(server, client, reply_pipe, reply_payload, reply_len) : OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    free(reply_payload);
+    if (rc == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      rc = write_rc;
+    }
+  }
+
+groups_cleanup:
+  free(reply_pipe);
+  free(added);
+  for (size_t i = 0; i < groups_len; i++) {
+    free(groups[i]);
+  }
+  free(groups);
+  return rc;
 }
 
 /**
@@ -551,24 +946,70 @@ OctopipesServerError cap_manage_unsubscription(OctopipesServer* server, const ch
  */
 
 OctopipesServerError octopipes_server_start_worker(OctopipesServer* server, const char* client, char** subscriptions, const size_t subscription_len, const char* cli_tx_pipe, const char* cli_rx_pipe) {
+  return worker_start(server, client, subscriptions, subscription_len, cli_tx_pipe, cli_rx_pipe, OCTOPIPES_SUBSCRIPTION_NONE, 0);
+}
+
+/**
+ * @brief start a new worker, replaying the logged groups it subscribes to if requested
+ * @param OctopipesServer*
+ * @param char* client
+ * @param char** subscriptions
+ * @param size_t subscription length
+ * @param char* pipe rx
+ * @param char* pipe tx
+ * @param OctopipesSubscriptionFlags flags: only the replay flags are used
+ * @param uint64_t from: offset or time (ms since epoch) the replay starts from
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_start(OctopipesServer* server, const char* client, char** subscriptions, const size_t subscription_len, const char* cli_tx_pipe, const char* cli_rx_pipe, const OctopipesSubscriptionFlags flags, const uint64_t from) {
   //Instance a new worker
   OctopipesServerWorker* new_worker;
   OctopipesServerError rc;
+  if (!client_id_valid(client)) {
+    return OCTOPIPES_SERVER_ERROR_BAD_CLIENT_ID;
+  }
   //Check if a worker with that name exists
   if (octopipes_server_is_subscribed(server, client) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
     return OCTOPIPES_SERVER_ERROR_WORKER_EXISTS;
   }
   //Initialize a new worker
-  if ((rc = worker_init(&new_worker, (const char**) subscriptions, subscription_len, client, cli_tx_pipe, cli_rx_pipe)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+  if ((rc = worker_init(&new_worker, (const char**) subscriptions, subscription_len, client, cli_tx_pipe, cli_rx_pipe, server->outbound_queue_size, server->overflow_policy, &server->rate_limit, &server->credits, &server->memory, &server->dispatchers, &server->disconnects)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
     return rc;
   }
+  //Replays are set up before the worker is routed, so it can't receive a live frame which is not known to its replays
+  if (server->log != NULL && (flags & (OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET | OCTOPIPES_SUBSCRIPTION_REPLAY_TIME)) != 0) {
+    if ((rc = replay_add(server, new_worker, flags, from)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      worker_cleanup(new_worker);
+      return rc;
+    }
+  }
   //Push worker to current workers
-  server->workers = (OctopipesServerWorker**) realloc(server->workers, sizeof(OctopipesServerWorker*) * (server->workers_len + 1));
-  if (server->workers == NULL) {
-    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  pthread_rwlock_wrlock(&server->routing_lock);
+  if ((rc = workers_insert(server, new_worker)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    pthread_rwlock_unlock(&server->routing_lock);
+    worker_cleanup(new_worker);
+    return rc;
+  }
+  //Route the worker subscriptions
+  for (size_t i = 0; i < new_worker->subscriptions; i++) {
+    if ((rc = trie_insert(server->routing_trie, new_worker->subscriptions_list[i], new_worker)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      for (size_t j = 0; j < i; j++) {
+        trie_remove(server->routing_trie, new_worker->subscriptions_list[j], new_worker);
+      }
+      workers_remove(server, new_worker);
+      pthread_rwlock_unlock(&server->routing_lock);
+      worker_cleanup(new_worker);
+      return rc;
+    }
   }
-  server->workers[server->workers_len] = new_worker;
-  server->workers_len++;
+  pthread_rwlock_unlock(&server->routing_lock);
+  //Grant the first window; it's queued until the client opens its pipe
+  pthread_mutex_lock(&new_worker->worker_lock);
+  if (new_worker->credits.messages > 0 || new_worker->credits.bytes > 0) {
+    worker_grant_credits(new_worker);
+  }
+  pthread_mutex_unlock(&new_worker->worker_lock);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
@@ -580,559 +1021,3469 @@ OctopipesServerError octopipes_server_start_worker(OctopipesServer* server, cons
  */
 
 OctopipesServerError octopipes_server_stop_worker(OctopipesServer* server, const char* client) {
-  OctopipesServerError rc;
-  //Iterate over workers
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* curr_worker = server->workers[i];
-    //Check if curr worker is searched worker
-    if (strcmp(curr_worker->client_id, client) == 0) {
-      if ((rc = worker_cleanup(curr_worker)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-        return rc;
-      }
-      //Realloc
-      const size_t worker_index = i;
-      //Move all the elements backward of 1 position
-      server->workers_len--;
-      for (size_t j = worker_index; j < server->workers_len; j++) {
-        server->workers[j] = server->workers[j + 1];
-      }
-      //Reallocate workers
-      if (server->workers_len > 0) {
-        server->workers = (OctopipesServerWorker**) realloc(server->workers, sizeof(OctopipesServerWorker*) * server->workers_len);
-        if (server->workers == NULL) {
-          return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
-        }
-      } else {
-        free(server->workers);
-        server->workers = NULL;
-      }
-      //OK
-      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  //Remove the worker from the workers first, so it's not used by dispatch while it's being stopped
+  pthread_rwlock_wrlock(&server->routing_lock);
+  OctopipesServerWorker* stopped_worker = workers_find(server, client);
+  if (stopped_worker != NULL) {
+    for (size_t j = 0; j < stopped_worker->subscriptions; j++) {
+      trie_remove(server->routing_trie, stopped_worker->subscriptions_list[j], stopped_worker);
     }
+    workers_remove(server, stopped_worker);
   }
-  return OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_unlock(&server->routing_lock);
+  if (stopped_worker == NULL) {
+    return OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  }
+  return worker_cleanup(stopped_worker);
 }
 
 /**
- * @brief Dispatch a message to all the clients subscribed to the message remote
+ * @brief set the outbound queue of the workers started from now on. Messages dispatched to a client are queued
+ * while its pipe is full, so a client which doesn't read can't block the dispatch to the others
  * @param OctopipesServer* server
- * @param OctopipesMessage* message
- * @param char** worker which failed in dispatching message (NOTE: DO NOT FREE)
+ * @param size_t queue size: frames which can be queued for each client (0 keeps the current size)
+ * @param OctopipesServerOverflowPolicy policy applied when the queue of a client is full
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_dispatch_message(OctopipesServer* server, OctopipesMessage* message, const char** worker) {
-  //Check if remote is set
-  *worker = NULL;
-  if (message->remote == NULL) {
-    return OCTOPIPES_SERVER_ERROR_NO_RECIPIENT;
+OctopipesServerError octopipes_server_set_outbound_queue(OctopipesServer* server, const size_t queue_size, const OctopipesServerOverflowPolicy policy) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  //Iterate over workers
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerError ret;
-    OctopipesServerWorker* this_worker = server->workers[i];
-    if (worker_match_subscription(this_worker, message->remote)) {
-      //If subscription matches, send message to client
-      if ((ret = worker_send(this_worker, message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-        *worker = this_worker->client_id;
-        return ret;
-      }
-    }
+  if (queue_size > 0) {
+    server->outbound_queue_size = queue_size;
   }
+  server->overflow_policy = policy;
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief checks if a worker has a message to dispatch, once found a worker with a message in its inbox, it processes it and returns
+ * @brief limit the rate a client can send messages at, with a token bucket for messages and one for bytes. Each bucket holds one
+ * second of tokens, so a client can send a burst of up to a second worth of messages; a message larger than the bytes bucket
+ * is let through once the bucket is full and the client then waits for it to refill. The limits are enforced by the worker while
+ * it reads the client, so they also bound the messages waiting to be dispatched
  * @param OctopipesServer* server
- * @param size_t* processed requests
- * @param char** client which returned an error (NOTE: DO NOT FREE)
+ * @param char* client (NULL sets the limits of all the clients, including the ones started from now on)
+ * @param uint64_t messages per second (0: no limit)
+ * @param uint64_t bytes per second, payload included (0: no limit)
+ * @param OctopipesServerRateLimitPolicy policy applied to the messages over the limits
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_process_first(OctopipesServer* server, size_t* requests, const char** client) {
-  //Iterate over workers to find one to process
-  *client = NULL;
-  *requests = 0;
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    OctopipesServerMessage* inbox_message = NULL;
-    OctopipesServerError ret;
-    if ((ret = worker_get_next_message(this_worker, &inbox_message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-      *client = this_worker->client_id;
-      return ret;
-    }
-    if (inbox_message != NULL) {
-      //Dispatch message
-      OctopipesMessage* message = inbox_message->message;
-      if (message != NULL) {
-        if ((ret = octopipes_server_dispatch_message(server, message, client)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-          server_message_cleanup(inbox_message);
-          return ret;
-        }
-      } else {
-        ret = inbox_message->error;
-        *requests = *requests + 1;
-        server_message_cleanup(inbox_message);
-        return ret;
-      }
-      server_message_cleanup(inbox_message);
-      //Otherwise message has been processed successfully
-      *requests = *requests + 1;
-      return ret;
-    }
-    //Otherwise keep searching
+OctopipesServerError octopipes_server_set_rate_limit(OctopipesServer* server, const char* client, const uint64_t messages_per_sec, const uint64_t bytes_per_sec, const OctopipesServerRateLimitPolicy policy) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  return OCTOPIPES_SERVER_ERROR_SUCCESS; //No message processed
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  if (client == NULL) {
+    rate_limit_set(&server->rate_limit, messages_per_sec, bytes_per_sec, policy);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  //A single client is looked up in the workers map, the whole list is walked only to set all of them
+  OctopipesServerWorker* found = client != NULL ? workers_find(server, client) : NULL;
+  const size_t workers_len = client == NULL ? server->workers_len : (found != NULL ? 1 : 0);
+  for (size_t i = 0; i < workers_len; i++) {
+    OctopipesServerWorker* this_worker = client == NULL ? server->workers[i] : found;
+    pthread_mutex_lock(&this_worker->worker_lock);
+    rate_limit_set(&this_worker->rate_limit, messages_per_sec, bytes_per_sec, policy);
+    pthread_mutex_unlock(&this_worker->worker_lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
 }
 
 /**
- * @brief for each worker try to dispatch a message in the inbox once
+ * @brief get the rate limit statistics of a client
  * @param OctopipesServer* server
- * @param size_t* requests
- * @param char** worker which returned error (NOTE: DO NOT FREE)
+ * @param char* client
+ * @param size_t* dropped: messages dropped because they exceeded the limits
+ * @param size_t* throttled: times the worker stopped reading the client because it exceeded the limits
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_process_once(OctopipesServer* server, size_t* requests, const char** client) {
-  //Iterate over workers to find one to process
-  *client = NULL;
-  *requests = 0;
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    OctopipesServerMessage* inbox_message = NULL;
-    OctopipesServerError ret;
-    if ((ret = worker_get_next_message(this_worker, &inbox_message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-      *client = this_worker->client_id;
-      return ret;
-    }
-    if (inbox_message != NULL) {
-      //Dispatch message
-      OctopipesMessage* message = inbox_message->message;
-      if (message != NULL) {
-        if ((ret = octopipes_server_dispatch_message(server, message, client)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-          server_message_cleanup(inbox_message);
-          return ret;
-        }
-      } else {
-        ret = inbox_message->error;
-        *requests = *requests + 1;
-        server_message_cleanup(inbox_message);
-        return ret;
-      }
-      server_message_cleanup(inbox_message);
-      //Otherwise message has been processed successfully
-      *requests = *requests + 1;
-      //Continue
-    }
-    //Otherwise keep searching
+OctopipesServerError octopipes_server_get_rate_limit_stats(OctopipesServer* server, const char* client, size_t* dropped, size_t* throttled) {
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    pthread_mutex_lock(&this_worker->worker_lock);
+    *dropped = this_worker->rate_limit.dropped;
+    *throttled = this_worker->rate_limit.throttled;
+    pthread_mutex_unlock(&this_worker->worker_lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  return OCTOPIPES_SERVER_ERROR_SUCCESS; //No message processed
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
 }
 
 /**
- * @brief keep processing workers until all their inbox are empty
+ * @brief set the memory the server can hold: the messages waiting in the workers inboxes, the data read but not decoded yet,
+ * the frames queued for the clients, the replays and the retained frames. While the budget is exceeded, the workers stop
+ * reading their clients: if what was read from the clients exceeds the budget, only the ones holding more than their share of it,
+ * so the largest producers wait in their pipes until dispatch catches up; otherwise all of them, until the clients read their
+ * frames. Each worker can exceed the budget by what it reads at once, a pipe at most
  * @param OctopipesServer* server
- * @param size_t* requests processed
- * @param char** worker which returned error
+ * @param size_t budget in bytes (0: no limit)
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_process_all(OctopipesServer* server, size_t* requests, const char** client) {
-  *client = NULL;
-  *requests = 0;
-  size_t this_session_requests = 0;
-  do {
-    OctopipesServerError ret;
-    if ((ret = octopipes_server_process_once(server, &this_session_requests, client)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-      return ret;
-    }
-    *requests += this_session_requests; //Increment processed requests
-  } while(this_session_requests > 0);
+OctopipesServerError octopipes_server_set_memory_budget(OctopipesServer* server, const size_t budget) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  __atomic_store_n(&server->memory.budget, budget, __ATOMIC_RELAXED);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief checks if a certain client is subscribed to the server
+ * @brief get the memory held by a client, or by the whole server
  * @param OctopipesServer* server
- * @param char* client
- * @return OctopipesServerError (NOTE: SUCCESS if exists)
+ * @param char* client (NULL for all the clients)
+ * @param size_t* bytes held by the messages of the client waiting to be dispatched, its undecoded data and its outbound queue
+ * (the memory accounted against the budget if client is NULL)
+ * @param size_t* paused: times the worker stopped reading because the memory budget was exceeded (the sum of all the workers if client is NULL)
+ * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_is_subscribed(OctopipesServer* server, const char* client) {
-  //Iterate over workers
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    if (strcmp(this_worker->client_id, client) == 0) {
-      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+OctopipesServerError octopipes_server_get_memory_stats(OctopipesServer* server, const char* client, size_t* bytes, size_t* paused) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  *bytes = 0;
+  *paused = 0;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  if (client == NULL) {
+    *bytes = __atomic_load_n(&server->memory.used, __ATOMIC_RELAXED);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  OctopipesServerWorker* found = client != NULL ? workers_find(server, client) : NULL;
+  const size_t workers_len = client == NULL ? server->workers_len : (found != NULL ? 1 : 0);
+  for (size_t i = 0; i < workers_len; i++) {
+    OctopipesServerWorker* this_worker = client == NULL ? server->workers[i] : found;
+    pthread_mutex_lock(&this_worker->worker_lock);
+    if (client != NULL) {
+      *bytes = this_worker->inbox->bytes + __atomic_load_n(&this_worker->stream_bytes, __ATOMIC_RELAXED);
+    }
+    *paused += this_worker->paused;
+    pthread_mutex_unlock(&this_worker->worker_lock);
+    if (client != NULL) {
+      pthread_mutex_lock(&this_worker->outbound.lock);
+      *bytes += this_worker->outbound.bytes;
+      pthread_mutex_unlock(&this_worker->outbound.lock);
     }
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  return OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
 }
 
 /**
- * @brief get all the subscriptions for a certain worker
- * @param char* client
- * @param char*** subscriptions (NOTE: DO NOT FREE)
- * @param size_t* subscriptions length
+ * @brief set the window of credits granted to clients. A client is granted the window when it subscribes, and then the credits
+ * of its messages as they're dispatched (or expire, or are dropped), once half of the window has been given back; clients read their
+ * credits with octopipes_get_send_credits, so they can slow down before their pipe fills up. Credits are advisory: the server doesn't
+ * drop the messages over the window. Only enable credits if the clients support them, or they will receive grants as messages
+ * @param OctopipesServer* server
+ * @param char* client (NULL sets the window of all the clients, including the ones started from now on)
+ * @param size_t messages the client can send before its messages are dispatched (0: no limit)
+ * @param size_t frame bytes the client can send before its messages are dispatched (0: no limit)
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_get_subscriptions(OctopipesServer* server, const char* client, char*** subscriptions, size_t* sub_len) {
-  //Iterate over workers
-  *subscriptions = NULL;
-  *sub_len = 0;
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    if (strcmp(this_worker->client_id, client) == 0) {
-      //Okay, get subscriptions for this worker
-      OctopipesServerError ret;
-      ret = worker_get_subscriptions(this_worker, subscriptions, sub_len);
-      return ret;
+OctopipesServerError octopipes_server_set_credits(OctopipesServer* server, const char* client, const size_t messages, const size_t bytes) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  if (client == NULL) {
+    server->credits.messages = messages;
+    server->credits.bytes = bytes;
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  OctopipesServerWorker* found = client != NULL ? workers_find(server, client) : NULL;
+  const size_t workers_len = client == NULL ? server->workers_len : (found != NULL ? 1 : 0);
+  for (size_t i = 0; i < workers_len; i++) {
+    OctopipesServerWorker* this_worker = client == NULL ? server->workers[i] : found;
+    pthread_mutex_lock(&this_worker->worker_lock);
+    const int granted = this_worker->credits.messages > 0 || this_worker->credits.bytes > 0;
+    this_worker->credits.messages = messages;
+    this_worker->credits.bytes = bytes;
+    //The new window replaces the one the client has been granted (a client which had none isn't told it has none)
+    if (granted || messages > 0 || bytes > 0) {
+      worker_grant_credits(this_worker);
     }
+    pthread_mutex_unlock(&this_worker->worker_lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  return OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
 }
 
 /**
- * @brief returns all the clients subscribed to the server at the moment
+ * @brief get the outbound queue statistics of a client
  * @param OctopipesServer* server
- * @param char*** clients (NOTE: FREE char**, but not the content)
- * @param size_t* clients length
+ * @param char* client
+ * @param size_t* depth: frames currently queued
+ * @param size_t* dropped: frames dropped because the queue was full
  * @return OctopipesServerError
  */
 
-OctopipesServerError octopipes_server_get_clients(OctopipesServer* server, char*** clients, size_t* cli_len) {
-  if (server->workers_len == 0) {
-    *cli_len = 0;
-    return OCTOPIPES_SERVER_ERROR_SUCCESS;
+OctopipesServerError octopipes_server_get_outbound_stats(OctopipesServer* server, const char* client, size_t* depth, size_t* dropped) {
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    pthread_mutex_lock(&this_worker->outbound.lock);
+    *depth = this_worker->outbound.len;
+    *dropped = this_worker->outbound.dropped;
+    pthread_mutex_unlock(&this_worker->outbound.lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  char** cli_ptr = (char**) malloc(sizeof(char*) * server->workers_len);
-  if (cli_ptr == NULL) {
-    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief get the amount of messages of a client which expired before being delivered
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param size_t* inbox_expired: messages sent by the client which expired before being dispatched
+ * @param size_t* outbound_expired: frames for the client which expired before being written
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_get_expired_stats(OctopipesServer* server, const char* client, size_t* inbox_expired, size_t* outbound_expired) {
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    pthread_mutex_lock(&this_worker->worker_lock);
+    *inbox_expired = this_worker->inbox->expired;
+    pthread_mutex_unlock(&this_worker->worker_lock);
+    pthread_mutex_lock(&this_worker->outbound.lock);
+    *outbound_expired = this_worker->outbound.expired;
+    pthread_mutex_unlock(&this_worker->outbound.lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  *cli_len = server->workers_len;
-  for (size_t i = 0; i < server->workers_len; i++) {
-    OctopipesServerWorker* this_worker = server->workers[i];
-    cli_ptr[i] = this_worker->client_id;
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief keep the last frame dispatched to each group and send it to the clients which subscribe to the group later.
+ * Frames are evicted, least recently used first, to keep the cache within budget
+ * @param OctopipesServer* server
+ * @param size_t budget in bytes (0 disables the cache and frees the retained frames)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_retained_cache(OctopipesServer* server, const size_t budget) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  *clients = cli_ptr;
+  pthread_mutex_lock(&server->retained.lock);
+  server->retained.budget = budget;
+  retained_evict(&server->retained);
+  pthread_mutex_unlock(&server->retained.lock);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief get description for server error
- * @param OctopipesServerError
- * @return const char*
+ * @brief get the retained cache statistics
+ * @param OctopipesServer* server
+ * @param size_t* groups: groups with a retained frame
+ * @param size_t* bytes: bytes used by the cache
+ * @param size_t* evicted: frames evicted to stay within budget
+ * @return OctopipesServerError
  */
 
-const char* octopipes_server_get_error_desc(const OctopipesServerError error) {
-  switch (error) {
-    case OCTOPIPES_SERVER_ERROR_BAD_ALLOC: 
-      return "Could not allocate more memory";
-    case OCTOPIPES_SERVER_ERROR_BAD_CHECKSUM:
-      return "Message has bad checksum";
-    case OCTOPIPES_SERVER_ERROR_BAD_CLIENT_DIR:
-      return "It was not possible to initialize the provided clients directory";
-    case OCTOPIPES_SERVER_ERROR_BAD_PACKET:
-      return "The received packet has an invalid syntax";
-    case OCTOPIPES_SERVER_ERROR_CAP_TIMEOUT:
-      return "CAP timeout";
-    case OCTOPIPES_SERVER_ERROR_NO_RECIPIENT:
-      return "The received message has no recipient, but it should had";
-    case OCTOPIPES_SERVER_ERROR_OPEN_FAILED:
-      return "Could not open or create the pipe";
-    case OCTOPIPES_SERVER_ERROR_READ_FAILED:
-      return "Could not read from pipe";
-    case OCTOPIPES_SERVER_ERROR_SUCCESS:
-      return "Not an error";
-    case OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING:
-      return "Thread is already running";
-    case OCTOPIPES_SERVER_ERROR_THREAD_ERROR:
-      return "There was an error in initializing the thread";
-    case OCTOPIPES_SERVER_ERROR_UNINITIALIZED:
-      return "Octopipes sever is not correctly initialized";
-    case OCTOPIPES_SERVER_ERROR_UNSUPPORTED_VERSION:
-      return "Unsupported protocol version";
-    case OCTOPIPES_SERVER_ERROR_WORKER_ALREADY_RUNNING:
-      return "A worker with these parameters is already running";
-    case OCTOPIPES_SERVER_ERROR_WORKER_EXISTS:
-      return "A worker with these parameters already exists";
-    case OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND:
-      return "Could not find a worker with that name";
-    case OCTOPIPES_SERVER_ERROR_WORKER_NOT_RUNNING:
-      return "The requested worker is not running";
-    case OCTOPIPES_SERVER_ERROR_WRITE_FAILED:
-      return "Could not write to pipe";
-    case OCTOPIPES_SERVER_ERROR_UNKNOWN:
-    default:
-      return "Unknown error";
+OctopipesServerError octopipes_server_get_retained_stats(OctopipesServer* server, size_t* groups, size_t* bytes, size_t* evicted) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
+  pthread_mutex_lock(&server->retained.lock);
+  *groups = server->retained.entries;
+  *bytes = server->retained.bytes;
+  *evicted = server->retained.evicted;
+  pthread_mutex_unlock(&server->retained.lock);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
-//Privates
-
 /**
- * @brief initialize a server worker
- * @param OctopipesServerWorker**
+ * @brief set whether the outbound queue of a client conflates frames: a newer frame of a group replaces the queued one in place,
+ * so the queue holds at most one frame for each group. Clients ask for it when they subscribe
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param int conflate
  * @return OctopipesServerError
  */
 
-OctopipesServerError worker_init(OctopipesServerWorker** worker, const char** subscriptions, const size_t sub_len, const char* client_id, const char* pipe_read, const char* pipe_write) {
-  //Try creating pipes
-  if (pipe_create(pipe_read) != OCTOPIPES_ERROR_SUCCESS) {
-    return OCTOPIPES_SERVER_ERROR_OPEN_FAILED;
-  }
-  if (pipe_create(pipe_write) != OCTOPIPES_ERROR_SUCCESS) {
-    return OCTOPIPES_SERVER_ERROR_OPEN_FAILED;
-  }
-  OctopipesServerWorker* ptr = (OctopipesServerWorker*) malloc(sizeof(OctopipesServerWorker));
-  if (ptr == NULL) {
-    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+OctopipesServerError octopipes_server_set_conflation(OctopipesServer* server, const char* client, const int conflate) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  ptr->active = 0;
-  ptr->client_id = NULL;
-  ptr->inbox = NULL;
-  ptr->pipe_read = NULL;
-  ptr->pipe_write = NULL;
-  ptr->subscriptions_list = NULL;
-  ptr->subscriptions = 0;
-  //Init inbox
-  if (message_inbox_init(&ptr->inbox) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-    goto worker_bad_alloc;
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    pthread_mutex_lock(&this_worker->outbound.lock);
+    this_worker->outbound.conflate = conflate;
+    pthread_mutex_unlock(&this_worker->outbound.lock);
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
   }
-  //Copy clid
-  const size_t clid_len = strlen(client_id);
-  ptr->client_id = (char*) malloc(sizeof(char) * (clid_len + 1));
-  if (ptr->client_id == NULL) {
-    goto worker_bad_alloc;
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief log the messages dispatched to each group into a durable append-only log, so clients can subscribe replaying
+ * the groups from an offset or a time. Each group is stored in memory mapped segments under directory; the oldest segments
+ * are deleted once a group exceeds the retention size or they're older than the retention age. It can't be changed while the server is running
+ * @param OctopipesServer* server
+ * @param char* directory of the log (NULL disables the log; segments are kept on disk)
+ * @param size_t segment size in bytes
+ * @param size_t retention bytes for each group (0: no limit)
+ * @param uint64_t retention age in milliseconds (0: no limit)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_log(OctopipesServer* server, const char* directory, const size_t segment_size, const size_t retention_bytes, const uint64_t retention_age_ms) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  memcpy(ptr->client_id, client_id, clid_len);
-  ptr->client_id[clid_len] = 0x00;
-  //Copy pipe read
-  const size_t piper_len = strlen(pipe_read);
-  ptr->pipe_read = (char*) malloc(sizeof(char) * (piper_len + 1));
-  if (ptr->pipe_read == NULL) {
-    goto worker_bad_alloc;
+  //Workers keep pointers to the group logs they replay
+  if (server->state == OCTOPIPES_SERVER_STATE_RUNNING || server->workers_len > 0) {
+    return OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING;
   }
-  memcpy(ptr->pipe_read, pipe_read, piper_len);
-  ptr->pipe_read[piper_len] = 0x00;
-  //Copy pipe write
-  const size_t pipew_len = strlen(pipe_write);
-  ptr->pipe_write = (char*) malloc(sizeof(char) * (pipew_len + 1));
-  if (ptr->pipe_write == NULL) {
-    goto worker_bad_alloc;
+  OctopipesLog* log = NULL;
+  OctopipesError ret;
+  if (directory != NULL && (ret = octopipes_log_open(&log, directory, segment_size, retention_bytes, retention_age_ms)) != OCTOPIPES_ERROR_SUCCESS) {
+    return to_server_error(ret);
   }
-  memcpy(ptr->pipe_write, pipe_write, pipew_len);
-  ptr->pipe_write[pipew_len] = 0x00;
-  //Copy subscription list
-  ptr->subscriptions_list = (char**) malloc(sizeof(char*) * (sub_len + 1));
-  if (ptr->subscriptions_list == NULL) {
-    goto worker_bad_alloc;
+  if (server->log != NULL) {
+    octopipes_log_close(server->log);
   }
-  for (size_t i = 0; i < sub_len; i++) {
-    const size_t this_sub_len = strlen(subscriptions[i]);
-    ptr->subscriptions_list[i] = (char*) malloc(sizeof(char) * (this_sub_len + 1));
-    if (ptr->subscriptions_list[i] == NULL) {
-      goto worker_bad_alloc;
-    }
-    memcpy(ptr->subscriptions_list[i], subscriptions[i], this_sub_len);
-    (ptr->subscriptions_list[i])[this_sub_len] = 0x00;
-    ptr->subscriptions++;
+  server->log = log;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief set how many groups the log can load at once: each group keeps its segments mapped, so clients dispatching to
+ * arbitrary groups can't exhaust the address space. Messages to other groups are still dispatched, but they're not logged
+ * and dispatch reports OCTOPIPES_SERVER_ERROR_LOG_FULL
+ * @param OctopipesServer* server
+ * @param size_t max groups
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_log_max_groups(OctopipesServer* server, const size_t max_groups) {
+  if (server == NULL || server->log == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  ptr->subscriptions_list[sub_len] = (char*) malloc(sizeof(char*) * (clid_len + 1));
-  memcpy((ptr->subscriptions_list)[sub_len], ptr->client_id, clid_len);
-  ((ptr->subscriptions_list)[sub_len])[clid_len] = 0x00;
-  ptr->subscriptions = sub_len + 1;
-  //Create mutex
-  if (pthread_mutex_init(&ptr->worker_lock, NULL) != 0) {
-    goto worker_thread_error;
+  return to_server_error(octopipes_log_set_max_groups(server->log, max_groups));
+}
+
+/**
+ * @brief get the offsets of the log of a group: clients can replay the group from any offset in [first, next)
+ * @param OctopipesServer* server
+ * @param char* group
+ * @param uint64_t* first: offset of the oldest record still logged
+ * @param uint64_t* next: offset the next message dispatched to the group will get
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_get_log_offsets(OctopipesServer* server, const char* group, uint64_t* first, uint64_t* next) {
+  if (server == NULL || server->log == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  //Start thread
-  ptr->active = 1;
-  if (pthread_create(&ptr->worker_listener, NULL, worker_loop, ptr) != 0) {
-    goto worker_thread_error;
+  *first = 0;
+  *next = 0;
+  OctopipesLogGroup* log_group;
+  OctopipesError ret;
+  if ((ret = octopipes_log_get_group(server->log, group, 0, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    //A group which has never been logged is empty
+    return ret == OCTOPIPES_ERROR_NO_DATA_AVAILABLE ? OCTOPIPES_SERVER_ERROR_SUCCESS : to_server_error(ret);
   }
-  *worker = ptr;
+  pthread_mutex_lock(&log_group->lock);
+  *first = octopipes_log_first(log_group);
+  *next = log_group->next;
+  pthread_mutex_unlock(&log_group->lock);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
 
-worker_bad_alloc:
-  if (ptr->client_id != NULL) {
-    free(ptr->client_id);
+/**
+ * @brief register an in-process handler for a group: the messages dispatched to it are passed to on_message as they are,
+ * without going through a pipe. The handler runs in the dispatching thread once the routing is unlocked, so it can call any
+ * server function, such as octopipes_server_dispatch_message or octopipes_server_reply; dispatches nested deeper than
+ * HANDLER_MAX_DEPTH fail. Registering a group again replaces its handler
+ * @param OctopipesServer* server
+ * @param char* group (wildcards are allowed)
+ * @param function on_message: the message is valid only during the call
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_register_handler(OctopipesServer* server, const char* group, void (*on_message)(OctopipesServer* server, const OctopipesMessage* message)) {
+  if (server == NULL || group == NULL || on_message == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  if (ptr->inbox != NULL) {
-    message_inbox_cleanup(ptr->inbox);
+  OctopipesServerError rc;
+  pthread_rwlock_wrlock(&server->routing_lock);
+  //Handlers are stored in the routing trie, so they're matched as the subscriptions
+  OctopipesServerTrieNode* node;
+  if ((rc = trie_walk(server->routing_trie, group, 1, &node)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto register_rollback;
   }
-  if (ptr->pipe_read != NULL) {
-    free(ptr->pipe_read);
+  if (node->handler != NULL) {
+    __atomic_store_n(&node->handler->on_message, on_message, __ATOMIC_RELEASE);
+    goto register_unlock;
   }
-  if (ptr->pipe_write != NULL) {
-    free(ptr->pipe_write);
+  OctopipesServerHandler* handler = (OctopipesServerHandler*) malloc(sizeof(OctopipesServerHandler));
+  if (handler == NULL) {
+    rc = OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    goto register_rollback;
   }
-  for (size_t i = 0; i < ptr->subscriptions; i++) {
-    free(ptr->subscriptions_list[i]);
+  handler->on_message = on_message;
+  handler->refs = 1;
+  node->handler = handler;
+  goto register_unlock;
+
+register_rollback:
+  //Free the nodes created for the group
+  trie_remove(server->routing_trie, group, NULL);
+register_unlock:
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief unregister the handler of a group; once it returns, the handler is not called anymore.
+ * It waits for the calls of the handler which are running, unless it's called by a handler: those may still be running then
+ * @param OctopipesServer* server
+ * @param char* group, as it was registered
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_unregister_handler(OctopipesServer* server, const char* group) {
+  if (server == NULL || group == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  if (ptr->subscriptions_list != NULL) {
-    free(ptr->subscriptions_list);
+  OctopipesServerHandler* handler = NULL;
+  pthread_rwlock_wrlock(&server->routing_lock);
+  OctopipesServerTrieNode* node;
+  trie_walk(server->routing_trie, group, 0, &node);
+  if (node != NULL && node->handler != NULL) {
+    handler = node->handler;
+    node->handler = NULL;
+    //The dispatches which have already matched it skip it from now on
+    __atomic_store_n(&handler->on_message, NULL, __ATOMIC_RELEASE);
+    trie_remove(server->routing_trie, group, NULL);
   }
-  return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
-worker_thread_error:
-  if (ptr->client_id != NULL) {
-    free(ptr->client_id);
+  pthread_rwlock_unlock(&server->routing_lock);
+  if (handler == NULL) {
+    return OCTOPIPES_SERVER_ERROR_NO_RECIPIENT;
   }
-  if (ptr->inbox != NULL) {
-    message_inbox_cleanup(ptr->inbox);
+  //Wait for the running calls; a handler would wait for itself
+  if (handler_depth == 0) {
+    while (__atomic_load_n(&handler->refs, __ATOMIC_ACQUIRE) > 1) {
+      usleep(HANDLER_WAIT_INTERVAL * 1000);
+    }
   }
-  if (ptr->pipe_read != NULL) {
-    free(ptr->pipe_read);
+  handler_release(handler);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief reply to a request from a handler. The reply is dispatched to the requester without copying data; a handler
+ * which made the request gets it without any encoding
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* request
+ * @param char* origin of the reply (usually the group of the handler)
+ * @param void* data
+ * @param uint64_t data size
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_reply(OctopipesServer* server, const OctopipesMessage* request, const char* origin, const void* data, const uint64_t data_size) {
+  if (server == NULL || request == NULL || origin == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
   }
-  if (ptr->pipe_write != NULL) {
-    free(ptr->pipe_write);
+  const size_t origin_size = strlen(origin);
+  if ((request->options & OCTOPIPES_OPTIONS_REQUEST) == 0 || request->origin == NULL || origin_size == 0 || origin_size > 255 || (data == NULL && data_size > 0)) {
+    return OCTOPIPES_SERVER_ERROR_BAD_PACKET;
   }
-  for (size_t i = 0; i < ptr->subscriptions; i++) {
-    free(ptr->subscriptions_list[i]);
+  OctopipesMessage message;
+  message.version = request->version;
+  message.origin_size = (uint8_t) origin_size;
+  message.origin = (char*) origin;
+  message.remote_size = request->origin_size;
+  message.remote = request->origin;
+  message.ttl = request->ttl;
+  message.data_size = data_size;
+  message.options = OCTOPIPES_OPTIONS_REPLY;
+  message.checksum = 0;
+  message.correlation_id = request->correlation_id;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = (uint8_t*) data;
+  const char* failed;
+  return octopipes_server_dispatch_message(server, &message, &failed);
+}
+
+/**
+ * @brief dispatch large messages in parallel: when the message size multiplied by its recipients reaches threshold,
+ * recipients are split among threads (plus the dispatcher), which steal each other's recipients once done with theirs.
+ * Each recipient still receives messages in order, since dispatch returns only once the message has been queued for all of them
+ * @param OctopipesServer* server
+ * @param size_t threads (0 disables parallel dispatch)
+ * @param size_t threshold in bytes (0 keeps the current one)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_fanout(OctopipesServer* server, const size_t threads, const size_t threshold) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerFanout* fanout = &server->fanout;
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  //Wait for the dispatch using the pool, then replace the pool
+  pthread_mutex_lock(&fanout->job_lock);
+  fanout_stop(fanout);
+  if (threshold > 0) {
+    fanout->threshold = threshold;
+  }
+  if (threads > 0) {
+    fanout->threads = (OctopipesServerFanoutThread*) malloc(sizeof(OctopipesServerFanoutThread) * threads);
+    fanout->ranges = (OctopipesServerFanoutRange*) malloc(sizeof(OctopipesServerFanoutRange) * (threads + 1));
+    if (fanout->threads == NULL || fanout->ranges == NULL) {
+      rc = OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+      goto fanout_error;
+    }
+    fanout->running = 1;
+    for (size_t i = 0; i < threads; i++) {
+      fanout->threads[i].index = i + 1; //Range 0 belongs to the dispatcher
+      fanout->threads[i].job = fanout->job;
+      fanout->threads[i].fanout = fanout;
+      if (pthread_create(&fanout->threads[i].thread, NULL, fanout_loop, &fanout->threads[i]) != 0) {
+        rc = OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+        goto fanout_error;
+      }
+      fanout->threads_len++;
+    }
+  }
+  pthread_mutex_unlock(&fanout->job_lock);
+  return rc;
+
+fanout_error:
+  fanout_stop(fanout);
+  pthread_mutex_unlock(&fanout->job_lock);
+  return rc;
+}
+
+/**
+ * @brief start dispatcher threads. Workers are partitioned by client id among the dispatchers, each one processing the inbox
+ * of its workers as soon as they receive messages, so routing isn't limited to the thread calling octopipes_server_process_*, which
+ * can't be used while dispatchers are running. Dispatchers are pinned to cores where supported
+ * @param OctopipesServer* server
+ * @param size_t dispatchers (0 starts one dispatcher for each online core)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_start_dispatchers(OctopipesServer* server, const size_t dispatchers) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerDispatchers* shards = &server->dispatchers;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1) {
+    cores = 1;
+  }
+  const size_t shards_len = dispatchers > 0 ? dispatchers : (size_t) cores;
+  pthread_rwlock_wrlock(&shards->lock);
+  if (shards->shards_len > 0) {
+    pthread_rwlock_unlock(&shards->lock);
+    return OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING;
+  }
+  shards->shards = (OctopipesServerShard*) malloc(sizeof(OctopipesServerShard) * shards_len);
+  if (shards->shards == NULL) {
+    pthread_rwlock_unlock(&shards->lock);
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  //Shards are selected by shards_len, so it must be set before dispatchers start
+  shards->shards_len = shards_len;
+  for (size_t i = 0; i < shards_len; i++) {
+    OctopipesServerShard* shard = &shards->shards[i];
+    shard->index = i;
+    shard->ready_head = NULL;
+    shard->ready_tail = NULL;
+    shard->running = 1;
+    shard->server = server;
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->ready, NULL);
+  }
+  //Process the messages received before starting; workers can't queue themselves until the dispatchers are unlocked
+  pthread_rwlock_rdlock(&server->routing_lock);
+  for (size_t i = 0; i < server->workers_len; i++) {
+    OctopipesServerWorker* this_worker = server->workers[i];
+    this_worker->ready = 0; //Left set by the previous dispatchers
+    shard_push(&shards->shards[this_worker->hash % shards_len], this_worker);
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  for (size_t i = 0; i < shards_len; i++) {
+    OctopipesServerShard* shard = &shards->shards[i];
+    if (pthread_create(&shard->thread, NULL, shard_loop, shard) != 0) {
+      for (size_t j = i; j < shards_len; j++) {
+        pthread_mutex_destroy(&shards->shards[j].lock);
+        pthread_cond_destroy(&shards->shards[j].ready);
+      }
+      shards->shards_len = i;
+      pthread_rwlock_unlock(&shards->lock);
+      octopipes_server_stop_dispatchers(server);
+      return OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+    }
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(i % (size_t) cores, &cpu_set);
+    pthread_setaffinity_np(shard->thread, sizeof(cpu_set_t), &cpu_set); //Not pinned threads work anyway
+#endif
+  }
+  pthread_rwlock_unlock(&shards->lock);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief stop the dispatcher threads; messages are then processed by octopipes_server_process_* again
+ * @param OctopipesServer* server
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_stop_dispatchers(OctopipesServer* server) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerDispatchers* shards = &server->dispatchers;
+  pthread_rwlock_wrlock(&shards->lock);
+  if (shards->shards == NULL) {
+    pthread_rwlock_unlock(&shards->lock);
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  for (size_t i = 0; i < shards->shards_len; i++) {
+    OctopipesServerShard* shard = &shards->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    shard->running = 0;
+    pthread_cond_signal(&shard->ready);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  //Dispatchers are joined unlocked, since they may stop disconnected workers, which leave the ready queues.
+  //Stopped shards don't take workers from their queue anymore, so stopped workers don't need to leave it
+  OctopipesServerShard* stopped = shards->shards;
+  const size_t stopped_len = shards->shards_len;
+  shards->shards = NULL;
+  shards->shards_len = 0;
+  pthread_rwlock_unlock(&shards->lock);
+  for (size_t i = 0; i < stopped_len; i++) {
+    OctopipesServerShard* shard = &stopped[i];
+    pthread_join(shard->thread, NULL);
+    pthread_mutex_destroy(&shard->lock);
+    pthread_cond_destroy(&shard->ready);
+  }
+  free(stopped);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief set the callback called by the dispatchers when a message can't be dispatched or a worker reports an error
+ * @param OctopipesServer* server
+ * @param function on_error: server, client which failed (NOTE: DO NOT FREE) and error
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_dispatch_error_cb(OctopipesServer* server, void (*on_error)(const OctopipesServer* server, const char* client, const OctopipesServerError error)) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  server->dispatchers.on_error = on_error;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Dispatch a message to all the clients subscribed to the message remote and to the handlers registered for it.
+ * The message is encoded once and queued for each client; a failing client doesn't prevent the dispatch to the others.
+ * It can be called from a handler to inject a message without encoding it, if only handlers are subscribed to it
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* message
+ * @param char** worker which failed in dispatching message (NOTE: DO NOT FREE)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_dispatch_message(OctopipesServer* server, OctopipesMessage* message, const char** worker) {
+  *worker = NULL;
+  //Handlers dispatching to each other can't recurse forever
+  if (handler_depth >= HANDLER_MAX_DEPTH) {
+    return OCTOPIPES_SERVER_ERROR_HANDLER_DEPTH;
+  }
+  //Frames of messages with a TTL expire if they're still queued when it elapses
+  const uint64_t expires = message->ttl > 0 ? octopipes_get_time_ms() + (uint64_t) message->ttl * 1000 : 0;
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
+  OctopipesServerWorker* route_workers[ROUTE_STACK_SIZE];
+  OctopipesServerHandler* route_handlers[ROUTE_HANDLERS_SIZE];
+  OctopipesServerRoute route;
+  route_init(&route, route_workers, route_handlers);
+  pthread_rwlock_rdlock(&server->routing_lock);
+  const OctopipesServerError ret = dispatch_message_locked(server, message, expires, worker, &route);
+  pthread_rwlock_unlock(&server->routing_lock);
+  handlers_call(server, message, &route);
+  route_cleanup(&route);
+  return ret;
+}
+
+/**
+ * @brief Dispatch a message to all the clients subscribed to the message remote; routing_lock must be read locked by the caller.
+ * The handlers registered for the remote are collected in route: the caller calls them with handlers_call once it releases routing_lock
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* message
+ * @param uint64_t expires: time the queued frames expire at (ms, 0 if they never expire)
+ * @param char** worker which failed in dispatching message (NOTE: DO NOT FREE)
+ * @param OctopipesServerRoute* route: empty route, initialized by the caller
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError dispatch_message_locked(OctopipesServer* server, OctopipesMessage* message, const uint64_t expires, const char** worker, OctopipesServerRoute* route) {
+  //Check if remote is set
+  *worker = NULL;
+  if (message->remote == NULL) {
+    return OCTOPIPES_SERVER_ERROR_NO_RECIPIENT;
+  }
+  //Collect the subscribers and the handlers of the remote from the routing trie
+  OctopipesServerError ret;
+  if ((ret = trie_match(server->routing_trie, message->remote, route)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto dispatch_failed;
+  }
+  //Messages to a client id are direct messages, not the state of a group
+  const int group = (message->options & POINT_TO_POINT_OPTIONS) == 0 && workers_find(server, message->remote) == NULL;
+  const int logged = server->log != NULL && group;
+  const int retained = server->retained.budget > 0 && group;
+  //Messages for the handlers only are never encoded; the frame is shared by the recipients which can't take it at once
+  uint8_t* data_out = NULL;
+  size_t data_out_size = 0;
+  OctopipesServerSharedFrame* frame = NULL;
+  if (route->workers_len > 0 || logged || retained) {
+    OctopipesError enc_ret;
+    if ((enc_ret = octopipes_encode(message, &data_out, &data_out_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      ret = to_server_error(enc_ret);
+      goto dispatch_failed;
+    }
+    if ((ret = shared_frame_init(&frame, data_out, data_out_size)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      free(data_out);
+      goto dispatch_failed;
+    }
+  }
+  //Log the frame before sending it, so the workers replaying the group know whether they wrote it already
+  uint64_t log_offset = OCTOPIPES_LOG_NO_OFFSET;
+  OctopipesError log_ret = OCTOPIPES_ERROR_SUCCESS;
+  if (logged) {
+    OctopipesLogGroup* log_group;
+    if ((log_ret = octopipes_log_get_group(server->log, message->remote, 1, &log_group)) == OCTOPIPES_ERROR_SUCCESS) {
+      log_ret = octopipes_log_append(log_group, data_out, data_out_size, &log_offset);
+    }
+  }
+  int parallel = 0;
+  const size_t priority = OCTOPIPES_PRIORITY(message->options);
+  //Large messages are sent in parallel, unless the pool is busy with another dispatcher
+  if (route->workers_len > 1 && pthread_mutex_trylock(&server->fanout.job_lock) == 0) {
+    OctopipesServerFanout* fanout = &server->fanout;
+    if (fanout->threads_len > 0 && data_out_size * route->workers_len >= fanout->threshold) {
+      OctopipesServerWorker* failed = NULL;
+      parallel = 1;
+      if ((ret = fanout_dispatch(fanout, route->workers, route->workers_len, frame, priority, expires, message->remote, log_offset, &failed)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+        *worker = failed->client_id;
+      }
+    }
+    pthread_mutex_unlock(&fanout->job_lock);
+  }
+  if (!parallel) {
+    //Send message to each subscriber; report the first one which failed
+    for (size_t i = 0; i < route->workers_len; i++) {
+      OctopipesServerError send_ret;
+      OctopipesServerWorker* this_worker = route->workers[i];
+      if ((send_ret = worker_send(this_worker, frame, priority, expires, message->remote, log_offset)) != OCTOPIPES_SERVER_ERROR_SUCCESS && *worker == NULL) {
+        *worker = this_worker->client_id;
+        ret = send_ret;
+      }
+    }
+  }
+  //Keep the frame for the late subscribers of the remote
+  if (retained) {
+    retained_store(&server->retained, message->remote, frame, priority, expires);
+  }
+  if (frame != NULL) {
+    shared_frame_release(frame);
+  }
+  //A message which couldn't be logged is still dispatched; the failure is reported without a worker
+  if (ret == OCTOPIPES_SERVER_ERROR_SUCCESS && log_ret != OCTOPIPES_ERROR_SUCCESS) {
+    ret = to_server_error(log_ret);
+  }
+  return ret;
+
+dispatch_failed:
+  //Handlers get the message only once the clients have it
+  route_drop_handlers(route);
+  return ret;
+}
+
+/**
+ * @brief checks if a worker has a message to dispatch, once found a worker with a message in its inbox, it processes it and returns
+ * @param OctopipesServer* server
+ * @param size_t* processed requests
+ * @param char** client which returned an error (NOTE: DO NOT FREE)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_process_first(OctopipesServer* server, size_t* requests, const char** client) {
+  //Iterate over workers to find one to process
+  *client = NULL;
+  *requests = 0;
+  //Workers are processed by the dispatchers while they're running
+  if (server->dispatchers.shards_len > 0) {
+    return OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING;
+  }
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
+  //Start from the worker after the last one processed, so the first workers can't starve the others
+  for (size_t i = 0; i < server->workers_len; i++) {
+    const size_t index = (server->schedule_cursor + i) % server->workers_len;
+    OctopipesServerWorker* this_worker = server->workers[index];
+    OctopipesServerMessage* inbox_message = NULL;
+    OctopipesServerError ret;
+    if ((ret = worker_get_next_message(this_worker, &inbox_message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      *client = this_worker->client_id;
+      return ret;
+    }
+    if (inbox_message != NULL) {
+      server->schedule_cursor = index + 1;
+      //Dispatch message
+      OctopipesMessage* message = inbox_message->message;
+      if (message != NULL) {
+        OctopipesServerWorker* route_workers[ROUTE_STACK_SIZE];
+        OctopipesServerHandler* route_handlers[ROUTE_HANDLERS_SIZE];
+        OctopipesServerRoute route;
+        route_init(&route, route_workers, route_handlers);
+        pthread_rwlock_rdlock(&server->routing_lock);
+        ret = dispatch_message_locked(server, message, inbox_message->expires, client, &route);
+        pthread_rwlock_unlock(&server->routing_lock);
+        handlers_call(server, message, &route);
+        route_cleanup(&route);
+        if (ret != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+          server_message_cleanup(inbox_message);
+          return ret;
+        }
+      } else {
+        ret = inbox_message->error;
+        *requests = *requests + 1;
+        server_message_cleanup(inbox_message);
+        return ret;
+      }
+      server_message_cleanup(inbox_message);
+      //Otherwise message has been processed successfully
+      *requests = *requests + 1;
+      return ret;
+    }
+    //Otherwise keep searching
+  }
+  return OCTOPIPES_SERVER_ERROR_SUCCESS; //No message processed
+}
+
+/**
+ * @brief for each worker try to dispatch a message in the inbox once
+ * @param OctopipesServer* server
+ * @param size_t* requests
+ * @param char** worker which returned error (NOTE: DO NOT FREE)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_process_once(OctopipesServer* server, size_t* requests, const char** client) {
+  //Iterate over workers to find one to process
+  *client = NULL;
+  *requests = 0;
+  //Workers are processed by the dispatchers while they're running
+  if (server->dispatchers.shards_len > 0) {
+    return OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING;
+  }
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
+  for (size_t i = 0; i < server->workers_len; i++) {
+    OctopipesServerWorker* this_worker = server->workers[i];
+    OctopipesServerMessage* inbox_message = NULL;
+    OctopipesServerError ret;
+    if ((ret = worker_get_next_message(this_worker, &inbox_message)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      *client = this_worker->client_id;
+      return ret;
+    }
+    if (inbox_message != NULL) {
+      //Dispatch message
+      OctopipesMessage* message = inbox_message->message;
+      if (message != NULL) {
+        OctopipesServerWorker* route_workers[ROUTE_STACK_SIZE];
+        OctopipesServerHandler* route_handlers[ROUTE_HANDLERS_SIZE];
+        OctopipesServerRoute route;
+        route_init(&route, route_workers, route_handlers);
+        pthread_rwlock_rdlock(&server->routing_lock);
+        ret = dispatch_message_locked(server, message, inbox_message->expires, client, &route);
+        pthread_rwlock_unlock(&server->routing_lock);
+        handlers_call(server, message, &route);
+        route_cleanup(&route);
+        if (ret != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+          server_message_cleanup(inbox_message);
+          return ret;
+        }
+      } else {
+        ret = inbox_message->error;
+        *requests = *requests + 1;
+        server_message_cleanup(inbox_message);
+        return ret;
+      }
+      server_message_cleanup(inbox_message);
+      //Otherwise message has been processed successfully
+      *requests = *requests + 1;
+      //Continue
+    }
+    //Otherwise keep searching
+  }
+  return OCTOPIPES_SERVER_ERROR_SUCCESS; //No message processed
+}
+
+/**
+ * @brief keep processing workers until all their inbox are empty
+ * @param OctopipesServer* server
+ * @param size_t* requests processed
+ * @param char** worker which returned error
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_process_all(OctopipesServer* server, size_t* requests, const char** client) {
+  *client = NULL;
+  *requests = 0;
+  size_t this_session_requests = 0;
+  do {
+    OctopipesServerError ret;
+    if ((ret = octopipes_server_process_once(server, &this_session_requests, client)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      return ret;
+    }
+    *requests += this_session_requests; //Increment processed requests
+  } while(this_session_requests > 0);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief process worker inboxes with a deficit round robin scheduler. Each round a worker is granted weight * SCHEDULE_QUANTUM bytes
+ * of messages; the round starts from where the previous call stopped, so no worker is favoured because of its position.
+ * Processing stops once max_msgs messages have been processed or max_us microseconds have elapsed (0 means no limit), or when inboxes are empty
+ * @param OctopipesServer* server
+ * @param size_t max messages to process
+ * @param uint64_t max time to spend processing (us)
+ * @param size_t* requests processed
+ * @param char** worker which returned error
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_process_budget(OctopipesServer* server, const size_t max_msgs, const uint64_t max_us, size_t* requests, const char** client) {
+  *client = NULL;
+  *requests = 0;
+  //Workers are processed by the dispatchers while they're running
+  if (server->dispatchers.shards_len > 0) {
+    return OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING;
+  }
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
+  const uint64_t t_start = octopipes_get_time_us();
+  OctopipesServerError ret = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  int exhausted = 0;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  //Stop after a round in which no worker had messages
+  size_t idle = 0;
+  while (!exhausted && idle < server->workers_len) {
+    if (server->schedule_cursor >= server->workers_len) {
+      server->schedule_cursor = 0; //Workers have been removed
+    }
+    OctopipesServerWorker* this_worker = server->workers[server->schedule_cursor];
+    //A worker interrupted by the budget resumes its turn with its remaining deficit
+    if (this_worker->deficit <= 0) {
+      //An overdrawn worker with nothing to send is forgiven, otherwise it would keep the rounds going until it paid back
+      if (this_worker->deficit < 0 && !worker_has_messages(this_worker)) {
+        this_worker->deficit = 0;
+      }
+      this_worker->deficit += (long) (this_worker->weight * SCHEDULE_QUANTUM);
+    }
+    size_t processed = 0;
+    int drained = 0;
+    int stopped = 0;
+    const uint32_t hash = this_worker->hash;
+    while (this_worker->deficit > 0) {
+      if ((max_msgs > 0 && *requests >= max_msgs) || (max_us > 0 && octopipes_get_time_us() - t_start >= max_us)) {
+        exhausted = 1;
+        break;
+      }
+      OctopipesServerMessage* inbox_message;
+      worker_get_next_message(this_worker, &inbox_message);
+      if (inbox_message == NULL) {
+        this_worker->deficit = 0; //Idle workers don't accumulate credit
+        drained = 1;
+        break;
+      }
+      processed++;
+      *requests = *requests + 1;
+      OctopipesMessage* message = inbox_message->message;
+      OctopipesServerWorker* route_workers[ROUTE_STACK_SIZE];
+      OctopipesServerHandler* route_handlers[ROUTE_HANDLERS_SIZE];
+      OctopipesServerRoute route;
+      route_init(&route, route_workers, route_handlers);
+      if (message != NULL) {
+        //The cost can exceed the deficit; the worker pays it back in the next rounds
+        this_worker->deficit -= (long) (message->data_size + SCHEDULE_MESSAGE_COST);
+        ret = dispatch_message_locked(server, message, inbox_message->expires, client, &route);
+      } else {
+        this_worker->deficit -= SCHEDULE_MESSAGE_COST;
+        ret = inbox_message->error;
+        *client = this_worker->client_id;
+      }
+      //Handlers are called without routing_lock; the worker may be stopped meanwhile, so it's looked up again
+      if (route.handlers_len > 0) {
+        pthread_rwlock_unlock(&server->routing_lock);
+        handlers_call(server, message, &route);
+        pthread_rwlock_rdlock(&server->routing_lock);
+        stopped = !workers_contains(server, this_worker, hash);
+      }
+      route_cleanup(&route);
+      server_message_cleanup(inbox_message);
+      if (ret != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+        exhausted = 1;
+        break;
+      }
+      if (stopped) {
+        break;
+      }
+    }
+    //A stopped worker is replaced by the last one in its slot, which is served next
+    if (stopped) {
+      idle = 0;
+      continue;
+    }
+    //A worker paying back its overdraft still has messages, so it has to be served in the next rounds
+    idle = processed == 0 && drained ? idle + 1 : 0;
+    if (!exhausted || this_worker->deficit <= 0) {
+      server->schedule_cursor++;
+    }
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  return ret;
+}
+
+/**
+ * @brief set the weight of a client in octopipes_server_process_budget: each round it can send weight times the bytes of a client with weight 1
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param size_t weight (0 restores the default weight, 1)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_set_weight(OctopipesServer* server, const char* client, const size_t weight) {
+  if (server == NULL) {
+    return OCTOPIPES_SERVER_ERROR_UNINITIALIZED;
+  }
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    this_worker->weight = weight > 0 ? weight : 1;
+    rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief checks if a certain client is subscribed to the server
+ * @param OctopipesServer* server
+ * @param char* client
+ * @return OctopipesServerError (NOTE: SUCCESS if exists)
+ */
+
+OctopipesServerError octopipes_server_is_subscribed(OctopipesServer* server, const char* client) {
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  pthread_rwlock_unlock(&server->routing_lock);
+  return this_worker != NULL ? OCTOPIPES_SERVER_ERROR_SUCCESS : OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+}
+
+/**
+ * @brief get all the subscriptions for a certain worker
+ * @param char* client
+ * @param char*** subscriptions (NOTE: FREE char** only: the groups are copied in the same block, since the client can change them anytime)
+ * @param size_t* subscriptions length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_get_subscriptions(OctopipesServer* server, const char* client, char*** subscriptions, size_t* sub_len) {
+  *subscriptions = NULL;
+  *sub_len = 0;
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker != NULL) {
+    rc = worker_get_subscriptions(this_worker, subscriptions, sub_len);
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief returns all the clients subscribed to the server at the moment
+ * @param OctopipesServer* server
+ * @param char*** clients (NOTE: FREE char**, but not the content)
+ * @param size_t* clients length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError octopipes_server_get_clients(OctopipesServer* server, char*** clients, size_t* cli_len) {
+  if (server->workers_len == 0) {
+    *cli_len = 0;
+    return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  char** cli_ptr = (char**) malloc(sizeof(char*) * server->workers_len);
+  if (cli_ptr == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  *cli_len = server->workers_len;
+  for (size_t i = 0; i < server->workers_len; i++) {
+    OctopipesServerWorker* this_worker = server->workers[i];
+    cli_ptr[i] = this_worker->client_id;
+  }
+  *clients = cli_ptr;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief get description for server error
+ * @param OctopipesServerError
+ * @return const char*
+ */
+
+const char* octopipes_server_get_error_desc(const OctopipesServerError error) {
+  switch (error) {
+    case OCTOPIPES_SERVER_ERROR_BAD_ALLOC: 
+      return "Could not allocate more memory";
+    case OCTOPIPES_SERVER_ERROR_BAD_CHECKSUM:
+      return "Message has bad checksum";
+    case OCTOPIPES_SERVER_ERROR_BAD_CLIENT_DIR:
+      return "It was not possible to initialize the provided clients directory";
+    case OCTOPIPES_SERVER_ERROR_BAD_PACKET:
+      return "The received packet has an invalid syntax";
+    case OCTOPIPES_SERVER_ERROR_CAP_TIMEOUT:
+      return "CAP timeout";
+    case OCTOPIPES_SERVER_ERROR_NO_RECIPIENT:
+      return "The received message has no recipient, but it should had";
+    case OCTOPIPES_SERVER_ERROR_OPEN_FAILED:
+      return "Could not open or create the pipe";
+    case OCTOPIPES_SERVER_ERROR_READ_FAILED:
+      return "Could not read from pipe";
+    case OCTOPIPES_SERVER_ERROR_SUCCESS:
+      return "Not an error";
+    case OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING:
+      return "Thread is already running";
+    case OCTOPIPES_SERVER_ERROR_THREAD_ERROR:
+      return "There was an error in initializing the thread";
+    case OCTOPIPES_SERVER_ERROR_UNINITIALIZED:
+      return "Octopipes sever is not correctly initialized";
+    case OCTOPIPES_SERVER_ERROR_UNSUPPORTED_VERSION:
+      return "Unsupported protocol version";
+    case OCTOPIPES_SERVER_ERROR_WORKER_ALREADY_RUNNING:
+      return "A worker with these parameters is already running";
+    case OCTOPIPES_SERVER_ERROR_WORKER_EXISTS:
+      return "A worker with these parameters already exists";
+    case OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND:
+      return "Could not find a worker with that name";
+    case OCTOPIPES_SERVER_ERROR_WORKER_NOT_RUNNING:
+      return "The requested worker is not running";
+    case OCTOPIPES_SERVER_ERROR_WRITE_FAILED:
+      return "Could not write to pipe";
+    case OCTOPIPES_SERVER_ERROR_WORKER_OVERFLOW:
+      return "The worker outbound queue overflowed; the worker is disconnected by the next processing call";
+    case OCTOPIPES_SERVER_ERROR_LOG_FULL:
+      return "The log can't load more groups";
+    case OCTOPIPES_SERVER_ERROR_BAD_CLIENT_ID:
+      return "The client id can't contain wildcards or level separators";
+    case OCTOPIPES_SERVER_ERROR_HANDLER_DEPTH:
+      return "Too many dispatches nested in handlers";
+    case OCTOPIPES_SERVER_ERROR_UNKNOWN:
+    default:
+      return "Unknown error";
+  }
+}
+
+//Privates
+
+/**
+ * @brief initialize a server worker
+ * @param OctopipesServerWorker**
+ * @param char** subscriptions
+ * @param size_t subscriptions length
+ * @param char* client id
+ * @param char* pipe read
+ * @param char* pipe write
+ * @param size_t outbound queue size
+ * @param OctopipesServerOverflowPolicy outbound queue overflow policy
+ * @param OctopipesServerRateLimit* rate limit applied to the client (its limits are copied)
+ * @param OctopipesServerCredits* window granted to the client (it's copied)
+ * @param OctopipesServerMemory* accounting of the memory held by the inboxes
+ * @param OctopipesServerDispatchers* dispatchers to notify when messages are received
+ * @param OctopipesServerDisconnects* disconnects to report the overflow of the outbound queue to
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_init(OctopipesServerWorker** worker, const char** subscriptions, const size_t sub_len, const char* client_id, const char* pipe_read, const char* pipe_write, const size_t queue_size, const OctopipesServerOverflowPolicy policy, const OctopipesServerRateLimit* rate_limit, const OctopipesServerCredits* credits, OctopipesServerMemory* memory, OctopipesServerDispatchers* dispatchers, OctopipesServerDisconnects* disconnects) {
+  //Try creating pipes
+  if (pipe_create(pipe_read) != OCTOPIPES_ERROR_SUCCESS) {
+    return OCTOPIPES_SERVER_ERROR_OPEN_FAILED;
+  }
+  if (pipe_create(pipe_write) != OCTOPIPES_ERROR_SUCCESS) {
+    return OCTOPIPES_SERVER_ERROR_OPEN_FAILED;
+  }
+  OctopipesServerWorker* ptr = (OctopipesServerWorker*) malloc(sizeof(OctopipesServerWorker));
+  if (ptr == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  ptr->active = 0;
+  ptr->client_id = NULL;
+  ptr->inbox = NULL;
+  ptr->pipe_read = NULL;
+  ptr->pipe_write = NULL;
+  ptr->subscriptions_list = NULL;
+  ptr->subscriptions = 0;
+  ptr->hash = client_hash(client_id);
+  ptr->weight = 1;
+  ptr->deficit = 0;
+  ptr->dispatchers = dispatchers;
+  ptr->ready = 0;
+  ptr->ready_prev = NULL;
+  ptr->ready_next = NULL;
+  ptr->disconnects = disconnects;
+  ptr->read_fd = -1;
+  ptr->outbound.fd = -1;
+  for (size_t i = 0; i < OCTOPIPES_PRIORITIES; i++) {
+    ptr->outbound.lanes[i].frames = NULL;
+    ptr->outbound.lanes[i].head = 0;
+    ptr->outbound.lanes[i].len = 0;
+  }
+  ptr->outbound.len = 0;
+  ptr->outbound.size = queue_size;
+  ptr->outbound.offset = 0;
+  ptr->outbound.writing = 0;
+  ptr->outbound.policy = policy;
+  ptr->outbound.dropped = 0;
+  ptr->outbound.expired = 0;
+  ptr->outbound.overflowed = 0;
+  ptr->outbound.conflate = 0;
+  ptr->outbound.replays = NULL;
+  ptr->outbound.replays_len = 0;
+  ptr->outbound.replaying = 0;
+  ptr->outbound.bytes = 0;
+  ptr->outbound.memory = memory;
+  ptr->stream_bytes = 0;
+  rate_limit_set(&ptr->rate_limit, rate_limit->messages.rate, rate_limit->bytes.rate, rate_limit->policy);
+  ptr->rate_limit.dropped = 0;
+  ptr->rate_limit.throttled = 0;
+  ptr->paused = 0;
+  ptr->credits.messages = credits->messages;
+  ptr->credits.bytes = credits->bytes;
+  ptr->credits.messages_consumed = 0;
+  ptr->credits.bytes_consumed = 0;
+  ptr->credits.messages_granted = 0;
+  ptr->credits.bytes_granted = 0;
+  //Init inbox
+  if (message_inbox_init(&ptr->inbox, memory) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto worker_bad_alloc;
+  }
+  ptr->inbox->credits = &ptr->credits;
+  //Copy clid
+  const size_t clid_len = strlen(client_id);
+  ptr->client_id = (char*) malloc(sizeof(char) * (clid_len + 1));
+  if (ptr->client_id == NULL) {
+    goto worker_bad_alloc;
+  }
+  memcpy(ptr->client_id, client_id, clid_len);
+  ptr->client_id[clid_len] = 0x00;
+  //Copy pipe read
+  const size_t piper_len = strlen(pipe_read);
+  ptr->pipe_read = (char*) malloc(sizeof(char) * (piper_len + 1));
+  if (ptr->pipe_read == NULL) {
+    goto worker_bad_alloc;
+  }
+  memcpy(ptr->pipe_read, pipe_read, piper_len);
+  ptr->pipe_read[piper_len] = 0x00;
+  //Copy pipe write
+  const size_t pipew_len = strlen(pipe_write);
+  ptr->pipe_write = (char*) malloc(sizeof(char) * (pipew_len + 1));
+  if (ptr->pipe_write == NULL) {
+    goto worker_bad_alloc;
+  }
+  memcpy(ptr->pipe_write, pipe_write, pipew_len);
+  ptr->pipe_write[pipew_len] = 0x00;
+  //Copy subscription list
+  ptr->subscriptions_list = (char**) malloc(sizeof(char*) * (sub_len + 1));
+  if (ptr->subscriptions_list == NULL) {
+    goto worker_bad_alloc;
+  }
+  for (size_t i = 0; i < sub_len; i++) {
+    const size_t this_sub_len = strlen(subscriptions[i]);
+    ptr->subscriptions_list[i] = (char*) malloc(sizeof(char) * (this_sub_len + 1));
+    if (ptr->subscriptions_list[i] == NULL) {
+      goto worker_bad_alloc;
+    }
+    memcpy(ptr->subscriptions_list[i], subscriptions[i], this_sub_len);
+    (ptr->subscriptions_list[i])[this_sub_len] = 0x00;
+    ptr->subscriptions++;
+  }
+  ptr->subscriptions_list[sub_len] = (char*) malloc(sizeof(char*) * (clid_len + 1));
+  memcpy((ptr->subscriptions_list)[sub_len], ptr->client_id, clid_len);
+  ((ptr->subscriptions_list)[sub_len])[clid_len] = 0x00;
+  ptr->subscriptions = sub_len + 1;
+  //Open pipes; both are kept open for the whole worker lifetime, so writes never wait for the client to open its pipe
+  if (pipe_open(pipe_read, &ptr->read_fd) != OCTOPIPES_ERROR_SUCCESS || pipe_open(pipe_write, &ptr->outbound.fd) != OCTOPIPES_ERROR_SUCCESS) {
+    goto worker_open_failed;
+  }
+  //Create mutexes
+  if (pthread_mutex_init(&ptr->outbound.lock, NULL) != 0) {
+    goto worker_thread_error;
+  }
+  if (pthread_mutex_init(&ptr->worker_lock, NULL) != 0) {
+    pthread_mutex_destroy(&ptr->outbound.lock);
+    goto worker_thread_error;
+  }
+  //Start thread
+  ptr->active = 1;
+  if (pthread_create(&ptr->worker_listener, NULL, worker_loop, ptr) != 0) {
+    pthread_mutex_destroy(&ptr->outbound.lock);
+    pthread_mutex_destroy(&ptr->worker_lock);
+    goto worker_thread_error;
+  }
+  *worker = ptr;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+
+  OctopipesServerError rc;
+worker_bad_alloc:
+  rc = OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  goto worker_error;
+worker_open_failed:
+  rc = OCTOPIPES_SERVER_ERROR_OPEN_FAILED;
+  goto worker_error;
+worker_thread_error:
+  rc = OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+worker_error:
+  if (ptr->client_id != NULL) {
+    free(ptr->client_id);
+  }
+  if (ptr->inbox != NULL) {
+    message_inbox_cleanup(ptr->inbox);
+  }
+  if (ptr->pipe_read != NULL) {
+    free(ptr->pipe_read);
+  }
+  if (ptr->pipe_write != NULL) {
+    free(ptr->pipe_write);
+  }
+  for (size_t i = 0; i < ptr->subscriptions; i++) {
+    free(ptr->subscriptions_list[i]);
+  }
+  if (ptr->subscriptions_list != NULL) {
+    free(ptr->subscriptions_list);
+  }
+  if (ptr->read_fd != -1) {
+    pipe_close(ptr->read_fd);
+  }
+  if (ptr->outbound.fd != -1) {
+    pipe_close(ptr->outbound.fd);
+  }
+  free(ptr);
+  return rc;
+}
+
+/**
+ * @brief cleanup a server worker
+ * @param OctopipesServerWorker*
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_cleanup(OctopipesServerWorker* worker) {
+  if (worker->active) {
+    //Set worker active to false
+    worker->active = 0;
+    //Join listener
+    if (pthread_join(worker->worker_listener, NULL) != 0) {
+      return OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+    }
+    pthread_mutex_destroy(&worker->worker_lock);
+    pthread_mutex_destroy(&worker->outbound.lock);
+  }
+  //Leave the ready queue of the dispatcher; the worker has been removed from the workers, so it's not queued anymore
+  OctopipesServerDispatchers* dispatchers = worker->dispatchers;
+  pthread_rwlock_rdlock(&dispatchers->lock);
+  if (dispatchers->shards_len > 0) {
+    OctopipesServerShard* shard = &dispatchers->shards[worker->hash % dispatchers->shards_len];
+    pthread_mutex_lock(&shard->lock);
+    shard_remove(shard, worker);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  pthread_rwlock_unlock(&dispatchers->lock);
+  //Close pipes and drop the frames the client didn't read
+  pipe_close(worker->read_fd);
+  pipe_close(worker->outbound.fd);
+  worker_drop_frames(&worker->outbound);
+  for (size_t i = 0; i < OCTOPIPES_PRIORITIES; i++) {
+    free(worker->outbound.lanes[i].frames);
+  }
+  free(worker->outbound.replays);
+  outbound_account(&worker->outbound, 0, sizeof(OctopipesServerReplay) * worker->outbound.replays_len);
+  //Delete pipes
+  pipe_delete(worker->pipe_read);
+  pipe_delete(worker->pipe_write);
+  //Free worker
+  free(worker->client_id);
+  //Delete subscription list
+  for (size_t i = 0; i < worker->subscriptions; i++) {
+    char* sub = worker->subscriptions_list[i];
+    free(sub);
+  }
+  free(worker->subscriptions_list);
+  //Delete pipes
+  free(worker->pipe_read);
+  free(worker->pipe_write);
+  //Free inbox
+  OctopipesServerError rc;
+  if ((rc = message_inbox_cleanup(worker->inbox)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    return rc;
+  }
+  //Eventually free worker and return
+  free(worker);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief send an encoded message to the client associated to this worker. The frame is written straight to the pipe
+ * if nothing is queued and the pipe has room, otherwise a reference to it is queued and it is written by the worker thread;
+ * if the queue is full the worker overflow policy is applied. It never waits for the client.
+ * @param OctopipesServerWorker* worker
+ * @param OctopipesServerSharedFrame* frame: the encoded message
+ * @param size_t priority class of the message
+ * @param uint64_t expires: time the frame expires at if still queued (ms, 0 if it never expires)
+ * @param char* group the message was sent to; if the worker conflates, it replaces the queued frame of the group
+ * @param uint64_t log offset of the frame in the group log (OCTOPIPES_LOG_NO_OFFSET if not logged); frames the worker replays are not sent twice
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_send(OctopipesServerWorker* worker, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires, const char* group, const uint64_t log_offset) {
+  OctopipesServerOutbound* outbound = &worker->outbound;
+  const size_t data_size = frame->data_size;
+  OctopipesServerLane* lane = &outbound->lanes[priority];
+  OctopipesError ret;
+  size_t written = 0;
+  pthread_mutex_lock(&outbound->lock);
+  if (outbound->overflowed) {
+    pthread_mutex_unlock(&outbound->lock);
+    return OCTOPIPES_SERVER_ERROR_WORKER_OVERFLOW;
+  }
+  //Frames of a group being replayed are written by the replay
+  if (replay_drops(outbound, group, log_offset)) {
+    pthread_mutex_unlock(&outbound->lock);
+    return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  //Lanes are allocated on first use, before writing, so a partially written frame can always be queued
+  if (lane->frames == NULL) {
+    lane->frames = (OctopipesServerFrame*) malloc(sizeof(OctopipesServerFrame) * outbound->size);
+    if (lane->frames == NULL) {
+      pthread_mutex_unlock(&outbound->lock);
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+  }
+  //Nothing queued: try to write now, so frames are queued only when the client is late
+  if (outbound->len == 0 && !replay_partial(outbound)) {
+    if ((ret = pipe_write(outbound->fd, frame->data, data_size, &written)) != OCTOPIPES_ERROR_SUCCESS) {
+      pthread_mutex_unlock(&outbound->lock);
+      return to_server_error(ret);
+    }
+    if (written == data_size) {
+      pthread_mutex_unlock(&outbound->lock);
+      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+    }
+  }
+  //Conflation: replace the queued frame of the group in place, so it keeps its position in the queue
+  const uint32_t hash = outbound->conflate && group != NULL ? client_hash(group) : 0;
+  if (outbound->conflate && group != NULL) {
+    //The head frame can't be replaced if it has been partially written
+    const size_t first = outbound->offset > 0 && outbound->writing == priority ? 1 : 0;
+    for (size_t i = first; i < lane->len; i++) {
+      OctopipesServerFrame* queued = &lane->frames[(lane->head + i) % outbound->size];
+      if (queued->group == NULL || queued->hash != hash || strcmp(queued->group, group) != 0) {
+        continue;
+      }
+      outbound_account(outbound, data_size, queued->shared->data_size);
+      shared_frame_release(queued->shared);
+      shared_frame_retain(frame);
+      queued->shared = frame;
+      queued->expires = expires;
+      pthread_mutex_unlock(&outbound->lock);
+      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+    }
+  }
+  //Lane is full (so nothing has been written)
+  if (lane->len == outbound->size) {
+    //The head frame can't be dropped if it has been partially written, or the client would receive a broken frame
+    const size_t oldest = outbound->offset > 0 && outbound->writing == priority ? 1 : 0;
+    if (outbound->policy == OCTOPIPES_SERVER_OVERFLOW_DISCONNECT) {
+      //The frame being written is kept, so the client stream can end on a frame boundary before the disconnection is notified
+      const size_t kept = outbound->offset > 0 ? 1 : 0;
+      OctopipesServerLane* writing = &outbound->lanes[outbound->writing];
+      OctopipesServerFrame partial;
+      const size_t partial_offset = outbound->offset;
+      if (kept) {
+        partial = writing->frames[writing->head];
+        writing->head = (writing->head + 1) % outbound->size;
+        writing->len--;
+        outbound->len--;
+      }
+      outbound->dropped += outbound->len + 1;
+      worker_drop_frames(outbound);
+      if (kept) {
+        writing->frames[0] = partial;
+        writing->len = 1;
+        outbound->len = 1;
+        outbound->offset = partial_offset;
+      }
+      outbound->overflowed = 1;
+      pthread_mutex_unlock(&outbound->lock);
+      //Dispatch may hold routing read locked, so the worker is stopped later
+      pthread_mutex_lock(&worker->disconnects->lock);
+      worker->disconnects->pending++;
+      pthread_mutex_unlock(&worker->disconnects->lock);
+      return OCTOPIPES_SERVER_ERROR_WORKER_OVERFLOW;
+    } else if (outbound->policy == OCTOPIPES_SERVER_OVERFLOW_DROP_NEWEST || oldest >= lane->len) {
+      outbound->dropped++;
+      pthread_mutex_unlock(&outbound->lock);
+      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+    }
+    //Drop oldest: move the head in place of the dropped frame
+    const size_t dropped_index = (lane->head + oldest) % outbound->size;
+    outbound_account(outbound, 0, lane->frames[dropped_index].shared->data_size);
+    shared_frame_release(lane->frames[dropped_index].shared);
+    free(lane->frames[dropped_index].group);
+    lane->frames[dropped_index] = lane->frames[lane->head];
+    lane->head = (lane->head + 1) % outbound->size;
+    lane->len--;
+    outbound->len--;
+    outbound->dropped++;
+  }
+  //Queue a reference to the frame, so it's not copied for each recipient
+  shared_frame_retain(frame);
+  outbound_account(outbound, data_size, 0);
+  const size_t tail = (lane->head + lane->len) % outbound->size;
+  lane->frames[tail].shared = frame;
+  lane->frames[tail].group = NULL;
+  lane->frames[tail].hash = hash;
+  if (outbound->conflate && group != NULL) {
+    const size_t group_len = strlen(group);
+    //If the group can't be allocated, the frame is just not conflated
+    lane->frames[tail].group = (char*) malloc(sizeof(char) * (group_len + 1));
+    if (lane->frames[tail].group != NULL) {
+      memcpy(lane->frames[tail].group, group, group_len + 1);
+    }
+  }
+  lane->frames[tail].expires = expires;
+  if (outbound->len == 0) {
+    outbound->offset = written;
+    outbound->writing = priority;
+  }
+  lane->len++;
+  outbound->len++;
+  pthread_mutex_unlock(&outbound->lock);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief write the queued frames of a worker until the pipe is full or the queue is empty; expired frames are discarded.
+ * Once the queue is empty, the logged groups the worker replays are written
+ * @param OctopipesServerWorker* worker
+ * @param int* pending: set to 1 if there are still frames in the queue or groups to replay
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_flush(OctopipesServerWorker* worker, int* pending) {
+  OctopipesServerOutbound* outbound = &worker->outbound;
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  const uint64_t now = octopipes_get_time_ms();
+  pthread_mutex_lock(&outbound->lock);
+  //A partially written replayed frame must be completed first
+  if (replay_partial(outbound)) {
+    rc = replay_flush(outbound);
+  }
+  while (rc == OCTOPIPES_SERVER_ERROR_SUCCESS && outbound->len > 0 && !replay_partial(outbound)) {
+    //A partially written frame must be completed first; otherwise the highest priority lane is written
+    if (outbound->offset == 0) {
+      outbound->writing = OCTOPIPES_PRIORITIES - 1;
+      while (outbound->lanes[outbound->writing].len == 0) {
+        outbound->writing--;
+      }
+    }
+    OctopipesServerLane* lane = &outbound->lanes[outbound->writing];
+    OctopipesError ret;
+    OctopipesServerFrame* frame = &lane->frames[lane->head];
+    const size_t data_size = frame->shared->data_size;
+    size_t written = 0;
+    //Frames expire only before being written, otherwise the client would receive a broken frame
+    if (outbound->offset > 0 || frame->expires == 0 || frame->expires > now) {
+      if ((ret = pipe_write(outbound->fd, frame->shared->data + outbound->offset, data_size - outbound->offset, &written)) != OCTOPIPES_ERROR_SUCCESS) {
+        rc = to_server_error(ret);
+        break;
+      }
+      outbound->offset += written;
+      if (outbound->offset < data_size) {
+        break; //Pipe is full
+      }
+    } else {
+      outbound->expired++;
+    }
+    shared_frame_release(frame->shared);
+    free(frame->group);
+    outbound_account(outbound, 0, data_size);
+    lane->head = (lane->head + 1) % outbound->size;
+    lane->len--;
+    outbound->len--;
+    outbound->offset = 0;
+  }
+  if (rc == OCTOPIPES_SERVER_ERROR_SUCCESS && outbound->len == 0 && outbound->replaying > 0) {
+    rc = replay_flush(outbound);
+  }
+  *pending = outbound->len > 0 || outbound->replaying > 0;
+  pthread_mutex_unlock(&outbound->lock);
+  return rc;
+}
+
+/**
+ * @brief free all the frames queued in the outbound lanes; outbound lock must be held by the caller
+ * @param OctopipesServerOutbound* outbound
+ */
+
+void worker_drop_frames(OctopipesServerOutbound* outbound) {
+  for (size_t i = 0; i < OCTOPIPES_PRIORITIES; i++) {
+    OctopipesServerLane* lane = &outbound->lanes[i];
+    for (size_t j = 0; j < lane->len; j++) {
+      OctopipesServerFrame* frame = &lane->frames[(lane->head + j) % outbound->size];
+      outbound_account(outbound, 0, frame->shared->data_size);
+      shared_frame_release(frame->shared);
+      free(frame->group);
+    }
+    lane->head = 0;
+    lane->len = 0;
+  }
+  outbound->len = 0;
+  outbound->offset = 0;
+}
+
+/**
+ * @brief
+ * @param OctopipesServerWorker* worker
+ * @param OctopipesMessage** message out
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_get_next_message(OctopipesServerWorker* worker, OctopipesServerMessage** message) {
+  //Initialize message
+  *message = NULL;
+  //Lock mutex
+  pthread_mutex_lock(&worker->worker_lock);
+  //Deque inbox
+  OctopipesServerMessage* inbox_msg = message_inbox_dequeue(worker->inbox);
+  //Replenish the window of the client as its messages are dispatched
+  if (inbox_msg != NULL && credits_due(&worker->credits)) {
+    worker_grant_credits(worker);
+  }
+  //Unlock mutex
+  pthread_mutex_unlock(&worker->worker_lock);
+  //Return OK
+  *message = inbox_msg;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief check whether the inbox of a worker has messages
+ * @param OctopipesServerWorker* worker
+ * @return int
+ */
+
+int worker_has_messages(OctopipesServerWorker* worker) {
+  int has_messages = 0;
+  pthread_mutex_lock(&worker->worker_lock);
+  for (size_t i = 0; i < OCTOPIPES_PRIORITIES && !has_messages; i++) {
+    has_messages = worker->inbox->inbox_len[i] > 0;
+  }
+  pthread_mutex_unlock(&worker->worker_lock);
+  return has_messages;
+}
+
+/**
+ * @brief queue the worker to the dispatcher which owns it and wake it up, if dispatchers are running
+ * @param OctopipesServerWorker* worker
+ */
+
+void worker_notify(OctopipesServerWorker* worker) {
+  OctopipesServerDispatchers* dispatchers = worker->dispatchers;
+  pthread_rwlock_rdlock(&dispatchers->lock);
+  if (dispatchers->shards_len > 0) {
+    OctopipesServerShard* shard = &dispatchers->shards[worker->hash % dispatchers->shards_len];
+    pthread_mutex_lock(&shard->lock);
+    shard_push(shard, worker);
+    pthread_cond_signal(&shard->ready);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  pthread_rwlock_unlock(&dispatchers->lock);
+}
+
+/**
+ * @brief get a worker subscriptions list
+ * @param OctopipesServerWorker*
+ * @param char*** groups (NOTE: FREE char** only, the groups are copied after the pointers in the same block)
+ * @param size_t* groups length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_get_subscriptions(OctopipesServerWorker* worker, char*** groups, size_t* groups_len) {
+  size_t size = sizeof(char*) * worker->subscriptions;
+  for (size_t i = 0; i < worker->subscriptions; i++) {
+    size += strlen(worker->subscriptions_list[i]) + 1;
+  }
+  char** subs = (char**) malloc(size > 0 ? size : 1);
+  if (subs == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  char* group = (char*) (subs + worker->subscriptions);
+  for (size_t i = 0; i < worker->subscriptions; i++) {
+    const size_t group_len = strlen(worker->subscriptions_list[i]) + 1;
+    memcpy(group, worker->subscriptions_list[i], group_len);
+    subs[i] = group;
+    group += group_len;
+  }
+  *groups = subs;
+  *groups_len = worker->subscriptions;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief checks if a certain group is in a worker subscription list; wildcards are compared literally
+ * @param OctopipesServerWorker*
+ * @param char* group
+ * @return int
+ */
+
+int worker_has_subscription(OctopipesServerWorker* worker, const char* group) {
+  for (size_t i = 0; i < worker->subscriptions; i++) {
+    if (strcmp(worker->subscriptions_list[i], group) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief add groups to the subscriptions of a worker; groups the worker is already subscribed to are ignored.
+ * The new subscription list is built before replacing the current one, so the worker is never left with a partial update
+ * @param OctopipesServerWorker* worker
+ * @param char** groups
+ * @param size_t groups length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_add_subscriptions(OctopipesServerWorker* worker, const char** groups, const size_t groups_len) {
+  char** subscriptions_list = (char**) malloc(sizeof(char*) * (worker->subscriptions + groups_len));
+  if (subscriptions_list == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  memcpy(subscriptions_list, worker->subscriptions_list, sizeof(char*) * worker->subscriptions);
+  size_t subscriptions = worker->subscriptions;
+  for (size_t i = 0; i < groups_len; i++) {
+    //Skip groups already in the list
+    int subscribed = 0;
+    for (size_t j = 0; j < subscriptions && !subscribed; j++) {
+      subscribed = strcmp(subscriptions_list[j], groups[i]) == 0;
+    }
+    if (subscribed) {
+      continue;
+    }
+    const size_t group_len = strlen(groups[i]);
+    char* group = (char*) malloc(sizeof(char) * (group_len + 1));
+    if (group == NULL) {
+      for (size_t j = worker->subscriptions; j < subscriptions; j++) {
+        free(subscriptions_list[j]);
+      }
+      free(subscriptions_list);
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+    memcpy(group, groups[i], group_len);
+    group[group_len] = 0x00;
+    subscriptions_list[subscriptions++] = group;
+  }
+  free(worker->subscriptions_list);
+  worker->subscriptions_list = subscriptions_list;
+  worker->subscriptions = subscriptions;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief remove groups from the subscriptions of a worker; the client id can't be removed
+ * @param OctopipesServerWorker* worker
+ * @param char** groups
+ * @param size_t groups length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError worker_remove_subscriptions(OctopipesServerWorker* worker, const char** groups, const size_t groups_len) {
+  char** subscriptions_list = (char**) malloc(sizeof(char*) * worker->subscriptions);
+  if (subscriptions_list == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  size_t subscriptions = 0;
+  for (size_t i = 0; i < worker->subscriptions; i++) {
+    char* subscription = worker->subscriptions_list[i];
+    int removed = 0;
+    //Messages addressed to the client id must always be delivered
+    if (strcmp(subscription, worker->client_id) != 0) {
+      for (size_t j = 0; j < groups_len && !removed; j++) {
+        removed = strcmp(subscription, groups[j]) == 0;
+      }
+    }
+    if (removed) {
+      free(subscription);
+    } else {
+      subscriptions_list[subscriptions++] = subscription;
+    }
+  }
+  free(worker->subscriptions_list);
+  worker->subscriptions_list = subscriptions_list;
+  worker->subscriptions = subscriptions;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief find a worker by client id; routing_lock must be locked by the caller
+ * @param OctopipesServer* server
+ * @param char* client
+ * @return OctopipesServerWorker* (NULL if not found)
+ */
+
+OctopipesServerWorker* workers_find(OctopipesServer* server, const char* client) {
+  if (server->workers_map_size == 0) {
+    return NULL;
+  }
+  const size_t mask = server->workers_map_size - 1;
+  const uint32_t hash = client_hash(client);
+  //Linear probing: the first empty slot ends the cluster the client can be in
+  for (size_t slot = hash & mask; server->workers_map[slot] != NULL; slot = (slot + 1) & mask) {
+    OctopipesServerWorker* this_worker = server->workers_map[slot];
+    if (this_worker->hash == hash && strcmp(this_worker->client_id, client) == 0) {
+      return this_worker;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief check whether a worker is still in the workers map, without reading it: a worker which has been removed may have been freed.
+ * routing_lock must be locked by the caller
+ * @param OctopipesServer* server
+ * @param OctopipesServerWorker* worker
+ * @param uint32_t hash of the worker client id, read while the worker was known to be valid
+ * @return int
+ */
+
+int workers_contains(OctopipesServer* server, const OctopipesServerWorker* worker, const uint32_t hash) {
+  if (server->workers_map_size == 0) {
+    return 0;
+  }
+  const size_t mask = server->workers_map_size - 1;
+  for (size_t slot = hash & mask; server->workers_map[slot] != NULL; slot = (slot + 1) & mask) {
+    if (server->workers_map[slot] == worker) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief add a worker to the workers and to the workers map, doubling both when the workers are full; routing_lock must be write locked by the caller
+ * @param OctopipesServer* server
+ * @param OctopipesServerWorker* worker
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError workers_insert(OctopipesServer* server, OctopipesServerWorker* worker) {
+  if (workers_find(server, worker->client_id) != NULL) {
+    return OCTOPIPES_SERVER_ERROR_WORKER_EXISTS;
+  }
+  if (server->workers_len == server->workers_size) {
+    //Grow both before changing anything, so a failure leaves the workers untouched
+    const size_t workers_size = server->workers_size > 0 ? server->workers_size * 2 : WORKERS_INITIAL_SIZE;
+    OctopipesServerWorker** workers = (OctopipesServerWorker**) realloc(server->workers, sizeof(OctopipesServerWorker*) * workers_size);
+    if (workers == NULL) {
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+    server->workers = workers;
+    //The map is kept at most half full
+    const size_t map_size = workers_size * 2;
+    OctopipesServerWorker** workers_map = (OctopipesServerWorker**) calloc(map_size, sizeof(OctopipesServerWorker*));
+    if (workers_map == NULL) {
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+    for (size_t i = 0; i < server->workers_len; i++) {
+      size_t slot = server->workers[i]->hash & (map_size - 1);
+      while (workers_map[slot] != NULL) {
+        slot = (slot + 1) & (map_size - 1);
+      }
+      workers_map[slot] = server->workers[i];
+    }
+    free(server->workers_map);
+    server->workers_map = workers_map;
+    server->workers_map_size = map_size;
+    server->workers_size = workers_size;
+  }
+  const size_t mask = server->workers_map_size - 1;
+  size_t slot = worker->hash & mask;
+  while (server->workers_map[slot] != NULL) {
+    slot = (slot + 1) & mask;
+  }
+  server->workers_map[slot] = worker;
+  worker->index = server->workers_len;
+  server->workers[server->workers_len++] = worker;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief remove a worker from the workers and from the workers map; routing_lock must be write locked by the caller.
+ * The last worker takes the place of the removed one, so the workers order changes
+ * @param OctopipesServer* server
+ * @param OctopipesServerWorker* worker
+ */
+
+void workers_remove(OctopipesServer* server, OctopipesServerWorker* worker) {
+  const size_t mask = server->workers_map_size - 1;
+  size_t slot = worker->hash & mask;
+  while (server->workers_map[slot] != worker) {
+    slot = (slot + 1) & mask;
+  }
+  server->workers_map[slot] = NULL;
+  //Shift back the following workers of the cluster which can't be found anymore past the empty slot
+  for (size_t next = (slot + 1) & mask; server->workers_map[next] != NULL; next = (next + 1) & mask) {
+    const size_t home = server->workers_map[next]->hash & mask;
+    //Move it if its home isn't in (slot, next]
+    const int reachable = slot <= next ? (home > slot && home <= next) : (home > slot || home <= next);
+    if (!reachable) {
+      server->workers_map[slot] = server->workers_map[next];
+      server->workers_map[next] = NULL;
+      slot = next;
+    }
+  }
+  //Fill the hole in the workers with the last one
+  OctopipesServerWorker* last_worker = server->workers[--server->workers_len];
+  server->workers[worker->index] = last_worker;
+  last_worker->index = worker->index;
+}
+
+/**
+ * @brief stop the workers whose outbound queue overflowed with the disconnect policy. Overflows are detected while dispatching,
+ * with routing_lock read locked, so the workers are stopped afterwards by the processing functions; nothing is done inside a handler
+ * @param OctopipesServer* server
+ */
+
+void workers_disconnect(OctopipesServer* server) {
+  if (handler_depth > 0) {
+    return;
+  }
+  pthread_mutex_lock(&server->disconnects.lock);
+  const size_t pending = server->disconnects.pending;
+  server->disconnects.pending = 0;
+  pthread_mutex_unlock(&server->disconnects.lock);
+  if (pending == 0) {
+    return;
+  }
+  //Take the overflowed workers out of the routing, so they can be stopped without the lock
+  OctopipesServerWorker** stopped = (OctopipesServerWorker**) malloc(sizeof(OctopipesServerWorker*) * pending);
+  size_t stopped_len = 0;
+  if (stopped == NULL) {
+    //Try again on the next call
+    pthread_mutex_lock(&server->disconnects.lock);
+    server->disconnects.pending += pending;
+    pthread_mutex_unlock(&server->disconnects.lock);
+    return;
+  }
+  pthread_rwlock_wrlock(&server->routing_lock);
+  for (size_t i = 0; i < server->workers_len && stopped_len < pending;) {
+    OctopipesServerWorker* this_worker = server->workers[i];
+    pthread_mutex_lock(&this_worker->outbound.lock);
+    const int overflowed = this_worker->outbound.overflowed;
+    pthread_mutex_unlock(&this_worker->outbound.lock);
+    if (!overflowed) {
+      i++;
+      continue;
+    }
+    for (size_t j = 0; j < this_worker->subscriptions; j++) {
+      trie_remove(server->routing_trie, this_worker->subscriptions_list[j], this_worker);
+    }
+    //The last worker takes its place, so i is not incremented
+    workers_remove(server, this_worker);
+    stopped[stopped_len++] = this_worker;
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+  for (size_t i = 0; i < stopped_len; i++) {
+    worker_notify_disconnect(stopped[i]);
+    worker_cleanup(stopped[i]);
+  }
+  free(stopped);
+}
+
+/**
+ * @brief tell a client that the server disconnected it, with an UNSUBSCRIPTION sent by the server. The client pipe may still be full,
+ * so the notification is written only if the client makes room for it within DISCONNECT_NOTIFY_TIMEOUT
+ * @param OctopipesServerWorker* worker
+ */
+
+void worker_notify_disconnect(OctopipesServerWorker* worker) {
+  size_t payload_size;
+  uint8_t* payload = octopipes_cap_prepare_unsubscription(&payload_size);
+  if (payload == NULL) {
+    return;
+  }
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin_size = 0;
+  message.origin = NULL; //Server has no origin
+  message.remote_size = strlen(worker->client_id);
+  message.remote = worker->client_id;
+  message.ttl = 0;
+  message.data_size = payload_size;
+  message.options = OCTOPIPES_OPTIONS_PRIORITY_CRITICAL;
+  message.checksum = 0;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = payload;
+  uint8_t* data_out;
+  size_t data_out_size;
+  OctopipesError ret = octopipes_encode(&message, &data_out, &data_out_size);
+  free(payload);
+  if (ret != OCTOPIPES_ERROR_SUCCESS) {
+    return;
+  }
+  //The frame being written is completed first, so the notification starts on a frame boundary; frames up to PIPE_BUF are written entirely or not at all
+  OctopipesServerOutbound* outbound = &worker->outbound;
+  const uint64_t deadline = octopipes_get_time_ms() + DISCONNECT_NOTIFY_TIMEOUT;
+  uint64_t now;
+  int notified = 0;
+  while (!notified && (now = octopipes_get_time_ms()) < deadline) {
+    int readable;
+    int writable;
+    int pending;
+    if (pipe_wait(-1, outbound->fd, (int) (deadline - now), &readable, &writable) != OCTOPIPES_ERROR_SUCCESS) {
+      break; //No room within the timeout
+    }
+    if (worker_flush(worker, &pending) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      break;
+    }
+    pthread_mutex_lock(&outbound->lock);
+    if (outbound->offset == 0 && !replay_partial(outbound)) {
+      size_t written;
+      notified = pipe_write(outbound->fd, data_out, data_out_size, &written) != OCTOPIPES_ERROR_SUCCESS || written > 0;
+    }
+    pthread_mutex_unlock(&outbound->lock);
+  }
+  free(data_out);
+}
+
+/**
+ * @brief allocate a routing trie node
+ * @param OctopipesServerTrieNode** node
+ * @param char* level (NULL for the root)
+ * @param size_t level length
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError trie_node_init(OctopipesServerTrieNode** node, const char* level, const size_t level_len) {
+  OctopipesServerTrieNode* ptr = (OctopipesServerTrieNode*) malloc(sizeof(OctopipesServerTrieNode));
+  if (ptr == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  ptr->level = NULL;
+  if (level != NULL) {
+    ptr->level = (char*) malloc(sizeof(char) * (level_len + 1));
+    if (ptr->level == NULL) {
+      free(ptr);
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+    memcpy(ptr->level, level, level_len);
+    ptr->level[level_len] = 0x00;
+  }
+  ptr->children = NULL;
+  ptr->children_len = 0;
+  ptr->single_wildcard = NULL;
+  ptr->multi_wildcard = NULL;
+  ptr->subscribers = NULL;
+  ptr->subscribers_len = 0;
+  ptr->handler = NULL;
+  *node = ptr;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief free a routing trie node and all its children. Subscribers are not freed
+ * @param OctopipesServerTrieNode* node
+ */
+
+void trie_node_cleanup(OctopipesServerTrieNode* node) {
+  if (node == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < node->children_len; i++) {
+    trie_node_cleanup(node->children[i]);
+  }
+  trie_node_cleanup(node->single_wildcard);
+  trie_node_cleanup(node->multi_wildcard);
+  free(node->children);
+  free(node->subscribers);
+  if (node->handler != NULL) {
+    handler_release(node->handler);
+  }
+  free(node->level);
+  free(node);
+}
+
+/**
+ * @brief get the length of the first level of a group
+ * @param char* level
+ * @return size_t
+ */
+
+size_t trie_level_len(const char* level) {
+  const char* separator = strchr(level, GROUP_LEVEL_SEPARATOR);
+  return separator != NULL ? (size_t) (separator - level) : strlen(level);
+}
+
+/**
+ * @brief binary search a level among the children of a node
+ * @param OctopipesServerTrieNode* node
+ * @param char* level
+ * @param size_t level length
+ * @param size_t* index of the child, or where it should be inserted if not found
+ * @return int 1 if found
+ */
+
+int trie_find_child(OctopipesServerTrieNode* node, const char* level, const size_t level_len, size_t* index) {
+  size_t low = 0;
+  size_t high = node->children_len;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    const char* this_level = node->children[mid]->level;
+    int cmp = strncmp(this_level, level, level_len);
+    if (cmp == 0 && this_level[level_len] != 0x00) {
+      cmp = 1; //Child level is longer
+    }
+    if (cmp == 0) {
+      *index = mid;
+      return 1;
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  *index = low;
+  return 0;
+}
+
+/**
+ * @brief get the node where a level is stored; '*' and a trailing '#' are stored apart from the other children
+ * @param OctopipesServerTrieNode* node
+ * @param char* level
+ * @param size_t level length
+ * @param int is last level
+ * @return OctopipesServerTrieNode** slot (NULL if the level is a regular level)
+ */
+
+OctopipesServerTrieNode** trie_wildcard_slot(OctopipesServerTrieNode* node, const char* level, const size_t level_len, const int last) {
+  if (level_len == 1 && level[0] == GROUP_SINGLE_WILDCARD[0]) {
+    return &node->single_wildcard;
+  } else if (last && level_len == 1 && level[0] == GROUP_MULTI_WILDCARD[0]) {
+    return &node->multi_wildcard;
+  }
+  return NULL;
+}
+
+/**
+ * @brief find the node of a group in the routing trie. Groups are split into levels by '/';
+ * a '*' level matches any single level, while a trailing '#' matches all the remaining levels (even none).
+ * The nodes created for the group are left in the trie if it fails: they must be freed with trie_remove
+ * @param OctopipesServerTrieNode* root
+ * @param char* group
+ * @param int create: whether the missing nodes are created; otherwise node is NULL if the group has no node
+ * @param OctopipesServerTrieNode** node
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError trie_walk(OctopipesServerTrieNode* root, const char* group, const int create, OctopipesServerTrieNode** node) {
+  OctopipesServerTrieNode* this_node = root;
+  const char* level = group;
+  *node = NULL;
+  //Walk down the levels, creating the missing nodes
+  while (level != NULL) {
+    const size_t level_len = trie_level_len(level);
+    const char* next = level[level_len] == GROUP_LEVEL_SEPARATOR ? level + level_len + 1 : NULL;
+    OctopipesServerTrieNode** slot = trie_wildcard_slot(this_node, level, level_len, next == NULL);
+    if (slot != NULL) {
+      if (*slot == NULL) {
+        if (!create) {
+          return OCTOPIPES_SERVER_ERROR_SUCCESS;
+        }
+        if (trie_node_init(slot, level, level_len) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+          return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+        }
+      }
+      this_node = *slot;
+    } else {
+      size_t index;
+      if (!trie_find_child(this_node, level, level_len, &index)) {
+        if (!create) {
+          return OCTOPIPES_SERVER_ERROR_SUCCESS;
+        }
+        OctopipesServerTrieNode* child;
+        OctopipesServerTrieNode** children = (OctopipesServerTrieNode**) realloc(this_node->children, sizeof(OctopipesServerTrieNode*) * (this_node->children_len + 1));
+        if (children == NULL) {
+          return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+        }
+        this_node->children = children;
+        if (trie_node_init(&child, level, level_len) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+          return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+        }
+        memmove(this_node->children + index + 1, this_node->children + index, sizeof(OctopipesServerTrieNode*) * (this_node->children_len - index));
+        this_node->children[index] = child;
+        this_node->children_len++;
+      }
+      this_node = this_node->children[index];
+    }
+    level = next;
+  }
+  *node = this_node;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief subscribe a worker to a group in the routing trie.
+ * If the worker can't be subscribed, the nodes created for the group are freed
+ * @param OctopipesServerTrieNode* root
+ * @param char* group
+ * @param OctopipesServerWorker* worker
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError trie_insert(OctopipesServerTrieNode* root, const char* group, OctopipesServerWorker* worker) {
+  OctopipesServerTrieNode* node;
+  if (trie_walk(root, group, 1, &node) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    goto rollback;
+  }
+  //Add worker to subscribers, if not subscribed yet
+  for (size_t i = 0; i < node->subscribers_len; i++) {
+    if (node->subscribers[i] == worker) {
+      return OCTOPIPES_SERVER_ERROR_SUCCESS;
+    }
+  }
+  OctopipesServerWorker** subscribers = (OctopipesServerWorker**) realloc(node->subscribers, sizeof(OctopipesServerWorker*) * (node->subscribers_len + 1));
+  if (subscribers == NULL) {
+    goto rollback;
+  }
+  node->subscribers = subscribers;
+  node->subscribers[node->subscribers_len++] = worker;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+rollback:
+  //The worker is not a subscriber of the group, so this only frees the nodes left empty
+  trie_remove(root, group, worker);
+  return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+}
+
+/**
+ * @brief unsubscribe a worker from a group in the routing trie; nodes left empty are freed (worker can be NULL to free them only)
+ * @param OctopipesServerTrieNode* root
+ * @param char* group
+ * @param OctopipesServerWorker* worker
+ */
+
+void trie_remove(OctopipesServerTrieNode* root, const char* group, OctopipesServerWorker* worker) {
+  trie_remove_level(root, group, worker);
+}
+
+/**
+ * @brief remove a worker from the node matching level and below; returns whether node is left empty
+ * @param OctopipesServerTrieNode* node
+ * @param char* level (NULL once all the levels have been walked)
+ * @param OctopipesServerWorker* worker
+ * @return int
+ */
+
+int trie_remove_level(OctopipesServerTrieNode* node, const char* level, OctopipesServerWorker* worker) {
+  if (level == NULL) {
+    for (size_t i = 0; i < node->subscribers_len; i++) {
+      if (node->subscribers[i] == worker) {
+        node->subscribers[i] = node->subscribers[--node->subscribers_len];
+        break;
+      }
+    }
+    if (node->subscribers_len == 0) {
+      free(node->subscribers);
+      node->subscribers = NULL;
+    }
+  } else {
+    const size_t level_len = trie_level_len(level);
+    const char* next = level[level_len] == GROUP_LEVEL_SEPARATOR ? level + level_len + 1 : NULL;
+    OctopipesServerTrieNode** slot = trie_wildcard_slot(node, level, level_len, next == NULL);
+    if (slot != NULL) {
+      if (*slot != NULL && trie_remove_level(*slot, next, worker)) {
+        trie_node_cleanup(*slot);
+        *slot = NULL;
+      }
+    } else {
+      size_t index;
+      if (trie_find_child(node, level, level_len, &index) && trie_remove_level(node->children[index], next, worker)) {
+        trie_node_cleanup(node->children[index]);
+        node->children_len--;
+        memmove(node->children + index, node->children + index + 1, sizeof(OctopipesServerTrieNode*) * (node->children_len - index));
+        if (node->children_len == 0) {
+          free(node->children);
+          node->children = NULL;
+        }
+      }
+    }
+  }
+  return node->subscribers_len == 0 && node->handler == NULL && node->children_len == 0 && node->single_wildcard == NULL && node->multi_wildcard == NULL;
+}
+
+/**
+ * @brief collect the subscribers and the handlers of a remote into route. Each worker is collected once, even if several of its groups match
+ * @param OctopipesServerTrieNode* node
+ * @param char* level (NULL once all the levels have been walked)
+ * @param OctopipesServerRoute* route
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError trie_match(OctopipesServerTrieNode* node, const char* level, OctopipesServerRoute* route) {
+  OctopipesServerError rc;
+  //'#' matches the remaining levels, even if there are none
+  if (node->multi_wildcard != NULL && (rc = route_add_subscribers(route, node->multi_wildcard)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    return rc;
+  }
+  if (level == NULL) {
+    return route_add_subscribers(route, node);
+  }
+  const size_t level_len = trie_level_len(level);
+  const char* next = level[level_len] == GROUP_LEVEL_SEPARATOR ? level + level_len + 1 : NULL;
+  size_t index;
+  if (trie_find_child(node, level, level_len, &index) && (rc = trie_match(node->children[index], next, route)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    return rc;
+  }
+  if (node->single_wildcard != NULL) {
+    return trie_match(node->single_wildcard, next, route);
+  }
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief add the subscribers of a node to route, skipping the ones already there, and reference its handler.
+ * Route grows on the heap when its buffers are full
+ * @param OctopipesServerRoute* route
+ * @param OctopipesServerTrieNode* node
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError route_add_subscribers(OctopipesServerRoute* route, OctopipesServerTrieNode* node) {
+  //A remote walks through each node once at most, so handlers are never collected twice
+  if (node->handler != NULL) {
+    if (route->handlers_len == route->handlers_size) {
+      const size_t handlers_size = route->handlers_size * 2;
+      OctopipesServerHandler** handlers = (OctopipesServerHandler**) malloc(sizeof(OctopipesServerHandler*) * handlers_size);
+      if (handlers == NULL) {
+        return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+      }
+      memcpy(handlers, route->handlers, sizeof(OctopipesServerHandler*) * route->handlers_len);
+      if (route->handlers_size > ROUTE_HANDLERS_SIZE) {
+        free(route->handlers);
+      }
+      route->handlers = handlers;
+      route->handlers_size = handlers_size;
+    }
+    __atomic_add_fetch(&node->handler->refs, 1, __ATOMIC_RELAXED);
+    route->handlers[route->handlers_len++] = node->handler;
+  }
+  //Subscribers of a node are unique, so only the ones collected from other nodes must be checked
+  const size_t collected = route->workers_len;
+  for (size_t i = 0; i < node->subscribers_len; i++) {
+    OctopipesServerWorker* worker = node->subscribers[i];
+    int routed = 0;
+    for (size_t j = 0; j < collected && !routed; j++) {
+      routed = route->workers[j] == worker;
+    }
+    if (routed) {
+      continue;
+    }
+    if (route->workers_len == route->workers_size) {
+      const size_t workers_size = route->workers_size * 2;
+      OctopipesServerWorker** workers = (OctopipesServerWorker**) malloc(sizeof(OctopipesServerWorker*) * workers_size);
+      if (workers == NULL) {
+        return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+      }
+      memcpy(workers, route->workers, sizeof(OctopipesServerWorker*) * route->workers_len);
+      if (route->workers_size > ROUTE_STACK_SIZE) {
+        free(route->workers);
+      }
+      route->workers = workers;
+      route->workers_size = workers_size;
+    }
+    route->workers[route->workers_len++] = worker;
+  }
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief initialize an empty route on the buffers of the caller
+ * @param OctopipesServerRoute* route
+ * @param OctopipesServerWorker** workers: ROUTE_STACK_SIZE long
+ * @param OctopipesServerHandler** handlers: ROUTE_HANDLERS_SIZE long
+ */
+
+void route_init(OctopipesServerRoute* route, OctopipesServerWorker** workers, OctopipesServerHandler** handlers) {
+  route->workers = workers;
+  route->workers_len = 0;
+  route->workers_size = ROUTE_STACK_SIZE;
+  route->handlers = handlers;
+  route->handlers_len = 0;
+  route->handlers_size = ROUTE_HANDLERS_SIZE;
+}
+
+/**
+ * @brief release the handlers collected in a route without calling them
+ * @param OctopipesServerRoute* route
+ */
+
+void route_drop_handlers(OctopipesServerRoute* route) {
+  for (size_t i = 0; i < route->handlers_len; i++) {
+    handler_release(route->handlers[i]);
+  }
+  route->handlers_len = 0;
+}
+
+/**
+ * @brief release the handlers left in a route and free the buffers it moved to the heap
+ * @param OctopipesServerRoute* route
+ */
+
+void route_cleanup(OctopipesServerRoute* route) {
+  route_drop_handlers(route);
+  if (route->workers_size > ROUTE_STACK_SIZE) {
+    free(route->workers);
+  }
+  if (route->handlers_size > ROUTE_HANDLERS_SIZE) {
+    free(route->handlers);
+  }
+}
+
+/**
+ * @brief process the first worker of the ready queue of a shard: up to SHARD_BATCH messages are dispatched, then the worker
+ * is queued again behind the others if it has more, so a chatty client can't starve the others. routing_lock is taken for
+ * each message, so workers can be started and stopped and handlers called in between; the worker is looked up again each time, since it may have been stopped
+ * @param OctopipesServerShard* shard
+ */
+
+void shard_process(OctopipesServerShard* shard) {
+  OctopipesServer* server = shard->server;
+  OctopipesServerDispatchers* dispatchers = &server->dispatchers;
+  //Stop the workers disconnected by the previous dispatches
+  workers_disconnect(server);
+  pthread_rwlock_rdlock(&server->routing_lock);
+  pthread_mutex_lock(&shard->lock);
+  OctopipesServerWorker* this_worker = shard->running ? shard_pop(shard) : NULL;
+  //A worker which is still queued can't be freed, but once it's popped it's valid only while it's in the workers
+  uint32_t hash = 0;
+  if (this_worker != NULL) {
+    hash = this_worker->hash;
+    if (!workers_contains(server, this_worker, hash)) {
+      this_worker = NULL;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  size_t processed = 0;
+  while (this_worker != NULL) {
+    OctopipesServerMessage* inbox_message;
+    if (worker_get_next_message(this_worker, &inbox_message) != OCTOPIPES_SERVER_ERROR_SUCCESS || inbox_message == NULL) {
+      break; //The worker is queued again by its next message
+    }
+    const char* failed = this_worker->client_id;
+    OctopipesServerError ret = inbox_message->error;
+    OctopipesServerWorker* route_workers[ROUTE_STACK_SIZE];
+    OctopipesServerHandler* route_handlers[ROUTE_HANDLERS_SIZE];
+    OctopipesServerRoute route;
+    route_init(&route, route_workers, route_handlers);
+    if (inbox_message->message != NULL) {
+      ret = dispatch_message_locked(server, inbox_message->message, inbox_message->expires, &failed, &route);
+    }
+    //The error is reported once routing_lock is released, so the client which failed is copied: its worker may be stopped meanwhile
+    void (*on_error)(const OctopipesServer*, const char*, const OctopipesServerError) = ret != OCTOPIPES_SERVER_ERROR_SUCCESS ? dispatchers->on_error : NULL;
+    char failed_client[UINT8_MAX + 1];
+    if (on_error != NULL && failed != NULL) {
+      snprintf(failed_client, sizeof(failed_client), "%s", failed);
+    }
+    const int batched = ++processed == SHARD_BATCH;
+    if (batched) {
+      pthread_mutex_lock(&shard->lock);
+      shard_push(shard, this_worker);
+      pthread_mutex_unlock(&shard->lock);
+    }
+    //Let the writers waiting for routing_lock in; the error callback and the handlers are called meanwhile, so they can take it too
+    pthread_rwlock_unlock(&server->routing_lock);
+    if (on_error != NULL) {
+      on_error(server, failed != NULL ? failed_client : NULL, ret);
+    }
+    handlers_call(server, inbox_message->message, &route);
+    route_cleanup(&route);
+    server_message_cleanup(inbox_message);
+    if (batched) {
+      return;
+    }
+    pthread_rwlock_rdlock(&server->routing_lock);
+    if (!workers_contains(server, this_worker, hash)) {
+      this_worker = NULL;
+    }
+  }
+  pthread_rwlock_unlock(&server->routing_lock);
+}
+
+/**
+ * @brief append a worker to the ready queue of its shard, unless it's queued already; shard lock must be held by the caller
+ * @param OctopipesServerShard* shard
+ * @param OctopipesServerWorker* worker
+ */
+
+void shard_push(OctopipesServerShard* shard, OctopipesServerWorker* worker) {
+  if (worker->ready) {
+    return;
+  }
+  worker->ready = 1;
+  worker->ready_prev = shard->ready_tail;
+  worker->ready_next = NULL;
+  if (shard->ready_tail != NULL) {
+    shard->ready_tail->ready_next = worker;
+  } else {
+    shard->ready_head = worker;
+  }
+  shard->ready_tail = worker;
+}
+
+/**
+ * @brief take the first worker of the ready queue of a shard; shard lock must be held by the caller
+ * @param OctopipesServerShard* shard
+ * @return OctopipesServerWorker*: NULL if no worker is queued
+ */
+
+OctopipesServerWorker* shard_pop(OctopipesServerShard* shard) {
+  OctopipesServerWorker* worker = shard->ready_head;
+  if (worker != NULL) {
+    shard_remove(shard, worker);
+  }
+  return worker;
+}
+
+/**
+ * @brief remove a worker from the ready queue of its shard, if it's queued; shard lock must be held by the caller
+ * @param OctopipesServerShard* shard
+ * @param OctopipesServerWorker* worker
+ */
+
+void shard_remove(OctopipesServerShard* shard, OctopipesServerWorker* worker) {
+  if (!worker->ready) {
+    return;
+  }
+  if (worker->ready_prev != NULL) {
+    worker->ready_prev->ready_next = worker->ready_next;
+  } else {
+    shard->ready_head = worker->ready_next;
+  }
+  if (worker->ready_next != NULL) {
+    worker->ready_next->ready_prev = worker->ready_prev;
+  } else {
+    shard->ready_tail = worker->ready_prev;
+  }
+  worker->ready = 0;
+  worker->ready_prev = NULL;
+  worker->ready_next = NULL;
+}
+
+/**
+ * @brief hash a client id (FNV-1a)
+ * @param char* client_id
+ * @return uint32_t
+ */
+
+uint32_t client_hash(const char* client_id) {
+  uint32_t hash = 2166136261u;
+  for (const char* ptr = client_id; *ptr != 0x00; ptr++) {
+    hash = (hash ^ (uint8_t) *ptr) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief stop and join the fanout threads, then free the pool. The caller must hold job_lock
+ * @param OctopipesServerFanout* fanout
+ */
+
+void fanout_stop(OctopipesServerFanout* fanout) {
+  pthread_mutex_lock(&fanout->lock);
+  fanout->running = 0;
+  pthread_cond_broadcast(&fanout->job_ready);
+  pthread_mutex_unlock(&fanout->lock);
+  for (size_t i = 0; i < fanout->threads_len; i++) {
+    pthread_join(fanout->threads[i].thread, NULL);
+  }
+  free(fanout->threads);
+  free(fanout->ranges);
+  fanout->threads = NULL;
+  fanout->ranges = NULL;
+  fanout->threads_len = 0;
+}
+
+/**
+ * @brief send an encoded message to workers using the fanout threads; the dispatcher works too and returns once all the workers have been served.
+ * The workers which can't write the frame at once queue a reference to it. The caller must hold job_lock
+ * @param OctopipesServerFanout* fanout
+ * @param OctopipesServerWorker** workers
+ * @param size_t workers length
+ * @param OctopipesServerSharedFrame* frame: the encoded message
+ * @param OctopipesServerWorker** failed: the first worker which failed (NOTE: DO NOT FREE)
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError fanout_dispatch(OctopipesServerFanout* fanout, OctopipesServerWorker** workers, const size_t workers_len, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires, const char* group, const uint64_t log_offset, OctopipesServerWorker** failed) {
+  const size_t ranges = fanout->threads_len + 1;
+  pthread_mutex_lock(&fanout->lock);
+  fanout->frame = frame;
+  fanout->priority = priority;
+  fanout->expires = expires;
+  fanout->group = group;
+  fanout->log_offset = log_offset;
+  fanout->workers = workers;
+  //Split workers into contiguous ranges
+  for (size_t i = 0; i < ranges; i++) {
+    fanout->ranges[i].begin = workers_len * i / ranges;
+    fanout->ranges[i].end = workers_len * (i + 1) / ranges;
+  }
+  fanout->error = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  fanout->failed = NULL;
+  fanout->pending = fanout->threads_len;
+  fanout->job++;
+  pthread_cond_broadcast(&fanout->job_ready);
+  pthread_mutex_unlock(&fanout->lock);
+  fanout_work(fanout, 0);
+  //Wait for threads
+  pthread_mutex_lock(&fanout->lock);
+  while (fanout->pending > 0) {
+    pthread_cond_wait(&fanout->job_done, &fanout->lock);
+  }
+  *failed = fanout->failed;
+  const OctopipesServerError rc = fanout->error;
+  pthread_mutex_unlock(&fanout->lock);
+  return rc;
+}
+
+/**
+ * @brief send the current fanout job to the workers of a range, then steal from the others
+ * @param OctopipesServerFanout* fanout
+ * @param size_t index of the range
+ */
+
+void fanout_work(OctopipesServerFanout* fanout, const size_t index) {
+  size_t worker_index;
+  while (fanout_next(fanout, index, &worker_index)) {
+    OctopipesServerWorker* worker = fanout->workers[worker_index];
+    OctopipesServerError ret;
+    if ((ret = worker_send(worker, fanout->frame, fanout->priority, fanout->expires, fanout->group, fanout->log_offset)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      pthread_mutex_lock(&fanout->lock);
+      if (fanout->failed == NULL) {
+        fanout->error = ret;
+        fanout->failed = worker;
+      }
+      pthread_mutex_unlock(&fanout->lock);
+    }
+  }
+}
+
+/**
+ * @brief take the next worker of the current job: the first one of its own range, or else the last one of another range
+ * @param OctopipesServerFanout* fanout
+ * @param size_t index of the range
+ * @param size_t* worker_index
+ * @return int 0 if there are no more workers to serve
+ */
+
+int fanout_next(OctopipesServerFanout* fanout, const size_t index, size_t* worker_index) {
+  const size_t ranges = fanout->threads_len + 1;
+  int found = 0;
+  pthread_mutex_lock(&fanout->lock);
+  OctopipesServerFanoutRange* own = &fanout->ranges[index];
+  if (own->begin < own->end) {
+    *worker_index = own->begin++;
+    found = 1;
+  }
+  //Steal from the back of the other ranges, so their owners keep working at the front
+  for (size_t i = 1; i < ranges && !found; i++) {
+    OctopipesServerFanoutRange* victim = &fanout->ranges[(index + i) % ranges];
+    if (victim->begin < victim->end) {
+      *worker_index = --victim->end;
+      found = 1;
+    }
+  }
+  pthread_mutex_unlock(&fanout->lock);
+  return found;
+}
+
+/**
+ * @brief store the last frame dispatched to a group, replacing the previous one
+ * @param OctopipesServerRetainedCache* cache
+ * @param char* group
+ * @param OctopipesServerSharedFrame* frame: the encoded message; the cache takes a reference to it if stored
+ * @param size_t priority class of the message
+ * @param uint64_t expires: time the frame expires at (ms, 0 if it never expires)
+ */
+
+void retained_store(OctopipesServerRetainedCache* cache, const char* group, OctopipesServerSharedFrame* frame, const size_t priority, const uint64_t expires) {
+  const uint32_t hash = client_hash(group);
+  int stored = 0;
+  pthread_mutex_lock(&cache->lock);
+  OctopipesServerRetained* entry = retained_find(cache, group, hash);
+  if (entry != NULL) {
+    //Replace the frame in place
+    cache->bytes -= entry->frame->data_size;
+    memory_account(cache->memory, frame->data_size, entry->frame->data_size, 0);
+    shared_frame_release(entry->frame);
+    shared_frame_retain(frame);
+    entry->frame = frame;
+    entry->priority = priority;
+    entry->expires = expires;
+    cache->bytes += frame->data_size;
+    retained_touch(cache, entry);
+    stored = 1;
+  } else if (cache->budget > 0) {
+    entry = (OctopipesServerRetained*) malloc(sizeof(OctopipesServerRetained));
+    if (entry == NULL) {
+      goto unlock;
+    }
+    const size_t group_len = strlen(group);
+    entry->group = (char*) malloc(sizeof(char) * (group_len + 1));
+    if (entry->group == NULL) {
+      free(entry);
+      goto unlock;
+    }
+    memcpy(entry->group, group, group_len + 1);
+    entry->hash = hash;
+    entry->frame = frame;
+    entry->priority = priority;
+    entry->expires = expires;
+    if (retained_insert(cache, entry) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      free(entry->group);
+      free(entry);
+      goto unlock;
+    }
+    shared_frame_retain(frame);
+    stored = 1;
+  }
+  //A frame larger than the whole budget is evicted straight away, so the group has no stale frame either
+  retained_evict(cache);
+  if (stored && cache->bytes > cache->budget) {
+    retained_remove(cache, entry);
+  }
+
+unlock:
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief send the retained frames of the groups to a client; wildcard groups get the frames of all the groups they match.
+ * Frames retained for a client id before the client subscribed are direct messages, so they're not sent
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param char** groups
+ * @param size_t groups_len
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError retained_deliver(OctopipesServer* server, const char* client, const char** groups, const size_t groups_len) {
+  OctopipesServerRetainedCache* cache = &server->retained;
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND;
+  if (cache->budget == 0) {
+    return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  }
+  pthread_rwlock_rdlock(&server->routing_lock);
+  OctopipesServerWorker* this_worker = workers_find(server, client);
+  if (this_worker == NULL) {
+    goto unlock_routing;
+  }
+  rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  const uint64_t now = octopipes_get_time_ms();
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < groups_len && rc == OCTOPIPES_SERVER_ERROR_SUCCESS; i++) {
+    const char* group = groups[i];
+    OctopipesServerRetained* entry;
+    if (strpbrk(group, GROUP_SINGLE_WILDCARD GROUP_MULTI_WILDCARD) == NULL) {
+      if ((entry = retained_find(cache, group, client_hash(group))) == NULL || workers_find(server, group) != NULL) {
+        continue;
+      }
+      if (entry->expires > 0 && entry->expires <= now) {
+        retained_remove(cache, entry);
+        continue;
+      }
+      retained_touch(cache, entry);
+      rc = worker_send(this_worker, entry->frame, entry->priority, entry->expires, entry->group, OCTOPIPES_LOG_NO_OFFSET);
+      continue;
+    }
+    //Wildcard: scan all the groups
+    entry = cache->head;
+    while (entry != NULL && rc == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      OctopipesServerRetained* next = entry->next;
+      if (group_matches(group, entry->group) && workers_find(server, entry->group) == NULL) {
+        if (entry->expires > 0 && entry->expires <= now) {
+          retained_remove(cache, entry);
+        } else {
+          rc = worker_send(this_worker, entry->frame, entry->priority, entry->expires, entry->group, OCTOPIPES_LOG_NO_OFFSET);
+        }
+      }
+      entry = next;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+unlock_routing:
+  pthread_rwlock_unlock(&server->routing_lock);
+  return rc;
+}
+
+/**
+ * @brief find the retained entry of a group
+ * @param OctopipesServerRetainedCache* cache
+ * @param char* group
+ * @param uint32_t hash of group
+ * @return OctopipesServerRetained* (NULL if the group has no retained frame)
+ */
+
+OctopipesServerRetained* retained_find(OctopipesServerRetainedCache* cache, const char* group, const uint32_t hash) {
+  if (cache->map_size == 0) {
+    return NULL;
+  }
+  const size_t mask = cache->map_size - 1;
+  for (size_t slot = hash & mask; cache->map[slot] != NULL; slot = (slot + 1) & mask) {
+    OctopipesServerRetained* entry = cache->map[slot];
+    if (entry->hash == hash && strcmp(entry->group, group) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief add an entry to the map and at the front of the recency list; the map grows when half full
+ * @param OctopipesServerRetainedCache* cache
+ * @param OctopipesServerRetained* entry
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError retained_insert(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry) {
+  if ((cache->entries + 1) * 2 > cache->map_size) {
+    const size_t map_size = cache->map_size > 0 ? cache->map_size * 2 : RETAINED_INITIAL_SIZE * 2;
+    OctopipesServerRetained** map = (OctopipesServerRetained**) calloc(map_size, sizeof(OctopipesServerRetained*));
+    if (map == NULL) {
+      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+    }
+    for (OctopipesServerRetained* this_entry = cache->head; this_entry != NULL; this_entry = this_entry->next) {
+      size_t slot = this_entry->hash & (map_size - 1);
+      while (map[slot] != NULL) {
+        slot = (slot + 1) & (map_size - 1);
+      }
+      map[slot] = this_entry;
+    }
+    free(cache->map);
+    cache->map = map;
+    cache->map_size = map_size;
+  }
+  const size_t mask = cache->map_size - 1;
+  size_t slot = entry->hash & mask;
+  while (cache->map[slot] != NULL) {
+    slot = (slot + 1) & mask;
+  }
+  cache->map[slot] = entry;
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+  cache->entries++;
+  cache->bytes += retained_cost(entry);
+  memory_account(cache->memory, retained_cost(entry), 0, 0);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief remove an entry from the cache and free it
+ * @param OctopipesServerRetainedCache* cache
+ * @param OctopipesServerRetained* entry
+ */
+
+void retained_remove(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry) {
+  const size_t mask = cache->map_size - 1;
+  size_t slot = entry->hash & mask;
+  while (cache->map[slot] != entry) {
+    slot = (slot + 1) & mask;
+  }
+  cache->map[slot] = NULL;
+  //Shift back the following entries of the cluster which can't be found anymore past the empty slot
+  for (size_t next = (slot + 1) & mask; cache->map[next] != NULL; next = (next + 1) & mask) {
+    const size_t home = cache->map[next]->hash & mask;
+    const int reachable = slot <= next ? (home > slot && home <= next) : (home > slot || home <= next);
+    if (!reachable) {
+      cache->map[slot] = cache->map[next];
+      cache->map[next] = NULL;
+      slot = next;
+    }
+  }
+  //Unlink from the recency list
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+  cache->entries--;
+  cache->bytes -= retained_cost(entry);
+  memory_account(cache->memory, 0, retained_cost(entry), 0);
+  free(entry->group);
+  shared_frame_release(entry->frame);
+  free(entry);
+}
+
+/**
+ * @brief move an entry at the front of the recency list
+ * @param OctopipesServerRetainedCache* cache
+ * @param OctopipesServerRetained* entry
+ */
+
+void retained_touch(OctopipesServerRetainedCache* cache, OctopipesServerRetained* entry) {
+  if (cache->head == entry) {
+    return;
+  }
+  entry->prev->next = entry->next;
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = cache->head;
+  cache->head->prev = entry;
+  cache->head = entry;
+}
+
+/**
+ * @brief evict the least recently used entries until the cache is within budget; the most recent one is kept
+ * @param OctopipesServerRetainedCache* cache
+ */
+
+void retained_evict(OctopipesServerRetainedCache* cache) {
+  while (cache->bytes > cache->budget && cache->tail != NULL && (cache->tail != cache->head || cache->budget == 0)) {
+    retained_remove(cache, cache->tail);
+    cache->evicted++;
+  }
+}
+
+/**
+ * @brief get the bytes charged to the budget for an entry
+ * @param OctopipesServerRetained* entry
+ * @return size_t
+ */
+
+size_t retained_cost(const OctopipesServerRetained* entry) {
+  return sizeof(OctopipesServerRetained) + strlen(entry->group) + 1 + entry->frame->data_size;
+}
+
+/**
+ * @brief check if a group matches a subscription, following the routing trie rules: '*' matches a single level,
+ * while a trailing '#' matches all the remaining levels (even none)
+ * @param char* pattern: the subscription
+ * @param char* group
+ * @return int 1 if it matches
+ */
+
+int group_matches(const char* pattern, const char* group) {
+  while (1) {
+    const size_t pattern_len = trie_level_len(pattern);
+    const int last = pattern[pattern_len] != GROUP_LEVEL_SEPARATOR;
+    if (last && pattern_len == 1 && pattern[0] == GROUP_MULTI_WILDCARD[0]) {
+      return 1;
+    }
+    if (group == NULL) {
+      return 0;
+    }
+    const size_t group_len = trie_level_len(group);
+    const int any = pattern_len == 1 && pattern[0] == GROUP_SINGLE_WILDCARD[0];
+    if (!any && (pattern_len != group_len || strncmp(pattern, group, group_len) != 0)) {
+      return 0;
+    }
+    const char* next_group = group[group_len] == GROUP_LEVEL_SEPARATOR ? group + group_len + 1 : NULL;
+    if (last) {
+      return next_group == NULL;
+    }
+    pattern += pattern_len + 1;
+    group = next_group;
+  }
+}
+
+/**
+ * @brief set up the replay of the logged groups matching the worker subscriptions; it's written by the worker thread
+ * @param OctopipesServer* server
+ * @param OctopipesServerWorker* worker
+ * @param OctopipesSubscriptionFlags flags: OCTOPIPES_SUBSCRIPTION_REPLAY_TIME if from is a time, otherwise it's an offset
+ * @param uint64_t from
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError replay_add(OctopipesServer* server, OctopipesServerWorker* worker, const OctopipesSubscriptionFlags flags, const uint64_t from) {
+  //Groups are matched against the groups logged on disk, so wildcards replay all the groups they match
+  char** groups;
+  size_t groups_len;
+  OctopipesError ret;
+  if ((ret = octopipes_log_get_groups(server->log, &groups, &groups_len)) != OCTOPIPES_ERROR_SUCCESS) {
+    return to_server_error(ret);
+  }
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  for (size_t i = 0; i < groups_len; i++) {
+    //Direct messages logged by previous versions are not replayed
+    pthread_rwlock_rdlock(&server->routing_lock);
+    int matches = strcmp(groups[i], worker->client_id) != 0 && workers_find(server, groups[i]) == NULL;
+    pthread_rwlock_unlock(&server->routing_lock);
+    int subscribed = 0;
+    for (size_t j = 0; j < worker->subscriptions && matches && !subscribed; j++) {
+      subscribed = group_matches(worker->subscriptions_list[j], groups[i]);
+    }
+    matches = matches && subscribed;
+    OctopipesLogGroup* log_group;
+    if (matches && rc == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+      if ((ret = octopipes_log_get_group(server->log, groups[i], 0, &log_group)) == OCTOPIPES_ERROR_SUCCESS) {
+        rc = replay_add_group(&worker->outbound, log_group, flags, from);
+      } else if (ret != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+        rc = to_server_error(ret);
+      }
+    }
+    free(groups[i]);
+  }
+  free(groups);
+  return rc;
+}
+
+/**
+ * @brief add a group log to the replays of an outbound
+ * @param OctopipesServerOutbound* outbound
+ * @param OctopipesLogGroup* log group
+ * @param OctopipesSubscriptionFlags flags
+ * @param uint64_t from
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError replay_add_group(OctopipesServerOutbound* outbound, OctopipesLogGroup* log_group, const OctopipesSubscriptionFlags flags, const uint64_t from) {
+  uint64_t next = from;
+  if (flags & OCTOPIPES_SUBSCRIPTION_REPLAY_TIME) {
+    pthread_mutex_lock(&log_group->lock);
+    next = octopipes_log_seek_time(log_group, from);
+    pthread_mutex_unlock(&log_group->lock);
+  }
+  pthread_mutex_lock(&outbound->lock);
+  OctopipesServerReplay* new_replays = (OctopipesServerReplay*) realloc(outbound->replays, sizeof(OctopipesServerReplay) * (outbound->replays_len + 1));
+  if (new_replays == NULL) {
+    pthread_mutex_unlock(&outbound->lock);
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  outbound->replays = new_replays;
+  outbound_account(outbound, sizeof(OctopipesServerReplay), 0);
+  OctopipesServerReplay* replay = &outbound->replays[outbound->replays_len++];
+  replay->log = log_group;
+  replay->next = next;
+  replay->written = 0;
+  replay->done = 0;
+  replay->until = 0;
+  outbound->replaying++;
+  pthread_mutex_unlock(&outbound->lock);
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief write the replayed records until the pipe is full or all the replays caught up with their logs. Records are
+ * written straight from the mapped segments, one group after the other; outbound lock must be held by the caller
+ * @param OctopipesServerOutbound* outbound
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError replay_flush(OctopipesServerOutbound* outbound) {
+  OctopipesServerError rc = OCTOPIPES_SERVER_ERROR_SUCCESS;
+  for (size_t i = 0; i < outbound->replays_len && outbound->replaying > 0; i++) {
+    OctopipesServerReplay* replay = &outbound->replays[i];
+    if (replay->done) {
+      continue;
+    }
+    OctopipesLogGroup* log_group = replay->log;
+    int full = 0;
+    pthread_mutex_lock(&log_group->lock);
+    //Records deleted or expired by the retention are skipped, unless one of them is partially written
+    const uint64_t first = octopipes_log_first(log_group);
+    if (replay->next < first && replay->written == 0) {
+      replay->next = first;
+      replay->written = 0;
+    } else if (replay->next > log_group->next) {
+      replay->next = log_group->next;
+    }
+    while (replay->next < log_group->next) {
+      size_t data_size;
+      const uint8_t* data = octopipes_log_read(log_group, replay->next, &data_size);
+      size_t written = 0;
+      if (data == NULL) {
+        replay->next++; //Lost by the recovery
+        replay->written = 0;
+        continue;
+      }
+      OctopipesError ret;
+      if ((ret = pipe_write(outbound->fd, data + replay->written, data_size - replay->written, &written)) != OCTOPIPES_ERROR_SUCCESS) {
+        rc = to_server_error(ret);
+        full = 1;
+        break;
+      }
+      replay->written += written;
+      if (replay->written < data_size) {
+        full = 1; //Pipe is full
+        break;
+      }
+      replay->written = 0;
+      replay->next++;
+    }
+    if (!full) {
+      //Caught up: from now on the live frames of the group are written, except the ones already replayed
+      replay->done = 1;
+      replay->until = log_group->next;
+      outbound->replaying--;
+    }
+    pthread_mutex_unlock(&log_group->lock);
+    if (full) {
+      break;
+    }
+  }
+  return rc;
+}
+
+/**
+ * @brief check whether a replayed record has been partially written; nothing else can be written until it's complete.
+ * Outbound lock must be held by the caller
+ * @param OctopipesServerOutbound* outbound
+ * @return int
+ */
+
+int replay_partial(const OctopipesServerOutbound* outbound) {
+  for (size_t i = 0; i < outbound->replays_len && outbound->replaying > 0; i++) {
+    if (outbound->replays[i].written > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief check whether a live frame must be dropped because the worker replays it: a group being replayed gets no live frames,
+ * then only the ones logged after the replay caught up. Outbound lock must be held by the caller
+ * @param OctopipesServerOutbound* outbound
+ * @param char* group
+ * @param uint64_t log offset of the frame
+ * @return int
+ */
+
+int replay_drops(const OctopipesServerOutbound* outbound, const char* group, const uint64_t log_offset) {
+  if (log_offset == OCTOPIPES_LOG_NO_OFFSET) {
+    return 0;
+  }
+  for (size_t i = 0; i < outbound->replays_len; i++) {
+    const OctopipesServerReplay* replay = &outbound->replays[i];
+    if (strcmp(replay->log->group, group) == 0) {
+      return !replay->done || log_offset < replay->until;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief call the handlers collected in route by the dispatch of message, then release them. routing_lock mustn't be locked
+ * by the caller, so the handlers can call any server function; the dispatches they make are nested up to HANDLER_MAX_DEPTH
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* message
+ * @param OctopipesServerRoute* route
+ */
+
+void handlers_call(OctopipesServer* server, const OctopipesMessage* message, OctopipesServerRoute* route) {
+  if (route->handlers_len == 0) {
+    return;
+  }
+  handler_depth++;
+  for (size_t i = 0; i < route->handlers_len; i++) {
+    OctopipesServerHandler* handler = route->handlers[i];
+    //Handlers unregistered since the dispatch are skipped
+    void (*on_message)(OctopipesServer* server, const OctopipesMessage* message) = __atomic_load_n(&handler->on_message, __ATOMIC_ACQUIRE);
+    if (on_message != NULL) {
+      on_message(server, message);
+    }
+    handler_release(handler);
+  }
+  route->handlers_len = 0;
+  handler_depth--;
+}
+
+/**
+ * @brief drop a reference to a handler; the last one frees it
+ * @param OctopipesServerHandler* handler
+ */
+
+void handler_release(OctopipesServerHandler* handler) {
+  if (__atomic_sub_fetch(&handler->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(handler);
+  }
+}
+
+/**
+ * @brief set the limits of a rate limit; its buckets start full
+ * @param OctopipesServerRateLimit* rate limit
+ * @param uint64_t messages per second (0: no limit)
+ * @param uint64_t bytes per second (0: no limit)
+ * @param OctopipesServerRateLimitPolicy policy
+ */
+
+void rate_limit_set(OctopipesServerRateLimit* rate_limit, const uint64_t messages_per_sec, const uint64_t bytes_per_sec, const OctopipesServerRateLimitPolicy policy) {
+  const uint64_t now = octopipes_get_time_us();
+  rate_limit->messages.rate = messages_per_sec;
+  rate_limit->messages.tokens = (int64_t) (messages_per_sec * TOKEN_SCALE);
+  rate_limit->messages.refilled = now;
+  rate_limit->bytes.rate = bytes_per_sec;
+  rate_limit->bytes.tokens = (int64_t) (bytes_per_sec * TOKEN_SCALE);
+  rate_limit->bytes.refilled = now;
+  rate_limit->policy = policy;
+}
+
+/**
+ * @brief get how long a client with backpressure must wait before it's read again; worker_lock must be held by the caller
+ * @param OctopipesServerRateLimit* rate limit
+ * @return uint64_t microseconds until both buckets have tokens (0 if the client can be read)
+ */
+
+uint64_t rate_limit_delay(OctopipesServerRateLimit* rate_limit) {
+  if (rate_limit->policy != OCTOPIPES_SERVER_RATE_LIMIT_BACKPRESSURE || (rate_limit->messages.rate == 0 && rate_limit->bytes.rate == 0)) {
+    return 0;
   }
-  if (ptr->subscriptions_list != NULL) {
-    free(ptr->subscriptions_list);
+  const uint64_t now = octopipes_get_time_us();
+  uint64_t delay = 0;
+  OctopipesServerTokenBucket* buckets[2] = {&rate_limit->messages, &rate_limit->bytes};
+  for (size_t i = 0; i < 2; i++) {
+    OctopipesServerTokenBucket* bucket = buckets[i];
+    if (bucket->rate == 0) {
+      continue;
+    }
+    token_bucket_refill(bucket, now);
+    if (bucket->tokens <= 0) {
+      //Units are refilled at rate per microsecond
+      const uint64_t bucket_delay = (uint64_t) (-bucket->tokens) / bucket->rate + 1;
+      delay = bucket_delay > delay ? bucket_delay : delay;
+    }
   }
-  return OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+  return delay;
 }
 
 /**
- * @brief cleanup a server worker
- * @param OctopipesServerWorker*
- * @return OctopipesServerError
+ * @brief charge a message received from a client to its buckets; worker_lock must be held by the caller.
+ * With the drop policy, a message is rejected while a bucket is empty
+ * @param OctopipesServerRateLimit* rate limit
+ * @param size_t bytes of the message
+ * @return int 1 if the message can be dispatched
  */
 
-OctopipesServerError worker_cleanup(OctopipesServerWorker* worker) {
-  if (worker->active) {
-    //Set worker active to false
-    worker->active = 0;
-    //Join listener
-    if (pthread_join(worker->worker_listener, NULL) != 0) {
-      return OCTOPIPES_SERVER_ERROR_THREAD_ERROR;
+int rate_limit_admit(OctopipesServerRateLimit* rate_limit, const size_t bytes) {
+  if (rate_limit->messages.rate == 0 && rate_limit->bytes.rate == 0) {
+    return 1;
+  }
+  if (rate_limit->policy == OCTOPIPES_SERVER_RATE_LIMIT_DROP) {
+    const uint64_t now = octopipes_get_time_us();
+    token_bucket_refill(&rate_limit->messages, now);
+    token_bucket_refill(&rate_limit->bytes, now);
+    if ((rate_limit->messages.rate > 0 && rate_limit->messages.tokens <= 0) || (rate_limit->bytes.rate > 0 && rate_limit->bytes.tokens <= 0)) {
+      rate_limit->dropped++;
+      return 0;
     }
-    pthread_mutex_destroy(&worker->worker_lock);
   }
-  //Delete pipes
-  pipe_delete(worker->pipe_read);
-  pipe_delete(worker->pipe_write);
-  //Free worker
-  free(worker->client_id);
-  //Delete subscription list
-  for (size_t i = 0; i < worker->subscriptions; i++) {
-    char* sub = worker->subscriptions_list[i];
-    free(sub);
+  //A message is let through while the buckets have tokens, even if it overdraws them
+  if (rate_limit->messages.rate > 0) {
+    rate_limit->messages.tokens -= TOKEN_SCALE;
   }
-  free(worker->subscriptions_list);
-  //Delete pipes
-  free(worker->pipe_read);
-  free(worker->pipe_write);
-  //Free inbox
-  OctopipesServerError rc;
-  if ((rc = message_inbox_cleanup(worker->inbox)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
-    return rc;
+  if (rate_limit->bytes.rate > 0) {
+    rate_limit->bytes.tokens -= (int64_t) bytes * TOKEN_SCALE;
   }
-  //Eventually free worker and return
-  free(worker);
-  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  return 1;
 }
 
 /**
- * @brief send a message to the client associated to this worker
- * @param OctopipesServerWorker* worker
- * @param OctopipesMessage* message to send
- * @return OctopipesServerError
+ * @brief add to a bucket the tokens accumulated since its last refill, up to its capacity
+ * @param OctopipesServerTokenBucket* bucket
+ * @param uint64_t now (us)
  */
 
-OctopipesServerError worker_send(OctopipesServerWorker* worker, OctopipesMessage* message) {
-  //Encode message
-  uint8_t* data_out;
-  size_t data_out_size;
-  OctopipesError ret;
-  if ((ret = octopipes_encode(message, &data_out, &data_out_size)) != OCTOPIPES_ERROR_SUCCESS) {
-    return to_server_error(ret);
+void token_bucket_refill(OctopipesServerTokenBucket* bucket, const uint64_t now) {
+  if (bucket->rate == 0) {
+    return;
   }
-  if ((ret = pipe_send(worker->pipe_write, data_out, data_out_size, (message->ttl * 1000))) != OCTOPIPES_ERROR_SUCCESS) {
-    free(data_out);
-    return to_server_error(ret);
+  const int64_t capacity = (int64_t) (bucket->rate * TOKEN_SCALE);
+  const uint64_t elapsed = now - bucket->refilled;
+  bucket->refilled = now;
+  //Compare times rather than units, so a long idle time can't overflow the bucket
+  const uint64_t missing = (uint64_t) (capacity - bucket->tokens);
+  if (elapsed >= missing / bucket->rate) {
+    bucket->tokens = capacity;
+  } else {
+    bucket->tokens += (int64_t) (elapsed * bucket->rate);
   }
-  free(data_out);
-  return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief
- * @param OctopipesServerWorker* worker
- * @param OctopipesMessage** message out
- * @return OctopipesServerError
+ * @brief give back the credits of a message of the client taken out of the server; worker_lock must be held by the caller
+ * @param OctopipesServerCredits* credits
+ * @param size_t encoded size of the message
  */
 
-OctopipesServerError worker_get_next_message(OctopipesServerWorker* worker, OctopipesServerMessage** message) {
-  //Initialize message
-  *message = NULL;
-  //Lock mutex
-  pthread_mutex_lock(&worker->worker_lock);
-  //Deque inbox
-  OctopipesServerMessage* inbox_msg = message_inbox_dequeue(worker->inbox);
-  //Unlock mutex
-  pthread_mutex_unlock(&worker->worker_lock);
-  //Return OK
-  *message = inbox_msg;
-  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+void credits_return(OctopipesServerCredits* credits, const size_t bytes) {
+  credits->messages_consumed++;
+  credits->bytes_consumed += bytes;
 }
 
 /**
- * @brief get a worker subscriptions list
- * @param OctopipesServerWorker*
- * @param char*** groups (NOTE: FREE char**, not the content)
- * @param size_t* groups length
- * @return OctopipesServerError
+ * @brief check whether the client must be granted new credits: a grant is sent once half of a window has been given back,
+ * so the client gets new credits before running out of them; worker_lock must be held by the caller
+ * @param OctopipesServerCredits* credits
+ * @return int 1 if a grant is due
  */
 
-OctopipesServerError worker_get_subscriptions(OctopipesServerWorker* worker, char*** groups, size_t* groups_len) {
-  char** subs = (char**) malloc(sizeof(char*) * worker->subscriptions);
-  if (subs == NULL) {
-    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
-  }
-  for (size_t i = 0; i < worker->subscriptions; i++) {
-    subs[i] = worker->subscriptions_list[i];
+int credits_due(const OctopipesServerCredits* credits) {
+  if (credits->messages > 0 && credits->messages_consumed - credits->messages_granted >= (credits->messages + 1) / 2) {
+    return 1;
   }
-  *groups = subs;
-  *groups_len = worker->subscriptions;
-  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+  return credits->bytes > 0 && credits->bytes_consumed - credits->bytes_granted >= (credits->bytes + 1) / 2;
 }
 
 /**
- * @brief checks if a certain remote is in a worker subscription list
- * @param OctopipesServerWorker*
- * @param char* remote
- * @return int
+ * @brief write a credits grant to the client. The grant carries the totals the client can have sent (what it gave back plus the window),
+ * so it replaces the previous ones; grants are written in the highest priority lane, ahead of the queued messages.
+ * worker_lock must be held by the caller, so grants are queued in the order they are computed
+ * @param OctopipesServerWorker* worker
+ * @return OctopipesServerError
  */
 
-int worker_match_subscription(OctopipesServerWorker* worker, const char* remote) {
-  for (size_t i = 0; i < worker->subscriptions; i++) {
-    if (strcmp(worker->subscriptions_list[i], remote) == 0) {
-      return 1;
-    }
+OctopipesServerError worker_grant_credits(OctopipesServerWorker* worker) {
+  OctopipesServerCredits* credits = &worker->credits;
+  const uint64_t messages_limit = credits->messages > 0 ? credits->messages_consumed + credits->messages : 0;
+  const uint64_t bytes_limit = credits->bytes > 0 ? credits->bytes_consumed + credits->bytes : 0;
+  size_t payload_size;
+  uint8_t* payload = octopipes_cap_prepare_credits(messages_limit, bytes_limit, &payload_size);
+  if (payload == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
   }
-  return 0;
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin_size = 0;
+  message.origin = NULL; //Server has no origin
+  message.remote_size = strlen(worker->client_id);
+  message.remote = worker->client_id;
+  message.ttl = CREDITS_TTL;
+  message.data_size = payload_size;
+  message.options = OCTOPIPES_OPTIONS_PRIORITY_CRITICAL;
+  message.checksum = 0;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = payload;
+  uint8_t* data_out;
+  size_t data_out_size;
+  OctopipesError err = octopipes_encode(&message, &data_out, &data_out_size);
+  free(payload);
+  if (err != OCTOPIPES_ERROR_SUCCESS) {
+    return to_server_error(err);
+  }
+  OctopipesServerSharedFrame* frame;
+  OctopipesServerError ret;
+  if ((ret = shared_frame_init(&frame, data_out, data_out_size)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    free(data_out);
+    return ret;
+  }
+  ret = worker_send(worker, frame, OCTOPIPES_PRIORITY(message.options), 0, NULL, OCTOPIPES_LOG_NO_OFFSET);
+  shared_frame_release(frame);
+  //If the grant couldn't be written, it's sent again on the next check
+  if (ret == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    credits->messages_granted = credits->messages_consumed;
+    credits->bytes_granted = credits->bytes_consumed;
+  }
+  return ret;
 }
 
-
 /**
  * @brief initialize a message inbox
  * @param OctopipesServerInbox**
+ * @param OctopipesServerMemory* memory the inbox is accounted in (NULL if it's not accounted)
  * @return OctopipesServerError
  */
 
-OctopipesServerError message_inbox_init(OctopipesServerInbox** inbox) {
+OctopipesServerError message_inbox_init(OctopipesServerInbox** inbox, OctopipesServerMemory* memory) {
   OctopipesServerInbox* ptr = (OctopipesServerInbox*) malloc(sizeof(OctopipesServerInbox));
   if (ptr == NULL) {
     return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
   }
-  ptr->messages = NULL;
-  ptr->inbox_len = 0;
+  for (size_t i = 0; i < OCTOPIPES_PRIORITIES; i++) {
+    ptr->head[i] = NULL;
+    ptr->tail[i] = NULL;
+    ptr->inbox_len[i] = 0;
+  }
+  if (octopipes_timer_wheel_init(&ptr->expirations, INBOX_TTL_TICK, octopipes_get_time_ms()) != OCTOPIPES_ERROR_SUCCESS) {
+    free(ptr);
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  ptr->expired = 0;
+  ptr->bytes = 0;
+  ptr->memory = memory;
+  ptr->credits = NULL;
+  if (memory != NULL) {
+    __atomic_add_fetch(&memory->inboxes, 1, __ATOMIC_RELAXED);
+  }
   *inbox = ptr;
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
@@ -1148,35 +4499,85 @@ OctopipesServerError message_inbox_cleanup(OctopipesServerInbox* inbox) {
   if ((err = message_inbox_expunge(inbox)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
     return err;
   }
+  octopipes_timer_wheel_cleanup(inbox->expirations);
+  if (inbox->memory != NULL) {
+    __atomic_sub_fetch(&inbox->memory->inboxes, 1, __ATOMIC_RELAXED);
+  }
   free(inbox);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief get the first message from the inbox and remove it from the message queue
+ * @brief get the first message of the highest priority class from the inbox and remove it from the message queue.
+ * Expired messages are discarded first
  * @param OctopipesServerInbox*
  * @return OctopipesMessage* (or NULL if empty)
  */
 
 OctopipesServerMessage* message_inbox_dequeue(OctopipesServerInbox* inbox) {
-  if (inbox->inbox_len == 0) {
+  if (inbox->expirations->timers > 0) {
+    message_inbox_expire(inbox, octopipes_get_time_ms());
+  }
+  size_t priority = OCTOPIPES_PRIORITIES;
+  while (priority > 0 && inbox->head[priority - 1] == NULL) {
+    priority--;
+  }
+  if (priority == 0) {
     return NULL;
   }
-  OctopipesServerMessage* ret = inbox->messages[0];
-  //Move all the following messages one position behind
-  const size_t new_inbox_len = inbox->inbox_len - 1;
-  for (size_t i = 0; i < new_inbox_len; i++) {
-    inbox[i] = inbox[i + 1];
+  OctopipesServerMessage* ret = inbox->head[priority - 1];
+  message_inbox_unlink(inbox, ret);
+  return ret;
+}
+
+/**
+ * @brief take a message out of its queue and unschedule its expiration
+ * @param OctopipesServerInbox*
+ * @param OctopipesServerMessage*
+ */
+
+void message_inbox_unlink(OctopipesServerInbox* inbox, OctopipesServerMessage* message) {
+  const size_t priority = message->message != NULL ? OCTOPIPES_PRIORITY(message->message->options) : 0;
+  if (message->prev != NULL) {
+    message->prev->next = message->next;
+  } else {
+    inbox->head[priority] = message->next;
   }
-  //Reallocate messages
-  if (new_inbox_len > 0) {
-    inbox->messages = (OctopipesServerMessage**) realloc(inbox->messages, sizeof(OctopipesServerMessage*) * new_inbox_len);
+  if (message->next != NULL) {
+    message->next->prev = message->prev;
   } else {
-    free(inbox->messages);
-    inbox->messages = NULL;
+    inbox->tail[priority] = message->prev;
   }
-  inbox->inbox_len = new_inbox_len;
-  return ret;
+  message->prev = NULL;
+  message->next = NULL;
+  octopipes_timer_remove(inbox->expirations, &message->timer);
+  inbox->inbox_len[priority]--;
+  message_inbox_account(inbox, 0, message_inbox_cost(message));
+  if (inbox->credits != NULL && message->message != NULL) {
+    credits_return(inbox->credits, octopipes_get_encoded_size(message->message));
+  }
+}
+
+/**
+ * @brief discard all the messages whose TTL has elapsed
+ * @param OctopipesServerInbox*
+ * @param uint64_t current time in milliseconds
+ * @return size_t amount of discarded messages
+ */
+
+size_t message_inbox_expire(OctopipesServerInbox* inbox, const uint64_t now) {
+  OctopipesTimer* expired = NULL;
+  const size_t expired_len = octopipes_timer_wheel_advance(inbox->expirations, now, &expired);
+  while (expired != NULL) {
+    OctopipesTimer* next = expired->next;
+    expired->next = NULL;
+    OctopipesServerMessage* message = (OctopipesServerMessage*) ((uint8_t*) expired - offsetof(OctopipesServerMessage, timer));
+    message_inbox_unlink(inbox, message);
+    server_message_cleanup(message);
+    expired = next;
+  }
+  inbox->expired += expired_len;
+  return expired_len;
 }
 
 /**
@@ -1186,27 +4587,28 @@ OctopipesServerMessage* message_inbox_dequeue(OctopipesServerInbox* inbox) {
  */
 
 OctopipesServerError message_inbox_expunge(OctopipesServerInbox* inbox) {
-  for (size_t i = 0; i < inbox->inbox_len; i++) {
-    OctopipesServerMessage* message = inbox->messages[i];
-    //Cleanup message
-    server_message_cleanup(message);
+  for (size_t priority = 0; priority < OCTOPIPES_PRIORITIES; priority++) {
+    while (inbox->head[priority] != NULL) {
+      OctopipesServerMessage* message = inbox->head[priority];
+      message_inbox_unlink(inbox, message);
+      //Cleanup message
+      server_message_cleanup(message);
+    }
   }
-  inbox->inbox_len = 0;
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief push a new message into the Inbox
+ * @brief push a new message into the Inbox, in the queue of its priority class (errors have the lowest priority).
+ * If the message has a TTL, it is discarded when it elapses before the message is dispatched
  * @param OctopipesServerInbox**
- * @param size_t inbox len
  * @param OctopipesMessage* message to push (or NULL)
  * @param OctopipesServerError error to associate (can be success)
  * @return OctopipesServerError
  */
 
 OctopipesServerError message_inbox_push(OctopipesServerInbox* inbox, OctopipesMessage* message, OctopipesServerError error) {
-  //Reallocate inbox messages
-  const size_t new_inbox_len = inbox->inbox_len + 1;
+  const size_t priority = message != NULL ? OCTOPIPES_PRIORITY(message->options) : 0;
   //Instance new OctopipesServerMessage
   OctopipesServerMessage* new_message = (OctopipesServerMessage*) malloc(sizeof(OctopipesServerMessage));
   if (new_message == NULL) {
@@ -1214,53 +4616,147 @@ OctopipesServerError message_inbox_push(OctopipesServerInbox* inbox, OctopipesMe
   }
   new_message->message = message;
   new_message->error = error;
-  inbox->messages = (OctopipesServerMessage**) realloc(inbox->messages, sizeof(OctopipesServerMessage*) * new_inbox_len);
-  if (inbox->messages == NULL) {
-    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  new_message->expires = 0;
+  new_message->timer.slot = NULL;
+  new_message->timer.prev = NULL;
+  new_message->timer.next = NULL;
+  //Append to the queue
+  new_message->prev = inbox->tail[priority];
+  new_message->next = NULL;
+  if (inbox->tail[priority] != NULL) {
+    inbox->tail[priority]->next = new_message;
+  } else {
+    inbox->head[priority] = new_message;
+  }
+  inbox->tail[priority] = new_message;
+  inbox->inbox_len[priority]++;
+  message_inbox_account(inbox, message_inbox_cost(new_message), 0);
+  //Schedule expiration (ttl is in seconds)
+  if (message != NULL && message->ttl > 0) {
+    new_message->expires = octopipes_get_time_ms() + (uint64_t) message->ttl * 1000;
+    octopipes_timer_add(inbox->expirations, &new_message->timer, new_message->expires);
   }
-  inbox->messages[inbox->inbox_len] = new_message;
-  inbox->inbox_len++;
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
 /**
- * @brief remove the message in position index
+ * @brief remove the message in position index, counting in dequeue order (highest priority class first)
  * @param OctopipesServerInbox*
  * @param size_t index
  * @return OctopipesServerError
  */
 
 OctopipesServerError message_inbox_remove(OctopipesServerInbox* inbox, const size_t index) {
-  //Get the message in the provided position
-  if (index >= inbox->inbox_len) {
+  //Find the queue of the message
+  size_t priority = OCTOPIPES_PRIORITIES;
+  size_t position = index;
+  while (priority > 0 && position >= inbox->inbox_len[priority - 1]) {
+    position -= inbox->inbox_len[priority - 1];
+    priority--;
+  }
+  if (priority == 0) {
     return OCTOPIPES_SERVER_ERROR_SUCCESS; //Out of range, just ignore the error
   }
-  OctopipesServerMessage* target_message = inbox->messages[index];
-  //Free message if not null
-  if (target_message->message != NULL) {
-    octopipes_cleanup_message(target_message->message);
+  OctopipesServerMessage* target_message = inbox->head[priority - 1];
+  for (size_t i = 0; i < position; i++) {
+    target_message = target_message->next;
   }
+  message_inbox_unlink(inbox, target_message);
   //Free target
-  free(target_message);
-  //Move all the following messages one position behind
-  const size_t new_inbox_len = inbox->inbox_len - 1;
-  for (size_t i = index; i < new_inbox_len; i++) {
-    inbox[i] = inbox[i + 1];
-  }
-  //Reallocate messages
-  if (new_inbox_len > 0) {
-    inbox->messages = (OctopipesServerMessage**) realloc(inbox->messages, sizeof(OctopipesServerMessage*) * new_inbox_len);
-    if (inbox->messages == NULL) {
-      return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
-    }
-  } else {
-    free(inbox->messages);
-    inbox->messages = NULL;
-  }
-  inbox->inbox_len--;
+  server_message_cleanup(target_message);
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
+/**
+ * @brief get the memory held by a message in an inbox
+ * @param OctopipesServerMessage*
+ * @return size_t bytes
+ */
+
+size_t message_inbox_cost(const OctopipesServerMessage* message) {
+  size_t cost = sizeof(OctopipesServerMessage);
+  if (message->message != NULL) {
+    cost += sizeof(OctopipesMessage) + message->message->origin_size + message->message->remote_size + message->message->data_size;
+  }
+  return cost;
+}
+
+/**
+ * @brief account the memory of the messages added to and removed from an inbox
+ * @param OctopipesServerInbox*
+ * @param size_t bytes added
+ * @param size_t bytes removed
+ */
+
+void message_inbox_account(OctopipesServerInbox* inbox, const size_t added, const size_t removed) {
+  inbox->bytes = inbox->bytes + added - removed;
+  memory_account(inbox->memory, added, removed, 1);
+}
+
+/**
+ * @brief account the memory added to and removed from the server; the counters are unsigned, so the difference wraps
+ * around as expected when less is added than removed
+ * @param OctopipesServerMemory* memory (NULL if not accounted)
+ * @param size_t bytes added
+ * @param size_t bytes removed
+ * @param int 1 if the memory holds data read from the clients
+ */
+
+void memory_account(OctopipesServerMemory* memory, const size_t added, const size_t removed, const int input) {
+  if (memory == NULL || added == removed) {
+    return;
+  }
+  __atomic_add_fetch(&memory->used, added - removed, __ATOMIC_RELAXED);
+  if (input) {
+    __atomic_add_fetch(&memory->input, added - removed, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * @brief check whether a worker must stop reading its client because the memory budget is exceeded. While the data read
+ * from the clients exceeds the budget, only the workers holding more than their share of it are paused, so the largest producers
+ * are slowed down first and the others keep flowing; otherwise the memory is held by the frames waiting for the clients, which
+ * any message adds to, so all the workers are paused
+ * @param OctopipesServerMemory* memory
+ * @param size_t bytes held by the worker inbox and its undecoded data
+ * @return int 1 if the worker must not read
+ */
+
+int memory_over_budget(OctopipesServerMemory* memory, const size_t bytes) {
+  const size_t budget = __atomic_load_n(&memory->budget, __ATOMIC_RELAXED);
+  if (budget == 0 || __atomic_load_n(&memory->used, __ATOMIC_RELAXED) <= budget) {
+    return 0;
+  }
+  if (__atomic_load_n(&memory->input, __ATOMIC_RELAXED) > budget) {
+    const size_t inboxes = __atomic_load_n(&memory->inboxes, __ATOMIC_RELAXED);
+    return bytes > budget / (inboxes > 0 ? inboxes : 1);
+  }
+  return 1;
+}
+
+/**
+ * @brief account the memory of the frames and replays added to and removed from an outbound; outbound lock must be held by the caller
+ * @param OctopipesServerOutbound* outbound
+ * @param size_t bytes added
+ * @param size_t bytes removed
+ */
+
+void outbound_account(OctopipesServerOutbound* outbound, const size_t added, const size_t removed) {
+  outbound->bytes = outbound->bytes + added - removed;
+  memory_account(outbound->memory, added, removed, 0);
+}
+
+/**
+ * @brief account the data read from the client of a worker and not decoded yet; called by the worker thread only
+ * @param OctopipesServerWorker* worker
+ * @param size_t bytes not decoded yet
+ */
+
+void worker_account_stream(OctopipesServerWorker* worker, const size_t stream_len) {
+  memory_account(worker->inbox->memory, stream_len, worker->stream_bytes, 1);
+  __atomic_store_n(&worker->stream_bytes, stream_len, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief clean up a server message object
  * @param OctopipesServerMessage*
@@ -1279,6 +4775,47 @@ OctopipesServerError server_message_cleanup(OctopipesServerMessage* message) {
   return OCTOPIPES_SERVER_ERROR_SUCCESS;
 }
 
+/**
+ * @brief initialize a shared frame, referenced by the caller
+ * @param OctopipesServerSharedFrame** frame
+ * @param uint8_t* data: the encoded message; the frame takes it only if it succeeds
+ * @param size_t data size
+ * @return OctopipesServerError
+ */
+
+OctopipesServerError shared_frame_init(OctopipesServerSharedFrame** frame, uint8_t* data, const size_t data_size) {
+  OctopipesServerSharedFrame* ptr = (OctopipesServerSharedFrame*) malloc(sizeof(OctopipesServerSharedFrame));
+  if (ptr == NULL) {
+    return OCTOPIPES_SERVER_ERROR_BAD_ALLOC;
+  }
+  ptr->data = data;
+  ptr->data_size = data_size;
+  ptr->refs = 1;
+  *frame = ptr;
+  return OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief take a reference to a shared frame; the recipients of a message are served by several threads, so refs are atomic
+ * @param OctopipesServerSharedFrame* frame
+ */
+
+void shared_frame_retain(OctopipesServerSharedFrame* frame) {
+  __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief drop a reference to a shared frame; the last one frees it
+ * @param OctopipesServerSharedFrame* frame
+ */
+
+void shared_frame_release(OctopipesServerSharedFrame* frame) {
+  if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(frame->data);
+    free(frame);
+  }
+}
+
 /**
  * @brief loop for CAP listener
  * @param void* args (pointer to server)
@@ -1287,6 +4824,17 @@ OctopipesServerError server_message_cleanup(OctopipesServerMessage* message) {
 
 void* cap_loop(void* args) {
   OctopipesServer* server = (OctopipesServer*) args;
+  //Frames may be written back to back, so data is kept until frames are complete
+  uint8_t* stream = NULL;
+  size_t stream_len = 0;
+  //CAP is kept open, so subscribing clients never wait for the listener to open it
+  int cap_fd;
+  if (pipe_open(server->cap_pipe, &cap_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    pthread_mutex_lock(&server->cap_lock);
+    message_inbox_push(server->cap_inbox, NULL, OCTOPIPES_SERVER_ERROR_OPEN_FAILED);
+    pthread_mutex_unlock(&server->cap_lock);
+    return NULL;
+  }
   while (server->state != OCTOPIPES_SERVER_STATE_STOPPED) {
     //If state is BLOCK, wait
     while (server->state == OCTOPIPES_SERVER_STATE_BLOCK) {
@@ -1296,15 +4844,23 @@ void* cap_loop(void* args) {
     OctopipesError ret;
     uint8_t* data_in;
     size_t data_in_len;
-    if ((ret = pipe_receive(server->cap_pipe, &data_in, &data_in_len, 200)) == OCTOPIPES_ERROR_SUCCESS) {
-      //It's okay, try to decode packet
-      OctopipesMessage* message = NULL;
-      ret = octopipes_decode(data_in, data_in_len, &message);
-      free(data_in);
-      //Report message (or error)
-      pthread_mutex_lock(&server->cap_lock);
-      message_inbox_push(server->cap_inbox, message, to_server_error(ret));
-      pthread_mutex_unlock(&server->cap_lock);
+    if ((ret = pipe_read(cap_fd, &data_in, &data_in_len, 200)) == OCTOPIPES_ERROR_SUCCESS) {
+      //It's okay, append data to stream and try to decode packets
+      if ((ret = octopipes_stream_append(&stream, &stream_len, data_in, data_in_len)) == OCTOPIPES_ERROR_SUCCESS) {
+        size_t offset = 0;
+        OctopipesMessage* message;
+        pthread_mutex_lock(&server->cap_lock);
+        while ((ret = octopipes_decode_next(stream, stream_len, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+          //Report message (or error)
+          message_inbox_push(server->cap_inbox, message, to_server_error(ret));
+        }
+        pthread_mutex_unlock(&server->cap_lock);
+        octopipes_stream_consume(&stream, &stream_len, offset);
+      } else {
+        pthread_mutex_lock(&server->cap_lock);
+        message_inbox_push(server->cap_inbox, NULL, to_server_error(ret));
+        pthread_mutex_unlock(&server->cap_lock);
+      }
     } else {
       if (ret != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
         //Report error
@@ -1313,8 +4869,9 @@ void* cap_loop(void* args) {
         pthread_mutex_unlock(&server->cap_lock);
       } //Else keep waiting
     }
-    usleep(TIME_100MS);
   }
+  pipe_close(cap_fd);
+  free(stream);
   return NULL;
 }
 
@@ -1326,30 +4883,181 @@ void* cap_loop(void* args) {
 
 void* worker_loop(void* args) {
   OctopipesServerWorker* worker = (OctopipesServerWorker*) args;
+  //Frames may be written back to back, so data is kept until frames are complete
+  uint8_t* stream = NULL;
+  size_t stream_len = 0;
+  int pending = 0;
+  int throttled = 0;
+  int paused = 0;
   while (worker->active) {
-    //Read from pipe
     OctopipesError ret;
-    uint8_t* data_in;
-    size_t data_in_len;
-    if ((ret = pipe_receive(worker->pipe_read, &data_in, &data_in_len, 200)) == OCTOPIPES_ERROR_SUCCESS) {
-      //It's okay, try to decode packet
-      OctopipesMessage* message = NULL;
-      ret = octopipes_decode(data_in, data_in_len, &message);
-      free(data_in);
-      //Report message (or error)
+    int received = 0;
+    //A client over its rate limit is not read until its buckets refill, so its pipe fills up and its writes slow down;
+    //the same happens to the largest producers while the inboxes exceed the memory budget, until dispatch drains them
+    pthread_mutex_lock(&worker->worker_lock);
+    uint64_t delay = rate_limit_delay(&worker->rate_limit);
+    if (delay > 0 && !throttled) {
+      worker->rate_limit.throttled++;
+    }
+    throttled = delay > 0;
+    const int over_budget = memory_over_budget(worker->inbox->memory, worker->inbox->bytes + worker->stream_bytes);
+    if (over_budget && !paused) {
+      worker->paused++;
+    }
+    paused = over_budget;
+    pthread_mutex_unlock(&worker->worker_lock);
+    if (paused && delay < MEMORY_RETRY_INTERVAL * 1000) {
+      delay = MEMORY_RETRY_INTERVAL * 1000;
+    }
+    int readable = 0;
+    int writable = 0;
+    if (delay > 0) {
+      const uint64_t max_delay = (uint64_t) WORKER_POLL_TIMEOUT * 1000;
+      delay = delay < max_delay ? delay : max_delay;
+      //While frames are queued for the client, wake up as soon as they can be written
+      if (pending) {
+        pipe_wait(-1, worker->outbound.fd, (int) ((delay + 999) / 1000), &readable, &writable);
+      } else {
+        usleep(delay);
+      }
+    } else {
+      //Wait for data from the client or, while frames are queued for it, for room in its pipe
+      uint8_t* data_in;
+      size_t data_in_len;
+      if ((ret = pipe_wait(worker->read_fd, pending ? worker->outbound.fd : -1, WORKER_POLL_TIMEOUT, &readable, &writable)) == OCTOPIPES_ERROR_SUCCESS) {
+        //The budget may have been exceeded while waiting; the data is then left in the pipe until the next round
+        if (readable) {
+          pthread_mutex_lock(&worker->worker_lock);
+          readable = !memory_over_budget(worker->inbox->memory, worker->inbox->bytes + worker->stream_bytes);
+          pthread_mutex_unlock(&worker->worker_lock);
+        }
+        ret = readable ? pipe_read(worker->read_fd, &data_in, &data_in_len, 0) : OCTOPIPES_ERROR_NO_DATA_AVAILABLE;
+      }
+      if (ret == OCTOPIPES_ERROR_SUCCESS) {
+        //It's okay, append data to stream
+        if ((ret = octopipes_stream_append(&stream, &stream_len, data_in, data_in_len)) != OCTOPIPES_ERROR_SUCCESS) {
+          pthread_mutex_lock(&worker->worker_lock);
+          message_inbox_push(worker->inbox, NULL, to_server_error(ret));
+          pthread_mutex_unlock(&worker->worker_lock);
+          received = 1;
+        }
+        worker_account_stream(worker, stream_len);
+      } else {
+        if (ret != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+          //Report error
+          pthread_mutex_lock(&worker->worker_lock);
+          message_inbox_push(worker->inbox, NULL, to_server_error(ret));
+          pthread_mutex_unlock(&worker->worker_lock);
+          received = 1;
+          usleep(TIME_100MS);
+        } //Else keep waiting
+      }
+    }
+    //Decode the complete frames; with backpressure, the ones over the limits are left in the stream until they can be taken.
+    //Decoding only moves what was read from the stream to the inbox, so the memory budget stops the reads instead
+    if (stream_len > 0) {
+      size_t offset = 0;
+      size_t frame_start = 0;
+      OctopipesMessage* message;
+      pthread_mutex_lock(&worker->worker_lock);
+      while (rate_limit_delay(&worker->rate_limit) == 0 && (ret = octopipes_decode_next(stream, stream_len, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+        //The decoded frame is accounted in the inbox from now on
+        worker_account_stream(worker, stream_len - offset);
+        //The client has been charged for the frames which can't be decoded too: give back what was discarded (when the frame boundaries
+        //are lost, the rest of the stream is discarded and it's given back as one message)
+        if (message == NULL) {
+          credits_return(&worker->credits, offset - frame_start);
+        }
+        frame_start = offset;
+        if (message != NULL && !rate_limit_admit(&worker->rate_limit, message->data_size + message->origin_size + message->remote_size)) {
+          credits_return(&worker->credits, octopipes_get_encoded_size(message));
+          octopipes_cleanup_message(message);
+          continue;
+        }
+        //Report message (or error)
+        message_inbox_push(worker->inbox, message, to_server_error(ret));
+        received = 1;
+      }
+      pthread_mutex_unlock(&worker->worker_lock);
+      octopipes_stream_consume(&stream, &stream_len, offset);
+    }
+    //Write the frames queued while the client pipe was full
+    OctopipesServerError flush_ret;
+    if ((flush_ret = worker_flush(worker, &pending)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
       pthread_mutex_lock(&worker->worker_lock);
-      message_inbox_push(worker->inbox, message, to_server_error(ret));
+      message_inbox_push(worker->inbox, NULL, flush_ret);
       pthread_mutex_unlock(&worker->worker_lock);
-    } else {
-      if (ret != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
-        //Report error
-        pthread_mutex_lock(&worker->worker_lock);
-        message_inbox_push(worker->inbox, NULL, to_server_error(ret));
-        pthread_mutex_unlock(&worker->worker_lock);
-      } //Else keep waiting
+      received = 1;
+      usleep(TIME_100MS);
+    }
+    //Discard the messages whose TTL elapsed while waiting in the inbox
+    pthread_mutex_lock(&worker->worker_lock);
+    if (worker->inbox->expirations->timers > 0) {
+      message_inbox_expire(worker->inbox, octopipes_get_time_ms());
+    }
+    //Give back the credits of the messages expired or dropped
+    if (credits_due(&worker->credits)) {
+      worker_grant_credits(worker);
+    }
+    pthread_mutex_unlock(&worker->worker_lock);
+    //Wake up the dispatcher of this worker, if any
+    if (received) {
+      worker_notify(worker);
+    }
+  }
+  worker_account_stream(worker, 0);
+  free(stream);
+  return NULL;
+}
+
+/**
+ * @brief fanout thread: serves the workers of each fanout job
+ * @param void* args (OctopipesServerFanoutThread*)
+ * @return void*
+ */
+
+void* fanout_loop(void* args) {
+  OctopipesServerFanoutThread* thread = (OctopipesServerFanoutThread*) args;
+  OctopipesServerFanout* fanout = thread->fanout;
+  pthread_mutex_lock(&fanout->lock);
+  while (1) {
+    while (fanout->running && fanout->job == thread->job) {
+      pthread_cond_wait(&fanout->job_ready, &fanout->lock);
+    }
+    if (!fanout->running) {
+      break;
+    }
+    thread->job = fanout->job;
+    pthread_mutex_unlock(&fanout->lock);
+    fanout_work(fanout, thread->index);
+    pthread_mutex_lock(&fanout->lock);
+    if (--fanout->pending == 0) {
+      pthread_cond_signal(&fanout->job_done);
+    }
+  }
+  pthread_mutex_unlock(&fanout->lock);
+  return NULL;
+}
+
+/**
+ * @brief dispatcher thread: processes the workers of its shard as they're queued by the messages they receive
+ * @param void* args (OctopipesServerShard*)
+ * @return void*
+ */
+
+void* shard_loop(void* args) {
+  OctopipesServerShard* shard = (OctopipesServerShard*) args;
+  pthread_mutex_lock(&shard->lock);
+  while (shard->running) {
+    if (shard->ready_head == NULL) {
+      pthread_cond_wait(&shard->ready, &shard->lock);
+      continue;
     }
-    usleep(TIME_100MS);
+    pthread_mutex_unlock(&shard->lock);
+    shard_process(shard);
+    pthread_mutex_lock(&shard->lock);
   }
+  pthread_mutex_unlock(&shard->lock);
   return NULL;
 }
 
@@ -1429,6 +5137,8 @@ OctopipesServerError to_server_error(const OctopipesError error) {
       return OCTOPIPES_SERVER_ERROR_UNSUPPORTED_VERSION;
     case OCTOPIPES_ERROR_WRITE_FAILED:
       return OCTOPIPES_SERVER_ERROR_WRITE_FAILED;
+    case OCTOPIPES_ERROR_LOG_FULL:
+      return OCTOPIPES_SERVER_ERROR_LOG_FULL;
     case OCTOPIPES_ERROR_UNKNOWN_ERROR:
     default:
       return OCTOPIPES_SERVER_ERROR_UNKNOWN;
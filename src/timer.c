@@ -0,0 +1,232 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#include <octopipes/timer.h>
+
+#include <string.h>
+#include <time.h>
+
+#define SLOT_BITS 6
+#define SLOT_MASK (OCTOPIPES_TIMER_WHEEL_SLOTS - 1)
+
+//Private functions
+void timer_wheel_insert(OctopipesTimerWheel* wheel, OctopipesTimer* timer);
+void timer_wheel_cascade(OctopipesTimerWheel* wheel, const size_t level);
+
+/**
+ * @brief get monotonic time in milliseconds
+ * @return uint64_t
+ */
+
+uint64_t octopipes_get_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief get monotonic time in microseconds
+ * @return uint64_t
+ */
+
+uint64_t octopipes_get_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief get wall clock time in milliseconds since epoch
+ * @return uint64_t
+ */
+
+uint64_t octopipes_get_epoch_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief initialize a hierarchical timer wheel
+ * @param OctopipesTimerWheel**
+ * @param uint64_t tick duration in milliseconds
+ * @param uint64_t current time in milliseconds
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_timer_wheel_init(OctopipesTimerWheel** wheel, const uint64_t tick_ms, const uint64_t now_ms) {
+  if (tick_ms == 0) {
+    return OCTOPIPES_ERROR_UNINITIALIZED;
+  }
+  *wheel = (OctopipesTimerWheel*) malloc(sizeof(OctopipesTimerWheel));
+  if (*wheel == NULL) {
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  (*wheel)->tick_ms = tick_ms;
+  (*wheel)->current_tick = now_ms / tick_ms;
+  (*wheel)->timers = 0;
+  memset((*wheel)->slots, 0, sizeof((*wheel)->slots));
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief free a timer wheel; timers are owned by the caller, so they're not freed
+ * @param OctopipesTimerWheel*
+ * @return OctopipesError
+ */
+
+OctopipesError octopipes_timer_wheel_cleanup(OctopipesTimerWheel* wheel) {
+  free(wheel);
+  return OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief schedule a timer (if the timer is already scheduled, it is rescheduled)
+ * @param OctopipesTimerWheel*
+ * @param OctopipesTimer*
+ * @param uint64_t expiration time in milliseconds
+ */
+
+void octopipes_timer_add(OctopipesTimerWheel* wheel, OctopipesTimer* timer, const uint64_t expires_ms) {
+  if (timer->slot != NULL) {
+    octopipes_timer_remove(wheel, timer);
+  }
+  //Round up to the next tick, timers never expire early
+  timer->expires = (expires_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+  timer_wheel_insert(wheel, timer);
+  wheel->timers++;
+}
+
+/**
+ * @brief unschedule a timer; does nothing if the timer is not scheduled
+ * @param OctopipesTimerWheel*
+ * @param OctopipesTimer*
+ */
+
+void octopipes_timer_remove(OctopipesTimerWheel* wheel, OctopipesTimer* timer) {
+  if (timer->slot == NULL) {
+    return;
+  }
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  } else {
+    *timer->slot = timer->next;
+  }
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+  timer->slot = NULL;
+  timer->prev = NULL;
+  timer->next = NULL;
+  wheel->timers--;
+}
+
+/**
+ * @brief advance the wheel until now; expired timers are unscheduled and returned as a list linked through next
+ * @param OctopipesTimerWheel*
+ * @param uint64_t current time in milliseconds
+ * @param OctopipesTimer** expired timers list
+ * @return size_t amount of expired timers
+ */
+
+size_t octopipes_timer_wheel_advance(OctopipesTimerWheel* wheel, const uint64_t now_ms, OctopipesTimer** expired) {
+  *expired = NULL;
+  OctopipesTimer* last = NULL;
+  size_t expired_len = 0;
+  const uint64_t target_tick = now_ms / wheel->tick_ms;
+  while (wheel->current_tick < target_tick) {
+    if (wheel->timers == 0) {
+      //Nothing to expire, just jump ahead
+      wheel->current_tick = target_tick;
+      break;
+    }
+    wheel->current_tick++;
+    //When a level wraps, move the timers of the upper level down
+    for (size_t level = 1; level < OCTOPIPES_TIMER_WHEEL_LEVELS; level++) {
+      if (((wheel->current_tick >> (SLOT_BITS * (level - 1))) & SLOT_MASK) != 0) {
+        break;
+      }
+      timer_wheel_cascade(wheel, level);
+    }
+    //Expire timers in the current slot
+    OctopipesTimer** slot = &wheel->slots[0][wheel->current_tick & SLOT_MASK];
+    while (*slot != NULL) {
+      OctopipesTimer* timer = *slot;
+      octopipes_timer_remove(wheel, timer);
+      if (last == NULL) {
+        *expired = timer;
+      } else {
+        last->next = timer;
+      }
+      last = timer;
+      expired_len++;
+    }
+  }
+  return expired_len;
+}
+
+/**
+ * @brief put a timer into the slot of the level which fits its expiration
+ * @param OctopipesTimerWheel*
+ * @param OctopipesTimer*
+ */
+
+void timer_wheel_insert(OctopipesTimerWheel* wheel, OctopipesTimer* timer) {
+  //Expired timers fire on the next tick
+  const uint64_t expires = timer->expires > wheel->current_tick ? timer->expires : wheel->current_tick + 1;
+  const uint64_t delta = expires - wheel->current_tick;
+  size_t level = 0;
+  while (level < OCTOPIPES_TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t) 1 << (SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  uint64_t slot_tick = expires;
+  if (delta >= ((uint64_t) 1 << (SLOT_BITS * OCTOPIPES_TIMER_WHEEL_LEVELS))) {
+    //Too far away: park it in the last slot of the wheel, it will be cascaded again later
+    slot_tick = wheel->current_tick + ((uint64_t) SLOT_MASK << (SLOT_BITS * level));
+  }
+  OctopipesTimer** slot = &wheel->slots[level][(slot_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+  timer->slot = slot;
+  timer->prev = NULL;
+  timer->next = *slot;
+  if (*slot != NULL) {
+    (*slot)->prev = timer;
+  }
+  *slot = timer;
+}
+
+/**
+ * @brief reinsert all the timers in the current slot of a level into the lower levels
+ * @param OctopipesTimerWheel*
+ * @param size_t level
+ */
+
+void timer_wheel_cascade(OctopipesTimerWheel* wheel, const size_t level) {
+  OctopipesTimer** slot = &wheel->slots[level][(wheel->current_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+  OctopipesTimer* timer = *slot;
+  *slot = NULL;
+  while (timer != NULL) {
+    OctopipesTimer* next = timer->next;
+    timer_wheel_insert(wheel, timer);
+    timer = next;
+  }
+}
@@ -25,8 +25,10 @@
 #include <octopipes/cap.h>
 #include <octopipes/pipes.h>
 #include <octopipes/serializer.h>
+#include <octopipes/timer.h>
 
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +50,20 @@
 #define CLIENT_NAME_SIZE 11
 #define FAKE_CLIENT_NAME "fake_client"
 #define FAKE_CLIENT_NAME_SIZE 11
+#define SESSIONS_AMOUNT 4 //The second time the client is cleaned up while its loop is running, the third one it sends sequenced messages, the fourth one it receives them through the executor
+#define ACK_PEER "ack_peer" //Remote of the sequenced messages; the test reads them and writes its ACKs
+#define ACK_WINDOW 4
+#define ACK_TIMEOUT 1000 //Retransmission timeout (ms)
+#define REQUEST_TIMEOUT 2000 //Timeout of the requests the test replies to (ms)
+#define REQUEST_EXPIRY 200 //Timeout of the requests nobody replies to (ms)
+#define BATCH_LARGE_ENTRIES 4
+#define BATCH_LARGE_SIZE 2048 //Payload of the entries of the batch bigger than PIPE_BUF
+#define RECEIVE_MAX 3 //Messages taken by each receive
+#define RECEIVE_TIMEOUT 200 //Receive timeout (ms)
+#define SEND_THREADS 4
+#define SEND_THREAD_MESSAGES 32 //Messages sent by each thread, alternating small and large ones
+#define SEND_SMALL_SIZE 64
+#define SEND_LARGE_SIZE 8192 //Bigger than PIPE_BUF, so it's written in more chunks
 
 //Colors
 #define KNRM "\x1B[0m"
@@ -63,6 +79,20 @@ char* txPipe = NULL;
 char* rxPipe = NULL;
 char* capPipe = NULL;
 int messages_received = 0;
+int unsubscriptions = 0;
+volatile int blocked_send_done = 0;
+volatile int loop_send_done = 0;
+OctopipesError loop_send_error = OCTOPIPES_ERROR_SUCCESS;
+volatile int executor_released = 0;
+volatile size_t executor_delivered = 0;
+uint32_t executor_sequences[ACK_WINDOW * 2];
+volatile int request_done = 0;
+OctopipesError request_error = OCTOPIPES_ERROR_SUCCESS;
+OctopipesMessage* request_reply = NULL;
+volatile int async_done = 0;
+OctopipesError async_error = OCTOPIPES_ERROR_SUCCESS;
+char async_payload[32];
+void* async_user_data = NULL;
 
 /**
  * Test Description: test_client simulates the connection steps with the server (subscription, assignment, ipc, unsubscription), the test consists in:
@@ -74,6 +104,14 @@ int messages_received = 0;
  * - start looping on the pipe
  * - stop looping
  * - unsubscribe from the server
+ * - clean up a client whose loop is running
+ * - send sequenced messages within the ACK window, send them again if they're not acknowledged (go back N)
+ * - acknowledge received messages once the executor has delivered them, and read ACKs while the executor queue is full
+ * - match the replies to the requests by correlation id, time out the requests nobody replies to and drop the late replies to reused slots
+ * - send batches mixing valid and invalid entries, reporting the result of each entry and writing the valid ones in order
+ * - commit the frames reserved for a payload written in place, encoded as the encoder does, and discard them without writing them
+ * - receive messages without the loop, putting back together the frames written in parts
+ * - send from more threads at once, the frames bigger than PIPE_BUF included, without interleaving them
  * Functions covered by this test (including CAP and pipes):
  * - octopipes_init
  * - octopipes_cleanup
@@ -84,6 +122,16 @@ int messages_received = 0;
  * - octopipes_unsubscribe
  * - octopipes_send
  * - octopipes_send_ex
+ * - octopipes_set_ack_window
+ * - octopipes_request
+ * - octopipes_request_async
+ * - octopipes_reply
+ * - octopipes_send_batch
+ * - octopipes_send_reserve
+ * - octopipes_send_commit
+ * - octopipes_send_discard
+ * - octopipes_receive
+ * - octopipes_set_executor
  * - octopipes_set_received_cb
  * - octopipes_set_sent_cb
  * - octopipes_set_receive_error_cb
@@ -101,6 +149,12 @@ typedef enum ClientStep {
   TERMINATED
 } ClientStep;
 
+typedef struct ConcurrentSender {
+  OctopipesClient* client;
+  size_t index;
+  OctopipesError error;
+} ConcurrentSender;
+
 /**
  * @brief generate a random string of alphanumerical characters
  * @param char* str
@@ -135,6 +189,7 @@ void on_subscribed(const OctopipesClient* client) {
 
 void on_unsubscribed(const OctopipesClient* client) {
   printf("%son_unsubscribed: Client %s UNSUBSCRIBED to the server%s\n", KYEL, client->client_id, KNRM);
+  unsubscriptions++;
 }
 
 void on_sent(const OctopipesClient* client, const OctopipesMessage* message) {
@@ -301,6 +356,1078 @@ int main_client() {
   return 0;
 }
 
+/**
+ * @brief subscribe and start the loop, then clean up the client without unsubscribing or stopping the loop:
+ * cleanup must unsubscribe and wait for the loop before freeing the client
+ * @return int
+ */
+
+int main_client_cleanup() {
+  printf("%sPARENT (client): Cleaning up a running client%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  OctopipesError ret;
+  if ((ret = octopipes_init(&client, CLIENT_NAME, capPipe, OCTOPIPES_VERSION_1)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  octopipes_set_receive_error_cb(client, on_receive_error);
+  octopipes_set_received_cb(client, on_received);
+  octopipes_set_unsubscribed_cb(client, on_unsubscribed);
+  const int previous_unsubscriptions = unsubscriptions;
+  OctopipesCapError cap_error;
+  if ((ret = octopipes_subscribe(client, NULL, 0, &cap_error)) != OCTOPIPES_ERROR_SUCCESS || (ret = octopipes_loop_start(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not start octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    octopipes_cleanup(client);
+    return 1;
+  }
+  printf("%sLoop started; cleaning up without stopping it%s\n", KYEL, KNRM);
+  if ((ret = octopipes_cleanup(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not cleanup octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  if (unsubscriptions != previous_unsubscriptions + 1) {
+    printf("%sCleanup should have unsubscribed the client%s\n", KRED, KNRM);
+    return 1;
+  }
+  printf("%sRunning OctopipesClient cleaned up%s\n", KYEL, KNRM);
+  sleep(2); //Give to the server the time to terminate
+  return 0;
+}
+
+/**
+ * @brief on received callback which sends a sequenced message from the loop thread
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ */
+
+void on_received_sequenced(const OctopipesClient* client, const OctopipesMessage* message) {
+  (void) message;
+  loop_send_error = octopipes_send_ex((OctopipesClient*) client, ACK_PEER, "loop", 4, 5, OCTOPIPES_OPTIONS_REQUIRE_ACK);
+  loop_send_done = 1;
+}
+
+/**
+ * @brief send a sequenced message; runs in its own thread, since the window is full
+ * @param void* args (client)
+ * @return void*
+ */
+
+void* send_blocked(void* args) {
+  OctopipesClient* client = (OctopipesClient*) args;
+  octopipes_send_ex(client, ACK_PEER, "blocked", 7, 5, OCTOPIPES_OPTIONS_REQUIRE_ACK);
+  blocked_send_done = 1;
+  return NULL;
+}
+
+/**
+ * @brief read the sequenced messages the client wrote to its TX pipe, until max are read or nothing is written for timeout milliseconds
+ * @param int fd
+ * @param uint32_t* epoch of the last message
+ * @param uint32_t* sequences
+ * @param size_t max
+ * @param int timeout
+ * @return size_t amount of messages read
+ */
+
+size_t peer_read(const int fd, uint32_t* epoch, uint32_t* sequences, const size_t max, const int timeout) {
+  uint8_t* stream = NULL;
+  size_t stream_len = 0;
+  size_t received = 0;
+  while (received < max) {
+    uint8_t* data;
+    size_t data_size;
+    if (pipe_read(fd, &data, &data_size, timeout) != OCTOPIPES_ERROR_SUCCESS || octopipes_stream_append(&stream, &stream_len, data, data_size) != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+    size_t offset = 0;
+    OctopipesMessage* message;
+    OctopipesError ret;
+    while (received < max && (ret = octopipes_decode_next(stream, stream_len, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      if (ret == OCTOPIPES_ERROR_SUCCESS) {
+        *epoch = message->epoch;
+        sequences[received++] = message->sequence;
+        octopipes_cleanup_message(message);
+      }
+    }
+    octopipes_stream_consume(&stream, &stream_len, offset);
+  }
+  free(stream);
+  return received;
+}
+
+/**
+ * @brief write a message from the peer to the client RX pipe
+ * @param OctopipesOptions options
+ * @param uint32_t epoch
+ * @param uint32_t sequence
+ * @return int
+ */
+
+int peer_write(const OctopipesOptions options, const uint32_t epoch, const uint32_t sequence) {
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin = ACK_PEER;
+  message.origin_size = strlen(ACK_PEER);
+  message.remote = CLIENT_NAME;
+  message.remote_size = CLIENT_NAME_SIZE;
+  message.ttl = 5;
+  message.options = options;
+  message.correlation_id = 0;
+  message.epoch = epoch;
+  message.sequence = sequence;
+  //ACK payload is the stream remote
+  message.data = (uint8_t*) ACK_PEER;
+  message.data_size = strlen(ACK_PEER);
+  uint8_t* data;
+  size_t data_size;
+  if (octopipes_encode(&message, &data, &data_size) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  const int ret = pipe_send(rxPipe, data, data_size, PIPE_TIMEOUT) != OCTOPIPES_ERROR_SUCCESS;
+  free(data);
+  return ret;
+}
+
+/**
+ * @brief verify the sequences read by the peer
+ * @param uint32_t* sequences
+ * @param size_t received
+ * @param uint32_t first expected sequence
+ * @param size_t expected amount of sequences
+ * @return int
+ */
+
+int verify_sequences(const uint32_t* sequences, const size_t received, const uint32_t first, const size_t expected) {
+  if (received != expected) {
+    printf("%sExpected %zu sequenced messages, read %zu%s\n", KRED, expected, received, KNRM);
+    return 1;
+  }
+  for (size_t i = 0; i < received; i++) {
+    if (sequences[i] != first + i) {
+      printf("%sExpected sequence %zu, got %u%s\n", KRED, first + i, sequences[i], KNRM);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief send sequenced messages to a peer played by the test: the window blocks the sender until an ACK frees a slot,
+ * the loop thread gets an error instead of waiting and unacknowledged messages are sent again with the following ones
+ * @return int
+ */
+
+int main_client_acks() {
+  printf("%sPARENT (client): Sending sequenced messages%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  OctopipesError ret;
+  if ((ret = octopipes_init(&client, CLIENT_NAME, capPipe, OCTOPIPES_VERSION_1)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  octopipes_set_receive_error_cb(client, on_receive_error);
+  octopipes_set_unsubscribed_cb(client, on_unsubscribed);
+  octopipes_set_ack_window(client, ACK_WINDOW, ACK_TIMEOUT);
+  //The test reads what the client writes
+  int peer_fd;
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    octopipes_cleanup(client);
+    return 1;
+  }
+  OctopipesCapError cap_error;
+  if ((ret = octopipes_subscribe(client, NULL, 0, &cap_error)) != OCTOPIPES_ERROR_SUCCESS || (ret = octopipes_loop_start(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not start octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    octopipes_cleanup(client);
+    pipe_close(peer_fd);
+    return 1;
+  }
+  uint32_t epoch = 0;
+  uint32_t sequences[ACK_WINDOW * 2];
+  int rc = 0;
+  //Fill the window
+  for (size_t i = 0; i < ACK_WINDOW && rc == 0; i++) {
+    rc = octopipes_send_ex(client, ACK_PEER, "window", 6, 5, OCTOPIPES_OPTIONS_REQUIRE_ACK) != OCTOPIPES_ERROR_SUCCESS;
+  }
+  rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, ACK_WINDOW, 200), 1, ACK_WINDOW);
+  //The next one waits for an ACK
+  pthread_t sender;
+  if (rc == 0 && pthread_create(&sender, NULL, send_blocked, client) == 0) {
+    usleep(300000);
+    if (blocked_send_done) {
+      printf("%sMessage has been sent with a full window%s\n", KRED, KNRM);
+      rc = 1;
+    }
+    rc = peer_write(OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED, epoch, 2) || rc;
+    pthread_join(sender, NULL);
+    rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, 1, 200), ACK_WINDOW + 1, 1);
+  } else {
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sWindow blocked the sender until the ACK%s\n", KYEL, KNRM);
+  }
+  //Fill the window again, then send from the loop thread
+  rc = rc || octopipes_send_ex(client, ACK_PEER, "window", 6, 5, OCTOPIPES_OPTIONS_REQUIRE_ACK) != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, 1, 200), ACK_WINDOW + 2, 1);
+  octopipes_set_received_cb(client, on_received_sequenced);
+  rc = rc || peer_write(OCTOPIPES_OPTIONS_NONE, 0, 0);
+  for (int i = 0; i < 10 && rc == 0 && !loop_send_done; i++) {
+    usleep(50000);
+  }
+  if (rc == 0 && (!loop_send_done || loop_send_error != OCTOPIPES_ERROR_WINDOW_FULL)) {
+    printf("%sLoop thread should have got a full window error, got: %s%s\n", KRED, loop_send_done ? octopipes_get_error_desc(loop_send_error) : "nothing", KNRM);
+    rc = 1;
+  }
+  //Messages after the ACK are sent again, in order
+  rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, ACK_WINDOW, ACK_TIMEOUT * 2), 3, ACK_WINDOW);
+  if (rc == 0) {
+    printf("%sUnacknowledged messages sent again%s\n", KYEL, KNRM);
+  }
+  //Nothing is sent again after the last ACK
+  rc = rc || peer_write(OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED, epoch, ACK_WINDOW + 2);
+  if (rc == 0 && peer_read(peer_fd, &epoch, sequences, 1, ACK_TIMEOUT * 2) != 0) {
+    printf("%sAcknowledged message has been sent again%s\n", KRED, KNRM);
+    rc = 1;
+  }
+  if ((ret = octopipes_cleanup(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not cleanup octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    rc = 1;
+  }
+  pipe_close(peer_fd);
+  if (rc == 0) {
+    printf("%sSequenced messages acknowledged%s\n", KYEL, KNRM);
+  }
+  return rc;
+}
+
+/**
+ * @brief on received callback run by the executor: it waits until the test releases it, then records the sequence delivered
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ */
+
+void on_received_executor(const OctopipesClient* client, const OctopipesMessage* message) {
+  (void) client;
+  while (!executor_released) {
+    usleep(10000);
+  }
+  if (executor_delivered < ACK_WINDOW * 2) {
+    executor_sequences[executor_delivered] = message->sequence;
+  }
+  executor_delivered++;
+}
+
+/**
+ * @brief receive messages through an executor with one worker and a queue of one message: they're acknowledged only once delivered,
+ * and while the loop waits for room in the queue it still reads the ACKs of the messages sent by the client
+ * @return int
+ */
+
+int main_client_executor() {
+  printf("%sPARENT (client): Receiving through the executor%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  OctopipesError ret;
+  if ((ret = octopipes_init(&client, CLIENT_NAME, capPipe, OCTOPIPES_VERSION_1)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  octopipes_set_receive_error_cb(client, on_receive_error);
+  octopipes_set_received_cb(client, on_received_executor);
+  octopipes_set_ack_window(client, ACK_WINDOW, ACK_TIMEOUT);
+  octopipes_set_executor(client, 1, 1, OCTOPIPES_EXECUTOR_BLOCK);
+  int peer_fd;
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    octopipes_cleanup(client);
+    return 1;
+  }
+  OctopipesCapError cap_error;
+  if ((ret = octopipes_subscribe(client, NULL, 0, &cap_error)) != OCTOPIPES_ERROR_SUCCESS || (ret = octopipes_loop_start(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not start octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    octopipes_cleanup(client);
+    pipe_close(peer_fd);
+    return 1;
+  }
+  uint32_t epoch = 0;
+  uint32_t sequences[ACK_WINDOW * 2];
+  //Nothing is acknowledged while the worker holds the messages
+  int rc = peer_write(OCTOPIPES_OPTIONS_REQUIRE_ACK, 0, 0);
+  rc = rc || peer_write(OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED, 1, 1);
+  if (rc == 0 && peer_read(peer_fd, &epoch, sequences, 1, 300) != 0) {
+    printf("%sMessages have been acknowledged before being delivered%s\n", KRED, KNRM);
+    rc = 1;
+  }
+  //Plain ACK first, then the cumulative one
+  executor_released = 1;
+  rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, 2, 500), 0, 2);
+  if (rc == 0) {
+    printf("%sMessages acknowledged once delivered%s\n", KYEL, KNRM);
+  }
+  //Fill the send window, then the worker and its queue, so the loop can't hand the last message over
+  executor_released = 0;
+  for (size_t i = 0; i < ACK_WINDOW && rc == 0; i++) {
+    rc = octopipes_send_ex(client, ACK_PEER, "window", 6, 5, OCTOPIPES_OPTIONS_REQUIRE_ACK) != OCTOPIPES_ERROR_SUCCESS;
+  }
+  rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, ACK_WINDOW, 200), 1, ACK_WINDOW);
+  for (uint32_t sequence = 2; sequence <= 4 && rc == 0; sequence++) {
+    rc = peer_write(OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED, 1, sequence);
+  }
+  //The ACK is read anyway and frees the window
+  pthread_t sender;
+  blocked_send_done = 0;
+  if (rc == 0 && pthread_create(&sender, NULL, send_blocked, client) == 0) {
+    usleep(300000);
+    if (blocked_send_done) {
+      printf("%sMessage has been sent with a full window%s\n", KRED, KNRM);
+      rc = 1;
+    }
+    rc = peer_write(OCTOPIPES_OPTIONS_ACK | OCTOPIPES_OPTIONS_SEQUENCED, epoch, 1) || rc;
+    for (int i = 0; i < 20 && !blocked_send_done; i++) {
+      usleep(50000);
+    }
+    if (!blocked_send_done) {
+      printf("%sThe ACK hasn't been read while the executor queue was full%s\n", KRED, KNRM);
+      rc = 1;
+    }
+    executor_released = 1;
+    pthread_join(sender, NULL);
+    rc = rc || verify_sequences(sequences, peer_read(peer_fd, &epoch, sequences, 1, 200), ACK_WINDOW + 1, 1);
+  } else {
+    rc = 1;
+  }
+  executor_released = 1;
+  //Everything is delivered in order (the plain message first) and acknowledged up to the last message
+  for (int i = 0; i < 20 && executor_delivered < 5; i++) {
+    usleep(50000);
+  }
+  rc = rc || verify_sequences(executor_sequences, executor_delivered, 0, 5);
+  const size_t acks = rc == 0 ? peer_read(peer_fd, &epoch, sequences, 3, 500) : 0;
+  if (rc == 0 && (acks == 0 || sequences[acks - 1] != 4)) {
+    printf("%sThe last ACK should acknowledge sequence 4, got %u%s\n", KRED, acks > 0 ? sequences[acks - 1] : 0, KNRM);
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sACKs read while the executor queue was full%s\n", KYEL, KNRM);
+  }
+  if ((ret = octopipes_cleanup(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not cleanup octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    rc = 1;
+  }
+  pipe_close(peer_fd);
+  return rc;
+}
+
+/**
+ * @brief initialize a client on the test pipes, as if the server had assigned them, without subscribing through the CAP
+ * @param OctopipesClient** client
+ * @param char* client id
+ * @param char* tx pipe
+ * @param char* rx pipe (NULL if the client doesn't read)
+ * @return int
+ */
+
+int attach_client(OctopipesClient** client, const char* client_id, const char* tx_pipe, const char* rx_pipe) {
+  OctopipesError ret;
+  if ((ret = octopipes_init(client, client_id, capPipe, OCTOPIPES_VERSION_1)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  (*client)->tx_pipe = strdup(tx_pipe);
+  if (rx_pipe != NULL) {
+    (*client)->rx_pipe = strdup(rx_pipe);
+    if ((*client)->rx_pipe == NULL || pipe_open(rx_pipe, &(*client)->rx_fd) != OCTOPIPES_ERROR_SUCCESS) {
+      octopipes_cleanup(*client);
+      return 1;
+    }
+  }
+  if ((*client)->tx_pipe == NULL) {
+    octopipes_cleanup(*client);
+    return 1;
+  }
+  (*client)->state = OCTOPIPES_STATE_SUBSCRIBED;
+  octopipes_set_receive_error_cb(*client, on_receive_error);
+  return 0;
+}
+
+/**
+ * @brief clean up a client initialized by attach_client; it's not subscribed, so its loop is just stopped
+ * @param OctopipesClient* client
+ * @return int
+ */
+
+int detach_client(OctopipesClient* client) {
+  client->state = OCTOPIPES_STATE_UNSUBSCRIBED;
+  OctopipesError ret;
+  if ((ret = octopipes_cleanup(client)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not cleanup octopipes client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief read the messages the client wrote to its TX pipe, until max are read or nothing is written for timeout milliseconds
+ * @param int fd
+ * @param OctopipesMessage** messages
+ * @param size_t max
+ * @param int timeout
+ * @return size_t amount of messages read
+ */
+
+size_t peer_receive(const int fd, OctopipesMessage** messages, const size_t max, const int timeout) {
+  uint8_t* stream = NULL;
+  size_t stream_len = 0;
+  size_t received = 0;
+  while (received < max) {
+    uint8_t* data;
+    size_t data_size;
+    if (pipe_read(fd, &data, &data_size, timeout) != OCTOPIPES_ERROR_SUCCESS || octopipes_stream_append(&stream, &stream_len, data, data_size) != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+    size_t offset = 0;
+    OctopipesMessage* message;
+    OctopipesError ret;
+    while (received < max && (ret = octopipes_decode_next(stream, stream_len, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      if (ret == OCTOPIPES_ERROR_SUCCESS) {
+        messages[received++] = message;
+      }
+    }
+    octopipes_stream_consume(&stream, &stream_len, offset);
+  }
+  free(stream);
+  return received;
+}
+
+/**
+ * @brief verify the payload of a message
+ * @param OctopipesMessage* message
+ * @param char* payload
+ * @return int
+ */
+
+int verify_payload(const OctopipesMessage* message, const char* payload) {
+  if (message == NULL) {
+    printf("%sExpected '%s', got nothing%s\n", KRED, payload, KNRM);
+    return 1;
+  }
+  if (message->data_size != strlen(payload) || (message->data_size > 0 && memcmp(message->data, payload, message->data_size) != 0)) {
+    printf("%sExpected '%s', got '%.*s'%s\n", KRED, payload, (int) message->data_size, (const char*) message->data, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief send a request to the peer and wait for its reply; runs in its own thread, since the test plays the peer
+ * @param void* args (client)
+ * @return void*
+ */
+
+void* send_request(void* args) {
+  OctopipesClient* client = (OctopipesClient*) args;
+  request_error = octopipes_request(client, ACK_PEER, "ping", 4, REQUEST_TIMEOUT, &request_reply);
+  request_done = 1;
+  return NULL;
+}
+
+/**
+ * @brief reply callback of the asynchronous requests: the reply is freed once the callback returns, so its payload is copied
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* reply (NULL if the request timed out)
+ * @param OctopipesError error
+ * @param void* user data (the payload expected)
+ */
+
+void on_async_reply(const OctopipesClient* client, const OctopipesMessage* reply, const OctopipesError error, void* user_data) {
+  (void) client;
+  async_error = error;
+  async_payload[0] = '\0';
+  if (reply != NULL) {
+    snprintf(async_payload, sizeof(async_payload), "%.*s", (int) reply->data_size, (const char*) reply->data);
+  }
+  async_user_data = user_data;
+  async_done = 1;
+}
+
+/**
+ * @brief wait for the asynchronous request to complete
+ * @param int timeout in milliseconds
+ * @return int
+ */
+
+int wait_async_reply(const int timeout) {
+  for (int elapsed = 0; elapsed < timeout && !async_done; elapsed += 10) {
+    usleep(10000);
+  }
+  if (!async_done) {
+    printf("%sThe reply callback hasn't been called%s\n", KRED, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief send requests to a peer played by the test, which answers them with octopipes_reply: replies are matched by correlation id,
+ * requests nobody replies to time out, and a late reply to a slot which has been reused is dropped; asynchronous requests get the reply
+ * or the timeout through their callback
+ * @return int
+ */
+
+int main_client_requests() {
+  printf("%sPARENT (client): Sending requests%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  OctopipesClient* peer;
+  int peer_fd;
+  if (attach_client(&client, CLIENT_NAME, txPipe, rxPipe) != 0) {
+    return 1;
+  }
+  if (attach_client(&peer, ACK_PEER, rxPipe, NULL) != 0) {
+    detach_client(client);
+    return 1;
+  }
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    detach_client(peer);
+    detach_client(client);
+    return 1;
+  }
+  OctopipesMessage* reply = NULL;
+  //Replies are read by the loop
+  int rc = octopipes_request(client, ACK_PEER, "ping", 4, REQUEST_TIMEOUT, &reply) != OCTOPIPES_ERROR_THREAD;
+  rc = rc || octopipes_loop_start(client) != OCTOPIPES_ERROR_SUCCESS;
+  //The reply is matched to the request
+  OctopipesMessage* request = NULL;
+  pthread_t requester;
+  if (rc == 0 && pthread_create(&requester, NULL, send_request, client) == 0) {
+    if (peer_receive(peer_fd, &request, 1, REQUEST_TIMEOUT) != 1 || (request->options & OCTOPIPES_OPTIONS_REQUEST) == 0 || request->correlation_id == 0) {
+      printf("%sThe peer should have read a request with a correlation id%s\n", KRED, KNRM);
+      rc = 1;
+    }
+    rc = rc || octopipes_reply(peer, request, "pong", 4) != OCTOPIPES_ERROR_SUCCESS;
+    pthread_join(requester, NULL);
+    rc = rc || request_error != OCTOPIPES_ERROR_SUCCESS || verify_payload(request_reply, "pong");
+    if (rc == 0 && request_reply->correlation_id != request->correlation_id) {
+      printf("%sReply %08x doesn't match request %08x%s\n", KRED, request_reply->correlation_id, request->correlation_id, KNRM);
+      rc = 1;
+    }
+    octopipes_cleanup_message(request_reply);
+    request_reply = NULL;
+  } else {
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sReply matched to its request%s\n", KYEL, KNRM);
+  }
+  //Nobody replies
+  OctopipesMessage* expired = NULL;
+  if (rc == 0 && ((request_error = octopipes_request(client, ACK_PEER, "ping", 4, REQUEST_EXPIRY, &reply)) != OCTOPIPES_ERROR_REQUEST_TIMEOUT || reply != NULL)) {
+    printf("%sRequest should have timed out, got: %s%s\n", KRED, octopipes_get_error_desc(request_error), KNRM);
+    rc = 1;
+  }
+  rc = rc || peer_receive(peer_fd, &expired, 1, REQUEST_TIMEOUT) != 1;
+  //The next request takes the same slot: the late reply to the expired request is dropped, since the slot generation changed
+  OctopipesMessage* reused = NULL;
+  request_done = 0;
+  if (rc == 0 && pthread_create(&requester, NULL, send_request, client) == 0) {
+    if (peer_receive(peer_fd, &reused, 1, REQUEST_TIMEOUT) != 1 || (reused->correlation_id & 0xFFFF) != (expired->correlation_id & 0xFFFF) || reused->correlation_id == expired->correlation_id) {
+      printf("%sThe request should have reused the slot of %08x with another generation%s\n", KRED, expired->correlation_id, KNRM);
+      rc = 1;
+    }
+    rc = rc || octopipes_reply(peer, expired, "late", 4) != OCTOPIPES_ERROR_SUCCESS;
+    usleep(300000);
+    if (rc == 0 && request_done) {
+      printf("%sThe late reply has completed the request which reused its slot%s\n", KRED, KNRM);
+      rc = 1;
+    }
+    rc = (reused != NULL && octopipes_reply(peer, reused, "pong", 4) != OCTOPIPES_ERROR_SUCCESS) || rc;
+    pthread_join(requester, NULL);
+    rc = rc || request_error != OCTOPIPES_ERROR_SUCCESS || verify_payload(request_reply, "pong");
+    octopipes_cleanup_message(request_reply);
+    request_reply = NULL;
+  } else {
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sLate reply to a reused slot dropped%s\n", KYEL, KNRM);
+  }
+  //Asynchronous requests get the reply, or the timeout, through the callback
+  OctopipesMessage* async_request = NULL;
+  rc = rc || octopipes_request_async(client, ACK_PEER, "ping", 4, REQUEST_TIMEOUT, on_async_reply, "pong") != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || peer_receive(peer_fd, &async_request, 1, REQUEST_TIMEOUT) != 1;
+  rc = rc || octopipes_reply(peer, async_request, "pong", 4) != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || wait_async_reply(REQUEST_TIMEOUT);
+  if (rc == 0 && (async_error != OCTOPIPES_ERROR_SUCCESS || strcmp(async_payload, "pong") != 0 || strcmp((const char*) async_user_data, "pong") != 0)) {
+    printf("%sExpected 'pong' from the reply callback, got '%s' (%s)%s\n", KRED, async_payload, octopipes_get_error_desc(async_error), KNRM);
+    rc = 1;
+  }
+  async_done = 0;
+  OctopipesMessage* async_expired = NULL;
+  rc = rc || octopipes_request_async(client, ACK_PEER, "ping", 4, REQUEST_EXPIRY, on_async_reply, "timeout") != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || peer_receive(peer_fd, &async_expired, 1, REQUEST_TIMEOUT) != 1;
+  rc = rc || wait_async_reply(REQUEST_TIMEOUT);
+  if (rc == 0 && (async_error != OCTOPIPES_ERROR_REQUEST_TIMEOUT || async_payload[0] != '\0')) {
+    printf("%sThe reply callback should have reported a timeout, got: %s%s\n", KRED, octopipes_get_error_desc(async_error), KNRM);
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sAsynchronous replies and timeouts reported%s\n", KYEL, KNRM);
+  }
+  octopipes_cleanup_message(request);
+  octopipes_cleanup_message(expired);
+  octopipes_cleanup_message(reused);
+  octopipes_cleanup_message(async_request);
+  octopipes_cleanup_message(async_expired);
+  rc = detach_client(client) || rc;
+  rc = detach_client(peer) || rc;
+  pipe_close(peer_fd);
+  return rc;
+}
+
+/**
+ * @brief send batches mixing valid and invalid entries: each entry gets its result and the valid ones are written back to back, in order.
+ * The second batch is bigger than PIPE_BUF, so it's encoded into a buffer of its own
+ * @return int
+ */
+
+int main_client_batch() {
+  printf("%sPARENT (client): Sending batches%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  int peer_fd;
+  if (attach_client(&client, CLIENT_NAME, txPipe, NULL) != 0) {
+    return 1;
+  }
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    detach_client(client);
+    return 1;
+  }
+  char long_remote[300];
+  memset(long_remote, 'r', sizeof(long_remote) - 1);
+  long_remote[sizeof(long_remote) - 1] = '\0';
+  const OctopipesBatchEntry entries[] = {
+    {ACK_PEER, "first", 5, 5, OCTOPIPES_OPTIONS_NONE},
+    {NULL, "noremote", 8, 5, OCTOPIPES_OPTIONS_NONE},
+    {ACK_PEER, "second", 6, 5, OCTOPIPES_OPTIONS_IGNORE_CHECKSUM},
+    {ACK_PEER, NULL, 4, 5, OCTOPIPES_OPTIONS_NONE},
+    {long_remote, "toolong", 7, 5, OCTOPIPES_OPTIONS_NONE},
+    {FAKE_CLIENT_NAME, "third", 5, 5, OCTOPIPES_OPTIONS_NONE}
+  };
+  const size_t entries_len = sizeof(entries) / sizeof(OctopipesBatchEntry);
+  const char* payloads[] = {"first", "second", "third"};
+  const char* remotes[] = {ACK_PEER, ACK_PEER, FAKE_CLIENT_NAME};
+  OctopipesError results[sizeof(entries) / sizeof(OctopipesBatchEntry)];
+  //The first error is returned, the valid entries are sent anyway
+  OctopipesError ret = octopipes_send_batch(client, entries, entries_len, results);
+  int rc = 0;
+  if (ret != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%sBatch should have returned the error of its second entry, got: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+    rc = 1;
+  }
+  for (size_t i = 0; i < entries_len && rc == 0; i++) {
+    const OctopipesError expected = (i == 1 || i == 3 || i == 4) ? OCTOPIPES_ERROR_BAD_PACKET : OCTOPIPES_ERROR_SUCCESS;
+    if (results[i] != expected) {
+      printf("%sEntry %zu: expected %s, got %s%s\n", KRED, i, octopipes_get_error_desc(expected), octopipes_get_error_desc(results[i]), KNRM);
+      rc = 1;
+    }
+  }
+  OctopipesMessage* messages[BATCH_LARGE_ENTRIES];
+  size_t received = rc == 0 ? peer_receive(peer_fd, messages, BATCH_LARGE_ENTRIES, 200) : 0;
+  if (rc == 0 && received != 3) {
+    printf("%sExpected 3 frames, read %zu%s\n", KRED, received, KNRM);
+    rc = 1;
+  }
+  for (size_t i = 0; i < received && rc == 0; i++) {
+    rc = verify_payload(messages[i], payloads[i]);
+    if (rc == 0 && (strcmp(messages[i]->remote, remotes[i]) != 0 || strcmp(messages[i]->origin, CLIENT_NAME) != 0 || messages[i]->ttl != 5)) {
+      printf("%sFrame %zu has been sent from %s to %s with TTL %u%s\n", KRED, i, messages[i]->origin, messages[i]->remote, messages[i]->ttl, KNRM);
+      rc = 1;
+    }
+  }
+  for (size_t i = 0; i < received; i++) {
+    octopipes_cleanup_message(messages[i]);
+  }
+  //Frames bigger than PIPE_BUF altogether; they're told apart by their first byte
+  uint8_t* large_payload = (uint8_t*) malloc(BATCH_LARGE_SIZE * BATCH_LARGE_ENTRIES);
+  OctopipesBatchEntry large_entries[BATCH_LARGE_ENTRIES];
+  if (rc == 0 && large_payload != NULL) {
+    for (size_t i = 0; i < BATCH_LARGE_ENTRIES; i++) {
+      uint8_t* payload = large_payload + i * BATCH_LARGE_SIZE;
+      for (size_t j = 0; j < BATCH_LARGE_SIZE; j++) {
+        payload[j] = (uint8_t) j;
+      }
+      payload[0] = (uint8_t) i;
+      large_entries[i].remote = ACK_PEER;
+      large_entries[i].data = payload;
+      large_entries[i].data_size = BATCH_LARGE_SIZE;
+      large_entries[i].ttl = 5;
+      large_entries[i].options = OCTOPIPES_OPTIONS_NONE;
+    }
+    rc = octopipes_send_batch(client, large_entries, BATCH_LARGE_ENTRIES, results) != OCTOPIPES_ERROR_SUCCESS;
+    received = rc == 0 ? peer_receive(peer_fd, messages, BATCH_LARGE_ENTRIES, 200) : 0;
+  } else {
+    received = 0;
+    rc = 1;
+  }
+  free(large_payload);
+  if (rc == 0 && received != BATCH_LARGE_ENTRIES) {
+    printf("%sExpected %d frames, read %zu%s\n", KRED, BATCH_LARGE_ENTRIES, received, KNRM);
+    rc = 1;
+  }
+  for (size_t i = 0; i < received && rc == 0; i++) {
+    if (messages[i]->data_size != BATCH_LARGE_SIZE || messages[i]->data[0] != i || messages[i]->data[BATCH_LARGE_SIZE - 1] != (uint8_t) (BATCH_LARGE_SIZE - 1)) {
+      printf("%sFrame %zu of %llu bytes is out of order or corrupted%s\n", KRED, i, messages[i]->data_size, KNRM);
+      rc = 1;
+    }
+  }
+  for (size_t i = 0; i < received; i++) {
+    octopipes_cleanup_message(messages[i]);
+  }
+  if (rc == 0) {
+    printf("%sBatches sent in order%s\n", KYEL, KNRM);
+  }
+  rc = detach_client(client) || rc;
+  pipe_close(peer_fd);
+  return rc;
+}
+
+/**
+ * @brief send frames reserved with octopipes_send_reserve, whose payload is written in place: once committed they must be encoded
+ * exactly as octopipes_encode does, with the TTL, the options and the checksum filled in; discarded frames are never written
+ * @return int
+ */
+
+int main_client_reserve() {
+  printf("%sPARENT (client): Sending reserved frames%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  int peer_fd;
+  if (attach_client(&client, CLIENT_NAME, txPipe, NULL) != 0) {
+    return 1;
+  }
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    detach_client(client);
+    return 1;
+  }
+  const char* payloads[] = {"reserved payload", ""};
+  const uint8_t ttls[] = {7, 255};
+  const OctopipesOptions options[] = {OCTOPIPES_OPTIONS_PRIORITY_HIGH, OCTOPIPES_OPTIONS_NONE};
+  int rc = 0;
+  for (size_t i = 0; i < 2 && rc == 0; i++) {
+    OctopipesSendHandle* handle;
+    void* payload;
+    const size_t payload_size = strlen(payloads[i]);
+    if (octopipes_send_reserve(client, ACK_PEER, payload_size, &handle, &payload) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not reserve a frame of %zu bytes%s\n", KRED, payload_size, KNRM);
+      rc = 1;
+      break;
+    }
+    memcpy(payload, payloads[i], payload_size);
+    rc = octopipes_send_commit(client, handle, ttls[i], options[i]) != OCTOPIPES_ERROR_SUCCESS;
+    //The frame is read as it was written, then decoded, which verifies its checksum
+    uint8_t* frame = NULL;
+    size_t frame_size = 0;
+    rc = rc || pipe_read(peer_fd, &frame, &frame_size, 200) != OCTOPIPES_ERROR_SUCCESS;
+    OctopipesMessage* message = NULL;
+    OctopipesError ret;
+    if (rc == 0 && (ret = octopipes_decode(frame, frame_size, &message)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not decode the committed frame: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
+      message = NULL; //Freed by the decoder
+      rc = 1;
+    }
+    rc = rc || verify_payload(message, payloads[i]);
+    if (rc == 0 && (message->ttl != ttls[i] || message->options != options[i] || strcmp(message->remote, ACK_PEER) != 0 || strcmp(message->origin, CLIENT_NAME) != 0)) {
+      printf("%sFrame from %s to %s with TTL %u and options %02x%s\n", KRED, message->origin, message->remote, message->ttl, message->options, KNRM);
+      rc = 1;
+    }
+    //Same bytes as the encoder
+    OctopipesMessage expected;
+    expected.version = OCTOPIPES_VERSION_1;
+    expected.origin = CLIENT_NAME;
+    expected.origin_size = CLIENT_NAME_SIZE;
+    expected.remote = ACK_PEER;
+    expected.remote_size = strlen(ACK_PEER);
+    expected.ttl = ttls[i];
+    expected.options = options[i];
+    expected.correlation_id = 0;
+    expected.epoch = 0;
+    expected.sequence = 0;
+    expected.data = (uint8_t*) payloads[i];
+    expected.data_size = payload_size;
+    uint8_t* expected_frame = NULL;
+    size_t expected_frame_size = 0;
+    rc = rc || octopipes_encode(&expected, &expected_frame, &expected_frame_size) != OCTOPIPES_ERROR_SUCCESS;
+    if (rc == 0 && (frame_size != expected_frame_size || memcmp(frame, expected_frame, frame_size) != 0)) {
+      printf("%sThe committed frame differs from the encoded one%s\n", KRED, KNRM);
+      dump_data(KRED, frame, frame_size);
+      dump_data(KRED, expected_frame, expected_frame_size);
+      rc = 1;
+    }
+    free(expected_frame);
+    free(frame);
+    octopipes_cleanup_message(message);
+  }
+  if (rc == 0) {
+    printf("%sReserved frames committed%s\n", KYEL, KNRM);
+  }
+  //Options with fields can't be committed, since the frame has no room for them; discarded frames aren't written
+  OctopipesSendHandle* handle;
+  void* payload;
+  rc = rc || octopipes_send_reserve(client, ACK_PEER, 4, &handle, &payload) != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || octopipes_send_commit(client, handle, 5, OCTOPIPES_OPTIONS_REQUEST) != OCTOPIPES_ERROR_BAD_PACKET;
+  rc = rc || octopipes_send_reserve(client, ACK_PEER, 4, &handle, &payload) != OCTOPIPES_ERROR_SUCCESS;
+  if (rc == 0) {
+    memcpy(payload, "drop", 4);
+    rc = octopipes_send_discard(handle) != OCTOPIPES_ERROR_SUCCESS;
+  }
+  OctopipesMessage* message;
+  if (rc == 0 && peer_receive(peer_fd, &message, 1, 200) != 0) {
+    printf("%sA refused or discarded frame has been written%s\n", KRED, KNRM);
+    octopipes_cleanup_message(message);
+    rc = 1;
+  }
+  if (rc == 0) {
+    printf("%sDiscarded frames not written%s\n", KYEL, KNRM);
+  }
+  rc = detach_client(client) || rc;
+  pipe_close(peer_fd);
+  return rc;
+}
+
+/**
+ * @brief encode a message from the peer to the client
+ * @param char* payload
+ * @param uint8_t** data
+ * @param size_t* data size
+ * @return int
+ */
+
+int peer_encode(const char* payload, uint8_t** data, size_t* data_size) {
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin = ACK_PEER;
+  message.origin_size = strlen(ACK_PEER);
+  message.remote = CLIENT_NAME;
+  message.remote_size = CLIENT_NAME_SIZE;
+  message.ttl = 5;
+  message.options = OCTOPIPES_OPTIONS_NONE;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.data = (uint8_t*) payload;
+  message.data_size = strlen(payload);
+  return octopipes_encode(&message, data, data_size) != OCTOPIPES_ERROR_SUCCESS;
+}
+
+/**
+ * @brief write messages from the peer to the client RX pipe
+ * @param char** payloads
+ * @param size_t payloads amount
+ * @return int
+ */
+
+int peer_send(const char** payloads, const size_t payloads_len) {
+  int rc = 0;
+  for (size_t i = 0; i < payloads_len && rc == 0; i++) {
+    uint8_t* data;
+    size_t data_size;
+    rc = peer_encode(payloads[i], &data, &data_size);
+    if (rc == 0) {
+      rc = pipe_send(rxPipe, data, data_size, PIPE_TIMEOUT) != OCTOPIPES_ERROR_SUCCESS;
+      free(data);
+    }
+  }
+  return rc;
+}
+
+/**
+ * @brief receive up to RECEIVE_MAX messages and verify what octopipes_receive returned
+ * @param OctopipesClient* client
+ * @param OctopipesError expected
+ * @param char** payloads expected
+ * @param size_t payloads amount
+ * @return int
+ */
+
+int verify_receive(OctopipesClient* client, const OctopipesError expected, const char** payloads, const size_t payloads_len) {
+  OctopipesMessage* messages[RECEIVE_MAX] = {NULL};
+  size_t received = RECEIVE_MAX + 1;
+  const OctopipesError ret = octopipes_receive(client, messages, RECEIVE_MAX, RECEIVE_TIMEOUT, &received);
+  int rc = 0;
+  if (ret != expected || received != payloads_len) {
+    printf("%sExpected %s and %zu messages, got %s and %zu%s\n", KRED, octopipes_get_error_desc(expected), payloads_len, octopipes_get_error_desc(ret), received, KNRM);
+    rc = 1;
+  }
+  for (size_t i = 0; i < received && i < payloads_len && rc == 0; i++) {
+    rc = verify_payload(messages[i], payloads[i]);
+  }
+  for (size_t i = 0; i < received && i < RECEIVE_MAX; i++) {
+    octopipes_cleanup_message(messages[i]);
+  }
+  return rc;
+}
+
+/**
+ * @brief receive messages without the loop: it's refused while the loop runs, a frame written in two parts is put back together,
+ * the frames beyond max are left for the next call and received tells how many messages have been stored, also on timeout
+ * @return int
+ */
+
+int main_client_receive() {
+  printf("%sPARENT (client): Receiving without the loop%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  //The loop owns the RX pipe
+  if (attach_client(&client, CLIENT_NAME, txPipe, rxPipe) != 0) {
+    return 1;
+  }
+  int rc = octopipes_loop_start(client) != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || verify_receive(client, OCTOPIPES_ERROR_THREAD, NULL, 0);
+  rc = detach_client(client) || rc;
+  if (rc != 0 || attach_client(&client, CLIENT_NAME, txPipe, rxPipe) != 0) {
+    return 1;
+  }
+  //Nothing is received within the timeout
+  const uint64_t started = octopipes_get_time_ms();
+  rc = verify_receive(client, OCTOPIPES_ERROR_NO_DATA_AVAILABLE, NULL, 0);
+  if (rc == 0 && octopipes_get_time_ms() - started < RECEIVE_TIMEOUT) {
+    printf("%sReceive returned before the timeout%s\n", KRED, KNRM);
+    rc = 1;
+  }
+  //Half a frame is kept until the rest is written
+  uint8_t* frame = NULL;
+  size_t frame_size = 0;
+  rc = rc || peer_encode("split", &frame, &frame_size);
+  rc = rc || pipe_send(rxPipe, frame, frame_size / 2, PIPE_TIMEOUT) != OCTOPIPES_ERROR_SUCCESS;
+  rc = rc || verify_receive(client, OCTOPIPES_ERROR_NO_DATA_AVAILABLE, NULL, 0);
+  rc = rc || pipe_send(rxPipe, frame + frame_size / 2, frame_size - frame_size / 2, PIPE_TIMEOUT) != OCTOPIPES_ERROR_SUCCESS;
+  const char* split[] = {"split"};
+  rc = rc || verify_receive(client, OCTOPIPES_ERROR_SUCCESS, split, 1);
+  free(frame);
+  if (rc == 0) {
+    printf("%sSplit frame put back together%s\n", KYEL, KNRM);
+  }
+  //The messages already available are returned without waiting for max; the ones beyond max are left for the next call
+  const char* payloads[] = {"one", "two", "three", "four", "five"};
+  rc = rc || peer_send(payloads, 5);
+  rc = rc || verify_receive(client, OCTOPIPES_ERROR_SUCCESS, payloads, RECEIVE_MAX);
+  rc = rc || verify_receive(client, OCTOPIPES_ERROR_SUCCESS, payloads + RECEIVE_MAX, 5 - RECEIVE_MAX);
+  if (rc == 0) {
+    printf("%sMessages received without the loop%s\n", KYEL, KNRM);
+  }
+  rc = detach_client(client) || rc;
+  return rc;
+}
+
+/**
+ * @brief fill the payload of a message sent by a concurrent sender: every byte depends on the sender, the message and its position,
+ * so a frame made of parts of other frames is told apart
+ * @param uint8_t* payload
+ * @param size_t payload size
+ * @param size_t sender
+ * @param size_t message
+ */
+
+void fill_concurrent_payload(uint8_t* payload, const size_t payload_size, const size_t sender, const size_t message) {
+  for (size_t i = 0; i < payload_size; i++) {
+    payload[i] = (uint8_t) (sender * 31 + message * 7 + i);
+  }
+  payload[0] = (uint8_t) sender;
+  payload[1] = (uint8_t) message;
+}
+
+/**
+ * @brief send SEND_THREAD_MESSAGES messages to the peer, alternating small and large ones; runs in its own thread
+ * @param void* args (ConcurrentSender*)
+ * @return void*
+ */
+
+void* send_concurrent(void* args) {
+  ConcurrentSender* sender = (ConcurrentSender*) args;
+  uint8_t payload[SEND_LARGE_SIZE];
+  sender->error = OCTOPIPES_ERROR_SUCCESS;
+  for (size_t i = 0; i < SEND_THREAD_MESSAGES && sender->error == OCTOPIPES_ERROR_SUCCESS; i++) {
+    const size_t payload_size = i % 2 == 0 ? SEND_SMALL_SIZE : SEND_LARGE_SIZE;
+    fill_concurrent_payload(payload, payload_size, sender->index, i);
+    sender->error = octopipes_send(sender->client, ACK_PEER, payload, payload_size);
+  }
+  return NULL;
+}
+
+/**
+ * @brief more threads send on the same client at once: every frame must be read intact, and the ones of each thread in the order it sent them
+ * @return int
+ */
+
+int main_client_concurrent_send() {
+  printf("%sPARENT (client): Sending from %d threads%s\n", KYEL, SEND_THREADS, KNRM);
+  OctopipesClient* client;
+  int peer_fd;
+  if (attach_client(&client, CLIENT_NAME, txPipe, NULL) != 0) {
+    return 1;
+  }
+  if (pipe_open(txPipe, &peer_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open %s%s\n", KRED, txPipe, KNRM);
+    detach_client(client);
+    return 1;
+  }
+  ConcurrentSender senders[SEND_THREADS];
+  pthread_t threads[SEND_THREADS];
+  size_t started = 0;
+  int rc = 0;
+  for (; started < SEND_THREADS; started++) {
+    senders[started].client = client;
+    senders[started].index = started;
+    if (pthread_create(&threads[started], NULL, send_concurrent, &senders[started]) != 0) {
+      printf("%sCould not start sender %zu%s\n", KRED, started, KNRM);
+      rc = 1;
+      break;
+    }
+  }
+  //The frames are read while they're sent, since they don't fit the pipe; a frame which can't be decoded isn't counted
+  const size_t expected = started * SEND_THREAD_MESSAGES;
+  OctopipesMessage** messages = (OctopipesMessage**) calloc(SEND_THREADS * SEND_THREAD_MESSAGES, sizeof(OctopipesMessage*));
+  const size_t received = messages != NULL ? peer_receive(peer_fd, messages, SEND_THREADS * SEND_THREAD_MESSAGES, 1000) : 0;
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    if (senders[i].error != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sSender %zu failed: %s%s\n", KRED, i, octopipes_get_error_desc(senders[i].error), KNRM);
+      rc = 1;
+    }
+  }
+  if (rc == 0 && received != expected) {
+    printf("%sExpected %zu frames, read %zu intact%s\n", KRED, expected, received, KNRM);
+    rc = 1;
+  }
+  size_t next[SEND_THREADS] = {0};
+  uint8_t payload[SEND_LARGE_SIZE];
+  for (size_t i = 0; i < received && rc == 0; i++) {
+    const OctopipesMessage* message = messages[i];
+    const size_t sender = message->data_size >= 2 ? message->data[0] : SEND_THREADS;
+    if (sender >= SEND_THREADS || message->data[1] != next[sender]) {
+      printf("%sFrame %zu is out of order (sender %zu)%s\n", KRED, i, sender, KNRM);
+      rc = 1;
+      break;
+    }
+    const size_t payload_size = next[sender] % 2 == 0 ? SEND_SMALL_SIZE : SEND_LARGE_SIZE;
+    fill_concurrent_payload(payload, payload_size, sender, next[sender]);
+    if (message->data_size != payload_size || memcmp(message->data, payload, payload_size) != 0) {
+      printf("%sFrame %zu of sender %zu has been interleaved (%llu bytes)%s\n", KRED, next[sender], sender, message->data_size, KNRM);
+      rc = 1;
+    }
+    next[sender]++;
+  }
+  for (size_t i = 0; i < received; i++) {
+    octopipes_cleanup_message(messages[i]);
+  }
+  free(messages);
+  if (rc == 0) {
+    printf("%sFrames sent from %d threads read intact%s\n", KYEL, SEND_THREADS, KNRM);
+  }
+  rc = detach_client(client) || rc;
+  pipe_close(peer_fd);
+  return rc;
+}
+
 /**
  * @brief main for child process (child is a simualated server)
  * @param char* txPipe
@@ -312,9 +1439,9 @@ int main_server() {
   printf("%sCHILD (server): Starting main in 2.8 seconds%s\n", KCYN, KNRM);
   usleep(2800000);
   unsigned long int total_time_elapsed = 0;
-  bool client_unsubscribed = false;
+  int client_unsubscriptions = 0;
   //Read from pipes
-  while(!client_unsubscribed) {
+  while(client_unsubscriptions < SESSIONS_AMOUNT) {
     //Read from pipe
     uint8_t* data_in = NULL;
     size_t data_in_size;
@@ -349,7 +1476,8 @@ int main_server() {
           //Parse subscribe
           char** groups = NULL;
           size_t groups_amount;
-          if ((ret = octopipes_cap_parse_subscribe(data_in, data_in_size, &groups, &groups_amount)) != OCTOPIPES_ERROR_SUCCESS) {
+          char* reply_pipe = NULL;
+          if ((ret = octopipes_cap_parse_subscribe(message->data, message->data_size, &groups, &groups_amount, &reply_pipe, NULL, NULL)) != OCTOPIPES_ERROR_SUCCESS) {
             printf("%sCould not parse subscribe message: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
             octopipes_cleanup_message(message);
             free(data_in);
@@ -386,6 +1514,9 @@ int main_server() {
           assignment_message->data_size = out_payload_size;
           assignment_message->data = out_payload;
           assignment_message->options = OCTOPIPES_OPTIONS_NONE;
+          assignment_message->correlation_id = 0;
+          assignment_message->epoch = 0;
+          assignment_message->sequence = 0;
           assignment_message->checksum = calculate_checksum(assignment_message);
           //Encode message
           uint8_t* out_data;
@@ -404,7 +1535,7 @@ int main_server() {
             printf("%02x ", out_data[i]);
           }
           printf("%s\n", KNRM);
-          if ((ret = pipe_send(capPipe, out_data, out_data_size, 5000)) != OCTOPIPES_ERROR_SUCCESS) {
+          if ((ret = pipe_send((reply_pipe != NULL) ? reply_pipe : capPipe, out_data, out_data_size, 5000)) != OCTOPIPES_ERROR_SUCCESS) {
             printf("%sCould not send assignment to client: %s%s\n", KRED, octopipes_get_error_desc(ret), KNRM);
             free(out_data);
             octopipes_cleanup_message(message);
@@ -418,6 +1549,7 @@ int main_server() {
           printf("%sSent ASSIGNMENT to %s%s\n", KCYN, message->origin, KNRM);
           //Free out data
           free(out_data);
+          free(reply_pipe);
           break;
         }
         case OCTOPIPES_CAP_UNSUBSCRIPTION: {
@@ -428,7 +1560,7 @@ int main_server() {
             free(data_in);
             return 1;
           }
-          client_unsubscribed = true;
+          client_unsubscriptions++;
           gettimeofday(&t_write, NULL);
           break;
         }
@@ -522,6 +1654,30 @@ int main(int argc, char** argv) {
   int ret;
   if (is_child == 0) {
     ret = main_client();
+    if (ret == 0) {
+      ret = main_client_cleanup();
+    }
+    if (ret == 0) {
+      ret = main_client_acks();
+    }
+    if (ret == 0) {
+      ret = main_client_executor();
+    }
+    if (ret == 0) {
+      ret = main_client_requests();
+    }
+    if (ret == 0) {
+      ret = main_client_batch();
+    }
+    if (ret == 0) {
+      ret = main_client_reserve();
+    }
+    if (ret == 0) {
+      ret = main_client_receive();
+    }
+    if (ret == 0) {
+      ret = main_client_concurrent_send();
+    }
     //Remove pipes
     printf("Removing TX and RX pipes\n");
     if ((rc = pipe_delete(txPipe)) != OCTOPIPES_ERROR_SUCCESS) {
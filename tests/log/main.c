@@ -0,0 +1,393 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#include <octopipes/octopipes.h>
+#include <octopipes/log.h>
+#include <octopipes/serializer.h>
+#include <octopipes/timer.h>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "test_log"
+#define USAGE PROGRAM_NAME "Usage: " PROGRAM_NAME " [Options]\n\
+\t -d <directory>\t\tLog directory (default: /tmp/octopipes_log)\n\
+\t -h\t\tShow this page\n\
+"
+
+//Colors
+#define KNRM "\x1B[0m"
+#define KRED "\x1B[31m"
+#define KGRN "\x1B[32m"
+#define KYEL "\x1B[33m"
+#define KBLU "\x1B[34m"
+#define KMAG "\x1B[35m"
+#define KCYN "\x1B[36m"
+#define KWHT "\x1B[37m"
+
+#define GROUP "sensors/temperature"
+#define RECORDS_AMOUNT 64
+#define SEGMENT_SIZE 1024
+#define RETENTION_BYTES 4096
+#define RETENTION_AGE 50 //ms
+
+/**
+ * Test Description: test_log tests the segmented append-only log
+ * - appends frames and reads them back from the mapped segments
+ * - reopens the log and recovers the segments, skipping a broken record
+ * - deletes the oldest segments beyond the retention size
+ * - deletes the expired segments on load and skips the expired records until the log rolls
+ * - refuses to load groups beyond the max groups
+ * Functions covered by this test:
+ * - octopipes_log_open
+ * - octopipes_log_close
+ * - octopipes_log_get_group
+ * - octopipes_log_get_groups
+ * - octopipes_log_set_max_groups
+ * - octopipes_log_append
+ * - octopipes_log_first
+ * - octopipes_log_seek_time
+ * - octopipes_log_read
+ */
+
+/**
+ * @brief encode a message whose payload is its index
+ * @param size_t index
+ * @param uint8_t** data out
+ * @param size_t* data out size
+ * @return OctopipesError
+ */
+
+OctopipesError encode_record(const size_t index, uint8_t** data, size_t* data_size) {
+  char payload[32];
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin = "test_log";
+  message.origin_size = 8;
+  message.remote = GROUP;
+  message.remote_size = strlen(GROUP);
+  message.options = OCTOPIPES_OPTIONS_NONE;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.ttl = 0;
+  message.data_size = snprintf(payload, sizeof(payload), "record %zu", index);
+  message.data = (uint8_t*) payload;
+  return octopipes_encode(&message, data, data_size);
+}
+
+/**
+ * @brief verify a record of the log is the frame appended at index
+ * @param OctopipesLogGroup* log group
+ * @param uint64_t offset
+ * @param size_t index
+ * @return int
+ */
+
+int verify_record(OctopipesLogGroup* log_group, const uint64_t offset, const size_t index) {
+  uint8_t* expected;
+  size_t expected_size;
+  if (encode_record(index, &expected, &expected_size) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  size_t data_size;
+  const uint8_t* data = octopipes_log_read(log_group, offset, &data_size);
+  const int mismatch = data == NULL || data_size != expected_size || memcmp(data, expected, data_size) != 0;
+  free(expected);
+  if (mismatch) {
+    printf("%sRecord %" PRIu64 " doesn't match frame %zu%s\n", KRED, offset, index, KNRM);
+  }
+  return mismatch;
+}
+
+/**
+ * @brief append frames and read them back
+ * @param char* directory
+ * @return int
+ */
+
+int test_append(const char* directory) {
+  OctopipesError rc;
+  printf("%sAppending records%s\n", KYEL, KNRM);
+  OctopipesLog* log;
+  if ((rc = octopipes_log_open(&log, directory, SEGMENT_SIZE, 0, 0)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open log: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  OctopipesLogGroup* log_group;
+  if ((rc = octopipes_log_get_group(log, GROUP, 0, &log_group)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+    printf("%sGroup shouldn't exist yet, but got %d%s\n", KRED, rc, KNRM);
+    octopipes_log_close(log);
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  if ((rc = octopipes_log_get_group(log, GROUP, 1, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create group: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    octopipes_log_close(log);
+    return rc;
+  }
+  const uint64_t started = octopipes_get_epoch_ms();
+  for (size_t i = 0; i < RECORDS_AMOUNT; i++) {
+    uint8_t* data;
+    size_t data_size;
+    uint64_t offset;
+    if ((rc = encode_record(i, &data, &data_size)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_append(log_group, data, data_size, &offset)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not append record %zu: %s%s\n", KRED, i, octopipes_get_error_desc(rc), KNRM);
+      octopipes_log_close(log);
+      return rc;
+    }
+    free(data);
+    if (offset != i) {
+      printf("%sRecord %zu got offset %" PRIu64 "%s\n", KRED, i, offset, KNRM);
+      octopipes_log_close(log);
+      return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+    }
+  }
+  printf("%sAppended %d records in %zu segments%s\n", KYEL, RECORDS_AMOUNT, log_group->segments_len, KNRM);
+  int ret = log_group->segments_len < 2 || octopipes_log_first(log_group) != 0 || log_group->next != RECORDS_AMOUNT;
+  for (size_t i = 0; i < RECORDS_AMOUNT && ret == 0; i++) {
+    ret = verify_record(log_group, i, i);
+  }
+  size_t data_size;
+  if (ret == 0 && octopipes_log_read(log_group, RECORDS_AMOUNT, &data_size) != NULL) {
+    printf("%sThere should be no record past the end of the log%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  if (ret == 0 && (octopipes_log_seek_time(log_group, started) != 0 || octopipes_log_seek_time(log_group, UINT64_MAX) != RECORDS_AMOUNT)) {
+    printf("%sSeeking by time returned wrong offsets%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  octopipes_log_close(log);
+  return ret;
+}
+
+/**
+ * @brief reopen the log after breaking its last record and verify the good records are recovered
+ * @param char* directory
+ * @return int
+ */
+
+int test_recovery(const char* directory) {
+  OctopipesError rc;
+  printf("%sRecovering records%s\n", KYEL, KNRM);
+  OctopipesLog* log;
+  OctopipesLogGroup* log_group;
+  if ((rc = octopipes_log_open(&log, directory, SEGMENT_SIZE, 0, 0)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open log: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  if ((rc = octopipes_log_get_group(log, GROUP, 0, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not recover group: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    octopipes_log_close(log);
+    return rc;
+  }
+  int ret = log_group->next != RECORDS_AMOUNT;
+  for (size_t i = 0; i < RECORDS_AMOUNT && ret == 0; i++) {
+    ret = verify_record(log_group, i, i);
+  }
+  //Write a record header without its frame, as if the server stopped while appending
+  const OctopipesLogSegment* last = &log_group->segments[log_group->segments_len - 1];
+  const size_t broken_position = last->used;
+  char* broken_path = strdup(last->path);
+  octopipes_log_close(log);
+  if (ret != 0) {
+    free(broken_path);
+    return ret;
+  }
+  const uint8_t broken[4] = {0x00, 0x00, 0x00, 0x20};
+  const int fd = open(broken_path, O_WRONLY);
+  free(broken_path);
+  if (fd == -1 || pwrite(fd, broken, sizeof(broken), (off_t) broken_position) != sizeof(broken)) {
+    printf("%sCould not break the last segment%s\n", KRED, KNRM);
+    return 1;
+  }
+  close(fd);
+  if ((rc = octopipes_log_open(&log, directory, SEGMENT_SIZE, 0, 0)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_get_group(log, GROUP, 0, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not recover group: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  //The broken record is skipped and overwritten
+  uint8_t* data;
+  size_t data_size;
+  uint64_t offset;
+  if (log_group->next != RECORDS_AMOUNT || encode_record(RECORDS_AMOUNT, &data, &data_size) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sBroken record should have been skipped%s\n", KRED, KNRM);
+    octopipes_log_close(log);
+    return 1;
+  }
+  rc = octopipes_log_append(log_group, data, data_size, &offset);
+  free(data);
+  ret = rc != OCTOPIPES_ERROR_SUCCESS || offset != RECORDS_AMOUNT || verify_record(log_group, RECORDS_AMOUNT, RECORDS_AMOUNT);
+  octopipes_log_close(log);
+  return ret;
+}
+
+/**
+ * @brief append beyond the retention size and verify the oldest segments are deleted
+ * @param char* directory
+ * @return int
+ */
+
+int test_retention(const char* directory) {
+  OctopipesError rc;
+  printf("%sApplying retention%s\n", KYEL, KNRM);
+  OctopipesLog* log;
+  OctopipesLogGroup* log_group;
+  if ((rc = octopipes_log_open(&log, directory, SEGMENT_SIZE, RETENTION_BYTES, 0)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_get_group(log, GROUP, 0, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open log: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  const uint64_t next = log_group->next;
+  for (size_t i = 0; i < RECORDS_AMOUNT * 4; i++) {
+    uint8_t* data;
+    size_t data_size;
+    uint64_t offset;
+    if ((rc = encode_record(next + i, &data, &data_size)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_append(log_group, data, data_size, &offset)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not append record: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+      octopipes_log_close(log);
+      return rc;
+    }
+    free(data);
+  }
+  const uint64_t first = octopipes_log_first(log_group);
+  printf("%sLog holds %zu bytes from offset %" PRIu64 " to %" PRIu64 "%s\n", KYEL, log_group->bytes, first, log_group->next, KNRM);
+  size_t data_size;
+  int ret = log_group->bytes > RETENTION_BYTES + SEGMENT_SIZE || first == 0 || octopipes_log_read(log_group, first - 1, &data_size) != NULL;
+  for (uint64_t offset = first; offset < log_group->next && ret == 0; offset++) {
+    ret = verify_record(log_group, offset, (size_t) offset);
+  }
+  //The group is listed by name
+  char** groups;
+  size_t groups_len;
+  if (ret == 0 && octopipes_log_get_groups(log, &groups, &groups_len) == OCTOPIPES_ERROR_SUCCESS) {
+    ret = groups_len != 1 || strcmp(groups[0], GROUP) != 0;
+    for (size_t i = 0; i < groups_len; i++) {
+      free(groups[i]);
+    }
+    free(groups);
+  }
+  octopipes_log_close(log);
+  return ret;
+}
+
+/**
+ * @brief reopen the log once its records expired: the expired segments are deleted on load and the records of the
+ * current one are skipped; groups can't be loaded beyond the max groups
+ * @param char* directory
+ * @return int
+ */
+
+int test_age_retention(const char* directory) {
+  OctopipesError rc;
+  printf("%sApplying age retention%s\n", KYEL, KNRM);
+  usleep(RETENTION_AGE * 2000);
+  OctopipesLog* log;
+  OctopipesLogGroup* log_group;
+  if ((rc = octopipes_log_open(&log, directory, SEGMENT_SIZE, 0, RETENTION_AGE)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_get_group(log, GROUP, 0, &log_group)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open log: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  int ret = 0;
+  if (log_group->segments_len != 1 || octopipes_log_first(log_group) != log_group->next) {
+    printf("%sExpected the expired records to be skipped, got %zu segments from offset %" PRIu64 "%s\n", KRED, log_group->segments_len, octopipes_log_first(log_group), KNRM);
+    ret = 1;
+  }
+  //A new record is not expired
+  const uint64_t next = log_group->next;
+  uint8_t* data;
+  size_t data_size;
+  uint64_t offset;
+  if (ret == 0 && ((rc = encode_record(next, &data, &data_size)) != OCTOPIPES_ERROR_SUCCESS || (rc = octopipes_log_append(log_group, data, data_size, &offset)) != OCTOPIPES_ERROR_SUCCESS)) {
+    printf("%sCould not append record: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    ret = 1;
+  } else if (ret == 0) {
+    free(data);
+    ret = octopipes_log_first(log_group) != offset || verify_record(log_group, offset, (size_t) next);
+  }
+  //The group is loaded already, so no other group can be
+  OctopipesLogGroup* other;
+  if (ret == 0 && (octopipes_log_set_max_groups(log, 1) != OCTOPIPES_ERROR_SUCCESS || octopipes_log_get_group(log, "other", 1, &other) != OCTOPIPES_ERROR_LOG_FULL)) {
+    printf("%sThe log should have refused a second group%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  octopipes_log_close(log);
+  return ret;
+}
+
+int main(int argc, char** argv) {
+  printf(PROGRAM_NAME " liboctopipes Build: " OCTOPIPES_LIB_VERSION "\n");
+  const char* directory = "/tmp/octopipes_log";
+  int opt;
+  while ((opt = getopt(argc, argv, "d:h")) != -1) {
+    switch (opt) {
+    case 'd':
+      directory = optarg;
+      break;
+    case 'h':
+      printf("%s\n", USAGE);
+      return 0;
+    }
+  }
+  //Start from an empty log
+  char command[512];
+  snprintf(command, sizeof(command), "rm -rf %s", directory);
+  if (system(command) != 0) {
+    printf("%sCould not clean %s%s\n", KRED, directory, KNRM);
+    return 1;
+  }
+  int rc = 0;
+  int ret = 0;
+  //Test 1. records are appended and read back
+  if ((ret = test_append(directory)) != 0) {
+    printf("%sAppend test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sAppend test passed!%s\n", KGRN, KNRM);
+  //Test 2. segments are recovered when the log is reopened
+  if ((ret = test_recovery(directory)) != 0) {
+    printf("%sRecovery test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRecovery test passed!%s\n", KGRN, KNRM);
+  //Test 3. oldest segments are deleted
+  if ((ret = test_retention(directory)) != 0) {
+    printf("%sRetention test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRetention test passed!%s\n", KGRN, KNRM);
+  //Test 4. expired segments are deleted on load and skipped until then
+  if ((ret = test_age_retention(directory)) != 0) {
+    printf("%sAge retention test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sAge retention test passed!%s\n", KGRN, KNRM);
+  return rc; //Sum of error codes
+}
@@ -58,6 +58,7 @@
  * - parses normal octopipes payloads
  * - encodes all kind of CAP messages
  * - parses all kind of CAP messages
+ * - refuses the frames over the maximum frame size
  * Functions covered by this test:
  * - octopipes_decode
  * - octopipes_encode
@@ -69,6 +70,16 @@
  * - octopipes_cap_parse_subscribe
  * - octopipes_cap_parse_assign
  * - octopipes_cap_parse_unsubscribe
+ * - octopipes_cap_prepare_groups_update
+ * - octopipes_cap_parse_groups_update
+ * - octopipes_cap_prepare_credits
+ * - octopipes_cap_parse_credits
+ * - octopipes_get_frame_size
+ * - octopipes_decode_next
+ * - octopipes_encode_header
+ * - calculate_frame_checksum
+ * - octopipes_get_fields_size
+ * - octopipes_encode_fields
  * NOTE: This test JUST tests encoding/decoding functions
  */
 
@@ -91,6 +102,9 @@ int test_endecoding() {
   message->remote = REMOTE;
   message->remote_size = REMOTE_SIZE;
   message->options = 0;
+  message->correlation_id = 0;
+  message->epoch = 0;
+  message->sequence = 0;
   message->ttl = 60; //60 seconds
   message->data_size = 32;
   message->data = payload;
@@ -313,7 +327,8 @@ int test_cap_subscribe() {
   groups[2] = (char*) group_drivers;
   //Encode subscribe
   size_t data_size;
-  uint8_t* subscribe_data = octopipes_cap_prepare_subscription((const char**) groups, 3, &data_size);
+  const char* reply_pipe = "/tmp/octopipes/cap.fifo.test_parser";
+  uint8_t* subscribe_data = octopipes_cap_prepare_subscription((const char**) groups, 3, reply_pipe, OCTOPIPES_SUBSCRIPTION_CONFLATE | OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET, 0x0102030405060708, &data_size);
   if (subscribe_data == NULL) {
     printf("%sCould not prepare subscribe; data is invalid%s\n", KRED, KNRM);
   }
@@ -334,12 +349,35 @@ int test_cap_subscribe() {
   //Parse subscribe data back
   char** parsed_groups;
   size_t parsed_groups_amount;
-  if ((rc = octopipes_cap_parse_subscribe(subscribe_data, data_size, &parsed_groups, &parsed_groups_amount)) != OCTOPIPES_ERROR_SUCCESS) {
+  char* parsed_reply_pipe;
+  OctopipesSubscriptionFlags parsed_flags;
+  uint64_t parsed_from;
+  if ((rc = octopipes_cap_parse_subscribe(subscribe_data, data_size, &parsed_groups, &parsed_groups_amount, &parsed_reply_pipe, &parsed_flags, &parsed_from)) != OCTOPIPES_ERROR_SUCCESS) {
     printf("%sCould not parse subscribe payload: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
     free(subscribe_data);
     return rc;
   }
   free(subscribe_data);
+  //Verify reply pipe
+  if (parsed_reply_pipe == NULL || strcmp(parsed_reply_pipe, reply_pipe) != 0) {
+    printf("%sReply pipe mismatched: %s; %s%s\n", KRED, reply_pipe, parsed_reply_pipe, KNRM);
+    free(parsed_reply_pipe);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  printf("%sFound correct reply pipe %s%s\n", KYEL, parsed_reply_pipe, KNRM);
+  free(parsed_reply_pipe);
+  //Verify flags
+  if (parsed_flags != (OCTOPIPES_SUBSCRIPTION_CONFLATE | OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET)) {
+    printf("%sFlags mismatched: %d; %d%s\n", KRED, OCTOPIPES_SUBSCRIPTION_CONFLATE | OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET, parsed_flags, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  printf("%sFound correct flags %d%s\n", KYEL, parsed_flags, KNRM);
+  //Verify replay start
+  if (parsed_from != 0x0102030405060708) {
+    printf("%sReplay start mismatched: %" PRIx64 "; %" PRIx64 "%s\n", KRED, (uint64_t) 0x0102030405060708, parsed_from, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  printf("%sFound correct replay start %" PRIx64 "%s\n", KYEL, parsed_from, KNRM);
   if (parsed_groups_amount != 3) {
     printf("%sExpected %d groups, but got %zu%s\n", KRED, 3, parsed_groups_amount, KNRM);
     return OCTOPIPES_ERROR_BAD_PACKET;
@@ -369,7 +407,7 @@ int test_cap_subscribe() {
   //CAP Subscribe was successful
   //Test errors
   uint8_t bad_subscribe_data[2] = {0xFF, 0x00};
-  if ((rc = octopipes_cap_parse_subscribe(bad_subscribe_data, 2, &parsed_groups, &parsed_groups_amount)) != OCTOPIPES_ERROR_BAD_PACKET) {
+  if ((rc = octopipes_cap_parse_subscribe(bad_subscribe_data, 2, &parsed_groups, &parsed_groups_amount, NULL, NULL, NULL)) != OCTOPIPES_ERROR_BAD_PACKET) {
     printf("%soctopipes_cap_parse_subscribe should have returned OCTOPIPES_ERROR_BAD_PACKET, but returned %d %s\n", KRED, rc, KNRM);
     return rc;
   }
@@ -499,6 +537,337 @@ int test_cap_unsubscribe() {
   return 0;
 }
 
+/**
+ * @brief encode and parse add groups and remove groups payloads
+ * @return int
+ */
+
+int test_cap_groups_update() {
+  OctopipesError rc;
+  const char* groups[2] = {"sensors", "display"};
+  const OctopipesCapMessage types[2] = {OCTOPIPES_CAP_ADD_GROUPS, OCTOPIPES_CAP_REMOVE_GROUPS};
+  //The reply pipe is optional
+  const char* reply_pipes[2] = {"/tmp/octopipes_cap.fifo.client.groups", NULL};
+  for (size_t t = 0; t < 2; t++) {
+    printf("%sEncoding a groups update (%d) for groups: 'sensors', 'display'; reply pipe: %s%s\n", KYEL, types[t], reply_pipes[t] != NULL ? reply_pipes[t] : "none", KNRM);
+    size_t data_size;
+    uint8_t* update_data = octopipes_cap_prepare_groups_update(types[t], groups, 2, reply_pipes[t], &data_size);
+    if (update_data == NULL) {
+      printf("%sCould not prepare groups update%s\n", KRED, KNRM);
+      return OCTOPIPES_ERROR_BAD_ALLOC;
+    }
+    OctopipesCapMessage message_type = octopipes_cap_get_message(update_data, data_size);
+    if (message_type != types[t]) {
+      printf("%sMessage encoded has type %d, expected %d%s\n", KRED, message_type, types[t], KNRM);
+      free(update_data);
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    //Parse groups back
+    char** parsed_groups;
+    size_t parsed_groups_amount;
+    char* parsed_reply_pipe;
+    if ((rc = octopipes_cap_parse_groups_update(update_data, data_size, &parsed_groups, &parsed_groups_amount, &parsed_reply_pipe)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not parse groups update: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+      free(update_data);
+      return rc;
+    }
+    free(update_data);
+    rc = (parsed_groups_amount == 2) ? OCTOPIPES_ERROR_SUCCESS : OCTOPIPES_ERROR_BAD_PACKET;
+    if ((reply_pipes[t] == NULL) != (parsed_reply_pipe == NULL) || (parsed_reply_pipe != NULL && strcmp(parsed_reply_pipe, reply_pipes[t]) != 0)) {
+      printf("%sReply pipe mismatched: %s; %s%s\n", KRED, reply_pipes[t] != NULL ? reply_pipes[t] : "none", parsed_reply_pipe != NULL ? parsed_reply_pipe : "none", KNRM);
+      rc = OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    free(parsed_reply_pipe);
+    for (size_t i = 0; i < parsed_groups_amount; i++) {
+      if (strcmp(parsed_groups[i], groups[i]) != 0) {
+        printf("%sGroup %zu mismatched: %s; %s%s\n", KRED, i, groups[i], parsed_groups[i], KNRM);
+        rc = OCTOPIPES_ERROR_BAD_PACKET;
+      }
+      free(parsed_groups[i]);
+    }
+    free(parsed_groups);
+    if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      return rc;
+    }
+  }
+  //@! Test errors
+  char** parsed_groups;
+  size_t parsed_groups_amount;
+  uint8_t truncated_data[4] = {OCTOPIPES_CAP_ADD_GROUPS, 0x01, 0x05, 'a'};
+  if ((rc = octopipes_cap_parse_groups_update(truncated_data, 4, &parsed_groups, &parsed_groups_amount, NULL)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%soctopipes_cap_parse_groups_update should have returned OCTOPIPES_ERROR_BAD_PACKET, but returned %d %s\n", KRED, rc, KNRM);
+    return rc;
+  }
+  //Reply pipe longer than the payload
+  uint8_t truncated_reply[6] = {OCTOPIPES_CAP_ADD_GROUPS, 0x01, 0x01, 'a', 0x05, '/'};
+  if ((rc = octopipes_cap_parse_groups_update(truncated_reply, 6, &parsed_groups, &parsed_groups_amount, NULL)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%soctopipes_cap_parse_groups_update should have returned OCTOPIPES_ERROR_BAD_PACKET for a truncated reply pipe, but returned %d %s\n", KRED, rc, KNRM);
+    return rc;
+  }
+  return 0;
+}
+
+/**
+ * @brief encode and parse a credits grant
+ * @return int
+ */
+
+int test_cap_credits() {
+  OctopipesError rc;
+  const uint64_t messages_limit = 1024;
+  const uint64_t bytes_limit = 0x0102030405060708;
+  printf("%sEncoding a credits grant (messages: %" PRIu64 ", bytes: %" PRIu64 ")%s\n", KYEL, messages_limit, bytes_limit, KNRM);
+  size_t data_size;
+  uint8_t* credits_data = octopipes_cap_prepare_credits(messages_limit, bytes_limit, &data_size);
+  if (credits_data == NULL) {
+    printf("%sCould not prepare credits grant%s\n", KRED, KNRM);
+    return OCTOPIPES_ERROR_BAD_ALLOC;
+  }
+  OctopipesCapMessage message_type = octopipes_cap_get_message(credits_data, data_size);
+  if (message_type != OCTOPIPES_CAP_CREDITS) {
+    printf("%sMessage encoded is not of credits type (%d)%s\n", KRED, message_type, KNRM);
+    free(credits_data);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //Parse limits back
+  uint64_t parsed_messages_limit;
+  uint64_t parsed_bytes_limit;
+  if ((rc = octopipes_cap_parse_credits(credits_data, data_size, &parsed_messages_limit, &parsed_bytes_limit)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not parse credits grant: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    free(credits_data);
+    return rc;
+  }
+  if (parsed_messages_limit != messages_limit || parsed_bytes_limit != bytes_limit) {
+    printf("%sCredits mismatched: %" PRIu64 ", %" PRIu64 "; %" PRIu64 ", %" PRIu64 "%s\n", KRED, messages_limit, bytes_limit, parsed_messages_limit, parsed_bytes_limit, KNRM);
+    free(credits_data);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //@! Test errors
+  if ((rc = octopipes_cap_parse_credits(credits_data, data_size - 1, &parsed_messages_limit, &parsed_bytes_limit)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%soctopipes_cap_parse_credits should have returned OCTOPIPES_ERROR_BAD_PACKET, but returned %d %s\n", KRED, rc, KNRM);
+    free(credits_data);
+    return rc;
+  }
+  free(credits_data);
+  return 0;
+}
+
+/**
+ * @brief encode some messages back to back and split them again
+ * @return int
+ */
+
+int test_stream() {
+  OctopipesError rc;
+  printf("%sEncoding a stream of messages%s\n", KYEL, KNRM);
+  uint8_t payload[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin = ORIGIN;
+  message.origin_size = ORIGIN_SIZE;
+  message.remote = REMOTE;
+  message.remote_size = REMOTE_SIZE;
+  message.options = 0;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.ttl = 60;
+  message.data = payload;
+  //Encode 3 frames with different payload sizes
+  uint8_t stream[256];
+  size_t stream_size = 0;
+  for (size_t i = 0; i < 3; i++) {
+    size_t frame_size;
+    message.data_size = i * 4;
+    if ((rc = octopipes_encode_to(&message, stream + stream_size, sizeof(stream) - stream_size, &frame_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not encode message: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+      return rc;
+    }
+    stream_size += frame_size;
+  }
+  //Cut the last frame and decode the complete ones
+  const size_t cut_size = stream_size - 3;
+  size_t offset = 0;
+  size_t frames = 0;
+  OctopipesMessage* decoded;
+  while ((rc = octopipes_decode_next(stream, cut_size, &offset, &decoded)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+    if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not decode frame %zu: %s%s\n", KRED, frames, octopipes_get_error_desc(rc), KNRM);
+      return rc;
+    }
+    if (decoded->data_size != frames * 4 || strcmp(decoded->remote, REMOTE) != 0) {
+      printf("%sFrame %zu has unexpected content (data size: %" PRIu64 ")%s\n", KRED, frames, decoded->data_size, KNRM);
+      octopipes_cleanup_message(decoded);
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    octopipes_cleanup_message(decoded);
+    frames++;
+  }
+  if (frames != 2) {
+    printf("%sExpected 2 complete frames, but got %zu%s\n", KRED, frames, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //The remaining frame must be complete with the missing bytes
+  size_t frame_size;
+  if ((rc = octopipes_get_frame_size(stream + offset, stream_size - offset, &frame_size)) != OCTOPIPES_ERROR_SUCCESS || offset + frame_size != stream_size) {
+    printf("%sLast frame should be complete: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //@! Test errors
+  stream[offset] = 0xFF;
+  if ((rc = octopipes_decode_next(stream, stream_size, &offset, &decoded)) != OCTOPIPES_ERROR_BAD_PACKET || offset != stream_size) {
+    printf("%soctopipes_decode_next should have returned OCTOPIPES_ERROR_BAD_PACKET and discarded the stream, but returned %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //A frame over the maximum frame size is refused as soon as its data size is read
+  const size_t data_size_ptr = 3 + ORIGIN_SIZE + 1 + REMOTE_SIZE + 1;
+  for (size_t i = 0; i < 8; i++) {
+    stream[data_size_ptr + i] = i < 4 ? 0x00 : 0xFF;
+  }
+  if ((rc = octopipes_get_frame_size(stream, data_size_ptr + 8, &frame_size)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%sA frame over the maximum frame size should have been refused, but got %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  offset = 0;
+  if ((rc = octopipes_decode_next(stream, data_size_ptr + 8, &offset, &decoded)) != OCTOPIPES_ERROR_BAD_PACKET || offset != data_size_ptr + 8) {
+    printf("%soctopipes_decode_next should have discarded the frame over the maximum frame size, but returned %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  //Nor can it be encoded
+  message.data_size = OCTOPIPES_MAX_FRAME_SIZE;
+  if ((rc = octopipes_encode_to(&message, stream, sizeof(stream), &frame_size)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%sA message over the maximum frame size shouldn't have been encoded, but got %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  return 0;
+}
+
+/**
+ * @brief encode an header, write the payload after it and decode the frame
+ * @return int
+ */
+
+int test_header() {
+  OctopipesError rc;
+  printf("%sEncoding a frame header%s\n", KYEL, KNRM);
+  OctopipesMessage message;
+  message.version = OCTOPIPES_VERSION_1;
+  message.origin = ORIGIN;
+  message.origin_size = ORIGIN_SIZE;
+  message.remote = REMOTE;
+  message.remote_size = REMOTE_SIZE;
+  message.options = 0;
+  message.correlation_id = 0;
+  message.epoch = 0;
+  message.sequence = 0;
+  message.ttl = 60;
+  message.data_size = 16;
+  message.data = NULL;
+  uint8_t frame[128];
+  const size_t frame_size = octopipes_get_encoded_size(&message);
+  size_t header_size;
+  if ((rc = octopipes_encode_header(&message, frame, sizeof(frame), &header_size)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not encode header: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  //Write payload and ETX in place
+  for (size_t i = 0; i < 16; i++) {
+    frame[header_size + i] = i;
+  }
+  frame[frame_size - 1] = 0x03;
+  const size_t checksum_ptr = octopipes_get_checksum_offset(&message);
+  frame[checksum_ptr] = calculate_frame_checksum(frame, frame_size, checksum_ptr);
+  printf("%sFrame dump: ", KYEL);
+  for (size_t i = 0; i < frame_size; i++) {
+    printf("%02x ", frame[i]);
+  }
+  printf("%s\n", KNRM);
+  OctopipesMessage* decoded;
+  if ((rc = octopipes_decode(frame, frame_size, &decoded)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not decode frame: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  if (decoded->data_size != 16 || decoded->data[15] != 15 || decoded->ttl != 60) {
+    printf("%sDecoded frame has unexpected content%s\n", KRED, KNRM);
+    octopipes_cleanup_message(decoded);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  octopipes_cleanup_message(decoded);
+  //@! Test errors
+  if ((rc = octopipes_encode_header(&message, frame, header_size - 1, &header_size)) != OCTOPIPES_ERROR_BAD_ALLOC) {
+    printf("%soctopipes_encode_header should have returned OCTOPIPES_ERROR_BAD_ALLOC, but returned %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  return 0;
+}
+
+/**
+ * @brief encode a request, a reply and a sequenced message and verify the fields once decoded
+ * @return int
+ */
+
+int test_fields() {
+  OctopipesError rc;
+  printf("%sEncoding requests, replies and sequenced messages%s\n", KYEL, KNRM);
+  uint8_t payload[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  const OctopipesOptions options[3] = {OCTOPIPES_OPTIONS_REQUEST, OCTOPIPES_OPTIONS_REPLY, OCTOPIPES_OPTIONS_REQUIRE_ACK | OCTOPIPES_OPTIONS_SEQUENCED};
+  const size_t fields_size[3] = {4, 4, 8};
+  for (size_t i = 0; i < 3; i++) {
+    OctopipesMessage message;
+    message.version = OCTOPIPES_VERSION_1;
+    message.origin = ORIGIN;
+    message.origin_size = ORIGIN_SIZE;
+    message.remote = REMOTE;
+    message.remote_size = REMOTE_SIZE;
+    message.options = options[i];
+    message.correlation_id = 0xDEAD0001 + i;
+    message.epoch = 0xBEEF0000 + i;
+    message.sequence = 0x01020304 + i;
+    message.ttl = 5;
+    message.data_size = 8;
+    message.data = payload;
+    uint8_t* data;
+    size_t data_size;
+    if ((rc = octopipes_encode(&message, &data, &data_size)) != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not encode message: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+      return rc;
+    }
+    if (data_size != octopipes_get_encoded_size(&message) || octopipes_get_fields_size(message.options) != fields_size[i]) {
+      printf("%sEncoded size doesn't count fields%s\n", KRED, KNRM);
+      free(data);
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    OctopipesMessage* decoded;
+    rc = octopipes_decode(data, data_size, &decoded);
+    free(data);
+    if (rc != OCTOPIPES_ERROR_SUCCESS) {
+      printf("%sCould not decode message: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+      return rc;
+    }
+    //Correlation id is encoded only for requests and replies, epoch and sequence only for sequenced messages
+    const uint32_t correlation_id = (i < 2) ? message.correlation_id : 0;
+    const uint32_t epoch = (i < 2) ? 0 : message.epoch;
+    const uint32_t sequence = (i < 2) ? 0 : message.sequence;
+    if (decoded->correlation_id != correlation_id || decoded->epoch != epoch || decoded->sequence != sequence || decoded->data_size != 8 || memcmp(decoded->data, payload, 8) != 0) {
+      printf("%sDecoded message has unexpected content (correlation id %08x)%s\n", KRED, decoded->correlation_id, KNRM);
+      octopipes_cleanup_message(decoded);
+      return OCTOPIPES_ERROR_BAD_PACKET;
+    }
+    octopipes_cleanup_message(decoded);
+  }
+  //@! Test errors: a request must be big enough for its fields
+  uint8_t bad_request[] = {0x01, 0x01, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, OCTOPIPES_OPTIONS_REQUEST, 0x00, 0x02, 0x00, 0x00, 0x03};
+  OctopipesMessage* decoded;
+  if ((rc = octopipes_decode(bad_request, sizeof(bad_request), &decoded)) != OCTOPIPES_ERROR_BAD_PACKET) {
+    printf("%soctopipes_decode should have returned OCTOPIPES_ERROR_BAD_PACKET, but returned %d%s\n", KRED, rc, KNRM);
+    if (rc == OCTOPIPES_ERROR_SUCCESS) {
+      octopipes_cleanup_message(decoded);
+    }
+    return OCTOPIPES_ERROR_BAD_PACKET;
+  }
+  return 0;
+}
+
 int main(int argc, char** argv) {
   printf(PROGRAM_NAME " liboctopipes Build: " OCTOPIPES_LIB_VERSION "\n");
   int opt;
@@ -539,5 +908,40 @@ int main(int argc, char** argv) {
   }
   if (ret == 0)
     printf("%sCAP unsubscribe test passed!%s\n", KGRN, KNRM);
+  //Test 5. Stream test
+  if ((ret = test_stream()) != 0) {
+    printf("%sStream test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sStream test passed!%s\n", KGRN, KNRM);
+  //Test 6. Header test
+  if ((ret = test_header()) != 0) {
+    printf("%sHeader test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sHeader test passed!%s\n", KGRN, KNRM);
+  //Test 7. Fields test
+  if ((ret = test_fields()) != 0) {
+    printf("%sFields test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sFields test passed!%s\n", KGRN, KNRM);
+  //Test 8. CAP groups update test
+  if ((ret = test_cap_groups_update()) != 0) {
+    printf("%sCAP groups update test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sCAP groups update test passed!%s\n", KGRN, KNRM);
+  //Test 9. CAP credits test
+  if ((ret = test_cap_credits()) != 0) {
+    printf("%sCAP credits test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sCAP credits test passed!%s\n", KGRN, KNRM);
   return rc; //Sum of error codes
 }
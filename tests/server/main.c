@@ -0,0 +1,2066 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ *
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#include <octopipes/octopipes.h>
+#include <octopipes/cap.h>
+#include <octopipes/pipes.h>
+#include <octopipes/serializer.h>
+#include <octopipes/timer.h>
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "test_server"
+#define USAGE PROGRAM_NAME "Usage: " PROGRAM_NAME " [Options]\n\
+\t -c <capPath>\t\tSpecify the CAP Pipe of the server (default: /tmp/octopipes_test_server_cap)\n\
+\t -d <directory>\t\tClients directory (default: /tmp/octopipes_test_server)\n\
+\t -h\t\t\tShow this page\n\
+"
+
+//Colors
+#define KNRM "\x1B[0m"
+#define KRED "\x1B[31m"
+#define KGRN "\x1B[32m"
+#define KYEL "\x1B[33m"
+#define KBLU "\x1B[34m"
+#define KMAG "\x1B[35m"
+#define KCYN "\x1B[36m"
+#define KWHT "\x1B[37m"
+
+#define SERVER_NAME "test_server"
+#define INBOX_WAIT 300000 //Time given to the workers to read what the clients wrote (us)
+#define READ_TIMEOUT 500 //Time to wait for the frames written to a client (ms)
+#define FILLER_SIZE 131072 //Payload bigger than a FIFO, so the frames which follow it are queued
+#define RATE_LIMIT 10 //Messages per second allowed by the rate limit tests
+#define RATE_LIMIT_MESSAGES 30
+#define OVERFLOW_QUEUE_SIZE 2 //Frames queued for each client by the overflow test
+#define RETAINED_BUDGET 65536 //Bytes retained by the retained cache test
+#define LOG_SEGMENT_SIZE 65536 //Segment size of the log kept by the test server
+#define DISPATCHERS 2
+#define DISPATCHED_MESSAGES 200 //More than a dispatcher takes from a worker at once
+#define QUITTER_MESSAGES 100 //Messages left in the inbox of a worker stopped by the dispatchers test
+#define BUDGET_OVERDRAFT (1L << 50) //Debt of a worker with nothing to send: paying it back would take days
+#define BUDGET_TIMEOUT 1000000 //Time a budgeted processing with empty inboxes can take (us)
+#define SCHEDULE_QUANTUM_TEST 8192 //Debt of a worker with messages: two rounds of the default quantum
+#define WEIGHT_PAYLOAD_SIZE 960 //With the cost of a message, a quarter of the quantum a worker with weight 1 is granted each round
+#define WEIGHT_HEAVY 3
+#define WEIGHT_ROUND_LIGHT 4 //Messages served to a worker with weight 1 in a round
+#define WEIGHT_ROUNDS 2
+#define MEMORY_BUDGET 65536 //Memory budget of the memory test, smaller than the filler
+#define HANDLER_DEPTH 8 //Dispatches which can be nested in handlers
+#define FANOUT_RECIPIENTS 3
+#define FANOUT_THREADS 2
+#define CREDITS_MESSAGES 4 //Window of the credits test
+#define CREDITS_BYTES 4096
+#define CAP_PROCESS_INTERVAL 10000 //Interval the CAP is processed at while a real client subscribes (us)
+
+const char* clients_dir = "/tmp/octopipes_test_server";
+//Handlers test
+size_t service_calls = 0;
+OctopipesServerError service_error = OCTOPIPES_SERVER_ERROR_SUCCESS; //Returned by the deepest nested dispatch
+size_t once_calls = 0;
+OctopipesServerError once_error = OCTOPIPES_SERVER_ERROR_UNKNOWN; //Returned by the handler unregistering itself
+//Credits test
+size_t credits_calls = 0;
+int cap_processing = 0;
+//Dispatch error test
+int dispatch_error_done = 0;
+OctopipesServerError dispatch_error = OCTOPIPES_SERVER_ERROR_SUCCESS;
+OctopipesServerError dispatch_error_stop = OCTOPIPES_SERVER_ERROR_UNKNOWN;
+char dispatch_error_client[256];
+//Groups update test
+size_t grouped_received = 0;
+size_t grouped_unexpected = 0;
+
+/**
+ * Test Description: test_server runs a server in process, with the test acting as its clients through the worker pipes
+ * - dispatches the messages of a client by priority class
+ * - discards the messages whose TTL elapses in the inbox and in the outbound queue
+ * - conflates the frames queued for a client
+ * - applies the rate limit of a client, with both the drop and the backpressure policies
+ * - writes assignments only to the reply pipes a client would create, and answers the groups updates on them
+ * - disconnects a client whose outbound queue overflows with the disconnect policy, and notifies it
+ * - retains the last message of the groups, but not the direct messages, for the clients which subscribe to them later
+ * - logs the messages of the groups, but not the direct messages, and replays them to the clients which subscribe replaying
+ * - routes the messages with dispatcher threads, while workers are started and stopped
+ * - schedules the workers by deficit, making the overdrawn workers pay back only while they have messages
+ * - serves each worker in proportion to its weight
+ * - accounts the frames queued for the clients in the memory budget, pausing the producers until the clients read them
+ * - refuses the client ids which would be routed as patterns, and frees the routing trie nodes left empty
+ * - matches the handlers through the routing trie and calls them without the routing lock, so they can call the server functions;
+ *   dispatches nested too deep in handlers are refused
+ * - queues a single shared frame for all the recipients of a parallel dispatch, and stops the fanout pool on cleanup
+ * - grants credits to a client subscribed through the CAP and replenishes them as its messages are dispatched, frames which can't be decoded included
+ * - updates the groups of a client subscribed through the CAP, answering on its private reply pipe: the client receives the messages of
+ *   the groups it adds and stops receiving the ones of the groups it removes
+ * Functions covered by this test:
+ * - octopipes_server_init
+ * - octopipes_server_cleanup
+ * - octopipes_server_start_cap_listener
+ * - octopipes_server_process_cap_all
+ * - octopipes_server_is_subscribed
+ * - octopipes_server_start_worker
+ * - octopipes_server_stop_worker
+ * - octopipes_server_dispatch_message
+ * - octopipes_server_process_all
+ * - octopipes_server_get_outbound_stats
+ * - octopipes_server_get_expired_stats
+ * - octopipes_server_set_conflation
+ * - octopipes_server_set_rate_limit
+ * - octopipes_server_get_rate_limit_stats
+ * - octopipes_server_set_outbound_queue
+ * - octopipes_server_set_retained_cache
+ * - octopipes_server_get_retained_stats
+ * - octopipes_server_set_log
+ * - octopipes_server_set_log_max_groups
+ * - octopipes_server_get_log_offsets
+ * - octopipes_server_start_dispatchers
+ * - octopipes_server_stop_dispatchers
+ * - octopipes_server_process_budget
+ * - octopipes_server_set_weight
+ * - octopipes_server_set_memory_budget
+ * - octopipes_server_get_memory_stats
+ * - octopipes_server_register_handler
+ * - octopipes_server_unregister_handler
+ * - octopipes_server_get_subscriptions
+ * - octopipes_server_set_fanout
+ * - octopipes_server_set_credits
+ * - octopipes_server_set_dispatch_error_cb
+ * - octopipes_add_groups
+ * - octopipes_remove_groups
+ */
+
+/**
+ * @brief start the worker of a client and open its pipes as the client does
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param char** groups
+ * @param size_t groups amount
+ * @param int* tx_fd: the pipe the client writes to
+ * @param int* rx_fd: the pipe the client reads from
+ * @return int
+ */
+
+int client_start(OctopipesServer* server, const char* client, const char** groups, const size_t groups_len, int* tx_fd, int* rx_fd) {
+  char tx_pipe[256];
+  char rx_pipe[256];
+  snprintf(tx_pipe, sizeof(tx_pipe), "%s/%s_tx.fifo", clients_dir, client);
+  snprintf(rx_pipe, sizeof(rx_pipe), "%s/%s_rx.fifo", clients_dir, client);
+  OctopipesServerError rc;
+  if ((rc = octopipes_server_start_worker(server, client, (char**) groups, groups_len, tx_pipe, rx_pipe)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not start worker %s: %s%s\n", KRED, client, octopipes_server_get_error_desc(rc), KNRM);
+    return 1;
+  }
+  if (pipe_open(tx_pipe, tx_fd) != OCTOPIPES_ERROR_SUCCESS || pipe_open(rx_pipe, rx_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open the pipes of %s%s\n", KRED, client, KNRM);
+    octopipes_server_stop_worker(server, client);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief stop the worker of a client and close its pipes
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param int tx_fd
+ * @param int rx_fd
+ */
+
+void client_stop(OctopipesServer* server, const char* client, const int tx_fd, const int rx_fd) {
+  pipe_close(tx_fd);
+  pipe_close(rx_fd);
+  octopipes_server_stop_worker(server, client);
+}
+
+/**
+ * @brief fill a message from origin to remote
+ * @param OctopipesMessage* message
+ * @param char* origin
+ * @param char* remote
+ * @param void* payload
+ * @param size_t payload size
+ * @param uint8_t ttl
+ * @param OctopipesOptions options
+ */
+
+void message_fill(OctopipesMessage* message, const char* origin, const char* remote, const void* payload, const size_t payload_size, const uint8_t ttl, const OctopipesOptions options) {
+  message->version = OCTOPIPES_VERSION_1;
+  message->origin = (char*) origin;
+  message->origin_size = strlen(origin);
+  message->remote = (char*) remote;
+  message->remote_size = strlen(remote);
+  message->ttl = ttl;
+  message->options = options;
+  message->correlation_id = 0;
+  message->epoch = 0;
+  message->sequence = 0;
+  message->data = (uint8_t*) payload;
+  message->data_size = payload_size;
+}
+
+/**
+ * @brief write a message to the server as a client does
+ * @param int tx_fd
+ * @param char* origin
+ * @param char* remote
+ * @param char* payload
+ * @param uint8_t ttl
+ * @param OctopipesOptions options
+ * @return int
+ */
+
+int client_write(const int tx_fd, const char* origin, const char* remote, const char* payload, const uint8_t ttl, const OctopipesOptions options) {
+  OctopipesMessage message;
+  message_fill(&message, origin, remote, payload, strlen(payload), ttl, options);
+  uint8_t* data;
+  size_t data_size;
+  if (octopipes_encode(&message, &data, &data_size) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  size_t written;
+  const int ret = pipe_write(tx_fd, data, data_size, &written) != OCTOPIPES_ERROR_SUCCESS || written != data_size;
+  free(data);
+  if (ret != 0) {
+    printf("%sCould not write to %s%s\n", KRED, remote, KNRM);
+  }
+  return ret;
+}
+
+/**
+ * @brief write a frame with a wrong checksum to the server, so the worker can't decode it
+ * @param int tx_fd
+ * @param char* origin
+ * @param char* remote
+ * @param size_t* frame size
+ * @return int
+ */
+
+int client_write_corrupted(const int tx_fd, const char* origin, const char* remote, size_t* frame_size) {
+  OctopipesMessage message;
+  message_fill(&message, origin, remote, "corrupted", 9, 0, OCTOPIPES_OPTIONS_NONE);
+  uint8_t* data;
+  if (octopipes_encode(&message, &data, frame_size) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  data[octopipes_get_checksum_offset(&message)] ^= 0xFF;
+  size_t written;
+  const int ret = pipe_write(tx_fd, data, *frame_size, &written) != OCTOPIPES_ERROR_SUCCESS || written != *frame_size;
+  free(data);
+  if (ret != 0) {
+    printf("%sCould not write to %s%s\n", KRED, remote, KNRM);
+  }
+  return ret;
+}
+
+/**
+ * @brief read the messages written to a client, until max messages are read or nothing is written for timeout milliseconds
+ * @param int rx_fd
+ * @param OctopipesMessage** messages
+ * @param size_t max
+ * @param int timeout
+ * @return size_t amount of messages read
+ */
+
+size_t client_read(const int rx_fd, OctopipesMessage** messages, const size_t max, const int timeout) {
+  uint8_t* stream = NULL;
+  size_t stream_len = 0;
+  size_t received = 0;
+  while (received < max) {
+    uint8_t* data;
+    size_t data_size;
+    if (pipe_read(rx_fd, &data, &data_size, timeout) != OCTOPIPES_ERROR_SUCCESS || octopipes_stream_append(&stream, &stream_len, data, data_size) != OCTOPIPES_ERROR_SUCCESS) {
+      break;
+    }
+    size_t offset = 0;
+    OctopipesMessage* message;
+    OctopipesError ret;
+    while (received < max && (ret = octopipes_decode_next(stream, stream_len, &offset, &message)) != OCTOPIPES_ERROR_NO_DATA_AVAILABLE) {
+      if (ret == OCTOPIPES_ERROR_SUCCESS) {
+        messages[received++] = message;
+      }
+    }
+    octopipes_stream_consume(&stream, &stream_len, offset);
+  }
+  free(stream);
+  return received;
+}
+
+/**
+ * @brief free the messages read by client_read
+ * @param OctopipesMessage** messages
+ * @param size_t messages amount
+ */
+
+void cleanup_messages(OctopipesMessage** messages, const size_t messages_len) {
+  for (size_t i = 0; i < messages_len; i++) {
+    octopipes_cleanup_message(messages[i]);
+  }
+}
+
+/**
+ * @brief verify the payload of a message
+ * @param OctopipesMessage* message
+ * @param char* payload
+ * @return int
+ */
+
+int verify_payload(const OctopipesMessage* message, const char* payload) {
+  if (message->data_size != strlen(payload) || memcmp(message->data, payload, message->data_size) != 0) {
+    printf("%sExpected '%s', got '%.*s'%s\n", KRED, payload, (int) message->data_size, (const char*) message->data, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief dispatch a frame bigger than the pipe of the clients subscribed to group, so they don't read it all and the next frames are queued
+ * @param OctopipesServer* server
+ * @param char* group
+ * @return int
+ */
+
+int dispatch_filler(OctopipesServer* server, const char* group) {
+  uint8_t* payload = (uint8_t*) calloc(FILLER_SIZE, sizeof(uint8_t));
+  if (payload == NULL) {
+    return 1;
+  }
+  OctopipesMessage message;
+  message_fill(&message, SERVER_NAME, group, payload, FILLER_SIZE, 0, OCTOPIPES_OPTIONS_NONE);
+  const char* failed;
+  const OctopipesServerError rc = octopipes_server_dispatch_message(server, &message, &failed);
+  free(payload);
+  return rc != OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief dispatch a message from the server to group
+ * @param OctopipesServer* server
+ * @param char* group
+ * @param char* payload
+ * @param uint8_t ttl
+ * @return int
+ */
+
+int dispatch_payload(OctopipesServer* server, const char* group, const char* payload, const uint8_t ttl) {
+  OctopipesMessage message;
+  message_fill(&message, SERVER_NAME, group, payload, strlen(payload), ttl, OCTOPIPES_OPTIONS_NONE);
+  const char* failed;
+  return octopipes_server_dispatch_message(server, &message, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+}
+
+/**
+ * @brief write a CAP payload to the server as client
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param uint8_t* payload (freed)
+ * @param size_t payload size
+ * @return int
+ */
+
+int cap_write(OctopipesServer* server, const char* client, uint8_t* payload, const size_t payload_size) {
+  if (payload == NULL) {
+    return 1;
+  }
+  OctopipesMessage message;
+  message_fill(&message, client, "", payload, payload_size, 0, OCTOPIPES_OPTIONS_NONE);
+  uint8_t* data;
+  size_t data_size;
+  const OctopipesError rc = octopipes_encode(&message, &data, &data_size);
+  free(payload);
+  if (rc != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  const int ret = pipe_send(server->cap_pipe, data, data_size, READ_TIMEOUT) != OCTOPIPES_ERROR_SUCCESS;
+  free(data);
+  return ret;
+}
+
+/**
+ * @brief send a subscription to the CAP, asking for the assignment to be written to reply_pipe
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param char** groups
+ * @param size_t groups amount
+ * @param char* reply_pipe
+ * @param OctopipesSubscriptionFlags flags
+ * @param uint64_t from: offset or time the replay starts from
+ * @return int
+ */
+
+int cap_subscribe(OctopipesServer* server, const char* client, const char** groups, const size_t groups_len, const char* reply_pipe, const OctopipesSubscriptionFlags flags, const uint64_t from) {
+  size_t payload_size;
+  uint8_t* payload = octopipes_cap_prepare_subscription(groups, groups_len, reply_pipe, flags, from, &payload_size);
+  return cap_write(server, client, payload, payload_size);
+}
+
+/**
+ * @brief add groups to (or remove groups from) a client through the CAP, process the request and verify the outcome written to the reply pipe
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param OctopipesCapMessage message type
+ * @param char** groups
+ * @param size_t groups amount
+ * @param OctopipesCapError expected outcome
+ * @return int
+ */
+
+int cap_update_groups(OctopipesServer* server, const char* client, const OctopipesCapMessage message_type, const char** groups, const size_t groups_len, const OctopipesCapError expected) {
+  char reply_pipe[256];
+  snprintf(reply_pipe, sizeof(reply_pipe), "%s.%s.groups", server->cap_pipe, client);
+  int reply_fd;
+  if (pipe_create(reply_pipe) != OCTOPIPES_ERROR_SUCCESS || pipe_open(reply_pipe, &reply_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create %s%s\n", KRED, reply_pipe, KNRM);
+    return 1;
+  }
+  size_t payload_size;
+  uint8_t* payload = octopipes_cap_prepare_groups_update(message_type, groups, groups_len, reply_pipe, &payload_size);
+  int ret = cap_write(server, client, payload, payload_size);
+  if (ret != 0) {
+    printf("%sCould not write to the CAP%s\n", KRED, KNRM);
+  }
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  octopipes_server_process_cap_all(server, &requests); //Returns the update error, which is written to the reply pipe too
+  //The outcome is an assignment without pipes
+  OctopipesMessage* reply[1];
+  const size_t received = ret == 0 ? client_read(reply_fd, reply, 1, READ_TIMEOUT) : 0;
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  char* fifo_tx = NULL;
+  char* fifo_rx = NULL;
+  if (received == 1 && octopipes_cap_parse_assign(reply[0]->data, reply[0]->data_size, &cap_error, &fifo_tx, &fifo_rx) != OCTOPIPES_ERROR_SUCCESS) {
+    ret = 1;
+  }
+  if (ret == 0 && (received != 1 || cap_error != expected)) {
+    printf("%sGroups update of '%s': expected outcome %d, got %zu replies (error %d)%s\n", KRED, client, expected, received, cap_error, KNRM);
+    ret = 1;
+  }
+  free(fifo_tx);
+  free(fifo_rx);
+  cleanup_messages(reply, received);
+  pipe_close(reply_fd);
+  pipe_delete(reply_pipe);
+  return ret;
+}
+
+/**
+ * @brief subscribe client through the CAP with reply_pipe, which is a FIFO opened by the test or a symlink to it;
+ * verify whether the assignment is written and the client subscribed
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param char* reply_pipe
+ * @param int reply_fd the FIFO the reply pipe leads to
+ * @param int accepted whether the server should accept the reply pipe
+ * @return int
+ */
+
+int verify_reply_pipe(OctopipesServer* server, const char* client, const char* reply_pipe, const int reply_fd, const int accepted) {
+  if (cap_subscribe(server, client, NULL, 0, reply_pipe, OCTOPIPES_SUBSCRIPTION_NONE, 0) != 0) {
+    printf("%sCould not write to the CAP%s\n", KRED, KNRM);
+    return 1;
+  }
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  octopipes_server_process_cap_all(server, &requests);
+  uint8_t* data = NULL;
+  size_t data_size = 0;
+  const int written = pipe_read(reply_fd, &data, &data_size, READ_TIMEOUT) == OCTOPIPES_ERROR_SUCCESS && data_size > 0;
+  free(data);
+  const int subscribed = octopipes_server_is_subscribed(server, client) == OCTOPIPES_SERVER_ERROR_SUCCESS;
+  if (subscribed) {
+    octopipes_server_stop_worker(server, client);
+  }
+  if (written != accepted || subscribed != accepted) {
+    printf("%sReply pipe %s: expected %s, but assignment %s and client %s%s\n", KRED, reply_pipe, accepted ? "accepted" : "refused", written ? "written" : "not written", subscribed ? "subscribed" : "not subscribed", KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief the server writes the assignment only to a FIFO named after the CAP and the client; other paths and symlinks are refused
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_reply_pipe(OctopipesServer* server) {
+  printf("%sValidating reply pipes%s\n", KYEL, KNRM);
+  char valid_pipe[256];
+  char outside_pipe[256];
+  char link_pipe[256];
+  snprintf(valid_pipe, sizeof(valid_pipe), "%s.replied.1", server->cap_pipe);
+  snprintf(outside_pipe, sizeof(outside_pipe), "%s/outside.fifo", clients_dir);
+  snprintf(link_pipe, sizeof(link_pipe), "%s.linked.1", server->cap_pipe);
+  int valid_fd, outside_fd;
+  if (pipe_create(valid_pipe) != OCTOPIPES_ERROR_SUCCESS || pipe_open(valid_pipe, &valid_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create %s%s\n", KRED, valid_pipe, KNRM);
+    return 1;
+  }
+  if (pipe_create(outside_pipe) != OCTOPIPES_ERROR_SUCCESS || pipe_open(outside_pipe, &outside_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create %s%s\n", KRED, outside_pipe, KNRM);
+    pipe_close(valid_fd);
+    pipe_delete(valid_pipe);
+    return 1;
+  }
+  unlink(link_pipe);
+  int ret = symlink(outside_pipe, link_pipe) != 0;
+  ret = ret || verify_reply_pipe(server, "replied", valid_pipe, valid_fd, 1);
+  //Not named after the CAP and the client
+  ret = ret || verify_reply_pipe(server, "outside", outside_pipe, outside_fd, 0);
+  //Named after another client
+  ret = ret || verify_reply_pipe(server, "replied", link_pipe, outside_fd, 0);
+  //Well named, but a symlink
+  ret = ret || verify_reply_pipe(server, "linked", link_pipe, outside_fd, 0);
+  //A groups update is answered on the reply pipe too, also when the server doesn't know the client
+  const char* groups[] = {"replied"};
+  ret = ret || cap_update_groups(server, "unknown", OCTOPIPES_CAP_REMOVE_GROUPS, groups, 1, OCTOPIPES_CAP_ERROR_NOT_SUBSCRIBED);
+  unlink(link_pipe);
+  pipe_close(outside_fd);
+  pipe_delete(outside_pipe);
+  pipe_close(valid_fd);
+  pipe_delete(valid_pipe);
+  return ret;
+}
+
+/**
+ * @brief subscribe client through the CAP and verify the assignment refuses its name
+ * @param OctopipesServer* server
+ * @param char* client
+ * @return int
+ */
+
+int verify_invalid_name(OctopipesServer* server, const char* client) {
+  char reply_pipe[256];
+  snprintf(reply_pipe, sizeof(reply_pipe), "%s.%s.1", server->cap_pipe, client);
+  int reply_fd;
+  if (pipe_create(reply_pipe) != OCTOPIPES_ERROR_SUCCESS || pipe_open(reply_pipe, &reply_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create %s%s\n", KRED, reply_pipe, KNRM);
+    return 1;
+  }
+  const char* groups[] = {"trie"};
+  int ret = cap_subscribe(server, client, groups, 1, reply_pipe, OCTOPIPES_SUBSCRIPTION_NONE, 0);
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  octopipes_server_process_cap_all(server, &requests);
+  OctopipesMessage* assignment[1];
+  const size_t received = ret == 0 ? client_read(reply_fd, assignment, 1, READ_TIMEOUT) : 0;
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  char* fifo_tx = NULL;
+  char* fifo_rx = NULL;
+  if (received == 1) {
+    octopipes_cap_parse_assign(assignment[0]->data, assignment[0]->data_size, &cap_error, &fifo_tx, &fifo_rx);
+  }
+  if (ret == 0 && (cap_error != OCTOPIPES_CAP_ERROR_INVALID_NAME || octopipes_server_is_subscribed(server, client) == OCTOPIPES_SERVER_ERROR_SUCCESS)) {
+    printf("%sClient '%s' should have been refused, got %zu assignments (error %d)%s\n", KRED, client, received, cap_error, KNRM);
+    octopipes_server_stop_worker(server, client);
+    ret = 1;
+  }
+  free(fifo_tx);
+  free(fifo_rx);
+  cleanup_messages(assignment, received);
+  pipe_close(reply_fd);
+  pipe_delete(reply_pipe);
+  return ret;
+}
+
+/**
+ * @brief verify the routing trie has no node left
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int verify_trie_empty(OctopipesServer* server) {
+  const OctopipesServerTrieNode* root = server->routing_trie;
+  if (root->children_len != 0 || root->single_wildcard != NULL || root->multi_wildcard != NULL || root->subscribers_len != 0) {
+    printf("%sThe routing trie should be empty, but the root has %zu children%s\n", KRED, root->children_len, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief client ids with wildcards or level separators are refused, since they would be routed as patterns; a client matched by
+ * several patterns receives a message once, and the trie nodes are freed once their subscribers are stopped
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_trie(OctopipesServer* server) {
+  printf("%sRouting through the trie%s\n", KYEL, KNRM);
+  const char* invalid_ids[] = {"wild*", "all#", "nested/id", ""};
+  int ret = 0;
+  for (size_t i = 0; i < 4 && ret == 0; i++) {
+    if (octopipes_server_start_worker(server, invalid_ids[i], NULL, 0, "tx", "rx") != OCTOPIPES_SERVER_ERROR_BAD_CLIENT_ID) {
+      printf("%sWorker '%s' should have been refused%s\n", KRED, invalid_ids[i], KNRM);
+      octopipes_server_stop_worker(server, invalid_ids[i]);
+      ret = 1;
+    }
+  }
+  ret = ret || verify_invalid_name(server, "wild*") || verify_invalid_name(server, "all#");
+  //Both patterns match the message, which is delivered once
+  const char* patterns[] = {"sensors/*/temperature", "sensors/#"};
+  int leaf_tx, leaf_rx;
+  if (ret != 0 || client_start(server, "leaf", patterns, 2, &leaf_tx, &leaf_rx) != 0) {
+    return 1;
+  }
+  ret = dispatch_payload(server, "sensors/kitchen/temperature", "matched", 0) || dispatch_payload(server, "sensors", "parent", 0);
+  OctopipesMessage* messages[3];
+  const size_t received = ret == 0 ? client_read(leaf_rx, messages, 3, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 2) {
+    printf("%sLeaf received %zu messages out of 2%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = verify_payload(messages[0], "matched") || verify_payload(messages[1], "parent");
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "leaf", leaf_tx, leaf_rx);
+  return ret || verify_trie_empty(server);
+}
+
+/**
+ * @brief get the worker of a client
+ * @param OctopipesServer* server
+ * @param char* client
+ * @return OctopipesServerWorker*
+ */
+
+OctopipesServerWorker* get_worker(OctopipesServer* server, const char* client) {
+  for (size_t i = 0; i < server->workers_len; i++) {
+    if (strcmp(server->workers[i]->client_id, client) == 0) {
+      return server->workers[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief handler of the services: it queries and configures the server, then dispatches the message again
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* message
+ */
+
+void on_service(OctopipesServer* server, const OctopipesMessage* message) {
+  service_calls++;
+  char** subscriptions;
+  size_t sub_len;
+  if (octopipes_server_get_subscriptions(server, "watcher", &subscriptions, &sub_len) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    free(subscriptions);
+  }
+  octopipes_server_set_rate_limit(server, "watcher", 0, 0, OCTOPIPES_SERVER_RATE_LIMIT_DROP);
+  OctopipesMessage nested = *message;
+  const char* failed;
+  OctopipesServerError rc;
+  if ((rc = octopipes_server_dispatch_message(server, &nested, &failed)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    service_error = rc;
+  }
+}
+
+/**
+ * @brief handler which unregisters itself
+ * @param OctopipesServer* server
+ * @param OctopipesMessage* message
+ */
+
+void on_once(OctopipesServer* server, const OctopipesMessage* message) {
+  (void) message;
+  once_calls++;
+  once_error = octopipes_server_unregister_handler(server, "once/*");
+}
+
+/**
+ * @brief handlers are matched through the routing trie, wildcards included, and called once routing is unlocked: they can call the
+ * server functions, unregister themselves too, while the dispatches nested deeper than HANDLER_DEPTH fail
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_handlers(OctopipesServer* server) {
+  printf("%sCalling handlers%s\n", KYEL, KNRM);
+  const char* watcher_groups[] = {"services/#"};
+  int watcher_tx, watcher_rx, caller_tx, caller_rx;
+  if (client_start(server, "watcher", watcher_groups, 1, &watcher_tx, &watcher_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "caller", NULL, 0, &caller_tx, &caller_rx) != 0) {
+    client_stop(server, "watcher", watcher_tx, watcher_rx);
+    return 1;
+  }
+  int ret = octopipes_server_register_handler(server, "services/#", on_service) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || octopipes_server_register_handler(server, "unrelated/*", on_service) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || octopipes_server_register_handler(server, "once/*", on_once) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  //The service dispatches each message again, until the nesting is refused
+  ret = ret || dispatch_payload(server, "services/echo", "nested", 0);
+  if (ret == 0 && (service_calls != HANDLER_DEPTH || service_error != OCTOPIPES_SERVER_ERROR_HANDLER_DEPTH)) {
+    printf("%sExpected %d nested calls, the last one refused; got %zu (%s)%s\n", KRED, HANDLER_DEPTH, service_calls, octopipes_server_get_error_desc(service_error), KNRM);
+    ret = 1;
+  }
+  OctopipesMessage* messages[HANDLER_DEPTH + 1];
+  const size_t received = ret == 0 ? client_read(watcher_rx, messages, HANDLER_DEPTH + 1, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != HANDLER_DEPTH) {
+    printf("%sWatcher received %zu messages out of %d%s\n", KRED, received, HANDLER_DEPTH, KNRM);
+    ret = 1;
+  }
+  cleanup_messages(messages, received);
+  //The subscriptions are a copy of the worker groups, freed with the array
+  char** subscriptions = NULL;
+  size_t sub_len = 0;
+  OctopipesServerWorker* watcher = get_worker(server, "watcher");
+  if (ret == 0 && (octopipes_server_get_subscriptions(server, "watcher", &subscriptions, &sub_len) != OCTOPIPES_SERVER_ERROR_SUCCESS || sub_len != watcher->subscriptions)) {
+    printf("%sCould not get the subscriptions of the watcher%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  for (size_t i = 0; ret == 0 && i < sub_len; i++) {
+    if (subscriptions[i] == watcher->subscriptions_list[i] || strcmp(subscriptions[i], watcher->subscriptions_list[i]) != 0) {
+      printf("%sSubscription %zu is not a copy of '%s'%s\n", KRED, i, watcher->subscriptions_list[i], KNRM);
+      ret = 1;
+    }
+  }
+  free(subscriptions);
+  //Unknown clients are not found in the workers map
+  size_t bytes, paused;
+  if (ret == 0 && (octopipes_server_set_rate_limit(server, "nobody", 0, 0, OCTOPIPES_SERVER_RATE_LIMIT_DROP) != OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND ||
+                   octopipes_server_get_memory_stats(server, "nobody", &bytes, &paused) != OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND ||
+                   octopipes_server_set_credits(server, "nobody", 0, 0) != OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND ||
+                   octopipes_server_get_subscriptions(server, "nobody", &subscriptions, &sub_len) != OCTOPIPES_SERVER_ERROR_WORKER_NOT_FOUND)) {
+    printf("%sAn unknown client has been found%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //A handler called by a processing function unregisters itself; it's not called for the next message
+  ret = ret || client_write(caller_tx, "caller", "once/first", "first", 0, OCTOPIPES_OPTIONS_NONE);
+  ret = ret || client_write(caller_tx, "caller", "once/second", "second", 0, OCTOPIPES_OPTIONS_NONE);
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 2)) {
+    printf("%sExpected 2 messages to be processed, processed %zu%s\n", KRED, requests, KNRM);
+    ret = 1;
+  }
+  if (ret == 0 && (once_calls != 1 || once_error != OCTOPIPES_SERVER_ERROR_SUCCESS)) {
+    printf("%sThe handler should have been called once and unregistered, called %zu times (%s)%s\n", KRED, once_calls, octopipes_server_get_error_desc(once_error), KNRM);
+    ret = 1;
+  }
+  //The nodes of the handlers are freed once they're unregistered
+  if (octopipes_server_unregister_handler(server, "services/#") != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    ret = 1;
+  }
+  if (octopipes_server_unregister_handler(server, "unrelated/*") != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    ret = 1;
+  }
+  client_stop(server, "caller", caller_tx, caller_rx);
+  client_stop(server, "watcher", watcher_tx, watcher_rx);
+  return ret || verify_trie_empty(server);
+}
+
+
+/**
+ * @brief the messages a client sent together are dispatched by priority class, highest first
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_priority(OctopipesServer* server) {
+  printf("%sDispatching by priority%s\n", KYEL, KNRM);
+  const char* producer_groups[] = {"producer"};
+  const char* consumer_groups[] = {"priority"};
+  int producer_tx, producer_rx, consumer_tx, consumer_rx;
+  if (client_start(server, "producer", producer_groups, 1, &producer_tx, &producer_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "consumer", consumer_groups, 1, &consumer_tx, &consumer_rx) != 0) {
+    client_stop(server, "producer", producer_tx, producer_rx);
+    return 1;
+  }
+  int ret = client_write(producer_tx, "producer", "priority", "normal", 0, OCTOPIPES_OPTIONS_NONE);
+  ret = ret || client_write(producer_tx, "producer", "priority", "elevated", 0, OCTOPIPES_OPTIONS_PRIORITY_ELEVATED);
+  ret = ret || client_write(producer_tx, "producer", "priority", "critical", 0, OCTOPIPES_OPTIONS_PRIORITY_CRITICAL);
+  ret = ret || client_write(producer_tx, "producer", "priority", "high", 0, OCTOPIPES_OPTIONS_PRIORITY_HIGH);
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 4)) {
+    printf("%sExpected 4 messages to be processed, processed %zu%s\n", KRED, requests, KNRM);
+    ret = 1;
+  }
+  OctopipesMessage* messages[4];
+  const size_t received = ret == 0 ? client_read(consumer_rx, messages, 4, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 4) {
+    printf("%sConsumer received %zu messages out of 4%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  const char* expected[] = {"critical", "high", "elevated", "normal"};
+  for (size_t i = 0; i < received && ret == 0; i++) {
+    ret = verify_payload(messages[i], expected[i]);
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "consumer", consumer_tx, consumer_rx);
+  client_stop(server, "producer", producer_tx, producer_rx);
+  return ret;
+}
+
+/**
+ * @brief messages whose TTL elapses are discarded, both while waiting in the inbox of the sender and in the outbound queue of the recipient
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_expiry(OctopipesServer* server) {
+  printf("%sExpiring queued messages%s\n", KYEL, KNRM);
+  const char* producer_groups[] = {"producer"};
+  const char* consumer_groups[] = {"expiry"};
+  int producer_tx, producer_rx, consumer_tx, consumer_rx;
+  if (client_start(server, "producer", producer_groups, 1, &producer_tx, &producer_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "consumer", consumer_groups, 1, &consumer_tx, &consumer_rx) != 0) {
+    client_stop(server, "producer", producer_tx, producer_rx);
+    return 1;
+  }
+  //Not dispatched within its TTL
+  int ret = client_write(producer_tx, "producer", "expiry", "expired", 1, OCTOPIPES_OPTIONS_NONE);
+  //Queued behind a frame the consumer doesn't read within the TTL
+  ret = ret || dispatch_filler(server, "expiry") || dispatch_payload(server, "expiry", "late", 1);
+  usleep(1000000 + INBOX_WAIT);
+  size_t requests = 0;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 0)) {
+    printf("%sExpired message has been processed%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  OctopipesMessage* messages[2];
+  const size_t received = ret == 0 ? client_read(consumer_rx, messages, 2, READ_TIMEOUT) : 0;
+  if (ret == 0 && (received != 1 || messages[0]->data_size != FILLER_SIZE)) {
+    printf("%sConsumer should have received the filler only, but received %zu messages%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  cleanup_messages(messages, received);
+  size_t inbox_expired = 0, outbound_expired = 0, unused;
+  if (ret == 0) {
+    octopipes_server_get_expired_stats(server, "producer", &inbox_expired, &unused);
+    octopipes_server_get_expired_stats(server, "consumer", &unused, &outbound_expired);
+    if (inbox_expired != 1 || outbound_expired != 1) {
+      printf("%sExpected 1 message expired in the inbox and 1 in the outbound queue, got %zu and %zu%s\n", KRED, inbox_expired, outbound_expired, KNRM);
+      ret = 1;
+    }
+  }
+  client_stop(server, "consumer", consumer_tx, consumer_rx);
+  client_stop(server, "producer", producer_tx, producer_rx);
+  return ret;
+}
+
+/**
+ * @brief a client which conflates has at most one frame of each group queued, the latest one
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_conflation(OctopipesServer* server) {
+  printf("%sConflating queued frames%s\n", KYEL, KNRM);
+  if (octopipes_server_set_conflation(NULL, "consumer", 1) != OCTOPIPES_SERVER_ERROR_UNINITIALIZED) {
+    printf("%sSetting the conflation of an uninitialized server should fail%s\n", KRED, KNRM);
+    return 1;
+  }
+  const char* consumer_groups[] = {"filler", "conflated"};
+  int consumer_tx, consumer_rx;
+  if (client_start(server, "consumer", consumer_groups, 2, &consumer_tx, &consumer_rx) != 0) {
+    return 1;
+  }
+  int ret = octopipes_server_set_conflation(server, "consumer", 1) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || dispatch_filler(server, "filler");
+  const char* values[] = {"0", "1", "2", "3", "4"};
+  for (size_t i = 0; i < 5 && ret == 0; i++) {
+    ret = dispatch_payload(server, "conflated", values[i], 0);
+  }
+  size_t depth = 0, dropped = 0;
+  if (ret == 0 && (octopipes_server_get_outbound_stats(server, "consumer", &depth, &dropped) != OCTOPIPES_SERVER_ERROR_SUCCESS || depth != 2 || dropped != 0)) {
+    printf("%sExpected the filler and one conflated frame queued, got %zu frames (%zu dropped)%s\n", KRED, depth, dropped, KNRM);
+    ret = 1;
+  }
+  OctopipesMessage* messages[3];
+  const size_t received = ret == 0 ? client_read(consumer_rx, messages, 3, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 2) {
+    printf("%sConsumer received %zu messages out of 2%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = messages[0]->data_size != FILLER_SIZE || verify_payload(messages[1], "4");
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "consumer", consumer_tx, consumer_rx);
+  return ret;
+}
+
+/**
+ * @brief a client over its rate limit gets its messages dropped (drop policy) or is read later (backpressure policy)
+ * @param OctopipesServer* server
+ * @param OctopipesServerRateLimitPolicy policy
+ * @return int
+ */
+
+int test_rate_limit(OctopipesServer* server, const OctopipesServerRateLimitPolicy policy) {
+  printf("%sRate limiting with %s policy%s\n", KYEL, policy == OCTOPIPES_SERVER_RATE_LIMIT_DROP ? "drop" : "backpressure", KNRM);
+  const char* producer_groups[] = {"producer"};
+  int producer_tx, producer_rx;
+  if (client_start(server, "producer", producer_groups, 1, &producer_tx, &producer_rx) != 0) {
+    return 1;
+  }
+  int ret = octopipes_server_set_rate_limit(server, "producer", RATE_LIMIT, 0, policy) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  for (size_t i = 0; i < RATE_LIMIT_MESSAGES && ret == 0; i++) {
+    ret = client_write(producer_tx, "producer", "rate", "message", 0, OCTOPIPES_OPTIONS_NONE);
+  }
+  usleep(INBOX_WAIT);
+  //The bucket holds a second of messages, then it's refilled at the rate
+  size_t requests = 0;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests < RATE_LIMIT || requests > RATE_LIMIT + 5)) {
+    printf("%sExpected about %d messages let through, got %zu%s\n", KRED, RATE_LIMIT, requests, KNRM);
+    ret = 1;
+  }
+  size_t dropped = 0, throttled = 0;
+  if (policy == OCTOPIPES_SERVER_RATE_LIMIT_DROP) {
+    octopipes_server_get_rate_limit_stats(server, "producer", &dropped, &throttled);
+    if (ret == 0 && requests + dropped != RATE_LIMIT_MESSAGES) {
+      printf("%sMessages let through (%zu) and dropped (%zu) don't add up to %d%s\n", KRED, requests, dropped, RATE_LIMIT_MESSAGES, KNRM);
+      ret = 1;
+    }
+  } else {
+    //The others are read as the bucket refills
+    const unsigned long deadline = octopipes_get_time_ms() + (RATE_LIMIT_MESSAGES / RATE_LIMIT) * 1000 + 1000;
+    while (ret == 0 && requests < RATE_LIMIT_MESSAGES && octopipes_get_time_ms() < deadline) {
+      size_t processed = 0;
+      usleep(INBOX_WAIT);
+      octopipes_server_process_all(server, &processed, &failed);
+      requests += processed;
+    }
+    octopipes_server_get_rate_limit_stats(server, "producer", &dropped, &throttled);
+    if (ret == 0 && (requests != RATE_LIMIT_MESSAGES || dropped != 0 || throttled == 0)) {
+      printf("%sExpected all the %d messages through a throttled client, got %zu (%zu dropped, throttled %zu times)%s\n", KRED, RATE_LIMIT_MESSAGES, requests, dropped, throttled, KNRM);
+      ret = 1;
+    }
+  }
+  client_stop(server, "producer", producer_tx, producer_rx);
+  return ret;
+}
+
+/**
+ * @brief a client whose outbound queue overflows with the disconnect policy is stopped by the next processing call;
+ * the frame being written when the queue overflowed is completed, then the client is told with an UNSUBSCRIPTION from the server
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_overflow_disconnect(OctopipesServer* server) {
+  printf("%sDisconnecting an overflowed client%s\n", KYEL, KNRM);
+  const char* consumer_groups[] = {"overflow"};
+  int consumer_tx, consumer_rx;
+  int ret = octopipes_server_set_outbound_queue(server, OVERFLOW_QUEUE_SIZE, OCTOPIPES_SERVER_OVERFLOW_DISCONNECT) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || client_start(server, "consumer", consumer_groups, 1, &consumer_tx, &consumer_rx);
+  octopipes_server_set_outbound_queue(server, 1024, OCTOPIPES_SERVER_OVERFLOW_DROP_OLDEST);
+  if (ret != 0) {
+    return 1;
+  }
+  //The filler is partially written, then the queue overflows
+  ret = dispatch_filler(server, "overflow") || dispatch_payload(server, "overflow", "queued", 0);
+  if (ret == 0 && dispatch_payload(server, "overflow", "overflowed", 0) == 0) {
+    printf("%sThe outbound queue should have overflowed%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //The rest of the filler is written as soon as the client makes room for it
+  OctopipesMessage* messages[2];
+  size_t received = ret == 0 ? client_read(consumer_rx, messages, 2, READ_TIMEOUT) : 0;
+  if (ret == 0 && (received != 1 || messages[0]->data_size != FILLER_SIZE)) {
+    printf("%sConsumer should have received the filler only, but received %zu messages%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  cleanup_messages(messages, received);
+  size_t requests;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || octopipes_server_is_subscribed(server, "consumer") == OCTOPIPES_SERVER_ERROR_SUCCESS)) {
+    printf("%sConsumer should have been disconnected%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  received = ret == 0 ? client_read(consumer_rx, messages, 2, READ_TIMEOUT) : 0;
+  if (ret == 0 && (received != 1 || messages[0]->origin != NULL || octopipes_cap_get_message(messages[0]->data, messages[0]->data_size) != OCTOPIPES_CAP_UNSUBSCRIPTION)) {
+    printf("%sConsumer should have been notified of the disconnection, but received %zu messages%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "consumer", consumer_tx, consumer_rx);
+  return ret;
+}
+
+/**
+ * @brief the last message of a group is sent to the clients which subscribe to it later; messages to a client id are not retained
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_retained(OctopipesServer* server) {
+  printf("%sRetaining the state of the groups%s\n", KYEL, KNRM);
+  int target_tx, target_rx, watcher_tx, watcher_rx;
+  if (client_start(server, "target", NULL, 0, &target_tx, &target_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "watcher", NULL, 0, &watcher_tx, &watcher_rx) != 0) {
+    client_stop(server, "target", target_tx, target_rx);
+    return 1;
+  }
+  int ret = octopipes_server_set_retained_cache(server, RETAINED_BUDGET) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || dispatch_payload(server, "state", "stale", 0) || dispatch_payload(server, "state", "current", 0);
+  ret = ret || dispatch_payload(server, "target", "direct", 0);
+  size_t groups = 0, bytes = 0, evicted = 0;
+  if (ret == 0 && (octopipes_server_get_retained_stats(server, &groups, &bytes, &evicted) != OCTOPIPES_SERVER_ERROR_SUCCESS || groups != 1)) {
+    printf("%sExpected the state group only to be retained, got %zu groups%s\n", KRED, groups, KNRM);
+    ret = 1;
+  }
+  //Subscribing to more groups delivers their retained messages, as subscribing does
+  const char* watched[] = {"#"};
+  ret = ret || cap_update_groups(server, "watcher", OCTOPIPES_CAP_ADD_GROUPS, watched, 1, OCTOPIPES_CAP_ERROR_SUCCESS);
+  OctopipesMessage* messages[2];
+  const size_t received = ret == 0 ? client_read(watcher_rx, messages, 2, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 1) {
+    printf("%sWatcher received %zu messages out of 1%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = verify_payload(messages[0], "current");
+  }
+  cleanup_messages(messages, received);
+  octopipes_server_set_retained_cache(server, 0);
+  client_stop(server, "watcher", watcher_tx, watcher_rx);
+  client_stop(server, "target", target_tx, target_rx);
+  return ret;
+}
+
+/**
+ * @brief verify the offset the next message of a group will be logged at
+ * @param OctopipesServer* server
+ * @param char* group
+ * @param uint64_t expected next offset
+ * @return int
+ */
+
+int verify_log_next(OctopipesServer* server, const char* group, const uint64_t expected) {
+  uint64_t first, next;
+  if (octopipes_server_get_log_offsets(server, group, &first, &next) != OCTOPIPES_SERVER_ERROR_SUCCESS || next != expected) {
+    printf("%sExpected the next offset of %s to be %llu%s\n", KRED, group, (unsigned long long) expected, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief the messages of a group are logged and replayed to a client subscribing from an offset, followed by the live ones;
+ * messages to a client id are not logged and groups beyond the max groups aren't either
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_log(OctopipesServer* server) {
+  printf("%sReplaying the log of the groups%s\n", KYEL, KNRM);
+  //The log outlives the test, so offsets are relative to the ones found
+  uint64_t first, journal_next, recorder_next;
+  if (octopipes_server_get_log_offsets(server, "journal", &first, &journal_next) != OCTOPIPES_SERVER_ERROR_SUCCESS || octopipes_server_get_log_offsets(server, "recorder", &first, &recorder_next) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not get the log offsets%s\n", KRED, KNRM);
+    return 1;
+  }
+  int recorder_tx, recorder_rx;
+  if (client_start(server, "recorder", NULL, 0, &recorder_tx, &recorder_rx) != 0) {
+    return 1;
+  }
+  int ret = dispatch_payload(server, "journal", "first", 0) || dispatch_payload(server, "journal", "second", 0);
+  ret = ret || dispatch_payload(server, "recorder", "direct", 0);
+  ret = ret || verify_log_next(server, "journal", journal_next + 2) || verify_log_next(server, "recorder", recorder_next);
+  //Groups which aren't loaded yet are not logged once the log is full
+  if (ret == 0 && octopipes_server_set_log_max_groups(server, 0) == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    OctopipesMessage message;
+    message_fill(&message, SERVER_NAME, "unbounded", "lost", 4, 0, OCTOPIPES_OPTIONS_NONE);
+    const char* failed;
+    if (octopipes_server_dispatch_message(server, &message, &failed) != OCTOPIPES_SERVER_ERROR_LOG_FULL) {
+      printf("%sThe log should have refused a new group%s\n", KRED, KNRM);
+      ret = 1;
+    }
+    ret = ret || dispatch_payload(server, "journal", "third", 0) || verify_log_next(server, "journal", journal_next + 3);
+  } else {
+    ret = 1;
+  }
+  octopipes_server_set_log_max_groups(server, 1024);
+  client_stop(server, "recorder", recorder_tx, recorder_rx);
+  if (ret != 0) {
+    return ret;
+  }
+  //Subscribe replaying the group from the first message of this run
+  char reply_pipe[256];
+  char tx_pipe[256];
+  char rx_pipe[256];
+  snprintf(reply_pipe, sizeof(reply_pipe), "%s.replayer.1", server->cap_pipe);
+  snprintf(tx_pipe, sizeof(tx_pipe), "%s/replayer_tx.fifo", clients_dir);
+  snprintf(rx_pipe, sizeof(rx_pipe), "%s/replayer_rx.fifo", clients_dir);
+  int reply_fd;
+  if (pipe_create(reply_pipe) != OCTOPIPES_ERROR_SUCCESS || pipe_open(reply_pipe, &reply_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not create %s%s\n", KRED, reply_pipe, KNRM);
+    return 1;
+  }
+  const char* groups[] = {"journal"};
+  ret = cap_subscribe(server, "replayer", groups, 1, reply_pipe, OCTOPIPES_SUBSCRIPTION_REPLAY_OFFSET, journal_next);
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  ret = ret || octopipes_server_process_cap_all(server, &requests) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 1;
+  ret = ret || octopipes_server_is_subscribed(server, "replayer") != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  uint8_t* data = NULL;
+  size_t data_size = 0;
+  pipe_read(reply_fd, &data, &data_size, READ_TIMEOUT);
+  free(data);
+  pipe_close(reply_fd);
+  pipe_delete(reply_pipe);
+  if (ret != 0) {
+    printf("%sReplayer could not subscribe%s\n", KRED, KNRM);
+    return 1;
+  }
+  int replayer_tx, replayer_rx;
+  if (pipe_open(tx_pipe, &replayer_tx) != OCTOPIPES_ERROR_SUCCESS || pipe_open(rx_pipe, &replayer_rx) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not open the pipes of replayer%s\n", KRED, KNRM);
+    octopipes_server_stop_worker(server, "replayer");
+    return 1;
+  }
+  //The live messages follow the replayed ones
+  ret = dispatch_payload(server, "journal", "live", 0);
+  const char* expected[] = {"first", "second", "third", "live"};
+  OctopipesMessage* messages[5];
+  const size_t received = ret == 0 ? client_read(replayer_rx, messages, 5, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 4) {
+    printf("%sReplayer received %zu messages out of 4%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  for (size_t i = 0; ret == 0 && i < received; i++) {
+    ret = verify_payload(messages[i], expected[i]);
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "replayer", replayer_tx, replayer_rx);
+  return ret;
+}
+
+/**
+ * @brief read messages written to a client and verify their payloads are the indexes from first on, in order
+ * @param int rx_fd
+ * @param char* client
+ * @param size_t first index
+ * @param size_t amount of messages expected
+ * @return int
+ */
+
+int verify_sequence(const int rx_fd, const char* client, const size_t first, const size_t amount) {
+  OctopipesMessage** messages = (OctopipesMessage**) malloc(sizeof(OctopipesMessage*) * (amount + 1));
+  if (messages == NULL) {
+    return 1;
+  }
+  const size_t received = client_read(rx_fd, messages, amount + 1, READ_TIMEOUT);
+  int ret = 0;
+  if (received != amount) {
+    printf("%s%s received %zu messages out of %zu%s\n", KRED, client, received, amount, KNRM);
+    ret = 1;
+  }
+  for (size_t i = 0; ret == 0 && i < received; i++) {
+    char payload[32];
+    snprintf(payload, sizeof(payload), "%zu", first + i);
+    ret = verify_payload(messages[i], payload);
+  }
+  cleanup_messages(messages, received);
+  free(messages);
+  return ret;
+}
+
+/**
+ * @brief messages are routed by the dispatcher threads in the order they're sent, also while workers are started and stopped;
+ * once dispatchers are stopped, messages are processed by the process functions again
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_dispatchers(OctopipesServer* server) {
+  printf("%sRouting with dispatchers%s\n", KYEL, KNRM);
+  const char* sink_groups[] = {"sharded"};
+  int sender_tx, sender_rx, sink_tx, sink_rx, quitter_tx, quitter_rx, late_tx, late_rx;
+  if (client_start(server, "sender", NULL, 0, &sender_tx, &sender_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "sink", sink_groups, 1, &sink_tx, &sink_rx) != 0) {
+    client_stop(server, "sender", sender_tx, sender_rx);
+    return 1;
+  }
+  //Messages sent before the dispatchers start are dispatched by them
+  int ret = client_write(sender_tx, "sender", "sharded", "0", 0, OCTOPIPES_OPTIONS_NONE);
+  usleep(INBOX_WAIT);
+  ret = ret || octopipes_server_start_dispatchers(server, DISPATCHERS) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || verify_sequence(sink_rx, "sink", 0, 1);
+  size_t requests;
+  const char* failed;
+  if (ret == 0 && octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_THREAD_ALREADY_RUNNING) {
+    printf("%sMessages can't be processed while dispatchers are running%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //A worker stopped while it's queued to its dispatcher is skipped
+  if (ret == 0 && client_start(server, "quitter", NULL, 0, &quitter_tx, &quitter_rx) == 0) {
+    for (size_t i = 0; i < QUITTER_MESSAGES && ret == 0; i++) {
+      ret = client_write(quitter_tx, "quitter", "nowhere", "gone", 0, OCTOPIPES_OPTIONS_NONE);
+    }
+    client_stop(server, "quitter", quitter_tx, quitter_rx);
+  } else {
+    ret = 1;
+  }
+  for (size_t i = 1; i < DISPATCHED_MESSAGES && ret == 0; i++) {
+    char payload[32];
+    snprintf(payload, sizeof(payload), "%zu", i);
+    ret = client_write(sender_tx, "sender", "sharded", payload, 0, OCTOPIPES_OPTIONS_NONE);
+  }
+  ret = ret || verify_sequence(sink_rx, "sink", 1, DISPATCHED_MESSAGES - 1);
+  //A worker started while dispatchers are running is routed
+  if (ret == 0 && client_start(server, "late", sink_groups, 1, &late_tx, &late_rx) == 0) {
+    ret = client_write(sender_tx, "sender", "sharded", "200", 0, OCTOPIPES_OPTIONS_NONE);
+    ret = ret || verify_sequence(sink_rx, "sink", DISPATCHED_MESSAGES, 1) || verify_sequence(late_rx, "late", DISPATCHED_MESSAGES, 1);
+    client_stop(server, "late", late_tx, late_rx);
+  } else {
+    ret = 1;
+  }
+  if (octopipes_server_stop_dispatchers(server) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not stop the dispatchers%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //Messages are processed by the process functions again
+  ret = ret || client_write(sender_tx, "sender", "sharded", "201", 0, OCTOPIPES_OPTIONS_NONE);
+  usleep(INBOX_WAIT);
+  ret = ret || octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 1;
+  ret = ret || verify_sequence(sink_rx, "sink", DISPATCHED_MESSAGES + 1, 1);
+  client_stop(server, "sink", sink_tx, sink_rx);
+  client_stop(server, "sender", sender_tx, sender_rx);
+  return ret;
+}
+
+/**
+ * @brief an overdrawn worker with messages is served after the others until it pays back, while an overdrawn worker with
+ * an empty inbox is forgiven instead of keeping the scheduler spinning
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_budget(OctopipesServer* server) {
+  printf("%sScheduling by deficit%s\n", KYEL, KNRM);
+  const char* sink_groups[] = {"budget"};
+  int debtor_tx, debtor_rx, payer_tx, payer_rx, sink_tx, sink_rx;
+  if (client_start(server, "sink", sink_groups, 1, &sink_tx, &sink_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "debtor", NULL, 0, &debtor_tx, &debtor_rx) != 0) {
+    client_stop(server, "sink", sink_tx, sink_rx);
+    return 1;
+  }
+  if (client_start(server, "payer", NULL, 0, &payer_tx, &payer_rx) != 0) {
+    client_stop(server, "debtor", debtor_tx, debtor_rx);
+    client_stop(server, "sink", sink_tx, sink_rx);
+    return 1;
+  }
+  OctopipesServerWorker* debtor = get_worker(server, "debtor");
+  OctopipesServerWorker* payer = get_worker(server, "payer");
+  size_t requests;
+  const char* failed;
+  //The debt of an idle worker doesn't keep the rounds going
+  debtor->deficit = -BUDGET_OVERDRAFT;
+  const uint64_t t_start = octopipes_get_time_us();
+  int ret = octopipes_server_process_budget(server, 0, 0, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 0;
+  const uint64_t elapsed = octopipes_get_time_us() - t_start;
+  if (ret != 0 || elapsed > BUDGET_TIMEOUT || debtor->deficit != 0) {
+    printf("%sProcessing empty inboxes took %llu us, debtor deficit %ld%s\n", KRED, (unsigned long long) elapsed, debtor->deficit, KNRM);
+    ret = 1;
+  }
+  //A worker with messages pays back: the other one goes first
+  debtor->deficit = -(long) SCHEDULE_QUANTUM_TEST;
+  payer->deficit = 0;
+  ret = ret || client_write(debtor_tx, "debtor", "budget", "debtor", 0, OCTOPIPES_OPTIONS_NONE) || client_write(payer_tx, "payer", "budget", "payer", 0, OCTOPIPES_OPTIONS_NONE);
+  usleep(INBOX_WAIT);
+  ret = ret || octopipes_server_process_budget(server, 0, 0, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 2;
+  OctopipesMessage* messages[3];
+  const size_t received = ret == 0 ? client_read(sink_rx, messages, 3, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 2) {
+    printf("%sSink received %zu messages out of 2%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = verify_payload(messages[0], "payer") || verify_payload(messages[1], "debtor");
+  }
+  cleanup_messages(messages, received);
+  client_stop(server, "payer", payer_tx, payer_rx);
+  client_stop(server, "debtor", debtor_tx, debtor_rx);
+  client_stop(server, "sink", sink_tx, sink_rx);
+  return ret;
+}
+
+/**
+ * @brief a worker with weight WEIGHT_HEAVY is served WEIGHT_HEAVY times the messages of a worker with weight 1 in each round, all the
+ * messages costing a quarter of the quantum
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_weight(OctopipesServer* server) {
+  printf("%sScheduling by weight%s\n", KYEL, KNRM);
+  if (octopipes_server_set_weight(NULL, "heavy", WEIGHT_HEAVY) != OCTOPIPES_SERVER_ERROR_UNINITIALIZED) {
+    printf("%sSetting the weight of an uninitialized server should fail%s\n", KRED, KNRM);
+    return 1;
+  }
+  const char* sink_groups[] = {"weighted"};
+  int heavy_tx, heavy_rx, light_tx, light_rx, sink_tx, sink_rx;
+  if (client_start(server, "sink", sink_groups, 1, &sink_tx, &sink_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "heavy", NULL, 0, &heavy_tx, &heavy_rx) != 0) {
+    client_stop(server, "sink", sink_tx, sink_rx);
+    return 1;
+  }
+  if (client_start(server, "light", NULL, 0, &light_tx, &light_rx) != 0) {
+    client_stop(server, "heavy", heavy_tx, heavy_rx);
+    client_stop(server, "sink", sink_tx, sink_rx);
+    return 1;
+  }
+  int ret = octopipes_server_set_weight(server, "heavy", WEIGHT_HEAVY) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  char payload[WEIGHT_PAYLOAD_SIZE + 1];
+  memset(payload, 'w', WEIGHT_PAYLOAD_SIZE);
+  payload[WEIGHT_PAYLOAD_SIZE] = 0x00;
+  //Each worker has exactly the messages it's served in WEIGHT_ROUNDS rounds
+  const size_t round_heavy = WEIGHT_ROUND_LIGHT * WEIGHT_HEAVY;
+  for (size_t i = 0; ret == 0 && i < WEIGHT_ROUND_LIGHT * WEIGHT_ROUNDS; i++) {
+    ret = client_write(light_tx, "light", "weighted", payload, 0, OCTOPIPES_OPTIONS_NONE);
+  }
+  for (size_t i = 0; ret == 0 && i < round_heavy * WEIGHT_ROUNDS; i++) {
+    ret = client_write(heavy_tx, "heavy", "weighted", payload, 0, OCTOPIPES_OPTIONS_NONE);
+  }
+  usleep(INBOX_WAIT);
+  //A budget of one round serves each worker its share, whichever goes first
+  for (size_t round = 0; ret == 0 && round < WEIGHT_ROUNDS; round++) {
+    size_t requests;
+    const char* failed;
+    if (octopipes_server_process_budget(server, WEIGHT_ROUND_LIGHT + round_heavy, 0, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != WEIGHT_ROUND_LIGHT + round_heavy) {
+      printf("%sExpected %zu messages to be processed in round %zu, processed %zu%s\n", KRED, WEIGHT_ROUND_LIGHT + round_heavy, round, requests, KNRM);
+      ret = 1;
+      break;
+    }
+    OctopipesMessage* messages[WEIGHT_ROUND_LIGHT * (WEIGHT_HEAVY + 1) + 1];
+    const size_t received = client_read(sink_rx, messages, WEIGHT_ROUND_LIGHT * (WEIGHT_HEAVY + 1) + 1, READ_TIMEOUT);
+    size_t served_heavy = 0, served_light = 0;
+    for (size_t i = 0; i < received; i++) {
+      if (strcmp(messages[i]->origin, "heavy") == 0) {
+        served_heavy++;
+      } else if (strcmp(messages[i]->origin, "light") == 0) {
+        served_light++;
+      }
+    }
+    cleanup_messages(messages, received);
+    if (served_heavy != round_heavy || served_light != WEIGHT_ROUND_LIGHT) {
+      printf("%sRound %zu served %zu messages of heavy and %zu of light, expected %zu and %d%s\n", KRED, round, served_heavy, served_light, round_heavy, WEIGHT_ROUND_LIGHT, KNRM);
+      ret = 1;
+    }
+  }
+  client_stop(server, "light", light_tx, light_rx);
+  client_stop(server, "heavy", heavy_tx, heavy_rx);
+  client_stop(server, "sink", sink_tx, sink_rx);
+  return ret;
+}
+
+/**
+ * @brief the frames queued for a client which doesn't read count against the memory budget: while they exceed it, the
+ * producers are not read; once the client reads them, the producers are read again and all the memory is given back
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_memory(OctopipesServer* server) {
+  printf("%sAccounting the outbound frames in the memory budget%s\n", KYEL, KNRM);
+  const char* reader_groups[] = {"memory"};
+  int reader_tx, reader_rx, producer_tx, producer_rx;
+  if (client_start(server, "reader", reader_groups, 1, &reader_tx, &reader_rx) != 0) {
+    return 1;
+  }
+  if (client_start(server, "producer", NULL, 0, &producer_tx, &producer_rx) != 0) {
+    client_stop(server, "reader", reader_tx, reader_rx);
+    return 1;
+  }
+  //The filler doesn't fit in the pipe of the reader, so it's queued
+  int ret = dispatch_filler(server, "memory");
+  size_t used = 0, reader_bytes = 0, paused = 0;
+  octopipes_server_get_memory_stats(server, NULL, &used, &paused);
+  octopipes_server_get_memory_stats(server, "reader", &reader_bytes, &paused);
+  if (ret == 0 && (used < FILLER_SIZE || reader_bytes < FILLER_SIZE)) {
+    printf("%sThe queued filler should be accounted, got %zu bytes used (%zu by the reader)%s\n", KRED, used, reader_bytes, KNRM);
+    ret = 1;
+  }
+  //Over the budget, the producer is not read
+  size_t requests = 0;
+  const char* failed;
+  ret = ret || octopipes_server_set_memory_budget(server, MEMORY_BUDGET) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  ret = ret || client_write(producer_tx, "producer", "memory", "paused", 0, OCTOPIPES_OPTIONS_NONE);
+  usleep(INBOX_WAIT);
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 0)) {
+    printf("%sThe producer should have been paused, but %zu messages were processed%s\n", KRED, requests, KNRM);
+    ret = 1;
+  }
+  octopipes_server_get_memory_stats(server, "producer", &used, &paused);
+  if (ret == 0 && paused == 0) {
+    printf("%sThe producer should have been paused%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //Once the reader takes the filler, the producer is read again
+  OctopipesMessage* messages[2];
+  size_t received = ret == 0 ? client_read(reader_rx, messages, 1, READ_TIMEOUT) : 0;
+  if (ret == 0 && (received != 1 || messages[0]->data_size != FILLER_SIZE)) {
+    printf("%sReader should have received the filler, but received %zu messages%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  cleanup_messages(messages, received);
+  usleep(INBOX_WAIT);
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != 1)) {
+    printf("%sThe producer should have been read again, but %zu messages were processed%s\n", KRED, requests, KNRM);
+    ret = 1;
+  }
+  received = ret == 0 ? client_read(reader_rx, messages, 2, READ_TIMEOUT) : 0;
+  if (ret == 0 && received != 1) {
+    printf("%sReader received %zu messages out of 1%s\n", KRED, received, KNRM);
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = verify_payload(messages[0], "paused");
+  }
+  cleanup_messages(messages, received);
+  octopipes_server_set_memory_budget(server, 0);
+  client_stop(server, "producer", producer_tx, producer_rx);
+  client_stop(server, "reader", reader_tx, reader_rx);
+  //Everything accounted has been given back
+  octopipes_server_get_memory_stats(server, NULL, &used, &paused);
+  if (ret == 0 && used != 0) {
+    printf("%sThe server should hold no memory, but %zu bytes are accounted%s\n", KRED, used, KNRM);
+    ret = 1;
+  }
+  return ret;
+}
+
+/**
+ * @brief get the last frame queued for a client in a priority class
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param size_t priority
+ * @return OctopipesServerSharedFrame*: NULL if nothing is queued
+ */
+
+OctopipesServerSharedFrame* get_queued_frame(OctopipesServer* server, const char* client, const size_t priority) {
+  OctopipesServerWorker* worker = get_worker(server, client);
+  if (worker == NULL) {
+    return NULL;
+  }
+  OctopipesServerOutbound* outbound = &worker->outbound;
+  OctopipesServerSharedFrame* frame = NULL;
+  pthread_mutex_lock(&outbound->lock);
+  const OctopipesServerLane* lane = &outbound->lanes[priority];
+  if (lane->len > 0) {
+    frame = lane->frames[(lane->head + lane->len - 1) % outbound->size].shared;
+  }
+  pthread_mutex_unlock(&outbound->lock);
+  return frame;
+}
+
+/**
+ * @brief a message dispatched in parallel to clients which are late is queued as a single frame, referenced by each of them;
+ * the pool is left running, so it's stopped by octopipes_server_cleanup
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_fanout(OctopipesServer* server) {
+  printf("%sSharing the frames of a parallel dispatch%s\n", KYEL, KNRM);
+  const char* clients[FANOUT_RECIPIENTS] = {"fan0", "fan1", "fan2"};
+  const char* fanout_groups[] = {"fanout"};
+  int tx_fds[FANOUT_RECIPIENTS];
+  int rx_fds[FANOUT_RECIPIENTS];
+  size_t started = 0;
+  int ret = 0;
+  for (; started < FANOUT_RECIPIENTS && ret == 0; started++) {
+    ret = client_start(server, clients[started], fanout_groups, 1, &tx_fds[started], &rx_fds[started]);
+  }
+  if (ret != 0) {
+    started--;
+  }
+  //Any message with several recipients is dispatched in parallel
+  const unsigned long job = server->fanout.job;
+  ret = ret || octopipes_server_set_fanout(server, FANOUT_THREADS, 1) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  //The filler is partially written, so the next message is queued
+  ret = ret || dispatch_filler(server, "fanout") || dispatch_payload(server, "fanout", "shared", 0);
+  if (ret == 0 && server->fanout.job != job + 2) {
+    printf("%sExpected 2 parallel dispatches, got %lu%s\n", KRED, server->fanout.job - job, KNRM);
+    ret = 1;
+  }
+  const size_t priority = OCTOPIPES_PRIORITY(OCTOPIPES_OPTIONS_NONE);
+  OctopipesServerSharedFrame* shared = ret == 0 ? get_queued_frame(server, clients[0], priority) : NULL;
+  for (size_t i = 1; i < FANOUT_RECIPIENTS && shared != NULL; i++) {
+    if (get_queued_frame(server, clients[i], priority) != shared) {
+      shared = NULL;
+    }
+  }
+  if (ret == 0 && (shared == NULL || __atomic_load_n(&shared->refs, __ATOMIC_ACQUIRE) != FANOUT_RECIPIENTS)) {
+    printf("%sThe recipients should share a frame referenced %d times%s\n", KRED, FANOUT_RECIPIENTS, KNRM);
+    ret = 1;
+  }
+  for (size_t i = 0; i < started; i++) {
+    OctopipesMessage* messages[3];
+    const size_t received = ret == 0 ? client_read(rx_fds[i], messages, 3, READ_TIMEOUT) : 0;
+    if (ret == 0 && (received != 2 || messages[0]->data_size != FILLER_SIZE || verify_payload(messages[1], "shared") != 0)) {
+      printf("%s%s should have received the filler and the shared frame, received %zu messages%s\n", KRED, clients[i], received, KNRM);
+      ret = 1;
+    }
+    cleanup_messages(messages, received);
+    client_stop(server, clients[i], tx_fds[i], rx_fds[i]);
+  }
+  return ret;
+}
+
+/**
+ * @brief credits callback of the credited client
+ * @param OctopipesClient* client
+ * @param size_t messages available
+ * @param size_t bytes available
+ */
+
+void on_credits(const OctopipesClient* client, const size_t messages, const size_t bytes) {
+  (void) client;
+  (void) messages;
+  (void) bytes;
+  __atomic_add_fetch(&credits_calls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief process the CAP until cap_processing is cleared, so a real client can subscribe and unsubscribe
+ * @param void* args (OctopipesServer*)
+ * @return void*
+ */
+
+void* cap_process_loop(void* args) {
+  OctopipesServer* server = (OctopipesServer*) args;
+  while (__atomic_load_n(&cap_processing, __ATOMIC_RELAXED)) {
+    size_t requests = 0;
+    octopipes_server_process_cap_all(server, &requests);
+    usleep(CAP_PROCESS_INTERVAL);
+  }
+  return NULL;
+}
+
+/**
+ * @brief wait until the client has the credits expected available
+ * @param OctopipesClient* client
+ * @param size_t messages
+ * @param size_t bytes
+ * @return int 0 if they're available within READ_TIMEOUT
+ */
+
+int wait_credits(OctopipesClient* client, const size_t messages, const size_t bytes) {
+  size_t available_messages = 0, available_bytes = 0;
+  for (int elapsed = 0; elapsed <= READ_TIMEOUT; elapsed += CAP_PROCESS_INTERVAL / 1000) {
+    octopipes_get_send_credits(client, &available_messages, &available_bytes);
+    if (available_messages == messages && available_bytes == bytes) {
+      return 0;
+    }
+    usleep(CAP_PROCESS_INTERVAL);
+  }
+  printf("%sExpected %zu messages and %zu bytes of credits, got %zu and %zu%s\n", KRED, messages, bytes, available_messages, available_bytes, KNRM);
+  return 1;
+}
+
+/**
+ * @brief a client subscribed through the CAP is granted the window, which is replenished as its messages are dispatched: the frame bytes
+ * the client is charged for match the ones the server gives back, and the frames which can't be decoded are given back as well
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_credits(OctopipesServer* server) {
+  printf("%sGranting credits to a client%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  if (octopipes_init(&client, "credited", server->cap_pipe, OCTOPIPES_VERSION_1) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  octopipes_set_credits_cb(client, on_credits);
+  //The clients subscribed from now on are granted the window
+  int ret = octopipes_server_set_credits(server, NULL, CREDITS_MESSAGES, CREDITS_BYTES) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  pthread_t cap_thread;
+  __atomic_store_n(&cap_processing, 1, __ATOMIC_RELAXED);
+  if (pthread_create(&cap_thread, NULL, cap_process_loop, server) != 0) {
+    octopipes_cleanup(client);
+    return 1;
+  }
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  if (ret == 0 && (octopipes_subscribe(client, NULL, 0, &cap_error) != OCTOPIPES_ERROR_SUCCESS || cap_error != OCTOPIPES_CAP_ERROR_SUCCESS || octopipes_loop_start(client) != OCTOPIPES_ERROR_SUCCESS)) {
+    printf("%sCould not subscribe the credited client (CAP error %d)%s\n", KRED, cap_error, KNRM);
+    ret = 1;
+  }
+  //The window is granted on subscription
+  ret = ret || wait_credits(client, CREDITS_MESSAGES, CREDITS_BYTES);
+  if (ret == 0 && __atomic_load_n(&credits_calls, __ATOMIC_RELAXED) == 0) {
+    printf("%sThe credits callback hasn't been called for the first grant%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //Sending the whole window leaves no message credits
+  for (size_t i = 0; ret == 0 && i < CREDITS_MESSAGES; i++) {
+    ret = octopipes_send(client, "credited", "credit", 6) != OCTOPIPES_ERROR_SUCCESS;
+  }
+  pthread_mutex_lock(&client->credits_lock);
+  const uint64_t bytes_sent = client->credits.bytes_sent;
+  pthread_mutex_unlock(&client->credits_lock);
+  ret = ret || wait_credits(client, 0, CREDITS_BYTES - bytes_sent);
+  //Once dispatched, the server has given back as many bytes as the client was charged for, and the window is replenished
+  const size_t calls = __atomic_load_n(&credits_calls, __ATOMIC_RELAXED);
+  usleep(INBOX_WAIT);
+  size_t requests = 0;
+  const char* failed;
+  if (ret == 0 && (octopipes_server_process_all(server, &requests, &failed) != OCTOPIPES_SERVER_ERROR_SUCCESS || requests != CREDITS_MESSAGES)) {
+    printf("%sExpected %d messages to be processed, processed %zu%s\n", KRED, CREDITS_MESSAGES, requests, KNRM);
+    ret = 1;
+  }
+  OctopipesServerWorker* worker = get_worker(server, "credited");
+  uint64_t messages_consumed = 0, bytes_consumed = 0;
+  if (worker != NULL) {
+    pthread_mutex_lock(&worker->worker_lock);
+    messages_consumed = worker->credits.messages_consumed;
+    bytes_consumed = worker->credits.bytes_consumed;
+    pthread_mutex_unlock(&worker->worker_lock);
+  }
+  if (ret == 0 && (messages_consumed != CREDITS_MESSAGES || bytes_consumed != bytes_sent)) {
+    printf("%sThe client sent %d messages (%lu bytes), the server gave back %lu (%lu bytes)%s\n", KRED, CREDITS_MESSAGES, (unsigned long) bytes_sent, (unsigned long) messages_consumed, (unsigned long) bytes_consumed, KNRM);
+    ret = 1;
+  }
+  ret = ret || wait_credits(client, CREDITS_MESSAGES, CREDITS_BYTES);
+  if (ret == 0 && __atomic_load_n(&credits_calls, __ATOMIC_RELAXED) <= calls) {
+    printf("%sThe credits callback hasn't been called for the replenished window%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  //A frame which can't be decoded is given back too
+  size_t frame_size = 0;
+  int tx_fd = -1;
+  if (ret == 0 && pipe_open(client->tx_pipe, &tx_fd) != OCTOPIPES_ERROR_SUCCESS) {
+    ret = 1;
+  }
+  if (ret == 0) {
+    ret = client_write_corrupted(tx_fd, "credited", "credited", &frame_size);
+    usleep(INBOX_WAIT);
+    octopipes_server_process_all(server, &requests, &failed);
+    pthread_mutex_lock(&worker->worker_lock);
+    if (worker->credits.messages_consumed != messages_consumed + 1 || worker->credits.bytes_consumed != bytes_consumed + frame_size) {
+      printf("%sThe corrupted frame (%zu bytes) hasn't been given back: %lu bytes given back%s\n", KRED, frame_size, (unsigned long) (worker->credits.bytes_consumed - bytes_consumed), KNRM);
+      ret = 1;
+    }
+    pthread_mutex_unlock(&worker->worker_lock);
+  }
+  if (tx_fd != -1) {
+    pipe_close(tx_fd);
+  }
+  octopipes_server_set_credits(server, NULL, 0, 0);
+  //Cleanup unsubscribes the client through the CAP
+  octopipes_cleanup(client);
+  for (int elapsed = 0; elapsed <= READ_TIMEOUT && octopipes_server_is_subscribed(server, "credited") == OCTOPIPES_SERVER_ERROR_SUCCESS; elapsed += CAP_PROCESS_INTERVAL / 1000) {
+    usleep(CAP_PROCESS_INTERVAL);
+  }
+  __atomic_store_n(&cap_processing, 0, __ATOMIC_RELAXED);
+  pthread_join(cap_thread, NULL);
+  if (ret == 0 && octopipes_server_is_subscribed(server, "credited") == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sThe credited client should have been unsubscribed%s\n", KRED, KNRM);
+    octopipes_server_stop_worker(server, "credited");
+    ret = 1;
+  }
+  return ret;
+}
+
+/**
+ * @brief dispatch error callback: it stops the worker which failed
+ * @param OctopipesServer* server
+ * @param char* client
+ * @param OctopipesServerError error
+ */
+
+void on_dispatch_error(const OctopipesServer* server, const char* client, const OctopipesServerError error) {
+  dispatch_error = error;
+  snprintf(dispatch_error_client, sizeof(dispatch_error_client), "%s", client != NULL ? client : "");
+  //Stopping a worker takes routing_lock, so the dispatcher must have released it
+  if (client != NULL) {
+    dispatch_error_stop = octopipes_server_stop_worker((OctopipesServer*) server, client);
+  }
+  __atomic_store_n(&dispatch_error_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief the dispatchers report the errors without holding the routing lock, so the error callback can stop the worker which failed
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_dispatch_error(OctopipesServer* server) {
+  printf("%sStopping a client from the dispatch error callback%s\n", KYEL, KNRM);
+  int corrupter_tx, corrupter_rx;
+  if (client_start(server, "corrupter", NULL, 0, &corrupter_tx, &corrupter_rx) != 0) {
+    return 1;
+  }
+  octopipes_server_set_dispatch_error_cb(server, on_dispatch_error);
+  int ret = octopipes_server_start_dispatchers(server, DISPATCHERS) != OCTOPIPES_SERVER_ERROR_SUCCESS;
+  size_t frame_size;
+  ret = ret || client_write_corrupted(corrupter_tx, "corrupter", "nowhere", &frame_size);
+  usleep(INBOX_WAIT);
+  for (int elapsed = 0; ret == 0 && elapsed <= READ_TIMEOUT && !__atomic_load_n(&dispatch_error_done, __ATOMIC_ACQUIRE); elapsed += 10) {
+    usleep(10000);
+  }
+  if (ret == 0 && !__atomic_load_n(&dispatch_error_done, __ATOMIC_ACQUIRE)) {
+    printf("%sThe error callback hasn't returned: it's waiting for the routing lock%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  if (ret == 0 && (dispatch_error != OCTOPIPES_SERVER_ERROR_BAD_CHECKSUM || strcmp(dispatch_error_client, "corrupter") != 0 || dispatch_error_stop != OCTOPIPES_SERVER_ERROR_SUCCESS)) {
+    printf("%sExpected a bad checksum from corrupter, got %s from '%s' (stop: %s)%s\n", KRED, octopipes_server_get_error_desc(dispatch_error), dispatch_error_client, octopipes_server_get_error_desc(dispatch_error_stop), KNRM);
+    ret = 1;
+  }
+  if (ret == 0 && octopipes_server_is_subscribed(server, "corrupter") == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sThe corrupter should have been stopped%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  if (octopipes_server_stop_dispatchers(server) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not stop the dispatchers%s\n", KRED, KNRM);
+    ret = 1;
+  }
+  octopipes_server_set_dispatch_error_cb(server, NULL);
+  //The worker is already stopped unless the test failed
+  client_stop(server, "corrupter", corrupter_tx, corrupter_rx);
+  return ret;
+}
+
+/**
+ * @brief received callback of the grouped client: counts the messages of the news group, any other message is unexpected
+ * @param OctopipesClient* client
+ * @param OctopipesMessage* message
+ */
+
+void on_grouped_received(const OctopipesClient* client, const OctopipesMessage* message) {
+  (void) client;
+  if (message->remote != NULL && strcmp(message->remote, "news") == 0) {
+    __atomic_add_fetch(&grouped_received, 1, __ATOMIC_RELEASE);
+  } else {
+    __atomic_add_fetch(&grouped_unexpected, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief wait until the grouped client has received the messages expected
+ * @param size_t messages
+ * @return int 0 if they're received within READ_TIMEOUT
+ */
+
+int wait_grouped(const size_t messages) {
+  for (int elapsed = 0; elapsed <= READ_TIMEOUT && __atomic_load_n(&grouped_received, __ATOMIC_ACQUIRE) < messages; elapsed += CAP_PROCESS_INTERVAL / 1000) {
+    usleep(CAP_PROCESS_INTERVAL);
+  }
+  const size_t received = __atomic_load_n(&grouped_received, __ATOMIC_ACQUIRE);
+  if (received != messages) {
+    printf("%sExpected the grouped client to receive %zu messages, received %zu%s\n", KRED, messages, received, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief verify the outcome of a groups update of a client, read from its private reply pipe, and that the pipe has been removed
+ * @param OctopipesClient* client
+ * @param OctopipesError rc
+ * @param OctopipesCapError update error
+ * @param OctopipesCapError expected
+ * @return int
+ */
+
+int verify_groups_update(OctopipesClient* client, const OctopipesError rc, const OctopipesCapError update_error, const OctopipesCapError expected) {
+  //A reply written to any other pipe would make the client time out
+  if (rc != OCTOPIPES_ERROR_SUCCESS || update_error != expected) {
+    printf("%sExpected the groups update to be answered with CAP error %d, got %s (CAP error %d)%s\n", KRED, expected, octopipes_get_error_desc(rc), update_error, KNRM);
+    return 1;
+  }
+  char reply_pipe[UINT8_MAX + 1];
+  snprintf(reply_pipe, sizeof(reply_pipe), "%s.%s.%d.%lx.groups", client->common_access_pipe, client->client_id, (int) getpid(), (unsigned long) (uintptr_t) client);
+  if (access(reply_pipe, F_OK) == 0) {
+    printf("%sThe reply pipe %s hasn't been removed%s\n", KRED, reply_pipe, KNRM);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief a client subscribed through the CAP adds and removes groups: the outcome is read from its private reply pipe, the messages of the
+ * groups added are received and the ones of the groups removed are not anymore
+ * @param OctopipesServer* server
+ * @return int
+ */
+
+int test_groups_update(OctopipesServer* server) {
+  printf("%sUpdating the groups of a client%s\n", KYEL, KNRM);
+  OctopipesClient* client;
+  if (octopipes_init(&client, "grouped", server->cap_pipe, OCTOPIPES_VERSION_1) != OCTOPIPES_ERROR_SUCCESS) {
+    return 1;
+  }
+  octopipes_set_received_cb(client, on_grouped_received);
+  pthread_t cap_thread;
+  __atomic_store_n(&cap_processing, 1, __ATOMIC_RELAXED);
+  if (pthread_create(&cap_thread, NULL, cap_process_loop, server) != 0) {
+    octopipes_cleanup(client);
+    return 1;
+  }
+  int ret = 0;
+  OctopipesCapError cap_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  if (octopipes_subscribe(client, NULL, 0, &cap_error) != OCTOPIPES_ERROR_SUCCESS || cap_error != OCTOPIPES_CAP_ERROR_SUCCESS || octopipes_loop_start(client) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not subscribe the grouped client (CAP error %d)%s\n", KRED, cap_error, KNRM);
+    ret = 1;
+  }
+  //Added groups are routed to the client
+  const char* groups[] = {"news"};
+  OctopipesCapError update_error = OCTOPIPES_CAP_ERROR_FS;
+  OctopipesError rc;
+  if (ret == 0) {
+    rc = octopipes_add_groups(client, groups, 1, &update_error);
+    ret = verify_groups_update(client, rc, update_error, OCTOPIPES_CAP_ERROR_SUCCESS);
+  }
+  ret = ret || dispatch_payload(server, "news", "first", 0);
+  ret = ret || wait_grouped(1);
+  //Removed groups are not
+  update_error = OCTOPIPES_CAP_ERROR_FS;
+  if (ret == 0) {
+    rc = octopipes_remove_groups(client, groups, 1, &update_error);
+    ret = verify_groups_update(client, rc, update_error, OCTOPIPES_CAP_ERROR_SUCCESS);
+  }
+  ret = ret || dispatch_payload(server, "news", "second", 0);
+  if (ret == 0) {
+    usleep(READ_TIMEOUT * 1000);
+    ret = wait_grouped(1);
+  }
+  if (ret == 0 && __atomic_load_n(&grouped_unexpected, __ATOMIC_ACQUIRE) != 0) {
+    printf("%sThe grouped client has received %zu messages of other groups%s\n", KRED, __atomic_load_n(&grouped_unexpected, __ATOMIC_ACQUIRE), KNRM);
+    ret = 1;
+  }
+  //A client the server doesn't know is told on the reply pipe as well
+  if (ret == 0 && octopipes_server_stop_worker(server, "grouped") != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    ret = 1;
+  }
+  update_error = OCTOPIPES_CAP_ERROR_SUCCESS;
+  if (ret == 0) {
+    rc = octopipes_add_groups(client, groups, 1, &update_error);
+    ret = verify_groups_update(client, rc, update_error, OCTOPIPES_CAP_ERROR_NOT_SUBSCRIBED);
+  }
+  //Cleanup unsubscribes the client through the CAP, unless its worker is already stopped
+  octopipes_cleanup(client);
+  for (int elapsed = 0; elapsed <= READ_TIMEOUT && octopipes_server_is_subscribed(server, "grouped") == OCTOPIPES_SERVER_ERROR_SUCCESS; elapsed += CAP_PROCESS_INTERVAL / 1000) {
+    usleep(CAP_PROCESS_INTERVAL);
+  }
+  __atomic_store_n(&cap_processing, 0, __ATOMIC_RELAXED);
+  pthread_join(cap_thread, NULL);
+  if (octopipes_server_is_subscribed(server, "grouped") == OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sThe grouped client should have been unsubscribed%s\n", KRED, KNRM);
+    octopipes_server_stop_worker(server, "grouped");
+    ret = 1;
+  }
+  return ret;
+}
+
+int main(int argc, char** argv) {
+  printf(PROGRAM_NAME " liboctopipes Build: " OCTOPIPES_LIB_VERSION "\n");
+  const char* cap_pipe = "/tmp/octopipes_test_server_cap";
+  int opt;
+  while ((opt = getopt(argc, argv, "c:d:h")) != -1) {
+    switch (opt) {
+    case 'c':
+      cap_pipe = optarg;
+      break;
+    case 'd':
+      clients_dir = optarg;
+      break;
+    case 'h':
+      printf("%s\n", USAGE);
+      return 0;
+    }
+  }
+  OctopipesServer* server;
+  OctopipesServerError server_rc;
+  if ((server_rc = octopipes_server_init(&server, cap_pipe, clients_dir, OCTOPIPES_VERSION_1)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not initialize server: %s%s\n", KRED, octopipes_server_get_error_desc(server_rc), KNRM);
+    return 1;
+  }
+  //The log can't be set once the server is running
+  char log_dir[256];
+  snprintf(log_dir, sizeof(log_dir), "%s_log", clients_dir);
+  if ((server_rc = octopipes_server_set_log(server, log_dir, LOG_SEGMENT_SIZE, 0, 0)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not set the log: %s%s\n", KRED, octopipes_server_get_error_desc(server_rc), KNRM);
+    octopipes_server_cleanup(server);
+    return 1;
+  }
+  //The listener creates the clients directory
+  if ((server_rc = octopipes_server_start_cap_listener(server)) != OCTOPIPES_SERVER_ERROR_SUCCESS) {
+    printf("%sCould not start CAP listener: %s%s\n", KRED, octopipes_server_get_error_desc(server_rc), KNRM);
+    octopipes_server_cleanup(server);
+    return 1;
+  }
+  int rc = 0;
+  int ret = 0;
+  //Test 1. messages are dispatched by priority class
+  if ((ret = test_priority(server)) != 0) {
+    printf("%sPriority test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sPriority test passed!%s\n", KGRN, KNRM);
+  //Test 2. expired messages are discarded
+  if ((ret = test_expiry(server)) != 0) {
+    printf("%sExpiry test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sExpiry test passed!%s\n", KGRN, KNRM);
+  //Test 3. queued frames are conflated
+  if ((ret = test_conflation(server)) != 0) {
+    printf("%sConflation test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sConflation test passed!%s\n", KGRN, KNRM);
+  //Test 4. messages over the rate limit are dropped
+  if ((ret = test_rate_limit(server, OCTOPIPES_SERVER_RATE_LIMIT_DROP)) != 0) {
+    printf("%sRate limit drop test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRate limit drop test passed!%s\n", KGRN, KNRM);
+  //Test 5. clients over the rate limit are read later
+  if ((ret = test_rate_limit(server, OCTOPIPES_SERVER_RATE_LIMIT_BACKPRESSURE)) != 0) {
+    printf("%sRate limit backpressure test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRate limit backpressure test passed!%s\n", KGRN, KNRM);
+  //Test 6. assignments are written only to valid reply pipes
+  if ((ret = test_reply_pipe(server)) != 0) {
+    printf("%sReply pipe test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sReply pipe test passed!%s\n", KGRN, KNRM);
+  //Test 7. clients whose outbound queue overflows are disconnected
+  if ((ret = test_overflow_disconnect(server)) != 0) {
+    printf("%sOverflow disconnect test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sOverflow disconnect test passed!%s\n", KGRN, KNRM);
+  //Test 8. the last message of the groups is retained for late subscribers
+  if ((ret = test_retained(server)) != 0) {
+    printf("%sRetained test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRetained test passed!%s\n", KGRN, KNRM);
+  //Test 9. the log of the groups is replayed to the clients which subscribe replaying
+  if ((ret = test_log(server)) != 0) {
+    printf("%sLog test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sLog test passed!%s\n", KGRN, KNRM);
+  //Test 10. messages are routed by the dispatcher threads
+  if ((ret = test_dispatchers(server)) != 0) {
+    printf("%sDispatchers test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sDispatchers test passed!%s\n", KGRN, KNRM);
+  //Test 11. workers are scheduled by deficit
+  if ((ret = test_budget(server)) != 0) {
+    printf("%sBudget test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sBudget test passed!%s\n", KGRN, KNRM);
+  //Test 12. the outbound frames count against the memory budget
+  if ((ret = test_memory(server)) != 0) {
+    printf("%sMemory test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sMemory test passed!%s\n", KGRN, KNRM);
+  //Test 13. client ids can't be patterns and the trie is pruned
+  if ((ret = test_trie(server)) != 0) {
+    printf("%sTrie test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sTrie test passed!%s\n", KGRN, KNRM);
+  //Test 14. handlers are matched through the trie and can call the server functions
+  if ((ret = test_handlers(server)) != 0) {
+    printf("%sHandlers test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sHandlers test passed!%s\n", KGRN, KNRM);
+  //Test 15. the recipients of a parallel dispatch share its frame
+  if ((ret = test_fanout(server)) != 0) {
+    printf("%sFanout test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sFanout test passed!%s\n", KGRN, KNRM);
+  //Test 16. a client is granted credits, replenished as its messages are dispatched
+  if ((ret = test_credits(server)) != 0) {
+    printf("%sCredits test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sCredits test passed!%s\n", KGRN, KNRM);
+  //Test 17. the dispatch error callback can stop the worker which failed
+  if ((ret = test_dispatch_error(server)) != 0) {
+    printf("%sDispatch error test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sDispatch error test passed!%s\n", KGRN, KNRM);
+  //Test 18. a client adds and removes groups through the CAP
+  if ((ret = test_groups_update(server)) != 0) {
+    printf("%sGroups update test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sGroups update test passed!%s\n", KGRN, KNRM);
+  //Test 19. the workers are served in proportion to their weight
+  if ((ret = test_weight(server)) != 0) {
+    printf("%sWeight test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sWeight test passed!%s\n", KGRN, KNRM);
+  octopipes_server_cleanup(server);
+  return rc; //Sum of error codes
+}
@@ -0,0 +1,185 @@
+/**
+ *   Octopipes
+ *   Developed by Christian Visintin
+ * 
+ * MIT License
+ * Copyright (c) 2019-2020 Christian Visintin
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+**/
+
+#include <octopipes/octopipes.h>
+#include <octopipes/timer.h>
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGRAM_NAME "test_timer"
+#define USAGE PROGRAM_NAME "Usage: " PROGRAM_NAME " [Options]\n\
+\t -h\t\tShow this page\n\
+"
+
+//Colors
+#define KNRM "\x1B[0m"
+#define KRED "\x1B[31m"
+#define KGRN "\x1B[32m"
+#define KYEL "\x1B[33m"
+#define KBLU "\x1B[34m"
+#define KMAG "\x1B[35m"
+#define KCYN "\x1B[36m"
+#define KWHT "\x1B[37m"
+
+#define TICK 10
+#define TIMERS_AMOUNT 6
+
+/**
+ * Test Description: test_timer tests the hierarchical timer wheel
+ * - schedules timers on all the levels of the wheel
+ * - advances the wheel and verifies timers expire on time
+ * - removes and reschedules timers
+ * Functions covered by this test:
+ * - octopipes_timer_wheel_init
+ * - octopipes_timer_wheel_cleanup
+ * - octopipes_timer_add
+ * - octopipes_timer_remove
+ * - octopipes_timer_wheel_advance
+ * - timer_wheel_insert
+ * - timer_wheel_cascade
+ */
+
+/**
+ * @brief schedule timers with different expirations and verify they never expire early nor more than a tick late
+ * @return int
+ */
+
+int test_expiration() {
+  OctopipesError rc;
+  printf("%sScheduling timers%s\n", KYEL, KNRM);
+  OctopipesTimerWheel* wheel;
+  if ((rc = octopipes_timer_wheel_init(&wheel, TICK, 0)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize timer wheel: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  //One timer for each level, plus one beyond the wheel range
+  const uint64_t expirations[TIMERS_AMOUNT] = {5, 120, 650, 40000, 3000000, 200000000};
+  OctopipesTimer timers[TIMERS_AMOUNT];
+  uint64_t expired_at[TIMERS_AMOUNT] = {0};
+  for (size_t i = 0; i < TIMERS_AMOUNT; i++) {
+    timers[i].slot = NULL;
+    octopipes_timer_add(wheel, &timers[i], expirations[i]);
+  }
+  if (wheel->timers != TIMERS_AMOUNT) {
+    printf("%sWheel should have %d timers, but has %zu%s\n", KRED, TIMERS_AMOUNT, wheel->timers, KNRM);
+    octopipes_timer_wheel_cleanup(wheel);
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  //Advance in irregular steps
+  uint64_t now = 0;
+  while (wheel->timers > 0) {
+    now += (now % 7) * TICK + 3;
+    OctopipesTimer* expired;
+    octopipes_timer_wheel_advance(wheel, now, &expired);
+    for (; expired != NULL; expired = expired->next) {
+      expired_at[expired - timers] = now;
+    }
+  }
+  octopipes_timer_wheel_cleanup(wheel);
+  for (size_t i = 0; i < TIMERS_AMOUNT; i++) {
+    //Expired timers are collected only when the wheel is advanced, so allow the largest step as delay
+    if (expired_at[i] < expirations[i] || expired_at[i] > expirations[i] + 8 * TICK) {
+      printf("%sTimer %zu should expire at %" PRIu64 ", but expired at %" PRIu64 "%s\n", KRED, i, expirations[i], expired_at[i], KNRM);
+      return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief remove and reschedule timers and verify only pending timers expire
+ * @return int
+ */
+
+int test_remove() {
+  OctopipesError rc;
+  printf("%sRemoving and rescheduling timers%s\n", KYEL, KNRM);
+  OctopipesTimerWheel* wheel;
+  if ((rc = octopipes_timer_wheel_init(&wheel, TICK, 1000)) != OCTOPIPES_ERROR_SUCCESS) {
+    printf("%sCould not initialize timer wheel: %s%s\n", KRED, octopipes_get_error_desc(rc), KNRM);
+    return rc;
+  }
+  OctopipesTimer first;
+  OctopipesTimer second;
+  first.slot = NULL;
+  second.slot = NULL;
+  octopipes_timer_add(wheel, &first, 1100);
+  octopipes_timer_add(wheel, &second, 1100);
+  //Removing twice must be harmless
+  octopipes_timer_remove(wheel, &first);
+  octopipes_timer_remove(wheel, &first);
+  //Reschedule second later
+  octopipes_timer_add(wheel, &second, 2000);
+  OctopipesTimer* expired;
+  size_t expired_len = octopipes_timer_wheel_advance(wheel, 1500, &expired);
+  if (expired_len != 0 || wheel->timers != 1) {
+    printf("%sNo timer should have expired, but %zu did%s\n", KRED, expired_len, KNRM);
+    octopipes_timer_wheel_cleanup(wheel);
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  expired_len = octopipes_timer_wheel_advance(wheel, 2000, &expired);
+  octopipes_timer_wheel_cleanup(wheel);
+  if (expired_len != 1 || expired != &second || second.slot != NULL) {
+    printf("%sSecond timer should have expired%s\n", KRED, KNRM);
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  //@! Test errors
+  if ((rc = octopipes_timer_wheel_init(&wheel, 0, 0)) != OCTOPIPES_ERROR_UNINITIALIZED) {
+    printf("%soctopipes_timer_wheel_init should have returned OCTOPIPES_ERROR_UNINITIALIZED, but returned %d%s\n", KRED, rc, KNRM);
+    return OCTOPIPES_ERROR_UNKNOWN_ERROR;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  printf(PROGRAM_NAME " liboctopipes Build: " OCTOPIPES_LIB_VERSION "\n");
+  int opt;
+  while ((opt = getopt(argc, argv, "h")) != -1) {
+    switch (opt) {
+    case 'h':
+      printf("%s\n", USAGE);
+      return 0;
+    }
+  }
+  int rc = 0;
+  int ret = 0;
+  //Test 1. timers expire on time
+  if ((ret = test_expiration()) != 0) {
+    printf("%sExpiration test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sExpiration test passed!%s\n", KGRN, KNRM);
+  //Test 2. timers can be removed and rescheduled
+  if ((ret = test_remove()) != 0) {
+    printf("%sRemove test failed: %d%s\n", KRED, ret, KNRM);
+    rc += ret;
+  }
+  if (ret == 0)
+    printf("%sRemove test passed!%s\n", KGRN, KNRM);
+  return rc; //Sum of error codes
+}